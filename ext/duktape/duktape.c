@@ -13491,6 +13491,451 @@ DUK_EXTERNAL duk_int_t duk_compile_raw(duk_context *ctx, const char *src_buffer,
 	/* [ ... closure ] */
 	return DUK_EXEC_SUCCESS;
 }
+#line 1 "duk_api_bytecode.c"
+/*
+ *  Bytecode dump/load
+ *
+ *  Minimal backport of the Duktape 1.3 duk_dump_function() and
+ *  duk_load_function() API calls.  The dump format is internal to this
+ *  build: it is native endian, depends on the Duktape version and config,
+ *  and is only meant for caching compiled code on the device that produced
+ *  it.  The loader bounds checks the input but does not validate bytecode,
+ *  so callers must make sure the data is what they dumped earlier.
+ *
+ *  Function templates and closures share the same data buffer, so either
+ *  can be dumped.  Loading always produces a closure bound to the global
+ *  environment, like duk_compile() does for program code.
+ */
+
+/* include removed: duk_internal.h */
+
+#define DUK__BC_MAGIC          0xbfU
+#define DUK__BC_NONE           0xffffffffUL
+#define DUK__BC_CONST_STRING   0x00U
+#define DUK__BC_CONST_NUMBER   0x01U
+#define DUK__BC_FLAGS_MASK     (DUK_HOBJECT_FLAG_STRICT | \
+                                DUK_HOBJECT_FLAG_NOTAIL | \
+                                DUK_HOBJECT_FLAG_NEWENV | \
+                                DUK_HOBJECT_FLAG_NAMEBINDING | \
+                                DUK_HOBJECT_FLAG_CREATEARGS)
+
+typedef struct {
+	duk_context *ctx;
+	duk_idx_t buf_idx;
+	duk_uint8_t *buf;
+	duk_size_t size;
+	duk_size_t alloc;
+} duk__bc_writer;
+
+typedef struct {
+	duk_hthread *thr;
+	const duk_uint8_t *p;
+	const duk_uint8_t *end;
+} duk__bc_reader;
+
+DUK_LOCAL duk_uint8_t *duk__bc_reserve(duk__bc_writer *bw, duk_size_t len) {
+	duk_uint8_t *ret;
+
+	if (bw->size + len > bw->alloc) {
+		bw->alloc = (bw->size + len) * 2 + 256;
+		bw->buf = (duk_uint8_t *) duk_resize_buffer(bw->ctx, bw->buf_idx, bw->alloc);
+	}
+	ret = bw->buf + bw->size;
+	bw->size += len;
+	return ret;
+}
+
+DUK_LOCAL void duk__bc_write_bytes(duk__bc_writer *bw, const void *data, duk_size_t len) {
+	duk_uint8_t *p = duk__bc_reserve(bw, len);
+	if (len > 0) {
+		DUK_MEMCPY((void *) p, data, len);
+	}
+}
+
+DUK_LOCAL void duk__bc_write_u32(duk__bc_writer *bw, duk_uint32_t val) {
+	duk__bc_write_bytes(bw, (const void *) &val, sizeof(val));
+}
+
+DUK_LOCAL void duk__bc_write_hstring(duk__bc_writer *bw, duk_hstring *h) {
+	duk_uint32_t len = (duk_uint32_t) DUK_HSTRING_GET_BYTELEN(h);
+	duk__bc_write_u32(bw, len);
+	duk__bc_write_bytes(bw, (const void *) DUK_HSTRING_GET_DATA(h), len);
+}
+
+/* Dump an optional string or buffer property of the object at stack top */
+DUK_LOCAL void duk__bc_write_prop(duk__bc_writer *bw, duk_small_int_t stridx) {
+	duk_context *ctx = bw->ctx;
+	duk_hthread *thr = (duk_hthread *) ctx;
+	duk_hstring *h_str;
+	duk_hbuffer *h_buf;
+
+	DUK_UNREF(thr);
+	duk_get_prop_stridx(ctx, -1, stridx);
+	if ((h_str = duk_get_hstring(ctx, -1)) != NULL) {
+		duk__bc_write_hstring(bw, h_str);
+	} else if ((h_buf = duk_get_hbuffer(ctx, -1)) != NULL) {
+		duk_uint32_t len = (duk_uint32_t) DUK_HBUFFER_GET_SIZE(h_buf);
+		duk__bc_write_u32(bw, len);
+		duk__bc_write_bytes(bw, DUK_HBUFFER_GET_DATA_PTR(thr->heap, h_buf), len);
+	} else {
+		duk__bc_write_u32(bw, (duk_uint32_t) DUK__BC_NONE);
+	}
+	duk_pop(ctx);
+}
+
+DUK_LOCAL void duk__bc_write_func(duk__bc_writer *bw, duk_hcompiledfunction *func) {
+	duk_context *ctx = bw->ctx;
+	duk_hthread *thr = (duk_hthread *) ctx;
+	duk_tval *tv, *tv_end;
+	duk_hobject **fn, **fn_end;
+	duk_uint32_t count;
+	duk_uint16_t u16;
+
+	DUK_UNREF(thr);
+	duk_require_stack(ctx, 4);
+	duk_push_hobject(ctx, (duk_hobject *) func);
+
+	duk__bc_write_u32(bw, (duk_uint32_t) DUK_HCOMPILEDFUNCTION_GET_CODE_COUNT(thr->heap, func));
+	duk__bc_write_u32(bw, (duk_uint32_t) DUK_HCOMPILEDFUNCTION_GET_CONSTS_COUNT(thr->heap, func));
+	duk__bc_write_u32(bw, (duk_uint32_t) DUK_HCOMPILEDFUNCTION_GET_FUNCS_COUNT(thr->heap, func));
+	u16 = func->nregs;
+	duk__bc_write_bytes(bw, (const void *) &u16, sizeof(u16));
+	u16 = func->nargs;
+	duk__bc_write_bytes(bw, (const void *) &u16, sizeof(u16));
+#if defined(DUK_USE_DEBUGGER_SUPPORT)
+	duk__bc_write_u32(bw, func->start_line);
+	duk__bc_write_u32(bw, func->end_line);
+#else
+	duk__bc_write_u32(bw, 0);
+	duk__bc_write_u32(bw, 0);
+#endif
+	duk__bc_write_u32(bw, (duk_uint32_t) (DUK_HEAPHDR_GET_FLAGS((duk_heaphdr *) func) & DUK__BC_FLAGS_MASK));
+
+	duk__bc_write_bytes(bw, (const void *) DUK_HCOMPILEDFUNCTION_GET_CODE_BASE(thr->heap, func),
+	                    DUK_HCOMPILEDFUNCTION_GET_CODE_SIZE(thr->heap, func));
+
+	tv = DUK_HCOMPILEDFUNCTION_GET_CONSTS_BASE(thr->heap, func);
+	tv_end = DUK_HCOMPILEDFUNCTION_GET_CONSTS_END(thr->heap, func);
+	for (; tv < tv_end; tv++) {
+		if (DUK_TVAL_IS_STRING(tv)) {
+			*duk__bc_reserve(bw, 1) = DUK__BC_CONST_STRING;
+			duk__bc_write_hstring(bw, DUK_TVAL_GET_STRING(tv));
+		} else {
+			duk_double_t d;
+			DUK_ASSERT(DUK_TVAL_IS_NUMBER(tv));
+			d = DUK_TVAL_GET_NUMBER(tv);
+			*duk__bc_reserve(bw, 1) = DUK__BC_CONST_NUMBER;
+			duk__bc_write_bytes(bw, (const void *) &d, sizeof(d));
+		}
+	}
+
+	fn = DUK_HCOMPILEDFUNCTION_GET_FUNCS_BASE(thr->heap, func);
+	fn_end = DUK_HCOMPILEDFUNCTION_GET_FUNCS_END(thr->heap, func);
+	for (; fn < fn_end; fn++) {
+		DUK_ASSERT(DUK_HOBJECT_IS_COMPILEDFUNCTION(*fn));
+		duk__bc_write_func(bw, (duk_hcompiledfunction *) *fn);
+	}
+
+	duk__bc_write_prop(bw, DUK_STRIDX_NAME);
+	duk__bc_write_prop(bw, DUK_STRIDX_FILE_NAME);
+	duk__bc_write_prop(bw, DUK_STRIDX_INT_PC2LINE);
+
+	/* _Varmap: { name: regnum, ... } */
+	if (duk_get_prop_stridx(ctx, -1, DUK_STRIDX_INT_VARMAP) && duk_is_object(ctx, -1)) {
+		duk_size_t count_off = bw->size;
+		duk__bc_write_u32(bw, 0);
+		count = 0;
+		duk_enum(ctx, -1, DUK_ENUM_OWN_PROPERTIES_ONLY);
+		while (duk_next(ctx, -1, 1 /*get_value*/)) {
+			duk__bc_write_hstring(bw, duk_require_hstring(ctx, -2));
+			duk__bc_write_u32(bw, (duk_uint32_t) duk_get_int(ctx, -1));
+			duk_pop_2(ctx);
+			count++;
+		}
+		duk_pop(ctx);  /* enum */
+		DUK_MEMCPY((void *) (bw->buf + count_off), (const void *) &count, sizeof(count));
+	} else {
+		duk__bc_write_u32(bw, (duk_uint32_t) DUK__BC_NONE);
+	}
+	duk_pop(ctx);
+
+	/* _Formals: [ name, ... ] */
+	if (duk_get_prop_stridx(ctx, -1, DUK_STRIDX_INT_FORMALS) && duk_is_object(ctx, -1)) {
+		duk_uint32_t i;
+		count = (duk_uint32_t) duk_get_length(ctx, -1);
+		duk__bc_write_u32(bw, count);
+		for (i = 0; i < count; i++) {
+			duk_get_prop_index(ctx, -1, (duk_uarridx_t) i);
+			duk__bc_write_hstring(bw, duk_require_hstring(ctx, -1));
+			duk_pop(ctx);
+		}
+	} else {
+		duk__bc_write_u32(bw, (duk_uint32_t) DUK__BC_NONE);
+	}
+	duk_pop(ctx);
+
+	duk_pop(ctx);  /* func */
+}
+
+DUK_EXTERNAL void duk_dump_function(duk_context *ctx) {
+	duk_hcompiledfunction *func;
+	duk__bc_writer bw;
+	duk_uint8_t *p;
+
+	DUK_ASSERT_CTX_VALID(ctx);
+
+	func = (duk_hcompiledfunction *) duk_get_hobject(ctx, -1);
+	if (func == NULL || !DUK_HOBJECT_IS_COMPILEDFUNCTION((duk_hobject *) func)) {
+		DUK_ERROR((duk_hthread *) ctx, DUK_ERR_TYPE_ERROR, "not a compiled function");
+	}
+
+	bw.ctx = ctx;
+	bw.alloc = 1024;
+	bw.size = 0;
+	bw.buf = (duk_uint8_t *) duk_push_dynamic_buffer(ctx, bw.alloc);
+	bw.buf_idx = duk_get_top(ctx) - 1;
+
+	p = duk__bc_reserve(&bw, 4);
+	p[0] = DUK__BC_MAGIC;
+	p[1] = (duk_uint8_t) sizeof(duk_instr_t);
+	p[2] = (duk_uint8_t) sizeof(duk_double_t);
+	p[3] = 0;
+	duk__bc_write_u32(&bw, (duk_uint32_t) DUK_VERSION);
+
+	duk__bc_write_func(&bw, func);
+
+	duk_resize_buffer(ctx, bw.buf_idx, bw.size);
+	duk_remove(ctx, -2);  /* -> [ ... buf ] */
+}
+
+DUK_LOCAL const duk_uint8_t *duk__bc_read_bytes(duk__bc_reader *br, duk_size_t len) {
+	const duk_uint8_t *p = br->p;
+	if ((duk_size_t) (br->end - br->p) < len) {
+		DUK_ERROR(br->thr, DUK_ERR_ERROR, "invalid bytecode");
+	}
+	br->p += len;
+	return p;
+}
+
+DUK_LOCAL duk_uint32_t duk__bc_read_u32(duk__bc_reader *br) {
+	duk_uint32_t val;
+	DUK_MEMCPY((void *) &val, (const void *) duk__bc_read_bytes(br, sizeof(val)), sizeof(val));
+	return val;
+}
+
+DUK_LOCAL void duk__bc_push_string(duk__bc_reader *br) {
+	duk_uint32_t len = duk__bc_read_u32(br);
+	const duk_uint8_t *p = duk__bc_read_bytes(br, len);
+	duk_push_lstring((duk_context *) br->thr, (const char *) p, len);
+}
+
+/* Read optional string or buffer and define it on the function at stack top */
+DUK_LOCAL void duk__bc_read_prop(duk__bc_reader *br, duk_small_int_t stridx, duk_bool_t is_buffer) {
+	duk_context *ctx = (duk_context *) br->thr;
+	duk_uint32_t len = duk__bc_read_u32(br);
+	const duk_uint8_t *p;
+
+	if (len == DUK__BC_NONE) {
+		return;
+	}
+	p = duk__bc_read_bytes(br, len);
+	if (is_buffer) {
+		void *buf = duk_push_fixed_buffer(ctx, len);
+		if (len > 0) {
+			DUK_MEMCPY(buf, (const void *) p, len);
+		}
+	} else {
+		duk_push_lstring(ctx, (const char *) p, len);
+	}
+	duk_xdef_prop_stridx(ctx, -2, stridx, DUK_PROPDESC_FLAGS_NONE);
+}
+
+/* Pushes a function template */
+DUK_LOCAL void duk__bc_read_func(duk__bc_reader *br) {
+	duk_hthread *thr = br->thr;
+	duk_context *ctx = (duk_context *) thr;
+	duk_hcompiledfunction *h_res;
+	duk_hbuffer_fixed *h_data;
+	duk_uint32_t count_instr, count_const, count_funcs, i, count;
+	duk_uint16_t nregs, nargs;
+	duk_uint32_t start_line, end_line;
+	duk_uint32_t flags;
+	const duk_uint8_t *instr;
+	duk_tval *tv_dst;
+	duk_hobject **fn_dst;
+	duk_idx_t idx_base;
+	duk_size_t data_size;
+
+	count_instr = duk__bc_read_u32(br);
+	count_const = duk__bc_read_u32(br);
+	count_funcs = duk__bc_read_u32(br);
+	DUK_MEMCPY((void *) &nregs, (const void *) duk__bc_read_bytes(br, sizeof(nregs)), sizeof(nregs));
+	DUK_MEMCPY((void *) &nargs, (const void *) duk__bc_read_bytes(br, sizeof(nargs)), sizeof(nargs));
+	start_line = duk__bc_read_u32(br);
+	end_line = duk__bc_read_u32(br);
+	flags = duk__bc_read_u32(br);
+
+	/* Every constant and function uses at least a few bytes of input,
+	 * so this also bounds the value stack reservation below.
+	 */
+	if (count_instr == 0 || nregs < nargs ||
+	    (flags & ~((duk_uint32_t) DUK__BC_FLAGS_MASK)) != 0 ||
+	    count_instr > (duk_uint32_t) (br->end - br->p) / sizeof(duk_instr_t) ||
+	    count_const > (duk_uint32_t) (br->end - br->p) ||
+	    count_funcs > (duk_uint32_t) (br->end - br->p)) {
+		DUK_ERROR(thr, DUK_ERR_ERROR, "invalid bytecode");
+	}
+	instr = duk__bc_read_bytes(br, count_instr * sizeof(duk_instr_t));
+
+	duk_require_stack(ctx, (duk_idx_t) (count_const + count_funcs + 8));
+	idx_base = duk_get_top(ctx);
+
+	/* [ ... consts funcs ] */
+
+	for (i = 0; i < count_const; i++) {
+		duk_uint8_t type = *duk__bc_read_bytes(br, 1);
+		if (type == DUK__BC_CONST_STRING) {
+			duk__bc_push_string(br);
+		} else if (type == DUK__BC_CONST_NUMBER) {
+			duk_double_t d;
+			DUK_MEMCPY((void *) &d, (const void *) duk__bc_read_bytes(br, sizeof(d)), sizeof(d));
+			duk_push_number(ctx, d);
+		} else {
+			DUK_ERROR(thr, DUK_ERR_ERROR, "invalid bytecode");
+		}
+	}
+
+	for (i = 0; i < count_funcs; i++) {
+		duk__bc_read_func(br);
+	}
+
+	(void) duk_push_compiledfunction(ctx);
+	h_res = (duk_hcompiledfunction *) duk_get_hobject(ctx, -1);
+	DUK_HEAPHDR_SET_FLAG_BITS((duk_heaphdr *) h_res, flags);
+	h_res->nregs = nregs;
+	h_res->nargs = nargs;
+#if defined(DUK_USE_DEBUGGER_SUPPORT)
+	h_res->start_line = start_line;
+	h_res->end_line = end_line;
+#else
+	DUK_UNREF(start_line);
+	DUK_UNREF(end_line);
+#endif
+
+	/* Same layout as in duk__convert_to_func_template() */
+	data_size = count_const * sizeof(duk_tval) +
+	            count_funcs * sizeof(duk_hobject *) +
+	            count_instr * sizeof(duk_instr_t);
+	duk_push_fixed_buffer(ctx, data_size);
+	h_data = (duk_hbuffer_fixed *) duk_get_hbuffer(ctx, -1);
+
+	DUK_HCOMPILEDFUNCTION_SET_DATA(thr->heap, h_res, (duk_hbuffer *) h_data);
+	DUK_HEAPHDR_INCREF(thr, h_data);
+
+	tv_dst = (duk_tval *) DUK_HBUFFER_FIXED_GET_DATA_PTR(thr->heap, h_data);
+	for (i = 0; i < count_const; i++) {
+		duk_tval *tv_src = duk_get_tval(ctx, idx_base + (duk_idx_t) i);
+		DUK_TVAL_SET_TVAL(tv_dst, tv_src);
+		DUK_TVAL_INCREF(thr, tv_dst);
+		tv_dst++;
+	}
+
+	fn_dst = (duk_hobject **) tv_dst;
+	DUK_HCOMPILEDFUNCTION_SET_FUNCS(thr->heap, h_res, fn_dst);
+	for (i = 0; i < count_funcs; i++) {
+		duk_hobject *h = duk_get_hobject(ctx, idx_base + (duk_idx_t) (count_const + i));
+		DUK_ASSERT(h != NULL && DUK_HOBJECT_IS_COMPILEDFUNCTION(h));
+		*fn_dst++ = h;
+		DUK_HOBJECT_INCREF(thr, h);
+	}
+
+	DUK_HCOMPILEDFUNCTION_SET_BYTECODE(thr->heap, h_res, (duk_instr_t *) fn_dst);
+	DUK_MEMCPY((void *) fn_dst, (const void *) instr, count_instr * sizeof(duk_instr_t));
+
+	duk_pop(ctx);  /* data */
+
+	/* [ ... consts funcs template ] */
+
+	duk__bc_read_prop(br, DUK_STRIDX_NAME, 0);
+	duk__bc_read_prop(br, DUK_STRIDX_FILE_NAME, 0);
+	duk__bc_read_prop(br, DUK_STRIDX_INT_PC2LINE, 1);
+
+	count = duk__bc_read_u32(br);
+	if (count != DUK__BC_NONE) {
+		duk_push_object(ctx);
+		for (i = 0; i < count; i++) {
+			duk__bc_push_string(br);
+			duk_push_uint(ctx, (duk_uint_t) duk__bc_read_u32(br));
+			duk_put_prop(ctx, -3);
+		}
+		duk_compact(ctx, -1);
+		duk_xdef_prop_stridx(ctx, -2, DUK_STRIDX_INT_VARMAP, DUK_PROPDESC_FLAGS_NONE);
+	}
+
+	count = duk__bc_read_u32(br);
+	if (count != DUK__BC_NONE) {
+		duk_push_array(ctx);
+		for (i = 0; i < count; i++) {
+			duk__bc_push_string(br);
+			duk_put_prop_index(ctx, -2, (duk_uarridx_t) i);
+		}
+		duk_compact(ctx, -1);
+		duk_xdef_prop_stridx(ctx, -2, DUK_STRIDX_INT_FORMALS, DUK_PROPDESC_FLAGS_NONE);
+	}
+
+	if (DUK_HOBJECT_HAS_NAMEBINDING((duk_hobject *) h_res) &&
+	    !duk_has_prop_stridx(ctx, -1, DUK_STRIDX_NAME)) {
+		DUK_ERROR(thr, DUK_ERR_ERROR, "invalid bytecode");
+	}
+
+	duk_compact(ctx, -1);
+
+	/* [ ... consts funcs template ] -> [ ... template ] */
+	if (count_const + count_funcs > 0) {
+		duk_replace(ctx, idx_base);
+		duk_set_top(ctx, idx_base + 1);
+	}
+}
+
+DUK_EXTERNAL void duk_load_function(duk_context *ctx) {
+	duk_hthread *thr = (duk_hthread *) ctx;
+	duk__bc_reader br;
+	duk_size_t size;
+	const duk_uint8_t *p;
+	duk_hcompiledfunction *h_templ;
+
+	DUK_ASSERT_CTX_VALID(ctx);
+
+	br.thr = thr;
+	br.p = (const duk_uint8_t *) duk_require_buffer(ctx, -1, &size);
+	br.end = br.p + size;
+
+	p = duk__bc_read_bytes(&br, 4);
+	if (p[0] != DUK__BC_MAGIC ||
+	    p[1] != sizeof(duk_instr_t) ||
+	    p[2] != sizeof(duk_double_t) ||
+	    duk__bc_read_u32(&br) != (duk_uint32_t) DUK_VERSION) {
+		DUK_ERROR(thr, DUK_ERR_ERROR, "invalid bytecode");
+	}
+
+	duk__bc_read_func(&br);
+	if (br.p != br.end) {
+		DUK_ERROR(thr, DUK_ERR_ERROR, "invalid bytecode");
+	}
+
+	/* [ ... buf template ] */
+
+	h_templ = (duk_hcompiledfunction *) duk_get_hobject(ctx, -1);
+	duk_js_push_closure(thr,
+	                    h_templ,
+	                    thr->builtins[DUK_BIDX_GLOBAL_ENV],
+	                    thr->builtins[DUK_BIDX_GLOBAL_ENV]);
+
+	/* [ ... buf template closure ] */
+
+	duk_replace(ctx, -3);
+	duk_pop(ctx);
+}
 #line 1 "duk_api_debug.c"
 /*
  *  Debugging related API calls
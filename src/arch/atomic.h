@@ -58,6 +58,12 @@ atomic_set(atomic_t *a, int v)
   a->v = v;
 }
 
+static inline void
+atomic_barrier(void)
+{
+  __sync_synchronize();
+}
+
 #elif defined(_MSC_VER)
 
 #include <Windows.h>
@@ -97,6 +103,12 @@ atomic_set(atomic_t *a, int v)
   a->v = v;
 }
 
+static __inline void
+atomic_barrier(void)
+{
+  MemoryBarrier();
+}
+
 #else
 #error Missing atomic ops
 #endif
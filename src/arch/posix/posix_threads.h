@@ -53,6 +53,17 @@ hts_mutex_trylock(pthread_mutex_t *m)
   return pthread_mutex_trylock(m) == EBUSY;
 }
 
+/**
+ * Read/write locks
+ */
+typedef pthread_rwlock_t hts_rwlock_t;
+
+#define hts_rwlock_init(l)           pthread_rwlock_init((l), NULL)
+#define hts_rwlock_rdlock(l)         pthread_rwlock_rdlock(l)
+#define hts_rwlock_wrlock(l)         pthread_rwlock_wrlock(l)
+#define hts_rwlock_unlock(l)         pthread_rwlock_unlock(l)
+#define hts_rwlock_destroy(l)        pthread_rwlock_destroy(l)
+
 /**
  * Condition variables
  */
@@ -109,6 +120,7 @@ typedef pthread_key_t hts_key_t;
 #endif
 
 #define HTS_MUTEX_DECL(name) hts_mutex_t name = PTHREAD_MUTEX_INITIALIZER
+#define HTS_RWLOCK_DECL(name) hts_rwlock_t name = PTHREAD_RWLOCK_INITIALIZER
 
 
 
@@ -96,6 +96,19 @@ extern void hts_mutex_destroyx(hts_mutex_t *m, const char *file, int line);
 
 #endif
 
+/**
+ * Read/write locks
+ *
+ * Plain mutexes for now, readers are serialized
+ */
+typedef hts_mutex_t hts_rwlock_t;
+
+#define hts_rwlock_init(l)    hts_mutex_init(l)
+#define hts_rwlock_rdlock(l)  hts_mutex_lock(l)
+#define hts_rwlock_wrlock(l)  hts_mutex_lock(l)
+#define hts_rwlock_unlock(l)  hts_mutex_unlock(l)
+#define hts_rwlock_destroy(l) hts_mutex_destroy(l)
+
 /**
  * Condition variables
  */
@@ -190,5 +203,7 @@ hts_mutex_t name; \
    hts_mutex_init(&name); \
  }
 
+#define HTS_RWLOCK_DECL(name) HTS_MUTEX_DECL(name)
+
 
 void mutex_dump_info(sys_mutex_t lock);
@@ -591,6 +591,7 @@ audio_decode_thread(void *aux)
     } else {
       avail = ad->ad_avr != NULL ? avresample_available(ad->ad_avr) : 0;
     }
+    mq_ring_drain(mp, mq);
     media_buf_t *data = TAILQ_FIRST(&mq->mq_q_data);
     media_buf_t *ctrl = TAILQ_FIRST(&mq->mq_q_ctrl);
     if(avail >= ad->ad_tile_size && blocked == 0 && !ad->ad_paused && !ctrl) {
@@ -628,6 +629,9 @@ audio_decode_thread(void *aux)
       mb = data;
       if(mb->mb_dts != PTS_UNSET)
         mq->mq_last_deq_dts = mb->mb_dts;
+    } else if(data == NULL) {
+      mq_wait_data(mp, mq);
+      continue;
     } else {
       hts_cond_wait(&mq->mq_avail, &mp->mp_mutex);
       continue;
@@ -33,26 +33,104 @@
 #include "misc/minmax.h"
 #include "fileaccess/fileaccess.h"
 
+#if ENABLE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #define bcprintf(x...) // printf(x)
 
-// Flags
+/**
+ * The index is split in BLOBCACHE_SHARDS shards, each with its own lock
+ * and its own open addressed hash table stored in bc2/index-<n>.dat
+ *
+ * With ENABLE_MMAP the table file is mapped shared so every update goes
+ * straight to the page cache and nothing needs to be loaded or saved
+ * in bulk. Each slot carries a checksum and the header has a clean
+ * flag which is only set on orderly shutdown. After a crash the shard
+ * is scanned once and slots failing the checksum are dropped.
+ *
+ * Eviction is CLOCK: Access sets bs_clock (to 2 for important items
+ * so they survive an extra sweep) and the hand clears it while
+ * sweeping. Unreferenced slots are evicted.
+ */
 
 #define BC2_MAGIC_07      0x62630207
 #define BC2_MAGIC_06      0x62630206
 #define BC2_MAGIC_05      0x62630205
 
-typedef struct blobcache_item {
-  struct blobcache_item *bi_link;
-  char *bi_etag;
-  uint64_t bi_key_hash;
-  uint64_t bi_content_hash;
-  uint32_t bi_lastaccess;
-  uint32_t bi_expiry;
-  uint32_t bi_modtime;
-  uint32_t bi_size;
-  uint8_t bi_content_type_len;
-  uint8_t bi_flags;
-} blobcache_item_t;
+#define BC2_SHARD_MAGIC   0x62630308
+
+#define BLOBCACHE_SHARDS            16
+#define BLOBCACHE_SHARD_MIN_SLOTS   1024
+#define BLOBCACHE_ETAG_MAX          88
+
+#define BS_EMPTY   0
+#define BS_USED    1
+#define BS_DELETED 2
+
+typedef struct blobcache_slot {
+  uint32_t bs_csum;
+  uint8_t bs_clock;   // CLOCK reference, not covered by bs_csum
+  uint8_t bs_pad[3];
+
+  // Everything below is covered by bs_csum
+
+  uint64_t bs_key_hash;
+  uint64_t bs_content_hash;
+  uint32_t bs_expiry;
+  uint32_t bs_modtime;
+  uint32_t bs_size;
+  uint8_t bs_state;
+  uint8_t bs_flags;
+  uint8_t bs_content_type_len;
+  uint8_t bs_etaglen;
+  char bs_etag[BLOBCACHE_ETAG_MAX];
+} blobcache_slot_t;
+
+static_assert(sizeof(blobcache_slot_t) == 128, "blobcache_slot size");
+
+
+typedef struct blobcache_shard_header {
+  uint32_t bsh_magic;
+  uint32_t bsh_capacity;   // Number of slots, power of 2
+  uint32_t bsh_used;
+  uint32_t bsh_deleted;
+  uint32_t bsh_hand;       // CLOCK hand
+  uint32_t bsh_clean;      // Set on orderly shutdown
+  uint64_t bsh_size;       // Sum of bs_size of used slots
+  uint8_t bsh_pad[96];
+} blobcache_shard_header_t;
+
+static_assert(sizeof(blobcache_shard_header_t) == 128,
+              "blobcache_shard_header size");
+
+
+TAILQ_HEAD(blobcache_flush_queue, blobcache_flush);
+
+typedef struct blobcache_flush {
+  TAILQ_ENTRY(blobcache_flush) bf_link;
+  uint64_t bf_key_hash;
+  buf_t *bf_buf;
+} blobcache_flush_t;
+
+
+typedef struct blobcache_shard {
+  hts_mutex_t sh_mutex;
+  blobcache_shard_header_t *sh_hdr;  // NULL when closed
+  blobcache_slot_t *sh_slots;
+  size_t sh_mapsize;
+  int sh_fd;
+  int sh_index;
+  int sh_dirty;
+  struct blobcache_flush_queue sh_flush_queue;
+} blobcache_shard_t;
+
+static blobcache_shard_t shards[BLOBCACHE_SHARDS];
+
+// Legacy (single file) index format, only used for import
 
 typedef struct blobcache_diskitem_06 {
   uint64_t di_key_hash;
@@ -80,37 +158,22 @@ typedef struct blobcache_diskitem_07 {
 } __attribute__((packed)) blobcache_diskitem_07_t;
 
 
-TAILQ_HEAD(blobcache_flush_queue, blobcache_flush);
-
-typedef struct blobcache_flush {
-  TAILQ_ENTRY(blobcache_flush) bf_link;
-  uint64_t bf_key_hash;
-  buf_t *bf_buf;
-} blobcache_flush_t;
-
-
-
-#define ITEM_HASH_SIZE 256
-#define ITEM_HASH_MASK (ITEM_HASH_SIZE - 1)
-
-static blobcache_item_t *hashvector[ITEM_HASH_SIZE];
-
-static struct blobcache_flush_queue flush_queue;
-
-static pool_t *item_pool;
+static pool_t *flush_pool;
 static hts_mutex_t cache_lock;
 static hts_cond_t cache_cond;
 static hts_thread_t bcthread;
+static int flush_pending;
+
+/**
+ * Written with cache_lock held, but also read with just a shard lock
+ * held. Any stale value seen there is harmless
+ */
 static enum {
   BLOBCACHE_RUN_BAD_CLOCK,
   BLOBCACHE_RUN,
   BLOBCACHE_STOPPING,
 } bcstate;
 
-static int loaded_cache_is_from;
-
-static int index_dirty;
-
 #define BLOB_CACHE_MINSIZE   (10 * 1000 * 1000)
 #define BLOB_CACHE_MAXSIZE (1000 * 1000 * 1000)
 
@@ -187,25 +250,212 @@ make_filename(char *buf, size_t len, uint64_t hash, int for_write)
 }
 
 
+/**
+ * The low bits of the key hash selects the slot and the file directory
+ * so use the top bits for shard selection
+ */
+static __inline blobcache_shard_t *
+shard_for_key(uint64_t dk)
+{
+  return &shards[dk >> 60];
+}
+
+static_assert(BLOBCACHE_SHARDS == 16, "shard_for_key() assumes 16 shards");
+
+
 /**
  *
  */
 static void
-save_index(void)
+shard_filename(char *buf, size_t len, int index, const char *suffix)
+{
+  snprintf(buf, len, "%s/bc2/index-%x.%s", gconf.cache_path, index, suffix);
+}
+
+
+/**
+ *
+ */
+static uint32_t
+slot_csum(const blobcache_slot_t *bs)
+{
+  const uint8_t *p = (const uint8_t *)&bs->bs_key_hash;
+  const uint8_t *e = (const uint8_t *)(bs + 1);
+  uint32_t h = 2166136261u;
+  while(p < e)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+
+/**
+ * Must be called after a slot has been modified
+ */
+static void
+slot_seal(blobcache_shard_t *sh, blobcache_slot_t *bs)
+{
+  bs->bs_csum = slot_csum(bs);
+  sh->sh_dirty = 1;
+}
+
+
+/**
+ *
+ */
+static void
+slot_touch(blobcache_shard_t *sh, blobcache_slot_t *bs)
+{
+  bs->bs_clock = bs->bs_flags & BLOBCACHE_IMPORTANT_ITEM ? 2 : 1;
+  sh->sh_dirty = 1;
+}
+
+
+#if ENABLE_MMAP
+
+/**
+ * Map a table file, if capacity is non-zero the file is (re)created
+ * with that many empty slots
+ */
+static int
+shard_map(blobcache_shard_t *sh, const char *path, uint32_t capacity)
+{
+  struct stat st;
+  blobcache_shard_header_t hdr;
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(fd == -1)
+    return -1;
+
+  if(capacity) {
+    if(ftruncate(fd, 0) ||
+       ftruncate(fd, sizeof(hdr) + (size_t)capacity * sizeof(blobcache_slot_t)))
+      goto bad;
+  } else {
+    if(fstat(fd, &st) || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+      goto bad;
+
+    if(hdr.bsh_magic != BC2_SHARD_MAGIC || hdr.bsh_capacity == 0 ||
+       (hdr.bsh_capacity & (hdr.bsh_capacity - 1)) ||
+       st.st_size != sizeof(hdr) +
+       (off_t)hdr.bsh_capacity * sizeof(blobcache_slot_t))
+      goto bad;
+    capacity = hdr.bsh_capacity;
+  }
+
+  size_t size = sizeof(hdr) + (size_t)capacity * sizeof(blobcache_slot_t);
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED)
+    goto bad;
+
+  sh->sh_hdr = p;
+  sh->sh_slots = p + sizeof(hdr);
+  sh->sh_mapsize = size;
+  sh->sh_fd = fd;
+  return 0;
+
+ bad:
+  close(fd);
+  return -1;
+}
+
+
+/**
+ *
+ */
+static void
+shard_unmap(blobcache_shard_t *sh)
+{
+  munmap(sh->sh_hdr, sh->sh_mapsize);
+  close(sh->sh_fd);
+  sh->sh_hdr = NULL;
+  sh->sh_slots = NULL;
+}
+
+
+/**
+ *
+ */
+static void
+shard_sync(blobcache_shard_t *sh, int wait)
+{
+  if(!sh->sh_dirty && !wait)
+    return;
+  msync(sh->sh_hdr, sh->sh_mapsize, wait ? MS_SYNC : MS_ASYNC);
+  sh->sh_dirty = 0;
+}
+
+#else
+
+/**
+ * Without mmap() the table is kept in memory and written back
+ * in full by shard_sync()
+ */
+static int
+shard_map(blobcache_shard_t *sh, const char *path, uint32_t capacity)
+{
+  blobcache_shard_header_t *hdr;
+  size_t size;
+
+  if(capacity) {
+    size = sizeof(*hdr) + (size_t)capacity * sizeof(blobcache_slot_t);
+    hdr = calloc(1, size);
+    if(hdr == NULL)
+      return -1;
+  } else {
+    fa_handle_t *fh = fa_open(path, NULL, 0);
+    if(fh == NULL)
+      return -1;
+
+    size = fa_fsize(fh);
+    if(size < sizeof(*hdr) || (hdr = mymalloc(size)) == NULL) {
+      fa_close(fh);
+      return -1;
+    }
+
+    int r = fa_read(fh, hdr, size);
+    fa_close(fh);
+
+    if(r != size || hdr->bsh_magic != BC2_SHARD_MAGIC ||
+       hdr->bsh_capacity == 0 ||
+       (hdr->bsh_capacity & (hdr->bsh_capacity - 1)) ||
+       size != sizeof(*hdr) +
+       (size_t)hdr->bsh_capacity * sizeof(blobcache_slot_t)) {
+      free(hdr);
+      return -1;
+    }
+  }
+  sh->sh_hdr = hdr;
+  sh->sh_slots = (void *)(hdr + 1);
+  sh->sh_mapsize = size;
+  sh->sh_dirty = 1;
+  return 0;
+}
+
+
+/**
+ *
+ */
+static void
+shard_unmap(blobcache_shard_t *sh)
+{
+  free(sh->sh_hdr);
+  sh->sh_hdr = NULL;
+  sh->sh_slots = NULL;
+}
+
+
+/**
+ *
+ */
+static void
+shard_sync(blobcache_shard_t *sh, int wait)
 {
   char errbuf[512];
   char filename[PATH_MAX];
-  uint8_t *out, *base;
-  int i;
-  blobcache_item_t *p;
-  blobcache_diskitem_07_t *di;
-  size_t siz;
 
-  if(!index_dirty)
+  if(!sh->sh_dirty)
     return;
 
-  snprintf(filename, sizeof(filename), "%s/bc2/index.dat", gconf.cache_path);
-
+  shard_filename(filename, sizeof(filename), sh->sh_index, "dat");
   fa_handle_t *fh = fa_open_ex(filename, errbuf, sizeof(errbuf),
                                FA_WRITE, NULL);
   if(fh == NULL) {
@@ -213,65 +463,226 @@ save_index(void)
           filename, errbuf);
     return;
   }
+  if(fa_write(fh, sh->sh_hdr, sh->sh_mapsize) == sh->sh_mapsize)
+    sh->sh_dirty = 0;
+  fa_close(fh);
+}
 
-  int items = 0;
-  siz = 12 + 20;
+#endif
 
-  for(i = 0; i < ITEM_HASH_SIZE; i++) {
-    for(p = hashvector[i]; p != NULL; p = p->bi_link) {
-      siz += sizeof(blobcache_diskitem_07_t);
-      siz += p->bi_etag ? strlen(p->bi_etag) : 0;
-      items++;
-    }
+
+/**
+ *
+ */
+static void
+shard_init_header(blobcache_shard_t *sh, uint32_t capacity)
+{
+  blobcache_shard_header_t *hdr = sh->sh_hdr;
+  memset(hdr, 0, sizeof(blobcache_shard_header_t));
+  hdr->bsh_magic = BC2_SHARD_MAGIC;
+  hdr->bsh_capacity = capacity;
+}
+
+
+/**
+ * Find slot for key, returns NULL if not found
+ */
+static blobcache_slot_t *
+shard_find(blobcache_shard_t *sh, uint64_t dk)
+{
+  blobcache_shard_header_t *hdr = sh->sh_hdr;
+  const uint32_t mask = hdr->bsh_capacity - 1;
+  uint32_t i = dk & mask;
+
+  for(uint32_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+    blobcache_slot_t *bs = &sh->sh_slots[i];
+    if(bs->bs_state == BS_EMPTY)
+      return NULL;
+    if(bs->bs_state != BS_USED || bs->bs_key_hash != dk)
+      continue;
+    if(bs->bs_csum == slot_csum(bs))
+      return bs;
+
+    // Torn write, just forget about it
+    bs->bs_state = BS_DELETED;
+    slot_seal(sh, bs);
+    hdr->bsh_used--;
+    hdr->bsh_deleted++;
+    hdr->bsh_size -= MIN(hdr->bsh_size, bs->bs_size);
   }
+  return NULL;
+}
 
-  base = out = mymalloc(siz);
-  if(out == NULL) {
-    fa_close(fh);
-    return;
+
+/**
+ * Find an empty slot for key. Table must not be full.
+ */
+static blobcache_slot_t *
+shard_place(blobcache_shard_t *sh, uint64_t dk)
+{
+  blobcache_shard_header_t *hdr = sh->sh_hdr;
+  const uint32_t mask = hdr->bsh_capacity - 1;
+  uint32_t i = dk & mask;
+
+  while(sh->sh_slots[i].bs_state == BS_USED)
+    i = (i + 1) & mask;
+  return &sh->sh_slots[i];
+}
+
+
+/**
+ * Rehash into a new table, doubling the size if it's more than half
+ * full. Otherwise this just purges tombstones
+ */
+static int
+shard_rehash(blobcache_shard_t *sh)
+{
+  char path[PATH_MAX];
+  char tmppath[PATH_MAX];
+  blobcache_shard_t old = *sh;
+  const blobcache_shard_header_t *ohdr = old.sh_hdr;
+  uint32_t capacity = ohdr->bsh_capacity;
+
+  if((ohdr->bsh_used + 1) * 2 > capacity)
+    capacity *= 2;
+
+  shard_filename(path,    sizeof(path),    sh->sh_index, "dat");
+  shard_filename(tmppath, sizeof(tmppath), sh->sh_index, "new");
+
+  if(shard_map(sh, tmppath, capacity)) {
+    *sh = old;
+    return -1;
   }
-  *(uint32_t *)out = BC2_MAGIC_07;
-  out += 4;
-  *(uint32_t *)out = items;
-  out += 4;
-  *(uint32_t *)out = time(NULL);
-  out += 4;
-  for(i = 0; i < ITEM_HASH_SIZE; i++) {
-    for(p = hashvector[i]; p != NULL; p = p->bi_link) {
-      const int etaglen = p->bi_etag ? strlen(p->bi_etag) : 0;
-      di = (blobcache_diskitem_07_t *)out;
-      di->di_key_hash     = p->bi_key_hash;
-      di->di_content_hash = p->bi_content_hash;
-      di->di_lastaccess   = p->bi_lastaccess;
-      di->di_expiry       = p->bi_expiry;
-      di->di_modtime      = p->bi_modtime;
-      di->di_size         = p->bi_size;
-      di->di_flags        = p->bi_flags;
-      di->di_etaglen      = etaglen;
-      di->di_content_type_len = p->bi_content_type_len;
-      out += sizeof(blobcache_diskitem_07_t);
-      if(etaglen) {
-	memcpy(out, p->bi_etag, etaglen);
-	out += etaglen;
-      }
 
+  shard_init_header(sh, capacity);
+  blobcache_shard_header_t *hdr = sh->sh_hdr;
+
+  for(uint32_t i = 0; i < ohdr->bsh_capacity; i++) {
+    const blobcache_slot_t *obs = &old.sh_slots[i];
+    if(obs->bs_state != BS_USED || obs->bs_csum != slot_csum(obs))
+      continue;
+    blobcache_slot_t *bs = shard_place(sh, obs->bs_key_hash);
+    *bs = *obs;
+    hdr->bsh_used++;
+    hdr->bsh_size += bs->bs_size;
+  }
+
+  sh->sh_dirty = 1;
+#if ENABLE_MMAP
+  if(rename(tmppath, path)) {
+    TRACE(TRACE_ERROR, "blobcache", "Unable to rename %s -- %s",
+          tmppath, strerror(errno));
+  }
+#endif
+  shard_unmap(&old);
+  return 0;
+}
+
+
+/**
+ * Insert a new slot for key (which must not already exist)
+ * The caller is expected to fill in the rest and seal the slot
+ */
+static blobcache_slot_t *
+shard_insert(blobcache_shard_t *sh, uint64_t dk)
+{
+  blobcache_shard_header_t *hdr = sh->sh_hdr;
+
+  if((hdr->bsh_used + hdr->bsh_deleted + 1) * 4 > hdr->bsh_capacity * 3) {
+    if(shard_rehash(sh) &&
+       hdr->bsh_used + 1 == hdr->bsh_capacity)
+      return NULL;
+    hdr = sh->sh_hdr;
+  }
+
+  blobcache_slot_t *bs = shard_place(sh, dk);
+  if(bs->bs_state == BS_DELETED)
+    hdr->bsh_deleted--;
+  hdr->bsh_used++;
+
+  memset(bs, 0, sizeof(blobcache_slot_t));
+  bs->bs_key_hash = dk;
+  bs->bs_state = BS_USED;
+  return bs;
+}
+
+
+/**
+ *
+ */
+static void
+shard_delete(blobcache_shard_t *sh, blobcache_slot_t *bs)
+{
+  blobcache_shard_header_t *hdr = sh->sh_hdr;
+  bs->bs_state = BS_DELETED;
+  slot_seal(sh, bs);
+  hdr->bsh_used--;
+  hdr->bsh_deleted++;
+  hdr->bsh_size -= MIN(hdr->bsh_size, bs->bs_size);
+}
+
+
+/**
+ * Drop slots with bad checksums and recompute counters. Only done
+ * when a shard was not closed properly
+ */
+static void
+shard_verify(blobcache_shard_t *sh)
+{
+  blobcache_shard_header_t *hdr = sh->sh_hdr;
+  int dropped = 0;
+
+  hdr->bsh_used = 0;
+  hdr->bsh_deleted = 0;
+  hdr->bsh_size = 0;
+  hdr->bsh_hand &= hdr->bsh_capacity - 1;
+
+  for(uint32_t i = 0; i < hdr->bsh_capacity; i++) {
+    blobcache_slot_t *bs = &sh->sh_slots[i];
+    switch(bs->bs_state) {
+    case BS_EMPTY:
+      continue;
+    case BS_USED:
+      if(bs->bs_csum == slot_csum(bs)) {
+        hdr->bsh_used++;
+        hdr->bsh_size += bs->bs_size;
+        continue;
+      }
+      dropped++;
+      bs->bs_state = BS_DELETED;
+      slot_seal(sh, bs);
+      // FALLTHRU
+    default:
+      hdr->bsh_deleted++;
+      break;
     }
   }
+  TRACE(TRACE_INFO, "blobcache",
+        "Index shard %d was not closed properly, %d items dropped",
+        sh->sh_index, dropped);
+}
 
-  sha1_decl(shactx);
-  sha1_init(shactx);
-  sha1_update(shactx, base, siz - 20);
-  sha1_final(shactx, out);
 
-  if(fa_write(fh, base, siz) != siz) {
-    TRACE(TRACE_INFO, "blobcache", "Unable to store index file %s -- %s",
-	  filename, strerror(errno));
+/**
+ *
+ */
+static void
+shard_open(blobcache_shard_t *sh)
+{
+  char path[PATH_MAX];
+  shard_filename(path, sizeof(path), sh->sh_index, "dat");
+
+  if(!shard_map(sh, path, 0)) {
+    if(!sh->sh_hdr->bsh_clean)
+      shard_verify(sh);
+  } else if(!shard_map(sh, path, BLOBCACHE_SHARD_MIN_SLOTS)) {
+    shard_init_header(sh, BLOBCACHE_SHARD_MIN_SLOTS);
   } else {
-    index_dirty = 0;
+    TRACE(TRACE_ERROR, "blobcache", "Unable to create index %s", path);
+    return;
   }
-
-  free(base);
-  fa_close(fh);
+  sh->sh_hdr->bsh_clean = 0;
+  sh->sh_dirty = 1;
 }
 
 
@@ -279,30 +690,50 @@ save_index(void)
  *
  */
 static void
-load_index(void)
+shard_close(blobcache_shard_t *sh)
+{
+  blobcache_flush_t *bf;
+
+  while((bf = TAILQ_FIRST(&sh->sh_flush_queue)) != NULL) {
+    TAILQ_REMOVE(&sh->sh_flush_queue, bf, bf_link);
+    buf_release(bf->bf_buf);
+    pool_put(flush_pool, bf);
+  }
+
+  if(sh->sh_hdr == NULL)
+    return;
+
+  sh->sh_hdr->bsh_clean = 1;
+  sh->sh_dirty = 1;
+  shard_sync(sh, 1);
+  shard_unmap(sh);
+}
+
+
+/**
+ * Import items from the old single file index (BC2_MAGIC_05 .. 07)
+ */
+static void
+import_legacy_index(void)
 {
   char errbuf[512];
   char filename[PATH_MAX];
   const uint8_t *in;
   void *base;
   int i;
-  blobcache_item_t *p;
   uint8_t digest[20];
 
   snprintf(filename, sizeof(filename), "%s/bc2/index.dat", gconf.cache_path);
 
   fa_handle_t *fh = fa_open(filename, errbuf, sizeof(errbuf));
-  if(fh == NULL) {
-    TRACE(TRACE_DEBUG, "cache", "Unable to open index %s -- %s",
-          filename, errbuf);
+  if(fh == NULL)
     return;
-  }
 
   int64_t size = fa_fsize(fh);
 
   if(size < 20) {
     fa_close(fh);
-    return;
+    goto done;
   }
 
   in = base = mymalloc(size);
@@ -315,7 +746,7 @@ load_index(void)
   fa_close(fh);
   if(r != size) {
     free(base);
-    return;
+    goto done;
   }
 
 
@@ -327,7 +758,7 @@ load_index(void)
   if(memcmp(digest, in + size - 20, 20)) {
     free(base);
     TRACE(TRACE_INFO, "blobcache", "Index file corrupt, throwing away cache");
-    return;
+    goto done;
   }
 
   uint32_t magic = *(uint32_t *)in;
@@ -339,26 +770,24 @@ load_index(void)
 
   switch(magic) {
   case BC2_MAGIC_06:
-    TRACE(TRACE_INFO, "blobcache", "Upgrading from older format 0x%08x", magic);
-    // FALLTHRU
   case BC2_MAGIC_07:
-    loaded_cache_is_from = *(uint32_t *)in;
     in += 4;
     break;
 
   case BC2_MAGIC_05:
-    TRACE(TRACE_INFO, "blobcache", "Upgrading from older format 0x%08x", magic);
     break;
 
   default:
     TRACE(TRACE_INFO, "blobcache", "Invalid magic 0x%08x", magic);
     free(base);
-    return;
+    goto done;
   }
 
+  TRACE(TRACE_INFO, "blobcache", "Importing index from older format 0x%08x",
+        magic);
 
   for(i = 0; i < items; i++) {
-    p = pool_get(item_pool);
+    blobcache_slot_t tmp = {0};
     int etaglen;
 
     switch(magic) {
@@ -366,15 +795,14 @@ load_index(void)
     case BC2_MAGIC_06: {
       const blobcache_diskitem_06_t *di = (blobcache_diskitem_06_t *)in;
 
-      p->bi_key_hash         = di->di_key_hash;
-      p->bi_content_hash     = di->di_content_hash;
-      p->bi_lastaccess       = di->di_lastaccess;
-      p->bi_expiry           = di->di_expiry;
-      p->bi_modtime          = di->di_modtime;
-      p->bi_size             = di->di_size;
-      p->bi_content_type_len = di->di_content_type_len;
-      p->bi_flags            = 0;
-      etaglen                = di->di_etaglen;
+      tmp.bs_key_hash         = di->di_key_hash;
+      tmp.bs_content_hash     = di->di_content_hash;
+      tmp.bs_expiry           = di->di_expiry;
+      tmp.bs_modtime          = di->di_modtime;
+      tmp.bs_size             = di->di_size;
+      tmp.bs_content_type_len = di->di_content_type_len;
+      tmp.bs_flags            = 0;
+      etaglen                 = di->di_etaglen;
       in += sizeof(blobcache_diskitem_06_t);
     }
       break;
@@ -382,15 +810,14 @@ load_index(void)
     case BC2_MAGIC_07: {
       const blobcache_diskitem_07_t *di = (blobcache_diskitem_07_t *)in;
 
-      p->bi_key_hash         = di->di_key_hash;
-      p->bi_content_hash     = di->di_content_hash;
-      p->bi_lastaccess       = di->di_lastaccess;
-      p->bi_expiry           = di->di_expiry;
-      p->bi_modtime          = di->di_modtime;
-      p->bi_size             = di->di_size;
-      p->bi_content_type_len = di->di_content_type_len;
-      p->bi_flags            = di->di_flags;
-      etaglen                = di->di_etaglen;
+      tmp.bs_key_hash         = di->di_key_hash;
+      tmp.bs_content_hash     = di->di_content_hash;
+      tmp.bs_expiry           = di->di_expiry;
+      tmp.bs_modtime          = di->di_modtime;
+      tmp.bs_size             = di->di_size;
+      tmp.bs_content_type_len = di->di_content_type_len;
+      tmp.bs_flags            = di->di_flags;
+      etaglen                 = di->di_etaglen;
       in += sizeof(blobcache_diskitem_07_t);
     }
       break;
@@ -398,22 +825,61 @@ load_index(void)
       abort(); // Prevent compilers whining about etaglen not initialized
     }
 
-    if(etaglen) {
-      p->bi_etag = malloc(etaglen+1);
-      memcpy(p->bi_etag, in, etaglen);
-      p->bi_etag[etaglen] = 0;
-      in += etaglen;
-    } else {
-      p->bi_etag = NULL;
+    if(etaglen <= BLOBCACHE_ETAG_MAX) {
+      memcpy(tmp.bs_etag, in, etaglen);
+      tmp.bs_etaglen = etaglen;
+    }
+    in += etaglen;
+
+    blobcache_shard_t *sh = shard_for_key(tmp.bs_key_hash);
+    hts_mutex_lock(&sh->sh_mutex);
+    blobcache_slot_t *bs;
+    if(sh->sh_hdr != NULL && shard_find(sh, tmp.bs_key_hash) == NULL &&
+       (bs = shard_insert(sh, tmp.bs_key_hash)) != NULL) {
+      tmp.bs_state = BS_USED;
+      *bs = tmp;
+      slot_seal(sh, bs);
+      sh->sh_hdr->bsh_size += bs->bs_size;
     }
-    p->bi_link = hashvector[p->bi_key_hash & ITEM_HASH_MASK];
-    hashvector[p->bi_key_hash & ITEM_HASH_MASK] = p;
-    current_cache_size += p->bi_size;
+    hts_mutex_unlock(&sh->sh_mutex);
   }
   free(base);
+
+ done:
+  fa_unlink(filename, NULL, 0);
+}
+
+
+/**
+ *
+ */
+static void
+slot_set_etag(blobcache_slot_t *bs, const char *etag)
+{
+  const int len = etag ? strlen(etag) : 0;
+  if(len > BLOBCACHE_ETAG_MAX) {
+    bs->bs_etaglen = 0;
+    return;
+  }
+  memcpy(bs->bs_etag, etag, len);
+  bs->bs_etaglen = len;
 }
 
 
+/**
+ *
+ */
+static char *
+slot_get_etag(const blobcache_slot_t *bs)
+{
+  if(bs->bs_etaglen == 0)
+    return NULL;
+  char *r = malloc(bs->bs_etaglen + 1);
+  memcpy(r, bs->bs_etag, bs->bs_etaglen);
+  r[bs->bs_etaglen] = 0;
+  return r;
+}
+
 
 /**
  *
@@ -426,69 +892,67 @@ blobcache_put(const char *key, const char *stash, buf_t *b,
   uint64_t dk = digest_key(key, stash);
   uint64_t dc = digest_content(b->b_ptr, b->b_size);
   uint32_t now = time(NULL);
-  blobcache_item_t *p;
-
-  if(etag != NULL && strlen(etag) > 255)
-    etag = NULL;
+  blobcache_shard_t *sh = shard_for_key(dk);
+  blobcache_slot_t *bs;
 
   bcprintf("cache: Writing %s ... ", key);
 
-  hts_mutex_lock(&cache_lock);
-  if(bcstate != BLOBCACHE_RUN) {
+  hts_mutex_lock(&sh->sh_mutex);
+  if(bcstate != BLOBCACHE_RUN || sh->sh_hdr == NULL) {
     bcprintf("Cache not running\n");
-    hts_mutex_unlock(&cache_lock);
+    hts_mutex_unlock(&sh->sh_mutex);
     return 0;
   }
 
-  for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-    if(p->bi_key_hash == dk)
-      break;
+  bs = shard_find(sh, dk);
 
-  hts_cond_signal(&cache_cond);
-  index_dirty = 1;
-
-  if(p != NULL && p->bi_content_hash == dc && p->bi_size == b->b_size) {
-    p->bi_modtime = mtime;
-    p->bi_expiry = now + maxage;
-    p->bi_lastaccess = now;
-    p->bi_flags = flags;
-    mystrset(&p->bi_etag, etag);
-    hts_mutex_unlock(&cache_lock);
+  int64_t expiry = (int64_t)maxage + now;
+
+  if(bs != NULL && bs->bs_content_hash == dc && bs->bs_size == b->b_size) {
+    bs->bs_modtime = mtime;
+    bs->bs_expiry = MIN(INT32_MAX, expiry);
+    bs->bs_flags = flags;
+    slot_set_etag(bs, etag);
+    slot_seal(sh, bs);
+    slot_touch(sh, bs);
+    hts_mutex_unlock(&sh->sh_mutex);
     bcprintf("Already in\n");
     return 1;
   }
 
+  if(bs == NULL) {
+    bs = shard_insert(sh, dk);
+    if(bs == NULL) {
+      hts_mutex_unlock(&sh->sh_mutex);
+      return 0;
+    }
+  } else {
+    sh->sh_hdr->bsh_size -= MIN(sh->sh_hdr->bsh_size, bs->bs_size);
+  }
+
   bcprintf("Ok\n");
 
-  blobcache_flush_t *bf = pool_get(item_pool);
+  blobcache_flush_t *bf = pool_get(flush_pool);
   bf->bf_key_hash = dk;
   bf->bf_buf = buf_retain(b);
-  TAILQ_INSERT_TAIL(&flush_queue, bf, bf_link);
-  hts_cond_signal(&cache_cond);
-
-  if(p == NULL) {
-    p = pool_get(item_pool);
-    p->bi_key_hash = dk;
-    p->bi_size = 0;
-    p->bi_content_type_len = 0;
-    p->bi_link = hashvector[dk & ITEM_HASH_MASK];
-    p->bi_etag = NULL;
-    hashvector[dk & ITEM_HASH_MASK] = p;
-  }
-
-  int64_t expiry = (int64_t)maxage + now;
-
-  p->bi_modtime = mtime;
-  mystrset(&p->bi_etag, etag);
-  p->bi_expiry = MIN(INT32_MAX, expiry);
-  p->bi_lastaccess = now;
-  p->bi_content_hash = dc;
-  current_cache_size -= p->bi_size;
-  p->bi_size = b->b_size;
-  current_cache_size += p->bi_size;
-  p->bi_content_type_len = b->b_content_type ?
+  TAILQ_INSERT_TAIL(&sh->sh_flush_queue, bf, bf_link);
+
+  bs->bs_modtime = mtime;
+  slot_set_etag(bs, etag);
+  bs->bs_expiry = MIN(INT32_MAX, expiry);
+  bs->bs_content_hash = dc;
+  bs->bs_size = b->b_size;
+  bs->bs_content_type_len = b->b_content_type ?
     strlen(rstr_get(b->b_content_type)) : 0;
-  p->bi_flags = flags;
+  bs->bs_flags = flags;
+  slot_seal(sh, bs);
+  slot_touch(sh, bs);
+  sh->sh_hdr->bsh_size += bs->bs_size;
+  hts_mutex_unlock(&sh->sh_mutex);
+
+  hts_mutex_lock(&cache_lock);
+  flush_pending++;
+  hts_cond_signal(&cache_cond);
   hts_mutex_unlock(&cache_lock);
   return 0;
 }
@@ -502,33 +966,32 @@ blobcache_get(const char *key, const char *stash, int pad,
 	      int *ignore_expiry, char **etagp, time_t *mtimep)
 {
   uint64_t dk = digest_key(key, stash);
-  blobcache_item_t *p, **q;
+  blobcache_shard_t *sh = shard_for_key(dk);
+  blobcache_slot_t *bs;
   char filename[PATH_MAX];
   uint32_t now;
 
   bcprintf("cache: Reading %s ... ", key);
 
-  hts_mutex_lock(&cache_lock);
+  hts_mutex_lock(&sh->sh_mutex);
 
-  if(bcstate == BLOBCACHE_STOPPING) {
+  if(bcstate == BLOBCACHE_STOPPING || sh->sh_hdr == NULL) {
     bcprintf("Cache stopped ... ");
-    p = NULL;
+    bs = NULL;
   } else {
-    for(q = &hashvector[dk & ITEM_HASH_MASK]; (p = *q); q = &p->bi_link)
-      if(p->bi_key_hash == dk)
-	break;
+    bs = shard_find(sh, dk);
   }
 
-  if(p == NULL) {
+  if(bs == NULL) {
     bcprintf("Item not found\n");
-    hts_mutex_unlock(&cache_lock);
+    hts_mutex_unlock(&sh->sh_mutex);
     return NULL;
   }
 
   now = time(NULL);
 
   // If clock is not OK yet, always consider stuff as expired
-  int expired = bcstate == BLOBCACHE_RUN_BAD_CLOCK || now > p->bi_expiry;
+  int expired = bcstate == BLOBCACHE_RUN_BAD_CLOCK || now > bs->bs_expiry;
 
   bcprintf("Found (expired=%s%s)\n",
            expired ? "yes":"no",
@@ -540,8 +1003,9 @@ blobcache_get(const char *key, const char *stash, int pad,
   blobcache_flush_t *bf;
   buf_t *b = NULL;
   fa_handle_t *fh = NULL;
-  TAILQ_FOREACH_REVERSE(bf, &flush_queue, blobcache_flush_queue, bf_link) {
-    if(bf->bf_key_hash == p->bi_key_hash) {
+  TAILQ_FOREACH_REVERSE(bf, &sh->sh_flush_queue, blobcache_flush_queue,
+                        bf_link) {
+    if(bf->bf_key_hash == dk) {
       // Item is not yet written to disk
       b = buf_retain(bf->bf_buf);
       break;
@@ -549,65 +1013,64 @@ blobcache_get(const char *key, const char *stash, int pad,
   }
 
   if(b == NULL) {
-    make_filename(filename, sizeof(filename), p->bi_key_hash, 0);
+    make_filename(filename, sizeof(filename), dk, 0);
     fh = fa_open(filename, NULL, 0);
     if(fh == NULL) {
     bad:
-      *q = p->bi_link;
-      pool_put(item_pool, p);
-      hts_mutex_unlock(&cache_lock);
+      shard_delete(sh, bs);
+      hts_mutex_unlock(&sh->sh_mutex);
       return NULL;
     }
 
     int64_t size = fa_fsize(fh);
 
-    if(size != p->bi_size + p->bi_content_type_len) {
+    if(size != bs->bs_size + bs->bs_content_type_len) {
+      fa_close(fh);
       fa_unlink(filename, NULL, 0);
       goto bad;
     }
   }
 
   if(mtimep)
-    *mtimep = p->bi_modtime;
+    *mtimep = bs->bs_modtime;
 
   if(etagp != NULL)
-    *etagp = p->bi_etag ? strdup(p->bi_etag) : NULL;
-
-  // Only mark lastaccess if clock is good
-  if(bcstate == BLOBCACHE_RUN)
-    p->bi_lastaccess = now;
+    *etagp = slot_get_etag(bs);
 
-  index_dirty = 1; // We don't deem it important enough to wakeup on get
+  slot_touch(sh, bs);
 
   if(ignore_expiry != NULL)
     *ignore_expiry = expired;
 
-  hts_mutex_unlock(&cache_lock);
+  const uint32_t datasize = bs->bs_size;
+  const int content_type_len = bs->bs_content_type_len;
+
+  hts_mutex_unlock(&sh->sh_mutex);
 
   if(b == NULL) {
 
-    b = buf_create(p->bi_size + pad);
+    b = buf_create(datasize + pad);
     if(b == NULL) {
       fa_close(fh);
       return NULL;
     }
 
-    if(p->bi_content_type_len) {
-      b->b_content_type = rstr_allocl(NULL, p->bi_content_type_len);
-      if(fa_read(fh, rstr_data(b->b_content_type), p->bi_content_type_len) !=
-	 p->bi_content_type_len) {
+    if(content_type_len) {
+      b->b_content_type = rstr_allocl(NULL, content_type_len);
+      if(fa_read(fh, rstr_data(b->b_content_type), content_type_len) !=
+	 content_type_len) {
 	buf_release(b);
 	fa_close(fh);
 	return NULL;
       }
     }
 
-    if(fa_read(fh, b->b_ptr, p->bi_size) != p->bi_size) {
+    if(fa_read(fh, b->b_ptr, datasize) != datasize) {
       buf_release(b);
       fa_close(fh);
       return NULL;
     }
-    memset(b->b_ptr + p->bi_size, 0, pad);
+    memset(b->b_ptr + datasize, 0, pad);
     fa_close(fh);
   }
   return b;
@@ -625,47 +1088,46 @@ blobcache_get_meta(const char *key, const char *stash,
 		   char **etagp, time_t *mtimep)
 {
   uint64_t dk = digest_key(key, stash);
-  blobcache_item_t *p;
+  blobcache_shard_t *sh = shard_for_key(dk);
+  blobcache_slot_t *bs;
   int r;
-  hts_mutex_lock(&cache_lock);
+  hts_mutex_lock(&sh->sh_mutex);
 
-  if(bcstate == BLOBCACHE_STOPPING) {
-    p = NULL;
+  if(bcstate == BLOBCACHE_STOPPING || sh->sh_hdr == NULL) {
+    bs = NULL;
   } else {
-    for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-      if(p->bi_key_hash == dk)
-	break;
+    bs = shard_find(sh, dk);
   }
 
-  if(p != NULL) {
+  if(bs != NULL) {
     r = 0;
 
     if(mtimep != NULL)
-      *mtimep = p->bi_modtime;
+      *mtimep = bs->bs_modtime;
 
     if(etagp != NULL)
-      *etagp = p->bi_etag ? strdup(p->bi_etag) : NULL;
+      *etagp = slot_get_etag(bs);
 
   } else {
     r = -1;
   }
 
-  hts_mutex_unlock(&cache_lock);
+  hts_mutex_unlock(&sh->sh_mutex);
   return r;
 }
 
 
 /**
- * Assume we're locked
+ *
  */
-static blobcache_item_t *
-lookup_item(uint64_t dk)
+static int
+item_exists(uint64_t dk)
 {
-  blobcache_item_t *p;
-  for(p = hashvector[dk & ITEM_HASH_MASK]; p != NULL; p = p->bi_link)
-    if(p->bi_key_hash == dk)
-      return p;
-  return NULL;
+  blobcache_shard_t *sh = shard_for_key(dk);
+  hts_mutex_lock(&sh->sh_mutex);
+  int r = sh->sh_hdr == NULL || shard_find(sh, dk) != NULL;
+  hts_mutex_unlock(&sh->sh_mutex);
+  return r;
 }
 
 /**
@@ -688,7 +1150,7 @@ prune_stale(void)
 
   RB_FOREACH(de1, &d1->fd_entries, fde_link) {
     const char *n1 = rstr_get(de1->fde_filename);
-    if(n1[0] != '.') {
+    if(n1[0] != '.' && de1->fde_type == CONTENT_DIR) {
       snprintf(path2, sizeof(path2), "%s/bc2/%s",
 	       gconf.cache_path, n1);
 
@@ -701,8 +1163,7 @@ prune_stale(void)
 	    snprintf(path3, sizeof(path3), "%s/bc2/%s/%s",
 		     gconf.cache_path, n1, n2);
 
-	    if(sscanf(n2, "%016"PRIx64, &k) != 1 ||
-	       lookup_item(k) == NULL) {
+	    if(sscanf(n2, "%016"PRIx64, &k) != 1 || !item_exists(k)) {
 	      TRACE(TRACE_DEBUG, "Blobcache", "Removed stale file %s", path3);
 	      fa_unlink(path3, NULL, 0);
 	    }
@@ -717,36 +1178,60 @@ prune_stale(void)
 }
 
 
-
 /**
- *
+ * Advance the CLOCK hand until one item is evicted
+ * Returns number of bytes freed
  */
-static void
-prune_item(blobcache_item_t *p)
+static uint64_t
+shard_evict_one(blobcache_shard_t *sh)
 {
   char filename[PATH_MAX];
-  make_filename(filename, sizeof(filename), p->bi_key_hash, 0);
-  fa_unlink(filename, NULL, 0);
-  pool_put(item_pool, p);
+  blobcache_shard_header_t *hdr = sh->sh_hdr;
+
+  if(hdr == NULL || hdr->bsh_used == 0)
+    return 0;
+
+  const uint32_t mask = hdr->bsh_capacity - 1;
+
+  // Three rounds is enough for all referenced items to reach zero
+  for(uint32_t n = 0; n < hdr->bsh_capacity * 3; n++) {
+    blobcache_slot_t *bs = &sh->sh_slots[hdr->bsh_hand & mask];
+    hdr->bsh_hand = (hdr->bsh_hand + 1) & mask;
+
+    if(bs->bs_state != BS_USED)
+      continue;
+
+    if(bs->bs_clock) {
+      bs->bs_clock--;
+      continue;
+    }
+
+    const uint64_t size = bs->bs_size;
+    make_filename(filename, sizeof(filename), bs->bs_key_hash, 0);
+    fa_unlink(filename, NULL, 0);
+    shard_delete(sh, bs);
+    return MAX(size, 1);
+  }
+  return 0;
 }
 
 
 /**
  *
  */
-static int
-accesstimecmp(const void *A, const void *B)
+static uint64_t
+cache_size(void)
 {
-  const blobcache_item_t *a = *(const blobcache_item_t **)A;
-  const blobcache_item_t *b = *(const blobcache_item_t **)B;
-
-  const int a_imp = !!(a->bi_flags & BLOBCACHE_IMPORTANT_ITEM);
-  const int b_imp = !!(b->bi_flags & BLOBCACHE_IMPORTANT_ITEM);
-
-  if(a_imp != b_imp)
-    return a_imp - b_imp;
-
-  return a->bi_lastaccess - b->bi_lastaccess;
+  uint64_t size = 0;
+  for(int i = 0; i < BLOBCACHE_SHARDS; i++) {
+    blobcache_shard_t *sh = &shards[i];
+    hts_mutex_lock(&sh->sh_mutex);
+    if(sh->sh_hdr != NULL)
+      size += sh->sh_hdr->bsh_size;
+    hts_mutex_unlock(&sh->sh_mutex);
+  }
+  current_cache_size = size;
+  return size;
 }
 
 
@@ -756,47 +1241,43 @@ accesstimecmp(const void *A, const void *B)
 static void
 prune_to_size(uint64_t maxsize)
 {
-  int i, tot = 0, j = 0;
-  blobcache_item_t *p, **sv;
-
-  for(i = 0; i < ITEM_HASH_SIZE; i++)
-    for(p = hashvector[i]; p != NULL; p = p->bi_link)
-      tot++;
-
-  sv = malloc(sizeof(blobcache_item_t *) * tot);
-  current_cache_size = 0;
-  for(i = 0; i < ITEM_HASH_SIZE; i++) {
-    for(p = hashvector[i]; p != NULL; p = p->bi_link) {
-      sv[j++] = p;
-      current_cache_size += p->bi_size;
+  static int rr;
+  uint64_t size = cache_size();
+  int idle = 0;
+
+  while(size > maxsize && idle < BLOBCACHE_SHARDS) {
+    blobcache_shard_t *sh = &shards[rr++ & (BLOBCACHE_SHARDS - 1)];
+    hts_mutex_lock(&sh->sh_mutex);
+    uint64_t freed = shard_evict_one(sh);
+    hts_mutex_unlock(&sh->sh_mutex);
+
+    if(freed) {
+      size -= MIN(size, freed);
+      idle = 0;
+    } else {
+      idle++;
     }
-    hashvector[i] = NULL;
   }
+  current_cache_size = size;
+}
 
-  assert(j == tot);
-
-  qsort(sv, j, sizeof(blobcache_item_t *), accesstimecmp);
-  for(i = 0; i < j; i++) {
-    p = sv[i];
-    if(current_cache_size < maxsize)
-      break;
-    current_cache_size -= p->bi_size;
-    prune_item(p);
-    index_dirty = 1;
-  }
 
-  for(; i < j; i++) {
-    p = sv[i];
-    p->bi_link = hashvector[p->bi_key_hash & ITEM_HASH_MASK];
-    hashvector[p->bi_key_hash & ITEM_HASH_MASK] = p;
+/**
+ *
+ */
+static void
+sync_shards(void)
+{
+  for(int i = 0; i < BLOBCACHE_SHARDS; i++) {
+    blobcache_shard_t *sh = &shards[i];
+    hts_mutex_lock(&sh->sh_mutex);
+    if(sh->sh_hdr != NULL)
+      shard_sync(sh, 0);
+    hts_mutex_unlock(&sh->sh_mutex);
   }
-
-  free(sv);
-  save_index();
 }
 
 
-
 /**
  *
  */
@@ -823,26 +1304,85 @@ blobcache_prune_old(void)
 static void
 cache_clear(void *opaque, prop_event_t event, ...)
 {
-  int i;
-  blobcache_item_t *p, *n;
-
-  hts_mutex_lock(&cache_lock);
+  char filename[PATH_MAX];
 
-  for(i = 0; i < ITEM_HASH_SIZE; i++) {
-    for(p = hashvector[i]; p != NULL; p = n) {
-      n = p->bi_link;
-      prune_item(p);
-      index_dirty = 1;
+  for(int i = 0; i < BLOBCACHE_SHARDS; i++) {
+    blobcache_shard_t *sh = &shards[i];
+    hts_mutex_lock(&sh->sh_mutex);
+    blobcache_shard_header_t *hdr = sh->sh_hdr;
+    if(hdr != NULL) {
+      for(uint32_t j = 0; j < hdr->bsh_capacity; j++) {
+        blobcache_slot_t *bs = &sh->sh_slots[j];
+        if(bs->bs_state == BS_USED) {
+          make_filename(filename, sizeof(filename), bs->bs_key_hash, 0);
+          fa_unlink(filename, NULL, 0);
+        }
+      }
+      memset(sh->sh_slots, 0, hdr->bsh_capacity * sizeof(blobcache_slot_t));
+      hdr->bsh_used = 0;
+      hdr->bsh_deleted = 0;
+      hdr->bsh_size = 0;
+      hdr->bsh_hand = 0;
+      sh->sh_dirty = 1;
+      shard_sync(sh, 0);
     }
-    hashvector[i] = NULL;
+    hts_mutex_unlock(&sh->sh_mutex);
   }
   current_cache_size = 0;
-  save_index();
-  hts_mutex_unlock(&cache_lock);
   notify_add(NULL, NOTIFY_INFO, NULL, 3, _("Cache cleared"));
 }
 
 
+/**
+ * Write out everything queued for a shard
+ */
+static int
+flush_shard(blobcache_shard_t *sh)
+{
+  blobcache_flush_t *bf;
+  int cnt = 0;
+
+  hts_mutex_lock(&sh->sh_mutex);
+
+  while((bf = TAILQ_FIRST(&sh->sh_flush_queue)) != NULL) {
+    hts_mutex_unlock(&sh->sh_mutex);
+
+    char filename[PATH_MAX];
+    make_filename(filename, sizeof(filename), bf->bf_key_hash, 1);
+    buf_t *b = bf->bf_buf;
+
+    fa_handle_t *fh = fa_open_ex(filename, NULL, 0, FA_WRITE, NULL);
+    if(fh != NULL) {
+
+      if(b->b_content_type != NULL) {
+	const char *str = rstr_get(b->b_content_type);
+	size_t len = strlen(str);
+	if(fa_write(fh, str, len) != len)
+	  fa_unlink(filename, NULL, 0);
+      }
+
+      if(fa_write(fh, b->b_ptr, b->b_size) != b->b_size)
+        fa_unlink(filename, NULL, 0);
+
+      fa_close(fh);
+    }
+    hts_mutex_lock(&sh->sh_mutex);
+
+    // Item may have been evicted while we were writing it
+    if(sh->sh_hdr == NULL || shard_find(sh, bf->bf_key_hash) == NULL)
+      fa_unlink(filename, NULL, 0);
+
+    // Only we remove entries from the flush queue
+    assert(TAILQ_FIRST(&sh->sh_flush_queue) == bf);
+    TAILQ_REMOVE(&sh->sh_flush_queue, bf, bf_link);
+    buf_release(bf->bf_buf);
+    pool_put(flush_pool, bf);
+    cnt++;
+  }
+  hts_mutex_unlock(&sh->sh_mutex);
+  return cnt;
+}
+
 
 /**
  *
@@ -850,7 +1390,10 @@ cache_clear(void *opaque, prop_event_t event, ...)
 static void *
 flushthread(void *aux)
 {
-  blobcache_flush_t *bf;
+  // These scale with cache size so don't do them during startup
+
+  prune_stale();
+  prune_to_size(blobcache_compute_maxsize());
 
   hts_mutex_lock(&cache_lock);
 
@@ -870,56 +1413,33 @@ flushthread(void *aux)
 
   while(bcstate != BLOBCACHE_STOPPING) {
 
-    if((bf = TAILQ_FIRST(&flush_queue)) == NULL) {
-
-      if(index_dirty) {
-        if(hts_cond_wait_timeout(&cache_cond, &cache_lock, 5000))
-          save_index();
-      } else {
-        hts_cond_wait(&cache_cond, &cache_lock);
+    if(flush_pending == 0) {
+      if(hts_cond_wait_timeout(&cache_cond, &cache_lock, 5000)) {
+        hts_mutex_unlock(&cache_lock);
+        sync_shards();
+        hts_mutex_lock(&cache_lock);
       }
       continue;
     }
 
     hts_mutex_unlock(&cache_lock);
-    char filename[PATH_MAX];
-    make_filename(filename, sizeof(filename), bf->bf_key_hash, 1);
-    buf_t *b = bf->bf_buf;
 
-    fa_handle_t *fh = fa_open_ex(filename, NULL, 0, FA_WRITE, NULL);
-    if(fh != NULL) {
-
-      if(b->b_content_type != NULL) {
-	const char *str = rstr_get(b->b_content_type);
-	size_t len = strlen(str);
-	if(fa_write(fh, str, len) != len)
-	  fa_unlink(filename, NULL, 0);
-      }
-
-      if(fa_write(fh, b->b_ptr, b->b_size) != b->b_size)
-        fa_unlink(filename, NULL, 0);
-
-      fa_close(fh);
-    }
-    hts_mutex_lock(&cache_lock);
-
-    assert(TAILQ_FIRST(&flush_queue) == bf);
-    TAILQ_REMOVE(&flush_queue, bf, bf_link);
-    buf_release(bf->bf_buf);
-    pool_put(item_pool, bf);
+    int flushed = 0;
+    for(int i = 0; i < BLOBCACHE_SHARDS; i++)
+      flushed += flush_shard(&shards[i]);
 
     uint64_t maxsize = blobcache_compute_maxsize();
 
-    if(maxsize < current_cache_size)
+    if(maxsize < cache_size())
       prune_to_size(maxsize);
+
+    hts_mutex_lock(&cache_lock);
+    flush_pending -= flushed;
   }
-  save_index();
   hts_mutex_unlock(&cache_lock);
   return NULL;
 }
 
-static_assert(sizeof(blobcache_flush_t) <= sizeof(blobcache_item_t),
-              "blobcache_flush too big");
 
 /**
  *
@@ -930,8 +1450,6 @@ blobcache_init(void)
   char buf[256];
   char errbuf[512];
 
-  TAILQ_INIT(&flush_queue);
-
   blobcache_prune_old();
   snprintf(buf, sizeof(buf), "%s/bc2", gconf.cache_path);
 
@@ -941,19 +1459,32 @@ blobcache_init(void)
 
   hts_mutex_init(&cache_lock);
   hts_cond_init(&cache_cond, &cache_lock);
-  item_pool = pool_create("blobcacheitems", sizeof(blobcache_item_t), 0);
+  bcstate = BLOBCACHE_RUN_BAD_CLOCK;
+  flush_pending = 0;
+  flush_pool = pool_create("blobcacheflush", sizeof(blobcache_flush_t),
+                           POOL_LOCKED);
 
+  int items = 0;
+  for(int i = 0; i < BLOBCACHE_SHARDS; i++) {
+    blobcache_shard_t *sh = &shards[i];
+    hts_mutex_init(&sh->sh_mutex);
+    TAILQ_INIT(&sh->sh_flush_queue);
+    sh->sh_index = i;
+    shard_open(sh);
+  }
 
-  load_index();
-  prune_stale();
+  import_legacy_index();
+
+  for(int i = 0; i < BLOBCACHE_SHARDS; i++)
+    if(shards[i].sh_hdr != NULL)
+      items += shards[i].sh_hdr->bsh_used;
 
   uint64_t maxsize = blobcache_compute_maxsize();
-  prune_to_size(maxsize);
 
   TRACE(TRACE_INFO, "blobcache",
 	"Initialized: %d items consuming %.2f MB "
         "(out of maximum %.2f MB) on disk in %s",
-	pool_num(item_pool), current_cache_size / 1000000.0,
+	items, cache_size() / 1000000.0,
         maxsize / 1000000.0, buf);
 
   settings_create_action(gconf.settings_general, _p("Clear cached files"),
@@ -972,4 +1503,11 @@ blobcache_fini(void)
   hts_cond_signal(&cache_cond);
   hts_mutex_unlock(&cache_lock);
   hts_thread_join(&bcthread);
+
+  for(int i = 0; i < BLOBCACHE_SHARDS; i++) {
+    blobcache_shard_t *sh = &shards[i];
+    hts_mutex_lock(&sh->sh_mutex);
+    shard_close(sh);
+    hts_mutex_unlock(&sh->sh_mutex);
+  }
 }
@@ -25,6 +25,35 @@
 #include "htsmsg/htsmsg.h"
 #include "ecmascript.h"
 #include "misc/minmax.h"
+#include "misc/sha.h"
+#include "misc/str.h"
+#include "misc/callout.h"
+#include "blobcache.h"
+#include "task.h"
+
+/**
+ * Compiled scripts are kept in the blobcache, keyed on path.
+ * The etag is a hash of the source and the app version so
+ * any change to either will cause a recompile. The bytecode is
+ * prefixed with its own SHA-1 so a damaged entry is detected
+ */
+#define ES_BYTECODE_STASH  "esbytecode"
+#define ES_BYTECODE_MAXAGE (86400 * 90)
+#define ES_BYTECODE_DIGEST_SIZE 20
+
+/**
+ * Duktape frees most garbage by refcounting so a full mark-and-sweep
+ * is only needed to get rid of cycles. Collect right away if the heap
+ * has grown by ES_GC_MIN_GROWTH or half its size since the last
+ * collection, otherwise wait until the context has been idle for
+ * ES_GC_IDLE_TIME seconds
+ */
+#define ES_GC_MIN_GROWTH (512 * 1024)
+#define ES_GC_IDLE_TIME  5
+
+static callout_t es_gc_timer;
+
+static void es_gc_schedule(void);
 
 static int es_num_contexts;
 static struct es_context_list es_contexts;
@@ -246,12 +275,143 @@ es_resource_destroy_duk(duk_context *ctx)
 }
 
 
+/**
+ *
+ */
+static int
+es_load_function(duk_context *ctx)
+{
+  duk_load_function(ctx);
+  return 1;
+}
+
+
+/**
+ *
+ */
+static int
+es_dump_function(duk_context *ctx)
+{
+  duk_dump_function(ctx);
+  return 1;
+}
+
+
+/**
+ * Duktape does not validate bytecode it loads, so a damaged cache entry
+ * must never reach duk_load_function()
+ */
+static void
+es_bytecode_digest(const void *data, size_t len, uint8_t *digest)
+{
+  sha1_decl(shactx);
+  sha1_init(shactx);
+  sha1_update(shactx, data, len);
+  sha1_final(shactx, digest);
+}
+
+
+/**
+ *
+ */
+static int
+es_bytecode_valid(const buf_t *bc)
+{
+  uint8_t digest[ES_BYTECODE_DIGEST_SIZE];
+
+  if(buf_len(bc) <= sizeof(digest))
+    return 0;
+
+  es_bytecode_digest(buf_c8(bc) + sizeof(digest),
+                     buf_len(bc) - sizeof(digest), digest);
+  return !memcmp(digest, buf_c8(bc), sizeof(digest));
+}
+
+
+/**
+ * Compile source in 'buf'. On success the function is left on the
+ * stack and 0 is returned, otherwise the error is left on the stack
+ */
+static int
+es_compile_cached(es_context_t *ec, const char *path, buf_t *buf)
+{
+  duk_context *ctx = ec->ec_duk;
+  uint8_t digest[20];
+  char etag[41];
+  char *cached_etag = NULL;
+  int expired;
+  int64_t ts = arch_get_ts();
+
+  sha1_decl(shactx);
+  sha1_init(shactx);
+  sha1_update(shactx, (const void *)htsversion_full, strlen(htsversion_full));
+  sha1_update(shactx, buf_data(buf), buf_len(buf));
+  sha1_final(shactx, digest);
+  bin2hex(etag, sizeof(etag), digest, sizeof(digest));
+
+  // Expiry does not matter, the etag tells if the code is still valid
+
+  buf_t *bc = blobcache_get(path, ES_BYTECODE_STASH, 0, &expired,
+                            &cached_etag, NULL);
+  if(bc != NULL) {
+    if(cached_etag == NULL || strcmp(cached_etag, etag)) {
+      // Source or showtime version changed, just recompile
+    } else if(!es_bytecode_valid(bc)) {
+      TRACE(TRACE_ERROR, rstr_get(ec->ec_id),
+            "Cached bytecode for %s is corrupt", path);
+    } else {
+      const size_t len = buf_len(bc) - ES_BYTECODE_DIGEST_SIZE;
+      void *p = duk_push_fixed_buffer(ctx, len);
+      memcpy(p, buf_c8(bc) + ES_BYTECODE_DIGEST_SIZE, len);
+
+      if(!duk_safe_call(ctx, es_load_function, 1, 1)) {
+        es_debug(ec, "Loaded %s from bytecode cache in %dus", path,
+                 (int)(arch_get_ts() - ts));
+        buf_release(bc);
+        free(cached_etag);
+        return 0;
+      }
+      TRACE(TRACE_ERROR, rstr_get(ec->ec_id),
+            "Unable to load cached bytecode for %s -- %s",
+            path, duk_safe_to_string(ctx, -1));
+      duk_pop(ctx);
+    }
+    buf_release(bc);
+  }
+  free(cached_etag);
+
+  duk_push_lstring(ctx, buf_cstr(buf), buf_len(buf));
+  duk_push_string(ctx, path);
+
+  if(duk_pcompile(ctx, 0))
+    return -1;
+
+  es_debug(ec, "Compiled %s in %dus", path, (int)(arch_get_ts() - ts));
+
+  duk_dup(ctx, -1);
+  if(!duk_safe_call(ctx, es_dump_function, 1, 1)) {
+    duk_size_t size;
+    const void *data = duk_get_buffer(ctx, -1, &size);
+    bc = buf_create(size + ES_BYTECODE_DIGEST_SIZE);
+    uint8_t *p = bc->b_ptr;
+    es_bytecode_digest(data, size, p);
+    memcpy(p + ES_BYTECODE_DIGEST_SIZE, data, size);
+    blobcache_put(path, ES_BYTECODE_STASH, bc, ES_BYTECODE_MAXAGE, etag, 0,
+                  BLOBCACHE_IMPORTANT_ITEM);
+    buf_release(bc);
+  }
+  duk_pop(ctx);
+  return 0;
+}
+
+
 /**
  *
  */
 static int
 es_compile(duk_context *ctx)
 {
+  es_context_t *ec = es_get(ctx);
   const char *path = duk_require_string(ctx, 0);
   char errbuf[256];
   buf_t *buf = fa_load(path,
@@ -261,12 +421,10 @@ es_compile(duk_context *ctx)
   if(buf == NULL)
     duk_error(ctx, DUK_ERR_ERROR, "Unable to load %s -- %s", path, errbuf);
 
-  duk_push_lstring(ctx, buf_cstr(buf), buf_len(buf));
+  int r = es_compile_cached(ec, path, buf);
   buf_release(buf);
-
-  duk_push_string(ctx, path);
-
-  duk_compile(ctx, 0);
+  if(r)
+    duk_throw(ctx);
   return 1;
 }
 
@@ -426,59 +584,6 @@ es_create_env(es_context_t *ec, const char *loaddir, const char *storage)
 }
 
 
-/**
- *
- */
-static void *
-es_mem_alloc(void *udata, duk_size_t size)
-{
-  es_context_t *ec = udata;
-  void *p = malloc(size);
-
-  if(p != NULL) {
-    ec->ec_mem_active += arch_malloc_size(p);
-    ec->ec_mem_peak = MAX(ec->ec_mem_peak, ec->ec_mem_active);
-  }
-  return p;
-}
-
-
-/**
- *
- */
-static void *
-es_mem_realloc(void *udata, void *ptr, duk_size_t size)
-{
-  es_context_t *ec = udata;
-  size_t prev = 0;
-
-  if(udata != NULL)
-    prev = arch_malloc_size(ptr);
-
-  ptr = realloc(ptr, size);
-  if(ptr != NULL) {
-    ec->ec_mem_active -= prev;
-    ec->ec_mem_active += arch_malloc_size(ptr);
-    ec->ec_mem_peak = MAX(ec->ec_mem_peak, ec->ec_mem_active);
-  }
-  return ptr;
-}
-
-
-/**
- *
- */
-static void
-es_mem_free(void *udata, void *ptr)
-{
-  es_context_t *ec = udata;
-  if(ptr == NULL)
-    return;
-  ec->ec_mem_active -= arch_malloc_size(ptr);
-  free(ptr);
-}
-
-
 /**
  *
  */
@@ -521,6 +626,7 @@ es_context_create(const char *id, int flags, const char *url,
 
   ec->ec_prop_unload_destroy = prop_vec_create(16);
 
+  ec->ec_mem = es_mem_create();
   ec->ec_duk = duk_create_heap(es_mem_alloc, es_mem_realloc, es_mem_free,
                                ec, NULL);
 
@@ -539,7 +645,7 @@ es_context_create(const char *id, int flags, const char *url,
 
 
 /**
- * Be careful here as it will sometimes will be called with prop_mutex
+ * Be careful here as it will sometimes will be called with prop locks
  * held (see es_prop_lockmgr() in es_prop.c). Thus any call that might
  * access the prop system might deadlock. You have been warned.
  */
@@ -576,14 +682,107 @@ es_context_begin(es_context_t *ec)
   hts_mutex_lock(&ec->ec_mutex);
 }
 
+/**
+ *
+ */
+static void
+es_gc(es_context_t *ec)
+{
+  int64_t ts = arch_get_ts();
+  duk_gc(ec->ec_duk, 0);
+  ec->ec_gc_time += arch_get_ts() - ts;
+  ec->ec_gc_count++;
+  ec->ec_gc_pending = 0;
+  ec->ec_mem_after_gc = ec->ec_mem_active;
+}
+
+
+/**
+ *
+ */
+static void
+es_gc_idle_task(void *aux)
+{
+  es_context_t **v = ecmascript_get_all_contexts();
+  const int64_t now = arch_get_ts();
+  int rearm = 0;
+
+  for(int i = 0; v[i] != NULL; i++) {
+    es_context_t *ec = v[i];
+
+    if(!ec->ec_gc_pending)
+      continue;
+
+    if(hts_mutex_trylock(&ec->ec_mutex)) {
+      rearm = 1; // Busy, try again later
+      continue;
+    }
+
+    if(ec->ec_duk == NULL || !ec->ec_gc_pending) {
+      hts_mutex_unlock(&ec->ec_mutex);
+      continue;
+    }
+
+    if(now - ec->ec_last_active < ES_GC_IDLE_TIME * 1000000LL) {
+      hts_mutex_unlock(&ec->ec_mutex);
+      rearm = 1;
+      continue;
+    }
+
+    es_gc(ec);
+
+    // es_context_end() will unlock and drop the reference
+
+    atomic_inc(&ec->ec_refcount);
+    es_context_end(ec, 0);
+  }
+
+  ecmascript_release_context_vector(v);
+
+  if(rearm)
+    es_gc_schedule();
+}
+
+
+/**
+ *
+ */
+static void
+es_gc_timer_cb(callout_t *c, void *aux)
+{
+  task_run(es_gc_idle_task, NULL);
+}
+
+
+/**
+ *
+ */
+static void
+es_gc_schedule(void)
+{
+  if(!callout_isarmed(&es_gc_timer))
+    callout_arm(&es_gc_timer, es_gc_timer_cb, NULL, ES_GC_IDLE_TIME);
+}
+
+
 /**
  *
  */
 void
 es_context_end(es_context_t *ec, int do_gc)
 {
-  if(do_gc)
-    duk_gc(ec->ec_duk, 0);
+  if(do_gc) {
+    const size_t slack = MAX(ES_GC_MIN_GROWTH, ec->ec_mem_after_gc / 2);
+
+    if(ec->ec_mem_active > ec->ec_mem_after_gc + slack) {
+      es_gc(ec);
+    } else {
+      ec->ec_gc_skipped++;
+      ec->ec_gc_pending = 1;
+      es_gc_schedule();
+    }
+  }
+  ec->ec_last_active = arch_get_ts();
 
   if(LIST_FIRST(&ec->ec_resources_permanent) == NULL) {
     // No more permanent resources, attached. Terminate context
@@ -597,6 +796,9 @@ es_context_end(es_context_t *ec, int do_gc)
     duk_destroy_heap(ec->ec_duk);
     ec->ec_duk = NULL;
 
+    es_mem_destroy(ec->ec_mem);
+    ec->ec_mem = NULL;
+
     prop_vec_destroy_entries(ec->ec_prop_unload_destroy);
     prop_vec_release(ec->ec_prop_unload_destroy);
 
@@ -677,12 +879,10 @@ es_load_and_compile(es_context_t *ec, const char *path)
 
   duk_context *ctx = ec->ec_duk;
 
-  duk_push_lstring(ctx, buf_cstr(buf), buf_len(buf));
+  int r = es_compile_cached(ec, path, buf);
   buf_release(buf);
-  duk_push_string(ctx, path);
-
-  if(duk_pcompile(ctx, 0)) {
 
+  if(r) {
     TRACE(TRACE_ERROR, rstr_get(ec->ec_id), "Unable to compile %s -- %s",
           path, duk_safe_to_string(ctx, -1));
     duk_pop(ctx);
@@ -89,9 +89,18 @@ typedef struct es_context {
   // This include stuff such as filedescriptors, database handles, etc
   struct es_resource_list ec_resources_volatile;
 
+  struct es_mem *ec_mem;      // Slab allocator, see es_mem.c
   size_t ec_mem_active;
   size_t ec_mem_peak;
 
+  // Garbage collection, see es_context_end()
+  size_t ec_mem_after_gc;    // ec_mem_active after last collection
+  int64_t ec_last_active;    // Last time es_context_end() was called
+  int64_t ec_gc_time;        // Total time spent collecting (µs)
+  int ec_gc_count;
+  int ec_gc_skipped;         // Collections deferred by scheduler
+  char ec_gc_pending;        // Wants a collection once idle
+
 
   struct htsmsg *ec_manifest; // plugin.json
 
@@ -136,6 +145,24 @@ void es_dump_err(duk_context *ctx);
 int es_get_err_code(duk_context *ctx);
 
 
+/**
+ * Duktape heap allocator
+ */
+typedef struct es_mem es_mem_t;
+
+es_mem_t *es_mem_create(void);
+
+void es_mem_destroy(es_mem_t *em);
+
+void es_mem_stats(const es_mem_t *em, size_t *slabs, size_t *large);
+
+void *es_mem_alloc(void *udata, duk_size_t size);
+
+void *es_mem_realloc(void *udata, void *ptr, duk_size_t size);
+
+void es_mem_free(void *udata, void *ptr);
+
+
 void es_stprop_push(duk_context *ctx, struct prop *p);
 
 /**
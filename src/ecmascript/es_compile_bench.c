@@ -0,0 +1,201 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+
+/**
+ * Standalone benchmark of script loading, cold vs. warm bytecode cache.
+ *
+ * Cold is what es_compile_cached() does on a cache miss: compile the
+ * source. Warm is what it does on a hit: verify the SHA-1 of the cached
+ * bytecode and load it. The blobcache lookup itself is not included.
+ *
+ * Usage: es-compile-bench [rounds] file.js ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "ext/duktape/duktape.h"
+#include "polarssl/sha1.h"
+
+#define DIGEST_SIZE 20
+
+
+static int64_t
+bench_ts(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+static char *
+bench_load(const char *path, size_t *lenp)
+{
+  FILE *fp = fopen(path, "rb");
+  if(fp == NULL)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  long len = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *buf = malloc(len + 1);
+  if(fread(buf, 1, len, fp) != len) {
+    free(buf);
+    fclose(fp);
+    return NULL;
+  }
+  buf[len] = 0;
+  fclose(fp);
+  *lenp = len;
+  return buf;
+}
+
+
+static int
+bench_compile(duk_context *ctx)
+{
+  duk_compile(ctx, 0);
+  return 1;
+}
+
+
+static int
+bench_dump(duk_context *ctx)
+{
+  duk_dump_function(ctx);
+  return 1;
+}
+
+
+static int
+bench_loadfn(duk_context *ctx)
+{
+  duk_load_function(ctx);
+  return 1;
+}
+
+
+/**
+ * Returns 0 on success
+ */
+static int
+bench_file(duk_context *ctx, const char *path, int rounds)
+{
+  size_t srclen;
+  char *src = bench_load(path, &srclen);
+  uint8_t digest[DIGEST_SIZE];
+
+  if(src == NULL) {
+    fprintf(stderr, "Unable to load %s\n", path);
+    return 1;
+  }
+
+  // Cold
+
+  int64_t ts = bench_ts();
+  for(int i = 0; i < rounds; i++) {
+    duk_push_lstring(ctx, src, srclen);
+    duk_push_string(ctx, path);
+    if(duk_safe_call(ctx, bench_compile, 2, 1)) {
+      fprintf(stderr, "%s: %s\n", path, duk_safe_to_string(ctx, -1));
+      free(src);
+      return 1;
+    }
+    duk_pop(ctx);
+  }
+  const int64_t cold = bench_ts() - ts;
+
+  // Produce the blob the same way es_compile_cached() does
+
+  duk_push_lstring(ctx, src, srclen);
+  duk_push_string(ctx, path);
+  duk_safe_call(ctx, bench_compile, 2, 1);
+  duk_safe_call(ctx, bench_dump, 1, 1);
+  duk_size_t bclen;
+  const void *bc = duk_get_buffer(ctx, -1, &bclen);
+  uint8_t *blob = malloc(bclen + DIGEST_SIZE);
+  sha1(bc, bclen, blob);
+  memcpy(blob + DIGEST_SIZE, bc, bclen);
+  duk_pop(ctx);
+
+  // Warm
+
+  int rval = 0;
+  ts = bench_ts();
+  for(int i = 0; i < rounds && !rval; i++) {
+    sha1(blob + DIGEST_SIZE, bclen, digest);
+    if(memcmp(digest, blob, DIGEST_SIZE)) {
+      fprintf(stderr, "%s: digest mismatch\n", path);
+      rval = 1;
+      break;
+    }
+    void *p = duk_push_fixed_buffer(ctx, bclen);
+    memcpy(p, blob + DIGEST_SIZE, bclen);
+    if(duk_safe_call(ctx, bench_loadfn, 1, 1)) {
+      fprintf(stderr, "%s: %s\n", path, duk_safe_to_string(ctx, -1));
+      rval = 1;
+    }
+    duk_pop(ctx);
+  }
+  const int64_t warm = bench_ts() - ts;
+
+  if(!rval)
+    printf("%-50s %7zu bytes src %7zu bytes bc  "
+           "cold %6"PRId64" us  warm %6"PRId64" us  %5.1fx\n",
+           path, srclen, (size_t)bclen, cold / rounds, warm / rounds,
+           warm ? (double)cold / warm : 0);
+
+  free(blob);
+  free(src);
+  return rval;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  int rounds = 200;
+  int rval = 0;
+
+  argc--;
+  argv++;
+
+  if(argc > 0 && atoi(argv[0]) > 0) {
+    rounds = atoi(argv[0]);
+    argc--;
+    argv++;
+  }
+
+  if(argc == 0) {
+    fprintf(stderr, "Usage: es-compile-bench [rounds] file.js ...\n");
+    return 1;
+  }
+
+  duk_context *ctx = duk_create_heap_default();
+
+  for(int i = 0; i < argc; i++)
+    rval |= bench_file(ctx, argv[i], rounds);
+
+  duk_destroy_heap(ctx);
+  return rval;
+}
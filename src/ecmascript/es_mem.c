@@ -0,0 +1,342 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+#include <stdlib.h>
+
+#include "main.h"
+#include "ecmascript.h"
+#include "misc/minmax.h"
+
+/**
+ * Memory allocator for duktape heaps
+ *
+ * Duktape allocates lots of small objects (strings, objects, property
+ * tables) that are freed by refcounting shortly after. Small chunks are
+ * served from per-context slabs with one freelist per slab and size
+ * class. Larger allocations go to malloc.
+ *
+ * Each chunk is prefixed by a small header that holds the size class and
+ * the offset back to the start of its slab (or the size for large
+ * allocations). This way ec_mem_active can be maintained without asking
+ * libc about block sizes, and slabs can be plain malloc'ed blocks
+ * instead of aligned ones which glibc pads generously.
+ *
+ * All access happens with ec_mutex held (or from duk_create_heap()
+ * and duk_destroy_heap()) so there is no locking here.
+ */
+
+#define ES_MEM_SLAB_SIZE  (16 * 1024)
+#define ES_MEM_HDR_SIZE   8
+#define ES_MEM_LARGE      0xff
+#define ES_MEM_MAX_SMALL  512
+
+static const uint16_t es_mem_class_size[] = {
+  16, 24, 32, 40, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512
+};
+
+#define ES_MEM_CLASSES ARRAYSIZE(es_mem_class_size)
+
+/**
+ * Size class for a chunk size rounded up to 8 bytes, indexed by size / 8
+ */
+static const uint8_t es_mem_class_lut[ES_MEM_MAX_SMALL / 8 + 1] = {
+  [0  ...  2] = 0,   //  16
+  [3]         = 1,   //  24
+  [4]         = 2,   //  32
+  [5]         = 3,   //  40
+  [6]         = 4,   //  48
+  [7  ...  8] = 5,   //  64
+  [9  ... 10] = 6,   //  80
+  [11 ... 12] = 7,   //  96
+  [13 ... 16] = 8,   // 128
+  [17 ... 20] = 9,   // 160
+  [21 ... 24] = 10,  // 192
+  [25 ... 32] = 11,  // 256
+  [33 ... 40] = 12,  // 320
+  [41 ... 48] = 13,  // 384
+  [49 ... 64] = 14,  // 512
+};
+
+typedef struct es_mem_hdr {
+  uint32_t emh_size;   // Offset into slab for small, size for large
+  uint8_t emh_class;
+  uint8_t emh_pad[3];
+} es_mem_hdr_t;
+
+LIST_HEAD(es_mem_slab_list, es_mem_slab);
+
+typedef struct es_mem_slab {
+  LIST_ENTRY(es_mem_slab) ems_link;  // Linked in em_partial if not full
+  LIST_ENTRY(es_mem_slab) ems_all_link;
+  void *ems_free;                    // Freed chunks
+  uint32_t ems_bump;                 // Offset to never used space
+  uint16_t ems_inuse;
+  uint8_t ems_class;
+  uint8_t ems_on_list;
+} es_mem_slab_t;
+
+#define ES_MEM_SLAB_HDR ((sizeof(es_mem_slab_t) + 7) & ~7)
+
+struct es_mem {
+  struct es_mem_slab_list em_partial[ES_MEM_CLASSES];
+  struct es_mem_slab_list em_all;
+  int em_slabs;
+  size_t em_large;
+};
+
+
+/**
+ *
+ */
+es_mem_t *
+es_mem_create(void)
+{
+  return calloc(1, sizeof(es_mem_t));
+}
+
+
+/**
+ * Release all slabs in one go. Large allocations are owned by the
+ * duktape heap and have been freed by duk_destroy_heap() already
+ */
+void
+es_mem_destroy(es_mem_t *em)
+{
+  es_mem_slab_t *ems;
+  while((ems = LIST_FIRST(&em->em_all)) != NULL) {
+    LIST_REMOVE(ems, ems_all_link);
+    free(ems);
+  }
+  free(em);
+}
+
+
+/**
+ *
+ */
+void
+es_mem_stats(const es_mem_t *em, size_t *slabs, size_t *large)
+{
+  *slabs = (size_t)em->em_slabs * ES_MEM_SLAB_SIZE;
+  *large = em->em_large;
+}
+
+
+/**
+ *
+ */
+static es_mem_slab_t *
+es_mem_slab_create(es_mem_t *em, int c)
+{
+  es_mem_slab_t *ems = malloc(ES_MEM_SLAB_SIZE);
+  if(ems == NULL)
+    return NULL;
+  ems->ems_free = NULL;
+  ems->ems_bump = ES_MEM_SLAB_HDR;
+  ems->ems_inuse = 0;
+  ems->ems_class = c;
+  ems->ems_on_list = 1;
+  LIST_INSERT_HEAD(&em->em_partial[c], ems, ems_link);
+  LIST_INSERT_HEAD(&em->em_all, ems, ems_all_link);
+  em->em_slabs++;
+  return ems;
+}
+
+
+/**
+ *
+ */
+static void *
+es_mem_small_alloc(es_mem_t *em, int c)
+{
+  es_mem_slab_t *ems = LIST_FIRST(&em->em_partial[c]);
+  const int csize = es_mem_class_size[c];
+  es_mem_hdr_t *h;
+
+  if(ems == NULL && (ems = es_mem_slab_create(em, c)) == NULL)
+    return NULL;
+
+  if(ems->ems_free != NULL) {
+    h = ems->ems_free;
+    ems->ems_free = *(void **)h;
+  } else {
+    h = (void *)((uint8_t *)ems + ems->ems_bump);
+    ems->ems_bump += csize;
+  }
+
+  ems->ems_inuse++;
+
+  if(ems->ems_free == NULL && ems->ems_bump + csize > ES_MEM_SLAB_SIZE) {
+    // Slab is full
+    LIST_REMOVE(ems, ems_link);
+    ems->ems_on_list = 0;
+  }
+
+  h->emh_size = (uint8_t *)h - (uint8_t *)ems;
+  h->emh_class = c;
+  return h;
+}
+
+
+/**
+ *
+ */
+static void
+es_mem_small_free(es_mem_t *em, es_mem_hdr_t *h)
+{
+  es_mem_slab_t *ems = (es_mem_slab_t *)((uint8_t *)h - h->emh_size);
+  const int c = ems->ems_class;
+
+  *(void **)h = ems->ems_free;
+  ems->ems_free = h;
+  ems->ems_inuse--;
+
+  if(!ems->ems_on_list) {
+    LIST_INSERT_HEAD(&em->em_partial[c], ems, ems_link);
+    ems->ems_on_list = 1;
+  } else if(ems->ems_inuse == 0 &&
+            (LIST_NEXT(ems, ems_link) != NULL ||
+             LIST_FIRST(&em->em_partial[c]) != ems)) {
+    // Keep one empty slab per class around to avoid thrashing
+    LIST_REMOVE(ems, ems_link);
+    LIST_REMOVE(ems, ems_all_link);
+    free(ems);
+    em->em_slabs--;
+  }
+}
+
+
+/**
+ *
+ */
+static void *
+es_mem_get(es_context_t *ec, size_t size)
+{
+  es_mem_hdr_t *h;
+  const size_t chunk = size + ES_MEM_HDR_SIZE;
+
+  if(chunk <= ES_MEM_MAX_SMALL) {
+    h = es_mem_small_alloc(ec->ec_mem, es_mem_class_lut[(chunk + 7) / 8]);
+    if(h == NULL)
+      return NULL;
+    ec->ec_mem_active += es_mem_class_size[h->emh_class];
+  } else {
+    h = malloc(chunk);
+    if(h == NULL)
+      return NULL;
+    h->emh_size = size;
+    h->emh_class = ES_MEM_LARGE;
+    ec->ec_mem_active += chunk;
+    ec->ec_mem->em_large += chunk;
+  }
+
+  ec->ec_mem_peak = MAX(ec->ec_mem_peak, ec->ec_mem_active);
+  return (uint8_t *)h + ES_MEM_HDR_SIZE;
+}
+
+
+/**
+ *
+ */
+static void
+es_mem_put(es_context_t *ec, void *ptr)
+{
+  es_mem_hdr_t *h = (es_mem_hdr_t *)((uint8_t *)ptr - ES_MEM_HDR_SIZE);
+
+  if(h->emh_class == ES_MEM_LARGE) {
+    const size_t chunk = h->emh_size + ES_MEM_HDR_SIZE;
+    ec->ec_mem_active -= chunk;
+    ec->ec_mem->em_large -= chunk;
+    free(h);
+  } else {
+    ec->ec_mem_active -= es_mem_class_size[h->emh_class];
+    es_mem_small_free(ec->ec_mem, h);
+  }
+}
+
+
+/**
+ *
+ */
+void *
+es_mem_alloc(void *udata, duk_size_t size)
+{
+  return es_mem_get(udata, size);
+}
+
+
+/**
+ *
+ */
+void *
+es_mem_realloc(void *udata, void *ptr, duk_size_t size)
+{
+  es_context_t *ec = udata;
+
+  if(ptr == NULL)
+    return es_mem_get(ec, size);
+
+  if(size == 0) {
+    es_mem_put(ec, ptr);
+    return NULL;
+  }
+
+  es_mem_hdr_t *h = (es_mem_hdr_t *)((uint8_t *)ptr - ES_MEM_HDR_SIZE);
+  size_t avail;
+
+  if(h->emh_class == ES_MEM_LARGE) {
+    if(size + ES_MEM_HDR_SIZE > ES_MEM_MAX_SMALL) {
+      // Stay large, let libc resize in place if it can
+      const size_t prev = h->emh_size + ES_MEM_HDR_SIZE;
+      h = realloc(h, size + ES_MEM_HDR_SIZE);
+      if(h == NULL)
+        return NULL;
+      h->emh_size = size;
+      ec->ec_mem_active += size + ES_MEM_HDR_SIZE - prev;
+      ec->ec_mem->em_large += size + ES_MEM_HDR_SIZE - prev;
+      ec->ec_mem_peak = MAX(ec->ec_mem_peak, ec->ec_mem_active);
+      return (uint8_t *)h + ES_MEM_HDR_SIZE;
+    }
+    avail = h->emh_size;
+  } else {
+    avail = es_mem_class_size[h->emh_class] - ES_MEM_HDR_SIZE;
+    if(size <= avail &&
+       es_mem_class_lut[(size + ES_MEM_HDR_SIZE + 7) / 8] == h->emh_class)
+      return ptr; // Same size class
+  }
+
+  void *n = es_mem_get(ec, size);
+  if(n == NULL)
+    return NULL;
+  memcpy(n, ptr, MIN(avail, size));
+  es_mem_put(ec, ptr);
+  return n;
+}
+
+
+/**
+ *
+ */
+void
+es_mem_free(void *udata, void *ptr)
+{
+  if(ptr != NULL)
+    es_mem_put(udata, ptr);
+}
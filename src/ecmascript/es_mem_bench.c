@@ -0,0 +1,208 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+
+/**
+ * Standalone benchmark of the duktape heap allocator (es_mem.c) with a
+ * workload that looks like a scraping plugin: build a page, pick it
+ * apart with regexps and string ops, and pass results around as JSON.
+ *
+ * Usage: es-mem-bench [slab|malloc] [heaps] [rounds]
+ *
+ * 'malloc' is the old scheme, libc with malloc_usable_size() accounting.
+ * Peak RSS is per process, so run each allocator in its own process.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include "ecmascript.h"
+
+static const char bench_script[] =
+  "var items = [];\n"
+  "for(var p = 0; p < 20; p++) {\n"
+  "  var html = '<html><body><ul>';\n"
+  "  for(var i = 0; i < 200; i++)\n"
+  "    html += '<li class=\"item\"><a href=\"/video/' + p + '/' + i +\n"
+  "            '\">Title ' + i + ' &amp; more</a><span>' + (i * 37) +\n"
+  "            ' views</span></li>';\n"
+  "  html += '</ul></body></html>';\n"
+  "  var re = /<a href=\"([^\"]+)\">([^<]+)<\\/a><span>(\\d+)/g;\n"
+  "  var m;\n"
+  "  while((m = re.exec(html)) !== null) {\n"
+  "    items.push({url: m[1], title: m[2].replace('&amp;', '&').trim(),\n"
+  "                views: parseInt(m[3]), tags: m[2].split(' ')});\n"
+  "  }\n"
+  "  items = JSON.parse(JSON.stringify(items.slice(-500)));\n"
+  "}\n"
+  "items.length;\n";
+
+
+/**
+ * Old allocator, for comparison
+ */
+static void *
+malloc_alloc(void *udata, duk_size_t size)
+{
+  es_context_t *ec = udata;
+  void *p = malloc(size);
+  if(p != NULL) {
+    ec->ec_mem_active += malloc_usable_size(p);
+    if(ec->ec_mem_active > ec->ec_mem_peak)
+      ec->ec_mem_peak = ec->ec_mem_active;
+  }
+  return p;
+}
+
+static void *
+malloc_realloc(void *udata, void *ptr, duk_size_t size)
+{
+  es_context_t *ec = udata;
+  if(ptr != NULL)
+    ec->ec_mem_active -= malloc_usable_size(ptr);
+  void *p = realloc(ptr, size);
+  if(p != NULL) {
+    ec->ec_mem_active += malloc_usable_size(p);
+    if(ec->ec_mem_active > ec->ec_mem_peak)
+      ec->ec_mem_peak = ec->ec_mem_active;
+  }
+  return p;
+}
+
+static void
+malloc_free(void *udata, void *ptr)
+{
+  es_context_t *ec = udata;
+  if(ptr != NULL)
+    ec->ec_mem_active -= malloc_usable_size(ptr);
+  free(ptr);
+}
+
+
+/**
+ * Count allocator calls to get a throughput figure
+ */
+static duk_alloc_function bench_alloc_fn;
+static duk_realloc_function bench_realloc_fn;
+static duk_free_function bench_free_fn;
+static int64_t bench_ops;
+
+static void *
+bench_alloc(void *udata, duk_size_t size)
+{
+  bench_ops++;
+  return bench_alloc_fn(udata, size);
+}
+
+static void *
+bench_realloc(void *udata, void *ptr, duk_size_t size)
+{
+  bench_ops++;
+  return bench_realloc_fn(udata, ptr, size);
+}
+
+static void
+bench_free(void *udata, void *ptr)
+{
+  bench_ops++;
+  bench_free_fn(udata, ptr);
+}
+
+
+static int64_t
+bench_ts(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  const char *mode = argc > 1 ? argv[1] : "slab";
+  const int heaps  = argc > 2 ? atoi(argv[2]) : 4;
+  const int rounds = argc > 3 ? atoi(argv[3]) : 10;
+  const int slab = !strcmp(mode, "slab");
+  size_t peak = 0;
+  struct rusage ru;
+
+  if(slab) {
+    bench_alloc_fn   = es_mem_alloc;
+    bench_realloc_fn = es_mem_realloc;
+    bench_free_fn    = es_mem_free;
+  } else if(!strcmp(mode, "malloc")) {
+    bench_alloc_fn   = malloc_alloc;
+    bench_realloc_fn = malloc_realloc;
+    bench_free_fn    = malloc_free;
+  } else {
+    fprintf(stderr, "Usage: %s [slab|malloc] [heaps] [rounds]\n", argv[0]);
+    return 1;
+  }
+
+  if(heaps < 1 || rounds < 1)
+    return 1;
+
+  es_context_t *ecs = calloc(heaps, sizeof(es_context_t));
+  const int64_t ts = bench_ts();
+
+  for(int r = 0; r < rounds; r++) {
+    for(int i = 0; i < heaps; i++) {
+      es_context_t *ec = &ecs[i];
+      if(slab)
+        ec->ec_mem = es_mem_create();
+      ec->ec_duk = duk_create_heap(bench_alloc, bench_realloc, bench_free,
+                                   ec, NULL);
+    }
+
+    // Interleave the heaps like plugins do
+    for(int i = 0; i < heaps; i++) {
+      duk_context *ctx = ecs[i].ec_duk;
+      if(duk_peval_string(ctx, bench_script)) {
+        fprintf(stderr, "Script failed: %s\n", duk_safe_to_string(ctx, -1));
+        return 1;
+      }
+      duk_pop(ctx);
+    }
+
+    for(int i = 0; i < heaps; i++) {
+      es_context_t *ec = &ecs[i];
+      peak = ec->ec_mem_peak > peak ? ec->ec_mem_peak : peak;
+      duk_destroy_heap(ec->ec_duk);
+      if(slab)
+        es_mem_destroy(ec->ec_mem);
+      memset(ec, 0, sizeof(es_context_t));
+    }
+  }
+
+  const int64_t elapsed = bench_ts() - ts;
+  getrusage(RUSAGE_SELF, &ru);
+
+  printf("%-6s  %d heaps x %d rounds: %6"PRId64" ms  "
+         "%6.2f Mops/s  heap peak %5zu kB  max RSS %6ld kB\n",
+         mode, heaps, rounds, elapsed / 1000,
+         (double)bench_ops / elapsed, peak / 1024, ru.ru_maxrss);
+  free(ecs);
+  return 0;
+}
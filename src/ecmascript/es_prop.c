@@ -95,14 +95,14 @@ es_prop_release_duk(duk_context *ctx)
 {
   prop_t *p = duk_require_pointer(ctx, 0);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_parent == NULL)
     prop_destroy0(p);
 
   prop_ref_dec_locked(p);
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return 0;
 }
 
@@ -164,10 +164,10 @@ es_prop_get_value_duk(duk_context *ctx)
 {
   prop_t *p = es_stprop_get(ctx, 0);
   char tmp[64];
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
     duk_error(ctx, ST_ERROR_PROP_ZOMBIE, NULL);
   }
 
@@ -199,7 +199,7 @@ es_prop_get_value_duk(duk_context *ctx)
     duk_push_string(ctx, tmp);
     break;
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return 1;
 }
 
@@ -219,10 +219,10 @@ es_prop_get_child_duk(duk_context *ctx)
     str = duk_require_string(ctx, 1);
   }
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
     duk_error(ctx, ST_ERROR_PROP_ZOMBIE, NULL);
   }
 
@@ -241,10 +241,10 @@ es_prop_get_child_duk(duk_context *ctx)
 
   if(p != NULL) {
     es_push_native_obj(ctx, &es_native_prop, prop_ref_inc(p));
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
     return 1;
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return 0;
 }
 
@@ -259,7 +259,7 @@ es_prop_enum_duk(duk_context *ctx)
 
   duk_push_array(ctx);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
 
   if(p->hp_type == PROP_DIR) {
@@ -274,7 +274,7 @@ es_prop_enum_duk(duk_context *ctx)
       duk_put_prop_index(ctx, -2, idx++);
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return 1;
 }
 
@@ -289,7 +289,7 @@ es_prop_has_duk(duk_context *ctx)
   const char *name = duk_get_string(ctx, 1);
   int yes = 0;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_DIR) {
     prop_t *c;
@@ -300,7 +300,7 @@ es_prop_has_duk(duk_context *ctx)
       }
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   duk_push_boolean(ctx, yes);
   return 1;
 }
@@ -767,7 +767,7 @@ es_prop_is_value(duk_context *ctx)
   } else {
     int v;
 
-    hts_mutex_lock(&prop_mutex);
+    prop_lock_global();
 
     switch(p->hp_type) {
     case PROP_CSTRING:
@@ -782,7 +782,7 @@ es_prop_is_value(duk_context *ctx)
       v = 0;
       break;
     }
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
     duk_push_boolean(ctx, v);
   }
   return 1;
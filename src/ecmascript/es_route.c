@@ -28,19 +28,140 @@
 #include "usage.h"
 
 LIST_HEAD(es_route_list, es_route);
+LIST_HEAD(es_route_node_list, es_route_node);
 
 typedef struct es_route {
   es_resource_t super;
   LIST_ENTRY(es_route) er_link;
+  struct es_route_node *er_node;
   char *er_pattern;
   hts_regex_t er_regex;
+  hts_mutex_t er_mutex;  // The compiled regex keeps match state
   int er_prio;
+  int er_seq;
 } es_route_t;
 
 
-static struct es_route_list routes;
+/**
+ * Routes are indexed in a trie over the literal prefix of their
+ * pattern (the part before any regex operator). When opening an URL only
+ * routes whose prefix matches the URL are tried.
+ */
+typedef struct es_route_node {
+  LIST_ENTRY(es_route_node) ern_link;
+  struct es_route_node *ern_parent;
+  struct es_route_node_list ern_children;
+  struct es_route_list ern_routes;  // Sorted on er_cmp()
+  char ern_char;
+} es_route_node_t;
+
+
+static es_route_node_t route_root;
+
+static int route_seq;
+
+static HTS_RWLOCK_DECL(route_lock);
+
+
+/**
+ * Extract the literal prefix of a route pattern. Returns the length
+ */
+static int
+es_route_prefix(const char *re, char *buf, int bufsize)
+{
+  int depth = 0, klass = 0, len = 0;
+  const char *s;
+
+  // A top level alternation means there is no common prefix
+  for(s = re; *s; s++) {
+    if(*s == '\\' && s[1]) {
+      s++;
+    } else if(klass) {
+      klass = *s != ']';
+    } else if(*s == '[') {
+      klass = 1;
+    } else if(*s == '(') {
+      depth++;
+    } else if(*s == ')') {
+      depth--;
+    } else if(*s == '|' && depth == 0) {
+      return 0;
+    }
+  }
+
+  s = re;
+  if(*s == '^')
+    s++;
+
+  while(*s && len < bufsize) {
+    char c;
+    if(*s == '\\') {
+      c = s[1];
+      // \d, \w, etc are character classes
+      if(c == 0 || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9'))
+        break;
+      s += 2;
+    } else if(strchr("^$.[]|()*+?{}", *s)) {
+      break;
+    } else {
+      c = *s++;
+    }
+
+    if(*s == '*' || *s == '?' || *s == '{')
+      break; // Preceding char is optional
+
+    buf[len++] = c;
+
+    if(*s == '+')
+      break;
+  }
+  return len;
+}
+
+
+/**
+ *
+ */
+static es_route_node_t *
+es_route_node_find(const char *prefix, int len, int create)
+{
+  es_route_node_t *ern = &route_root, *c;
+
+  for(int i = 0; i < len; i++) {
+    LIST_FOREACH(c, &ern->ern_children, ern_link)
+      if(c->ern_char == prefix[i])
+        break;
+
+    if(c == NULL) {
+      if(!create)
+        return NULL;
+      c = calloc(1, sizeof(es_route_node_t));
+      c->ern_char = prefix[i];
+      c->ern_parent = ern;
+      LIST_INSERT_HEAD(&ern->ern_children, c, ern_link);
+    }
+    ern = c;
+  }
+  return ern;
+}
 
-static HTS_MUTEX_DECL(route_mutex);
+
+/**
+ * Free nodes that no longer lead to any route
+ */
+static void
+es_route_node_prune(es_route_node_t *ern)
+{
+  while(ern != &route_root &&
+        LIST_FIRST(&ern->ern_routes) == NULL &&
+        LIST_FIRST(&ern->ern_children) == NULL) {
+    es_route_node_t *parent = ern->ern_parent;
+    LIST_REMOVE(ern, ern_link);
+    free(ern);
+    ern = parent;
+  }
+}
 
 
 /**
@@ -55,12 +176,14 @@ es_route_destroy(es_resource_t *eres)
 
   es_root_unregister(eres->er_ctx->ec_duk, eres);
 
-  hts_mutex_lock(&route_mutex);
+  hts_rwlock_wrlock(&route_lock);
   LIST_REMOVE(er, er_link);
-  hts_mutex_unlock(&route_mutex);
+  es_route_node_prune(er->er_node);
+  hts_rwlock_unlock(&route_lock);
 
   free(er->er_pattern);
   hts_regfree(&er->er_regex);
+  hts_mutex_destroy(&er->er_mutex);
 
   es_resource_unlink(&er->super);
 }
@@ -94,7 +217,20 @@ static const es_resource_class_t es_resource_route = {
 static int
 er_cmp(const es_route_t *a, const es_route_t *b)
 {
-  return b->er_prio - a->er_prio;
+  if(a->er_prio != b->er_prio)
+    return a->er_prio < b->er_prio ? 1 : -1;
+  // Most recently created route first
+  return b->er_seq - a->er_seq;
+}
+
+
+/**
+ *
+ */
+static int
+er_cmp_ptr(const void *A, const void *B)
+{
+  return er_cmp(*(const es_route_t **)A, *(const es_route_t **)B);
 }
 
 
@@ -116,38 +252,47 @@ es_route_create(duk_context *ctx)
 
   es_context_t *ec = es_get(ctx);
 
-  hts_mutex_lock(&route_mutex);
+  char prefix[256];
+  const int prefixlen = es_route_prefix(str, prefix, sizeof(prefix));
+
+  hts_rwlock_wrlock(&route_lock);
 
+  es_route_node_t *ern = es_route_node_find(prefix, prefixlen, 1);
   es_route_t *er;
 
-  LIST_FOREACH(er, &routes, er_link)
+  LIST_FOREACH(er, &ern->ern_routes, er_link)
     if(!strcmp(er->er_pattern, str))
       break;
 
   if(er != NULL) {
-    hts_mutex_unlock(&route_mutex);
+    hts_rwlock_unlock(&route_lock);
     duk_error(ctx, DUK_ERR_ERROR, "Route %s already exist", str);
   }
 
   er = es_resource_alloc(&es_resource_route);
   if(hts_regcomp(&er->er_regex, str)) {
-    hts_mutex_unlock(&route_mutex);
+    es_route_node_prune(ern);
+    hts_rwlock_unlock(&route_lock);
     free(er);
     duk_error(ctx, DUK_ERR_ERROR, "Invalid regular expression for route %s",
               str);
   }
 
   er->er_pattern = strdup(str);
+  hts_mutex_init(&er->er_mutex);
 
-  es_debug(ec, "Route %s added", er->er_pattern);
+  es_debug(ec, "Route %s added (prefix: %.*s)", er->er_pattern,
+           prefixlen, prefix);
 
   er->er_prio = strcspn(str, "()[]*?+$") ?: INT32_MAX;
+  er->er_seq = ++route_seq;
+  er->er_node = ern;
 
-  LIST_INSERT_SORTED(&routes, er, er_link, er_cmp, es_route_t);
+  LIST_INSERT_SORTED(&ern->ern_routes, er, er_link, er_cmp, es_route_t);
 
   es_resource_link(&er->super, ec, 1);
 
-  hts_mutex_unlock(&route_mutex);
+  hts_rwlock_unlock(&route_lock);
 
   es_root_register(ctx, 1, er);
 
@@ -163,17 +308,51 @@ int
 ecmascript_openuri(prop_t *page, const char *url, int sync)
 {
   hts_regmatch_t matches[8];
+  es_route_node_t *ern, *c;
+  es_route_t *er;
+  int num_candidates = 0;
 
-  hts_mutex_lock(&route_mutex);
+  hts_rwlock_rdlock(&route_lock);
 
-  es_route_t *er;
+  // Count candidates along the path of the URL in the trie
 
-  LIST_FOREACH(er, &routes, er_link)
-    if(!hts_regexec(&er->er_regex, url, 8, matches, 0))
+  ern = &route_root;
+  for(const char *u = url; ; u++) {
+    LIST_FOREACH(er, &ern->ern_routes, er_link)
+      num_candidates++;
+    if(*u == 0)
       break;
+    LIST_FOREACH(c, &ern->ern_children, ern_link)
+      if(c->ern_char == *u)
+        break;
+    if(c == NULL)
+      break;
+    ern = c;
+  }
+
+  es_route_t **candidates = alloca(num_candidates * sizeof(es_route_t *));
+  int n = 0;
+
+  for(; ern != NULL; ern = ern->ern_parent)
+    LIST_FOREACH(er, &ern->ern_routes, er_link)
+      candidates[n++] = er;
+
+  qsort(candidates, n, sizeof(es_route_t *), er_cmp_ptr);
+
+  er = NULL;
+  for(int i = 0; i < n; i++) {
+    es_route_t *cand = candidates[i];
+    hts_mutex_lock(&cand->er_mutex);
+    int r = hts_regexec(&cand->er_regex, url, 8, matches, 0);
+    hts_mutex_unlock(&cand->er_mutex);
+    if(!r) {
+      er = cand;
+      break;
+    }
+  }
 
   if(er == NULL) {
-    hts_mutex_unlock(&route_mutex);
+    hts_rwlock_unlock(&route_lock);
     return 1;
   }
 
@@ -181,7 +360,7 @@ ecmascript_openuri(prop_t *page, const char *url, int sync)
 
   es_context_t *ec = er->super.er_ctx;
 
-  hts_mutex_unlock(&route_mutex);
+  hts_rwlock_unlock(&route_lock);
 
   es_context_begin(ec);
 
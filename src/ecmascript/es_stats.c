@@ -65,6 +65,18 @@ dump_context(htsbuf_queue_t *out, es_context_t *ec)
   htsbuf_qprintf(out, "  Memory usage, current: %zd bytes, max: %zd\n",
                  ec->ec_mem_active, ec->ec_mem_peak);
 
+  if(ec->ec_mem != NULL) {
+    size_t slabs, large;
+    es_mem_stats(ec->ec_mem, &slabs, &large);
+    htsbuf_qprintf(out, "  Allocator: %zd bytes in slabs, %zd bytes large\n",
+                   slabs, large);
+  }
+
+  htsbuf_qprintf(out, "  GC: %d collections, %d deferred, "
+                 "total time: %d ms, heap after last GC: %zd bytes\n",
+                 ec->ec_gc_count, ec->ec_gc_skipped,
+                 (int)(ec->ec_gc_time / 1000), ec->ec_mem_after_gc);
+
   htsbuf_qprintf(out, "  Attached permanent resources:\n");
   dump_resource_list(out, &ec->ec_resources_permanent);
 
@@ -23,16 +23,81 @@
 #include "fileaccess.h"
 #include "fa_proto.h"
 #include "misc/minmax.h"
+#include "misc/callout.h"
+#include "arch/arch.h"
+#include "task.h"
+#include "prop/prop.h"
 
 #define FILE_PARKING 1
 
+#define FAB_MAX_PARKED 4
+#define FAB_PARK_TIME  10
+
 #define BF_CHK 0
 
 #define BF_ZONES 8
 #define BF_MASK (BF_ZONES - 1)
 
+/**
+ * Readahead is used for FA_BUFFERED_BIG handles once the source has
+ * been read sequentially FAB_RA_TRIGGER times in a row. A window of
+ * chunks ahead of the read position is fetched by FAB_RA_CONNS
+ * workers, each with its own connection to the source, so chunks are
+ * requested in parallel (as range requests for HTTP)
+ */
+#define FAB_RA_CHUNK_SIZE (256 * 1024)
+#define FAB_RA_CHUNKS     8
+#define FAB_RA_CONNS      2
+#define FAB_RA_TRIGGER    2
+
 static HTS_MUTEX_DECL(buffered_global_mutex);
 
+typedef enum {
+  FC_FREE,
+  FC_WANTED,
+  FC_INFLIGHT,
+  FC_READY,
+  FC_FAILED,
+} fab_chunk_state_t;
+
+typedef struct fab_chunk {
+  int64_t fc_fpos;
+  int fc_size;
+  fab_chunk_state_t fc_state;
+  uint8_t *fc_data;
+} fab_chunk_t;
+
+typedef struct fab_readahead {
+  hts_mutex_t fr_mutex;
+  hts_cond_t fr_cond;
+  int fr_run;
+  int fr_active;
+  int fr_workers;      // Number of workers able to fetch
+  int64_t fr_pos;      // Start of window (chunk aligned)
+  int64_t fr_next;     // Next chunk to schedule
+  int64_t fr_size;
+  int64_t fr_fetched;  // Bytes fetched by workers
+  char *fr_url;
+  int fr_flags;
+  cancellable_t *fr_cancellable;
+  hts_thread_t fr_threads[FAB_RA_CONNS];
+  fab_chunk_t fr_chunks[FAB_RA_CHUNKS];
+} fab_readahead_t;
+
+/**
+ * Source read stats. Summed over all handles and exposed in
+ * global.fileaccess.readahead
+ */
+typedef struct fab_ra_stats {
+  int hits;                // Served from readahead without waiting
+  int stalls;              // Had to wait for readahead
+  int misses;              // Read synchronously from source
+  int64_t stall_time;
+  int64_t fetched;         // Bytes fetched by readahead workers
+} fab_ra_stats_t;
+
+#define FAB_RA_PUBLISH_INTERVAL 1000000 // µs
+
 typedef struct buffered_zone {
   int64_t bz_fpos;
   int bz_mpos;
@@ -45,6 +110,7 @@ typedef struct buffered_zone {
 typedef struct buffered_file {
   fa_handle_t h;
 
+  TAILQ_ENTRY(buffered_file) bf_park_link;
   time_t bf_park_time;
 
   fa_handle_t *bf_src;
@@ -73,11 +139,30 @@ typedef struct buffered_file {
 
   buffered_zone_t bf_zones[BF_ZONES];
 
+  int bf_ra_enabled;
+  int bf_seq;              // Back-to-back sequential reads from source
+  int64_t bf_src_next;     // Where next sequential read from source starts
+  fab_readahead_t *bf_ra;
+
+  fab_ra_stats_t bf_ra_stats;
+  fab_ra_stats_t bf_ra_published;  // Part of bf_ra_stats added to props
+  int64_t bf_ra_publish_time;
 
 } buffered_file_t;
 
 
-static buffered_file_t *parked;
+/**
+ * Closed files are parked for a while (most recent first) in case
+ * they are reopened. Expired ones are closed by a timer
+ */
+TAILQ_HEAD(buffered_file_queue, buffered_file);
+
+static struct buffered_file_queue parked_files =
+  TAILQ_HEAD_INITIALIZER(parked_files);
+static int num_parked;
+static callout_t park_timer;
+
+static void fab_park_timer_cb(callout_t *c, void *aux);
 
 #ifdef DEBUG
 /**
@@ -231,12 +316,433 @@ need_to_fill(const buffered_file_t *bf, int64_t fpos, size_t rd)
 }
 
 
+/**
+ * Return chunk for file position, or NULL if not in window
+ */
+static fab_chunk_t *
+fab_ra_find(fab_readahead_t *fr, int64_t fpos)
+{
+  for(int i = 0; i < FAB_RA_CHUNKS; i++) {
+    fab_chunk_t *fc = &fr->fr_chunks[i];
+    if(fc->fc_state != FC_FREE && fc->fc_fpos == fpos)
+      return fc;
+  }
+  return NULL;
+}
+
+
+/**
+ * Release chunks outside of window and hand out free ones to workers
+ */
+static void
+fab_ra_schedule(fab_readahead_t *fr)
+{
+  int added = 0;
+
+  for(int i = 0; i < FAB_RA_CHUNKS; i++) {
+    fab_chunk_t *fc = &fr->fr_chunks[i];
+    if(fc->fc_state == FC_FREE || fc->fc_state == FC_INFLIGHT)
+      continue;
+    if(fc->fc_fpos < fr->fr_pos || fc->fc_fpos >= fr->fr_next)
+      fc->fc_state = FC_FREE;
+  }
+
+  if(!fr->fr_active)
+    return;
+
+  while(fr->fr_next < fr->fr_size) {
+    if(fab_ra_find(fr, fr->fr_next) == NULL) {
+      int i;
+      for(i = 0; i < FAB_RA_CHUNKS; i++)
+        if(fr->fr_chunks[i].fc_state == FC_FREE)
+          break;
+      if(i == FAB_RA_CHUNKS)
+        break;
+
+      fab_chunk_t *fc = &fr->fr_chunks[i];
+      fc->fc_fpos = fr->fr_next;
+      fc->fc_state = FC_WANTED;
+      added = 1;
+    }
+    fr->fr_next += FAB_RA_CHUNK_SIZE;
+  }
+
+  if(added)
+    hts_cond_broadcast(&fr->fr_cond);
+}
+
+
+/**
+ *
+ */
+static void *
+fab_ra_worker(void *aux)
+{
+  fab_readahead_t *fr = aux;
+  fa_handle_t *fh = NULL;
+  char errbuf[256];
+
+  hts_mutex_lock(&fr->fr_mutex);
+
+  while(fr->fr_run) {
+    fab_chunk_t *fc = NULL;
+    for(int i = 0; i < FAB_RA_CHUNKS; i++) {
+      fab_chunk_t *c = &fr->fr_chunks[i];
+      if(c->fc_state == FC_WANTED && (fc == NULL || c->fc_fpos < fc->fc_fpos))
+        fc = c;
+    }
+
+    if(fc == NULL) {
+      hts_cond_wait(&fr->fr_cond, &fr->fr_mutex);
+      continue;
+    }
+
+    fc->fc_state = FC_INFLIGHT;
+    const int64_t fpos = fc->fc_fpos;
+    hts_mutex_unlock(&fr->fr_mutex);
+
+    if(fh == NULL) {
+      fa_open_extra_t foe = {
+        .foe_cancellable = fr->fr_cancellable,
+      };
+      fh = fa_open_ex(fr->fr_url, errbuf, sizeof(errbuf), fr->fr_flags, &foe);
+      if(fh == NULL)
+        TRACE(TRACE_ERROR, "FA", "Readahead unable to open %s -- %s",
+              fr->fr_url, errbuf);
+    }
+
+    // fa_read() may return less than asked for, keep going until
+    // chunk is full or we hit end of file
+    const int want = MIN(FAB_RA_CHUNK_SIZE, fr->fr_size - fpos);
+    int r = -1;
+    if(fh != NULL && fa_seek(fh, fpos, SEEK_SET) == fpos) {
+      r = 0;
+      while(r < want) {
+        int n = fa_read(fh, fc->fc_data + r, want - r);
+        if(n < 0) {
+          r = -1;
+          break;
+        }
+        if(n == 0)
+          break;
+        r += n;
+      }
+    }
+
+    hts_mutex_lock(&fr->fr_mutex);
+    if(r < 0) {
+      fc->fc_state = FC_FAILED;
+    } else {
+      fc->fc_size = r;
+      fc->fc_state = FC_READY;
+      fr->fr_fetched += r;
+    }
+    hts_cond_broadcast(&fr->fr_cond);
+
+    if(fh == NULL)
+      break;
+  }
+
+  fr->fr_workers--;
+  hts_cond_broadcast(&fr->fr_cond);
+  hts_mutex_unlock(&fr->fr_mutex);
+
+  if(fh != NULL)
+    fa_close(fh);
+  return NULL;
+}
+
+
+/**
+ * Create readahead for a handle. Returns 0 if not possible
+ */
+static int
+fab_ra_start(buffered_file_t *bf)
+{
+  if(bf->bf_ra != NULL)
+    return 1;
+
+  if(!bf->bf_ra_enabled)
+    return 0;
+
+  bf->bf_ra_enabled = 0;
+
+  int64_t size = bf->h.fh_proto->fap_fsize(&bf->h);
+  if(size <= 0)
+    return 0;
+
+  fab_readahead_t *fr = calloc(1, sizeof(fab_readahead_t));
+  for(int i = 0; i < FAB_RA_CHUNKS; i++) {
+    fr->fr_chunks[i].fc_data = halloc(FAB_RA_CHUNK_SIZE);
+    if(fr->fr_chunks[i].fc_data == NULL) {
+      while(--i >= 0)
+        hfree(fr->fr_chunks[i].fc_data, FAB_RA_CHUNK_SIZE);
+      free(fr);
+      return 0;
+    }
+  }
+
+  hts_mutex_init(&fr->fr_mutex);
+  hts_cond_init(&fr->fr_cond, &fr->fr_mutex);
+  fr->fr_run = 1;
+  fr->fr_size = size;
+  fr->fr_url = strdup(bf->bf_url);
+  fr->fr_flags = bf->bf_flags;
+  // Own cancellable so readahead can be torn down without touching the
+  // source handle. fab_cancel() cancels both
+  fr->fr_cancellable = cancellable_create();
+  if(cancellable_is_cancelled(bf->bf_outbound_cancellable))
+    cancellable_cancel(fr->fr_cancellable);
+  fr->fr_workers = FAB_RA_CONNS;
+
+  for(int i = 0; i < FAB_RA_CONNS; i++)
+    hts_thread_create_joinable("readahead", &fr->fr_threads[i],
+                               fab_ra_worker, fr, THREAD_PRIO_FILESYSTEM);
+  bf->bf_ra = fr;
+  return 1;
+}
+
+
+/**
+ * Stop filling the window (non sequential access)
+ */
+static void
+fab_ra_pause(fab_readahead_t *fr)
+{
+  hts_mutex_lock(&fr->fr_mutex);
+  fr->fr_active = 0;
+  fr->fr_pos = 0;
+  fr->fr_next = 0;
+  fab_ra_schedule(fr);
+  hts_mutex_unlock(&fr->fr_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+fab_ra_destroy(fab_readahead_t *fr)
+{
+  // Abort any in-flight I/O, we're going away anyway
+  cancellable_cancel(fr->fr_cancellable);
+
+  hts_mutex_lock(&fr->fr_mutex);
+  fr->fr_run = 0;
+  hts_cond_broadcast(&fr->fr_cond);
+  hts_mutex_unlock(&fr->fr_mutex);
+
+  for(int i = 0; i < FAB_RA_CONNS; i++)
+    hts_thread_join(&fr->fr_threads[i]);
+
+  for(int i = 0; i < FAB_RA_CHUNKS; i++)
+    hfree(fr->fr_chunks[i].fc_data, FAB_RA_CHUNK_SIZE);
+
+  cancellable_release(fr->fr_cancellable);
+  hts_cond_destroy(&fr->fr_cond);
+  hts_mutex_destroy(&fr->fr_mutex);
+  free(fr->fr_url);
+  free(fr);
+}
+
+
+/**
+ * Read from readahead window. Returns number of bytes copied,
+ * 0 on EOF and -1 if caller should read from source instead
+ */
+static int
+fab_ra_read(buffered_file_t *bf, int64_t fpos, void *buf, size_t size)
+{
+  fab_readahead_t *fr = bf->bf_ra;
+  const int64_t cpos = fpos & ~(int64_t)(FAB_RA_CHUNK_SIZE - 1);
+  int64_t ts = 0;
+  int r = -1;
+
+  hts_mutex_lock(&fr->fr_mutex);
+
+  if(!fr->fr_active || cpos < fr->fr_pos || cpos >= fr->fr_next) {
+    fr->fr_active = 1;
+    fr->fr_next = cpos;
+  }
+  fr->fr_pos = cpos;
+  fab_ra_schedule(fr);
+
+  while(fr->fr_workers > 0) {
+    fab_chunk_t *fc = fab_ra_find(fr, cpos);
+    if(fc == NULL || fc->fc_state == FC_FAILED)
+      break;
+
+    if(fc->fc_state == FC_READY) {
+      const int off = fpos - cpos;
+      if(off >= fc->fc_size) {
+        // Short chunk is only EOF if it really ends at end of file,
+        // otherwise let caller read from source
+        r = cpos + fc->fc_size >= fr->fr_size ? 0 : -1;
+        break;
+      }
+      r = MIN(size, fc->fc_size - off);
+      memcpy(buf, fc->fc_data + off, r);
+
+      if(off + r == FAB_RA_CHUNK_SIZE) {
+        // Chunk fully consumed, slide window
+        fr->fr_pos = cpos + FAB_RA_CHUNK_SIZE;
+        fab_ra_schedule(fr);
+      }
+      break;
+    }
+
+    if(ts == 0)
+      ts = arch_get_ts();
+    hts_cond_wait(&fr->fr_cond, &fr->fr_mutex);
+  }
+
+  hts_mutex_unlock(&fr->fr_mutex);
+
+  if(r >= 0) {
+    if(ts) {
+      bf->bf_ra_stats.stalls++;
+      bf->bf_ra_stats.stall_time += arch_get_ts() - ts;
+    } else {
+      bf->bf_ra_stats.hits++;
+    }
+  }
+  return r;
+}
+
+
+/**
+ * Add what has happened since last time to the global counters
+ */
+static void
+fab_ra_publish(buffered_file_t *bf)
+{
+  static prop_t *root;
+  fab_ra_stats_t *cur = &bf->bf_ra_stats;
+  fab_ra_stats_t *pub = &bf->bf_ra_published;
+
+  hts_mutex_lock(&bf->bf_ra->fr_mutex);
+  cur->fetched = bf->bf_ra->fr_fetched;
+  hts_mutex_unlock(&bf->bf_ra->fr_mutex);
+
+  hts_mutex_lock(&buffered_global_mutex);
+  if(root == NULL)
+    root = prop_create(prop_create(prop_get_global(), "fileaccess"),
+                       "readahead");
+  hts_mutex_unlock(&buffered_global_mutex);
+
+  prop_add_int(prop_create(root, "hits"), cur->hits - pub->hits);
+  prop_add_int(prop_create(root, "stalls"), cur->stalls - pub->stalls);
+  prop_add_int(prop_create(root, "sourceReads"), cur->misses - pub->misses);
+  prop_add_int(prop_create(root, "stallTime"),
+               cur->stall_time / 1000 - pub->stall_time / 1000);
+  prop_add_int(prop_create(root, "fetched"),
+               cur->fetched / 1024 - pub->fetched / 1024);
+
+  *pub = *cur;
+  bf->bf_ra_publish_time = arch_get_ts();
+}
+
+
+/**
+ * Read from source at current position, via readahead if
+ * access is sequential
+ */
+static int
+fab_src_read0(buffered_file_t *bf, void *buf, size_t size)
+{
+  fa_handle_t *src = bf->bf_src;
+  const int64_t fpos = bf->bf_fpos;
+  size_t done = 0;
+  int r;
+
+  if(fpos == bf->bf_src_next)
+    bf->bf_seq++;
+  else
+    bf->bf_seq = 0;
+
+  if(bf->bf_seq >= FAB_RA_TRIGGER && fab_ra_start(bf)) {
+    while(done < size) {
+      r = fab_ra_read(bf, fpos + done, buf + done, size - done);
+      if(r == -1)
+        break;
+      if(r == 0) {
+        bf->bf_src_next = fpos + done;
+        return done;
+      }
+      done += r;
+    }
+    if(done == size) {
+      bf->bf_src_next = fpos + done;
+      return done;
+    }
+  } else if(bf->bf_ra != NULL) {
+    fab_ra_pause(bf->bf_ra);
+  }
+
+  bf->bf_ra_stats.misses++;
+
+  if(src->fh_proto->fap_seek(src, fpos + done, SEEK_SET, 0) != fpos + done)
+    return -1;
+
+  r = src->fh_proto->fap_read(src, buf + done, size - done);
+  if(r < 0)
+    return r;
+
+  done += r;
+  bf->bf_src_next = fpos + done;
+  return done;
+}
+
+
+/**
+ *
+ */
+static int
+fab_src_read(buffered_file_t *bf, void *buf, size_t size)
+{
+  int r = fab_src_read0(bf, buf, size);
+
+  if(bf->bf_ra != NULL &&
+     arch_get_ts() - bf->bf_ra_publish_time > FAB_RA_PUBLISH_INTERVAL)
+    fab_ra_publish(bf);
+  return r;
+}
+
+
+/**
+ * Tear down readahead. It is started again if the handle is reused
+ * and read sequentially
+ */
+static void
+fab_ra_stop(buffered_file_t *bf)
+{
+  fab_ra_publish(bf);
+  TRACE(TRACE_DEBUG, "FA",
+        "%s: readahead %d hits, %d stalls (%"PRId64" ms), "
+        "%d source reads, %"PRId64" kB fetched",
+        bf->bf_url, bf->bf_ra_stats.hits, bf->bf_ra_stats.stalls,
+        bf->bf_ra_stats.stall_time / 1000, bf->bf_ra_stats.misses,
+        bf->bf_ra_stats.fetched / 1024);
+  fab_ra_destroy(bf->bf_ra);
+  bf->bf_ra = NULL;
+  bf->bf_ra_enabled = 1;
+  bf->bf_seq = 0;
+
+  // Fetched count is kept by the readahead instance, start over
+  bf->bf_ra_stats.fetched = 0;
+  bf->bf_ra_published.fetched = 0;
+}
+
+
 /**
  *
  */
 static void
 fab_destroy(buffered_file_t *bf)
 {
+  if(bf->bf_ra != NULL)
+    fab_ra_stop(bf);
+
   bf->bf_src->fh_proto->fap_close(bf->bf_src);
 
   if(bf->bf_mem != NULL)
@@ -248,6 +754,51 @@ fab_destroy(buffered_file_t *bf)
 
 
 
+/**
+ * Close parked files that has expired. Runs as a task as closing
+ * may block on network I/O
+ */
+static void
+fab_park_reaper(void *aux)
+{
+  struct buffered_file_queue expired;
+  buffered_file_t *bf, *next;
+  time_t now;
+
+  TAILQ_INIT(&expired);
+  time(&now);
+
+  hts_mutex_lock(&buffered_global_mutex);
+  for(bf = TAILQ_FIRST(&parked_files); bf != NULL; bf = next) {
+    next = TAILQ_NEXT(bf, bf_park_link);
+    if(now - bf->bf_park_time > FAB_PARK_TIME) {
+      TAILQ_REMOVE(&parked_files, bf, bf_park_link);
+      TAILQ_INSERT_TAIL(&expired, bf, bf_park_link);
+      num_parked--;
+    }
+  }
+
+  if(num_parked)
+    callout_arm(&park_timer, fab_park_timer_cb, NULL, FAB_PARK_TIME + 1);
+  hts_mutex_unlock(&buffered_global_mutex);
+
+  while((bf = TAILQ_FIRST(&expired)) != NULL) {
+    TAILQ_REMOVE(&expired, bf, bf_park_link);
+    fab_destroy(bf);
+  }
+}
+
+
+/**
+ *
+ */
+static void
+fab_park_timer_cb(callout_t *c, void *aux)
+{
+  task_run(fab_park_reaper, NULL);
+}
+
+
 /**
  *
  */
@@ -271,12 +822,21 @@ fab_close(fa_handle_t *handle)
     return;
   }
 
+  // Don't keep connections, threads and chunks around while parked
+  if(bf->bf_ra != NULL)
+    fab_ra_stop(bf);
+
   hts_mutex_lock(&buffered_global_mutex);
-  if(parked)
-    closeme = parked;
+  time(&bf->bf_park_time);
+  TAILQ_INSERT_HEAD(&parked_files, bf, bf_park_link);
+  if(++num_parked > FAB_MAX_PARKED) {
+    closeme = TAILQ_LAST(&parked_files, buffered_file_queue);
+    TAILQ_REMOVE(&parked_files, closeme, bf_park_link);
+    num_parked--;
+  }
 
-  parked = bf;
-  time(&parked->bf_park_time);
+  if(!callout_isarmed(&park_timer))
+    callout_arm(&park_timer, fab_park_timer_cb, NULL, FAB_PARK_TIME + 1);
   hts_mutex_unlock(&buffered_global_mutex);
 
   if(closeme)
@@ -398,7 +958,6 @@ static int
 fab_read(fa_handle_t *handle, void *buf, size_t size)
 {
   buffered_file_t *bf = (buffered_file_t *)handle;
-  fa_handle_t *src = bf->bf_src;
 
   if(bf->bf_mem == NULL) {
     bf->bf_mem = halloc(bf->bf_mem_size);
@@ -426,10 +985,7 @@ fab_read(fa_handle_t *handle, void *buf, size_t size)
     int rreq = need_to_fill(bf, bf->bf_fpos, size);
     if(rreq >= bf->bf_min_request) {
 
-      if(src->fh_proto->fap_seek(src, bf->bf_fpos, SEEK_SET, 0) != bf->bf_fpos)
-	return -1;
-
-      int r = src->fh_proto->fap_read(src, buf, rreq);
+      int r = fab_src_read(bf, buf, rreq);
       if(r > 0) {
 	store_in_cache(bf, buf, r);
 	rval += r;
@@ -449,11 +1005,7 @@ fab_read(fa_handle_t *handle, void *buf, size_t size)
     
     erase_zone(bf, bf->bf_mem_ptr, bf->bf_min_request);
 
-    if(src->fh_proto->fap_seek(src, bf->bf_fpos, SEEK_SET, 0) != bf->bf_fpos)
-      return -1;
-
-    int r = src->fh_proto->fap_read(src, bf->bf_mem + bf->bf_mem_ptr,
-				    bf->bf_min_request);
+    int r = fab_src_read(bf, bf->bf_mem + bf->bf_mem_ptr, bf->bf_min_request);
     if(r < 1) {
       bf->bf_size = bf->bf_fpos;
       return r < 0 ? r : rval;
@@ -560,6 +1112,8 @@ fab_cancel(void *aux)
 {
   buffered_file_t *bf = aux;
   cancellable_cancel_locked(bf->bf_outbound_cancellable);
+  if(bf->bf_ra != NULL)
+    cancellable_cancel_locked(bf->bf_ra->fr_cancellable);
 }
 
 /**
@@ -569,7 +1123,6 @@ fa_handle_t *
 fa_buffered_open(const char *url, char *errbuf, size_t errsize, int flags,
                  struct fa_open_extra *foe)
 {
-  buffered_file_t *closeme = NULL;
   fa_handle_t *fh;
   fa_protocol_t *fap;
   char *filename;
@@ -587,33 +1140,27 @@ fa_buffered_open(const char *url, char *errbuf, size_t errsize, int flags,
   fh = NULL;
   hts_mutex_lock(&buffered_global_mutex);
 
-  if(parked) {
-    // Flush too old parked files
-    time_t now;
-    time(&now);
-    if(now - parked->bf_park_time > 10) {
-      closeme = parked;
-      parked = NULL;
+  time_t now;
+  time(&now);
+
+  buffered_file_t *pbf;
+  TAILQ_FOREACH(pbf, &parked_files, bf_park_link) {
+    if(now - pbf->bf_park_time <= FAB_PARK_TIME && !strcmp(pbf->bf_url, url)) {
+      TAILQ_REMOVE(&parked_files, pbf, bf_park_link);
+      num_parked--;
+      pbf->bf_fpos = 0;
+      fh = &pbf->h;
+      break;
     }
   }
 
-
-  if(parked && !strcmp(parked->bf_url, url)) {
-    parked->bf_fpos = 0;
-    fh = (fa_handle_t *)parked;
-    parked = NULL;
-  }
-
   hts_mutex_unlock(&buffered_global_mutex);
 
-  if(closeme != NULL)
-    fab_destroy(closeme);
-
   if(fh != NULL) {
     fap_release(fap);
     free(filename);
 
-    if(foe->foe_cancellable != NULL) {
+    if(foe != NULL && foe->foe_cancellable != NULL) {
       buffered_file_t *bf = (buffered_file_t *)fh;
       assert(bf->bf_inbound_cancellable == NULL);
       bf->bf_inbound_cancellable =
@@ -659,6 +1206,10 @@ fa_buffered_open(const char *url, char *errbuf, size_t errsize, int flags,
   bf->bf_mem_size = 1024 * 1024;
   bf->bf_flags = flags;
 
+  bf->bf_ra_enabled = mflags & FA_BUFFERED_BIG &&
+    !(mflags & (FA_BUFFERED_NO_PREFETCH | FA_STREAMING));
+  bf->bf_src_next = -1;
+
   bf->bf_src = fh;
   bf->bf_size = -1;
   bf->h.fh_proto = &fa_protocol_buffered;
@@ -43,6 +43,7 @@
 #include "misc/callout.h"
 #include "misc/average.h"
 #include "misc/minmax.h"
+#include "settings.h"
 
 #include "usage.h"
 
@@ -85,15 +86,44 @@ static int http_tokenize(char *buf, char **vec, int vecsize, int delimiter);
 
 /**
  * Connection parking
+ *
+ * Idle connections are parked per origin (host, port, ssl) in a hash
+ * table so lookup cost does not depend on how many hosts we talk to.
+ * All parked connections are also on a global queue (oldest first)
+ * used for enforcing the global limit. Connections whose keep-alive
+ * has expired are closed by a timer.
  */
 TAILQ_HEAD(http_connection_queue , http_connection);
+LIST_HEAD(http_origin_list, http_origin);
+
+#define HTTP_ORIGIN_HASH_SIZE 64
 
+#define HTTP_MAX_PARKED_CONNECTIONS 32
+
+static struct http_origin_list http_origins[HTTP_ORIGIN_HASH_SIZE];
 static struct http_connection_queue http_connections;
 static int http_parked_connections;
+static int http_max_parked_per_origin = 4;
 static hts_mutex_t http_connections_mutex;
+static callout_t http_connection_reaper;
+static time_t http_connection_reap_time;
 static atomic_t http_connection_tally;
+static atomic_t http_connection_reuse_tally;
 static atomic_t http_file_tally;
 
+static prop_t *http_stats_created;
+static prop_t *http_stats_reused;
+static prop_t *http_stats_parked;
+
+typedef struct http_origin {
+  LIST_ENTRY(http_origin) ho_link;
+  struct http_connection_queue ho_parked;  // Most recently parked first
+  int ho_num_parked;
+  int ho_port;
+  char ho_ssl;
+  char ho_hostname[HOSTNAME_MAX];
+} http_origin_t;
+
 typedef struct http_connection {
   char hc_hostname[HOSTNAME_MAX];
   int hc_port;
@@ -101,6 +131,8 @@ typedef struct http_connection {
   tcpcon_t *hc_tc;
 
   TAILQ_ENTRY(http_connection) hc_link;
+  TAILQ_ENTRY(http_connection) hc_origin_link;
+  http_origin_t *hc_origin;
 
   char hc_ssl;
   char hc_reused;
@@ -253,6 +285,135 @@ http_connection_destroy(http_connection_t *hc, int dbg, const char *reason)
 
 
 
+/**
+ * Update connection stats in global.http.connections
+ */
+static void
+http_connection_update_stats(void)
+{
+  prop_set_int(http_stats_created, atomic_get(&http_connection_tally));
+  prop_set_int(http_stats_reused, atomic_get(&http_connection_reuse_tally));
+  prop_set_int(http_stats_parked, http_parked_connections);
+}
+
+
+/**
+ * Must be called with http_connections_mutex locked
+ */
+static http_origin_t *
+http_origin_find(const char *hostname, int port, int ssl, int create)
+{
+  const unsigned int hash =
+    (mystrhash(hostname) ^ port ^ ssl) % HTTP_ORIGIN_HASH_SIZE;
+  http_origin_t *ho;
+
+  LIST_FOREACH(ho, &http_origins[hash], ho_link)
+    if(ho->ho_port == port && ho->ho_ssl == ssl &&
+       !strcmp(ho->ho_hostname, hostname))
+      return ho;
+
+  if(!create)
+    return NULL;
+
+  ho = malloc(sizeof(http_origin_t));
+  TAILQ_INIT(&ho->ho_parked);
+  ho->ho_num_parked = 0;
+  ho->ho_port = port;
+  ho->ho_ssl = ssl;
+  snprintf(ho->ho_hostname, sizeof(ho->ho_hostname), "%s", hostname);
+  LIST_INSERT_HEAD(&http_origins[hash], ho, ho_link);
+  return ho;
+}
+
+
+/**
+ * Must be called with http_connections_mutex locked
+ */
+static void
+http_connection_unpark(http_connection_t *hc)
+{
+  http_origin_t *ho = hc->hc_origin;
+
+  TAILQ_REMOVE(&http_connections, hc, hc_link);
+  TAILQ_REMOVE(&ho->ho_parked, hc, hc_origin_link);
+  http_parked_connections--;
+  hc->hc_origin = NULL;
+
+  if(--ho->ho_num_parked == 0) {
+    LIST_REMOVE(ho, ho_link);
+    free(ho);
+  }
+}
+
+
+/**
+ * Destroy connections collected while http_connections_mutex was held.
+ * Closing may block (TLS shutdown) so this must be done unlocked
+ */
+static void
+http_connection_destroy_queue(struct http_connection_queue *q, int dbg,
+                              const char *reason)
+{
+  http_connection_t *hc;
+
+  while((hc = TAILQ_FIRST(q)) != NULL) {
+    TAILQ_REMOVE(q, hc, hc_link);
+    http_connection_destroy(hc, dbg, reason);
+  }
+}
+
+
+static void http_connection_reap(callout_t *c, void *aux);
+
+/**
+ * Close connections whose keep alive has expired. Runs as a task
+ */
+static void
+http_connection_reap_task(void *aux)
+{
+  struct http_connection_queue expired;
+  http_connection_t *hc, *next;
+  time_t now, next_expire = INT32_MAX;
+
+  TAILQ_INIT(&expired);
+  time(&now);
+
+  hts_mutex_lock(&http_connections_mutex);
+
+  for(hc = TAILQ_FIRST(&http_connections); hc != NULL; hc = next) {
+    next = TAILQ_NEXT(hc, hc_link);
+
+    if(now >= hc->hc_reuse_before) {
+      http_connection_unpark(hc);
+      TAILQ_INSERT_TAIL(&expired, hc, hc_link);
+    } else {
+      next_expire = MIN(next_expire, hc->hc_reuse_before);
+    }
+  }
+
+  if(http_parked_connections) {
+    http_connection_reap_time = now + MAX(1, next_expire - now);
+    callout_arm(&http_connection_reaper, http_connection_reap, NULL,
+                http_connection_reap_time - now);
+  }
+
+  hts_mutex_unlock(&http_connections_mutex);
+
+  http_connection_destroy_queue(&expired, 0, "Keep alive expired");
+  http_connection_update_stats();
+}
+
+
+/**
+ *
+ */
+static void
+http_connection_reap(callout_t *c, void *aux)
+{
+  task_run(http_connection_reap_task, NULL);
+}
+
+
 /**
  *
  */
@@ -261,7 +422,8 @@ http_connection_get(const char *hostname, int port, int ssl,
 		    char *errbuf, int errlen, int dbg, int timeout,
                     cancellable_t *c, int allow_reuse)
 {
-  http_connection_t *hc, *next;
+  http_connection_t *hc;
+  http_origin_t *ho;
   tcpcon_t *tc;
 
   if(allow_reuse) {
@@ -272,27 +434,28 @@ http_connection_get(const char *hostname, int port, int ssl,
 
     hts_mutex_lock(&http_connections_mutex);
 
-    for(hc = TAILQ_FIRST(&http_connections); hc != NULL; hc = next) {
-      next = TAILQ_NEXT(hc, hc_link);
+    ho = http_origin_find(hostname, port, ssl, 0);
 
-      if(now >= hc->hc_reuse_before) {
-        TAILQ_REMOVE(&http_connections, hc, hc_link);
-        http_parked_connections--;
-        http_connection_destroy(hc, dbg, "Keep alive expired");
-        continue;
-      }
+    // Expired connections are left for the reaper. Keep alive time
+    // is per connection so each one must be checked
 
-      if(!strcmp(hc->hc_hostname, hostname) && hc->hc_port == port &&
-         hc->hc_ssl == ssl) {
-        TAILQ_REMOVE(&http_connections, hc, hc_link);
-        http_parked_connections--;
-        hts_mutex_unlock(&http_connections_mutex);
-        HTTP_TRACE(dbg, "Reusing connection to %s:%d (cid=%d)",
-                   hc->hc_hostname, hc->hc_port, hc->hc_id);
-        hc->hc_reused = 1;
-        tcp_set_cancellable(hc->hc_tc, c);
-        return hc;
-      }
+    hc = NULL;
+    if(ho != NULL) {
+      TAILQ_FOREACH(hc, &ho->ho_parked, hc_origin_link)
+        if(now < hc->hc_reuse_before)
+          break;
+    }
+
+    if(hc != NULL) {
+      http_connection_unpark(hc);
+      hts_mutex_unlock(&http_connections_mutex);
+      HTTP_TRACE(dbg, "Reusing connection to %s:%d (cid=%d)",
+                 hc->hc_hostname, hc->hc_port, hc->hc_id);
+      hc->hc_reused = 1;
+      tcp_set_cancellable(hc->hc_tc, c);
+      atomic_inc(&http_connection_reuse_tally);
+      http_connection_update_stats();
+      return hc;
     }
     hts_mutex_unlock(&http_connections_mutex);
   }
@@ -328,6 +491,7 @@ http_connection_get(const char *hostname, int port, int ssl,
   }
 
   HTTP_TRACE(dbg, "Connected to %s:%d (cid=%d)", hostname, port, id);
+  http_connection_update_stats();
 
   hc = malloc(sizeof(http_connection_t));
   snprintf(hc->hc_hostname, sizeof(hc->hc_hostname), "%s", hostname);
@@ -346,9 +510,10 @@ http_connection_get(const char *hostname, int port, int ssl,
 static void
 http_connection_park(http_connection_t *hc, int dbg, int max_age, const char *reason)
 {
+  struct http_connection_queue evicted;
   time_t now;
-  http_connection_t *next;
 
+  TAILQ_INIT(&evicted);
   time(&now);
 
   tcp_set_read_timeout(hc->hc_tc, 0);
@@ -360,30 +525,41 @@ http_connection_park(http_connection_t *hc, int dbg, int max_age, const char *re
   hc->hc_reuse_before = now + max_age;
 
   hts_mutex_lock(&http_connections_mutex);
+
+  http_origin_t *ho = http_origin_find(hc->hc_hostname, hc->hc_port,
+                                       hc->hc_ssl, 1);
+  hc->hc_origin = ho;
+  TAILQ_INSERT_HEAD(&ho->ho_parked, hc, hc_origin_link);
   TAILQ_INSERT_TAIL(&http_connections, hc, hc_link);
+  ho->ho_num_parked++;
   http_parked_connections++;
 
-  if(http_parked_connections > 5) {
-    for(hc = TAILQ_FIRST(&http_connections); hc != NULL; hc = next) {
-      next = TAILQ_NEXT(hc, hc_link);
-
-      if(now >= hc->hc_reuse_before) {
-	TAILQ_REMOVE(&http_connections, hc, hc_link);
-	http_parked_connections--;
-	http_connection_destroy(hc, dbg, "Keep alive expired");
-      }
-    }
+  // At least one connection stays so the origin is not freed here
+  while(ho->ho_num_parked > MAX(1, http_max_parked_per_origin)) {
+    hc = TAILQ_LAST(&ho->ho_parked, http_connection_queue);
+    http_connection_unpark(hc);
+    TAILQ_INSERT_TAIL(&evicted, hc, hc_link);
   }
 
-  while(http_parked_connections > 5) {
+  while(http_parked_connections > HTTP_MAX_PARKED_CONNECTIONS) {
     hc = TAILQ_FIRST(&http_connections);
-    assert(hc != NULL);
-    TAILQ_REMOVE(&http_connections, hc, hc_link);
-    http_connection_destroy(hc, dbg, "Too many idle connections");
-    http_parked_connections--;
+    http_connection_unpark(hc);
+    TAILQ_INSERT_TAIL(&evicted, hc, hc_link);
+  }
+
+  // Keep alive differs between connections, make sure the reaper
+  // runs no later than when this one expires
+  if(!callout_isarmed(&http_connection_reaper) ||
+     now + max_age < http_connection_reap_time) {
+    http_connection_reap_time = now + MAX(1, max_age);
+    callout_arm(&http_connection_reaper, http_connection_reap, NULL,
+                http_connection_reap_time - now);
   }
 
   hts_mutex_unlock(&http_connections_mutex);
+
+  http_connection_destroy_queue(&evicted, dbg, "Too many idle connections");
+  http_connection_update_stats();
 }
 
 
@@ -2286,12 +2462,38 @@ http_init(void)
 
   TAILQ_INIT(&http_connections);
   hts_mutex_init(&http_connections_mutex);
+
+  prop_t *p = prop_create(prop_create(prop_get_global(), "http"),
+                          "connections");
+  http_stats_created = prop_create(p, "created");
+  http_stats_reused  = prop_create(p, "reused");
+  http_stats_parked  = prop_create(p, "parked");
   hts_mutex_init(&http_redirects_mutex);
   hts_mutex_init(&http_cookies_mutex);
   hts_mutex_init(&http_auth_caches_mutex);
   load_cookies();
 }
 
+/**
+ *
+ */
+static void
+http_settings_init(void)
+{
+  htsmsg_t *s = htsmsg_store_load("httpclient") ?: htsmsg_create_map();
+
+  setting_create(SETTING_INT, gconf.settings_network, SETTINGS_INITIAL_UPDATE,
+                 SETTING_TITLE(_p("Idle HTTP connections kept per server")),
+                 SETTING_VALUE(4),
+                 SETTING_RANGE(1, 16),
+                 SETTING_WRITE_INT(&http_max_parked_per_origin),
+                 SETTING_HTSMSG("maxidleperhost", s, "httpclient"),
+                 NULL);
+}
+
+INITME(INIT_GROUP_API, http_settings_init, NULL);
+
+
 /**
  *
  */
@@ -37,6 +37,7 @@
 #include <libavutil/mathematics.h>
 #endif
 #include "misc/callout.h"
+#include "misc/minmax.h"
 #include "image/pixmap.h"
 #include "image/jpeg.h"
 #include "backend/backend.h"
@@ -50,14 +51,14 @@ static const uint8_t svgsig1[5] = {'<', '?', 'x', 'm', 'l'};
 static const uint8_t svgsig2[4] = {'<', 's', 'v', 'g'};
 
 #if ENABLE_LIBAV
-static hts_mutex_t image_from_video_mutex[2];
-static AVCodecContext *thumbctx;
+static hts_mutex_t image_from_video_mutex;
 static AVCodec *thumbcodec;
-static callout_t thumb_flush_callout;
 
 static image_t *fa_image_from_video(const char *url, const image_meta_t *im,
                                     char *errbuf, size_t errlen,
                                     int *cache_control, cancellable_t *c);
+
+static void ifv_init(void);
 #endif
 
 /**
@@ -67,8 +68,8 @@ void
 fa_imageloader_init(void)
 {
 #if ENABLE_LIBAV
-  hts_mutex_init(&image_from_video_mutex[0]);
-  hts_mutex_init(&image_from_video_mutex[1]);
+  hts_mutex_init(&image_from_video_mutex);
+  ifv_init();
   thumbcodec = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
 #endif
 }
@@ -294,54 +295,235 @@ fa_imageloader(const char *url, const struct image_meta *im,
 
 #if ENABLE_LIBAV
 
-static char *ifv_url;
-static AVFormatContext *ifv_fctx;
-static AVCodecContext *ifv_ctx;
-int ifv_stream;
+/**
+ * Video thumbnails are extracted by a small pool of workers. Each worker
+ * keeps its own demuxer, decoder and encoder so several thumbnails can
+ * be produced in parallel. A worker keeps the last file open for a while
+ * since thumbs are often requested for several positions in the same
+ * movie.
+ *
+ * Callers waiting for a worker are served newest first. Requests that
+ * have scrolled off screen are cancelled by the texture loader and leave
+ * the queue immediately.
+ */
+#define IFV_MAX_WORKERS 4
+#define IFV_IDLE_CLOSE  5 // seconds
+#define IFV_KEYFRAME_SLACK 10 // seconds
+
+typedef struct ifv_worker {
+  char *iw_url;
+  AVFormatContext *iw_fctx;
+  AVCodecContext *iw_ctx;
+  int iw_stream;
+  AVCodecContext *iw_thumbctx;
+  int iw_busy;
+  int64_t iw_last_use;
+} ifv_worker_t;
+
+TAILQ_HEAD(ifv_waiter_queue, ifv_waiter);
+
+typedef struct ifv_waiter {
+  TAILQ_ENTRY(ifv_waiter) iwa_link;
+} ifv_waiter_t;
+
+static hts_mutex_t ifv_mutex;
+static hts_cond_t ifv_cond;
+static ifv_worker_t ifv_workers[IFV_MAX_WORKERS];
+static int ifv_num_workers;
+static struct ifv_waiter_queue ifv_waiters;
+static callout_t ifv_autoclose_callout;
+
+
+/**
+ *
+ */
+static void
+ifv_init(void)
+{
+  hts_mutex_init(&ifv_mutex);
+  hts_cond_init(&ifv_cond, &ifv_mutex);
+  TAILQ_INIT(&ifv_waiters);
+}
+
 
+/**
+ *
+ */
 static void
-ifv_close(void)
+ifv_close(ifv_worker_t *iw)
 {
-  free(ifv_url);
-  ifv_url = NULL;
+  free(iw->iw_url);
+  iw->iw_url = NULL;
 
-  if(ifv_ctx != NULL) {
-    avcodec_close(ifv_ctx);
-    ifv_ctx = NULL;
+  if(iw->iw_ctx != NULL) {
+    avcodec_close(iw->iw_ctx);
+    iw->iw_ctx = NULL;
   }
 
-  if(ifv_fctx != NULL) {
-    fa_libav_close_format(ifv_fctx);
-    ifv_fctx = NULL;
+  if(iw->iw_fctx != NULL) {
+    fa_libav_close_format(iw->iw_fctx);
+    iw->iw_fctx = NULL;
   }
 }
 
+
 /**
  *
  */
 static void
 ifv_autoclose(callout_t *c, void *aux)
 {
-  if(hts_mutex_trylock(&image_from_video_mutex[1])) {
-    callout_arm(&thumb_flush_callout, ifv_autoclose, NULL, 5);
-  } else {
-    TRACE(TRACE_DEBUG, "Thumb", "Closing movie for thumb sources"); 
-    ifv_close();
-    hts_mutex_unlock(&image_from_video_mutex[1]);
+  const int64_t now = arch_get_ts();
+  int rearm = 0;
+
+  hts_mutex_lock(&ifv_mutex);
+
+  for(int i = 0; i < ifv_num_workers; i++) {
+    ifv_worker_t *iw = &ifv_workers[i];
+    if(iw->iw_url == NULL)
+      continue;
+
+    if(iw->iw_busy || now - iw->iw_last_use < IFV_IDLE_CLOSE * 1000000LL) {
+      rearm = 1;
+      continue;
+    }
+
+    TRACE(TRACE_DEBUG, "Thumb", "Closing movie for thumb sources");
+    iw->iw_busy = 1;
+    hts_mutex_unlock(&ifv_mutex);
+    ifv_close(iw);
+    hts_mutex_lock(&ifv_mutex);
+    iw->iw_busy = 0;
+    hts_cond_broadcast(&ifv_cond);
+  }
+
+  hts_mutex_unlock(&ifv_mutex);
+
+  if(rearm)
+    callout_arm(&ifv_autoclose_callout, ifv_autoclose, NULL, IFV_IDLE_CLOSE);
+}
+
+
+/**
+ * Called via cancellable when a waiting request is cancelled
+ */
+static void
+ifv_wakeup(void *opaque)
+{
+  hts_mutex_lock(&ifv_mutex);
+  hts_cond_broadcast(&ifv_cond);
+  hts_mutex_unlock(&ifv_mutex);
+}
+
+
+/**
+ * Find an idle worker, preferably one that already has the file open
+ */
+static ifv_worker_t *
+ifv_find_idle(const char *url)
+{
+  ifv_worker_t *best = NULL;
+
+  for(int i = 0; i < ifv_num_workers; i++) {
+    ifv_worker_t *iw = &ifv_workers[i];
+    if(iw->iw_busy)
+      continue;
+    if(iw->iw_url != NULL && !strcmp(iw->iw_url, url))
+      return iw;
+    if(best == NULL ||
+       (best->iw_url != NULL &&
+        (iw->iw_url == NULL || iw->iw_last_use < best->iw_last_use)))
+      best = iw;
+  }
+  return best;
+}
+
+
+/**
+ *
+ */
+static ifv_worker_t *
+ifv_acquire(const char *url, cancellable_t *c)
+{
+  ifv_waiter_t iwa;
+  ifv_worker_t *iw;
+  int queued = 0;
+
+  if(c != NULL)
+    c = cancellable_bind(c, ifv_wakeup, NULL);
+
+  hts_mutex_lock(&ifv_mutex);
+
+  if(ifv_num_workers == 0)
+    ifv_num_workers = MIN(MAX(gconf.concurrency, 1), IFV_MAX_WORKERS);
+
+  while(1) {
+    if(cancellable_is_cancelled(c)) {
+      iw = NULL;
+      break;
+    }
+
+    if(TAILQ_FIRST(&ifv_waiters) == (queued ? &iwa : NULL) &&
+       (iw = ifv_find_idle(url)) != NULL) {
+      iw->iw_busy = 1;
+      break;
+    }
+
+    if(!queued) {
+      /*
+       * We are now first in line and may have taken that spot from a
+       * waiter that was already signalled for an idle worker. Check
+       * again before sleeping or that wakeup is lost
+       */
+      TAILQ_INSERT_HEAD(&ifv_waiters, &iwa, iwa_link);
+      queued = 1;
+      continue;
+    }
+    hts_cond_wait(&ifv_cond, &ifv_mutex);
+  }
+
+  if(queued) {
+    TAILQ_REMOVE(&ifv_waiters, &iwa, iwa_link);
+    hts_cond_broadcast(&ifv_cond);
   }
+
+  hts_mutex_unlock(&ifv_mutex);
+
+  if(c != NULL)
+    cancellable_unbind(c, NULL);
+  return iw;
+}
+
+
+/**
+ *
+ */
+static void
+ifv_release(ifv_worker_t *iw)
+{
+  hts_mutex_lock(&ifv_mutex);
+  iw->iw_busy = 0;
+  iw->iw_last_use = arch_get_ts();
+  hts_cond_broadcast(&ifv_cond);
+  hts_mutex_unlock(&ifv_mutex);
+
+  if(iw->iw_url != NULL)
+    callout_arm(&ifv_autoclose_callout, ifv_autoclose, NULL, IFV_IDLE_CLOSE);
 }
 
+
 /**
  *
  */
 static void
-write_thumb(const AVCodecContext *src, const AVFrame *sframe, 
+write_thumb(ifv_worker_t *iw, const AVFrame *sframe,
             int width, int height, const char *cacheid, time_t mtime)
 {
   if(thumbcodec == NULL)
     return;
 
-  AVCodecContext *ctx = thumbctx;
+  const AVCodecContext *src = iw->iw_ctx;
+  AVCodecContext *ctx = iw->iw_thumbctx;
 
   if(ctx == NULL || ctx->width  != width || ctx->height != height) {
     
@@ -361,10 +543,10 @@ write_thumb(const AVCodecContext *src, const AVFrame *sframe,
 
     if(avcodec_open2(ctx, thumbcodec, NULL) < 0) {
       TRACE(TRACE_ERROR, "THUMB", "Unable to open thumb encoder");
-      thumbctx = NULL;
+      iw->iw_thumbctx = NULL;
       return;
     }
-    thumbctx = ctx;
+    iw->iw_thumbctx = ctx;
   }
 
   AVFrame *oframe = av_frame_alloc();
@@ -404,13 +586,13 @@ write_thumb(const AVCodecContext *src, const AVFrame *sframe,
  *
  */
 static image_t *
-fa_image_from_video2(const char *url, const image_meta_t *im,
+fa_image_from_video2(ifv_worker_t *iw, const char *url, const image_meta_t *im,
 		     const char *cacheid, char *errbuf, size_t errlen,
 		     int sec, time_t mtime, cancellable_t *c)
 {
   image_t *img = NULL;
 
-  if(ifv_url == NULL || strcmp(url, ifv_url)) {
+  if(iw->iw_url == NULL || strcmp(url, iw->iw_url)) {
     // Need to open
     int i;
     AVFormatContext *fctx;
@@ -457,29 +639,43 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
       return NULL;
     }
 
-    ifv_close();
+    ifv_close(iw);
 
-    ifv_stream = i;
-    ifv_url = strdup(url);
-    ifv_fctx = fctx;
-    ifv_ctx = ctx;
+    iw->iw_stream = i;
+    iw->iw_url = strdup(url);
+    iw->iw_fctx = fctx;
+    iw->iw_ctx = ctx;
   }
 
+  AVFormatContext *fctx = iw->iw_fctx;
+  AVCodecContext *ctx = iw->iw_ctx;
+
   AVPacket pkt;
   AVFrame *frame = av_frame_alloc();
   int got_pic;
 
 
-  AVStream *st = ifv_fctx->streams[ifv_stream];
+  AVStream *st = fctx->streams[iw->iw_stream];
   int64_t ts = av_rescale(sec, st->time_base.den, st->time_base.num);
+  // Accept a keyframe this close to the requested position
+  int64_t slack = av_rescale(IFV_KEYFRAME_SLACK,
+                             st->time_base.den, st->time_base.num);
 
-  if(av_seek_frame(ifv_fctx, ifv_stream, ts, AVSEEK_FLAG_BACKWARD) < 0) {
-    ifv_close();
+  if(av_seek_frame(fctx, iw->iw_stream, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+    ifv_close(iw);
+    av_frame_free(&frame);
     snprintf(errbuf, errlen, "Unable to seek to %"PRId64, ts);
     return NULL;
   }
   
-  avcodec_flush_buffers(ifv_ctx);
+  avcodec_flush_buffers(ctx);
+
+  /*
+   * Only keyframes are decoded. They decode without any references so
+   * we don't have to run the decoder over the whole GOP to reach the
+   * requested position
+   */
+  ctx->skip_frame = AVDISCARD_NONKEY;
 
 #define MAX_FRAME_SCAN 500
   
@@ -487,7 +683,7 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
   while(1) {
     int r;
 
-    r = av_read_frame(ifv_fctx, &pkt);
+    r = av_read_frame(fctx, &pkt);
 
     if(r == AVERROR(EAGAIN))
       continue;
@@ -502,24 +698,27 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
     }
 
     if(r != 0) {
-      ifv_close();
+      ifv_close(iw);
       break;
     }
 
-    if(pkt.stream_index != ifv_stream) {
+    if(pkt.stream_index != iw->iw_stream) {
       av_free_packet(&pkt);
       continue;
     }
     cnt--;
-    int want_pic = pkt.pts >= ts || cnt <= 0;
 
-    ifv_ctx->skip_frame = want_pic ? AVDISCARD_DEFAULT : AVDISCARD_NONREF;
-    
-    avcodec_decode_video2(ifv_ctx, frame, &got_pic, &pkt);
-    av_free_packet(&pkt);
-    if(got_pic == 0 || !want_pic) {
+    if(!(pkt.flags & AV_PKT_FLAG_KEY) ||
+       (pkt.pts != AV_NOPTS_VALUE && pkt.pts + slack < ts && cnt > 0)) {
+      av_free_packet(&pkt);
       continue;
     }
+
+    avcodec_decode_video2(ctx, frame, &got_pic, &pkt);
+    av_free_packet(&pkt);
+    if(got_pic == 0)
+      continue;
+
     int w,h;
 
     if(im->im_req_width != -1 && im->im_req_height != -1) {
@@ -527,10 +726,10 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
       h = im->im_req_height;
     } else if(im->im_req_width != -1) {
       w = im->im_req_width;
-      h = im->im_req_width * ifv_ctx->height / ifv_ctx->width;
+      h = im->im_req_width * ctx->height / ctx->width;
 
     } else if(im->im_req_height != -1) {
-      w = im->im_req_height * ifv_ctx->width / ifv_ctx->height;
+      w = im->im_req_height * ctx->width / ctx->height;
       h = im->im_req_height;
     } else {
       w = im->im_req_width;
@@ -540,18 +739,18 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
     pixmap_t *pm = pixmap_create(w, h, PIXMAP_BGR32, 0);
 
     if(pm == NULL) {
-      ifv_close();
+      ifv_close(iw);
       snprintf(errbuf, errlen, "Out of memory");
       av_free(frame);
       return NULL;
     }
 
     struct SwsContext *sws;
-    sws = sws_getContext(ifv_ctx->width, ifv_ctx->height, ifv_ctx->pix_fmt,
+    sws = sws_getContext(ctx->width, ctx->height, ctx->pix_fmt,
 			 w, h, AV_PIX_FMT_BGR32, SWS_BILINEAR,
                          NULL, NULL, NULL);
     if(sws == NULL) {
-      ifv_close();
+      ifv_close(iw);
       snprintf(errbuf, errlen, "Scaling failed");
       pixmap_release(pm);
       av_free(frame);
@@ -565,11 +764,11 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
     strides[0] = pm->pm_linesize;
 
     sws_scale(sws, (const uint8_t **)frame->data, frame->linesize,
-	      0, ifv_ctx->height, ptr, strides);
+	      0, ctx->height, ptr, strides);
 
     sws_freeContext(sws);
 
-    write_thumb(ifv_ctx, frame, w, h, cacheid, mtime);
+    write_thumb(iw, frame, w, h, cacheid, mtime);
 
     img = image_create_from_pixmap(pm);
     pixmap_release(pm);
@@ -582,8 +781,8 @@ fa_image_from_video2(const char *url, const image_meta_t *im,
     snprintf(errbuf, errlen, "Frame not found (scanned %d)", 
 	     MAX_FRAME_SCAN - cnt);
 
-  avcodec_flush_buffers(ifv_ctx);
-  callout_arm(&thumb_flush_callout, ifv_autoclose, NULL, 5);
+  if(iw->iw_ctx != NULL)
+    avcodec_flush_buffers(iw->iw_ctx);
   return img;
 }
 
@@ -608,19 +807,19 @@ fa_image_from_video(const char *url0, const image_meta_t *im,
   *tim++ = 0;
   int secs = atoi(tim);
 
-  hts_mutex_lock(&image_from_video_mutex[0]);
+  hts_mutex_lock(&image_from_video_mutex);
   
   if(strcmp(url, stated_url ?: "")) {
     free(stated_url);
     stated_url = NULL;
     if(fa_stat(url, &fs, errbuf, errlen)) {
-      hts_mutex_unlock(&image_from_video_mutex[0]);
+      hts_mutex_unlock(&image_from_video_mutex);
       return NULL;
     }
     stated_url = strdup(url);
   }
   stattime = fs.fs_mtime;
-  hts_mutex_unlock(&image_from_video_mutex[0]);
+  hts_mutex_unlock(&image_from_video_mutex);
 
   if(im->im_req_width < 100 && im->im_req_height < 100) {
     siz = "min";
@@ -631,25 +830,137 @@ fa_image_from_video(const char *url0, const image_meta_t *im,
   }
 
   snprintf(cacheid, sizeof(cacheid), "%s-%s", url0, siz);
-  buf_t *b = blobcache_get(cacheid, "videothumb", 0, 0, NULL, &mtime);
-  if(b != NULL && mtime == stattime) {
-    img = image_coded_create_from_buf(b, IMAGE_JPEG);
+  if(cache_control != BYPASS_CACHE) {
+    buf_t *b = blobcache_get(cacheid, "videothumb", 0, 0, NULL, &mtime);
+    if(b != NULL && mtime == stattime) {
+      img = image_coded_create_from_buf(b, IMAGE_JPEG);
+      buf_release(b);
+      return img;
+    }
     buf_release(b);
-    return img;
   }
-  buf_release(b);
 
   if(ONLY_CACHED(cache_control)) {
     snprintf(errbuf, errlen, "Not cached");
     return NULL;
   }
 
-  hts_mutex_lock(&image_from_video_mutex[1]);
-  img = fa_image_from_video2(url, im, cacheid, errbuf, errlen,
+  ifv_worker_t *iw = ifv_acquire(url, c);
+  if(iw == NULL) {
+    snprintf(errbuf, errlen, "Cancelled");
+    return NULL;
+  }
+  img = fa_image_from_video2(iw, url, im, cacheid, errbuf, errlen,
                              secs, stattime, c);
-  hts_mutex_unlock(&image_from_video_mutex[1]);
+  ifv_release(iw);
   if(img != NULL)
     img->im_flags |= IMAGE_ADAPTED;
   return img;
 }
 #endif
+
+
+#if ENABLE_LIBAV
+/**
+ * Thumbnail throughput benchmark, started with --thumb-bench <dir>
+ *
+ * Extracts one thumbnail from every file in the directory using
+ * twice as many concurrent requesters as there are workers so the
+ * pool is kept saturated. The blobcache is bypassed
+ */
+typedef struct ifv_bench {
+  char **ib_urls;
+  int ib_num_urls;
+  atomic_t ib_next;
+  atomic_t ib_ok;
+  atomic_t ib_failed;
+} ifv_bench_t;
+
+
+/**
+ *
+ */
+static void *
+ifv_bench_thread(void *aux)
+{
+  ifv_bench_t *ib = aux;
+  image_meta_t im = {0};
+  char errbuf[256];
+  char url[1024];
+
+  im.im_req_width = 320;
+  im.im_req_height = 180;
+
+  while(1) {
+    int i = atomic_add_and_fetch(&ib->ib_next, 1) - 1;
+    if(i >= ib->ib_num_urls)
+      break;
+
+    snprintf(url, sizeof(url), "%s#60", ib->ib_urls[i]);
+    image_t *img = fa_image_from_video(url, &im, errbuf, sizeof(errbuf),
+                                       BYPASS_CACHE, NULL);
+    if(img != NULL) {
+      atomic_inc(&ib->ib_ok);
+      image_release(img);
+    } else {
+      TRACE(TRACE_DEBUG, "thumbbench", "%s: %s", ib->ib_urls[i], errbuf);
+      atomic_inc(&ib->ib_failed);
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+ifv_bench(void)
+{
+  char errbuf[256];
+  ifv_bench_t ib = {0};
+  fa_dir_entry_t *fde;
+
+  if(gconf.thumb_bench == NULL)
+    return;
+
+  fa_dir_t *fd = fa_scandir(gconf.thumb_bench, errbuf, sizeof(errbuf));
+  if(fd == NULL) {
+    TRACE(TRACE_ERROR, "thumbbench", "Unable to scan %s -- %s",
+          gconf.thumb_bench, errbuf);
+    app_shutdown(1);
+    return;
+  }
+
+  ib.ib_urls = malloc(sizeof(char *) * fd->fd_count);
+  RB_FOREACH(fde, &fd->fd_entries, fde_link) {
+    if(fde->fde_type == CONTENT_FILE)
+      ib.ib_urls[ib.ib_num_urls++] = strdup(rstr_get(fde->fde_url));
+  }
+  fa_dir_free(fd);
+
+  int num_threads = MIN(MAX(gconf.concurrency, 1), IFV_MAX_WORKERS) * 2;
+  hts_thread_t tids[num_threads];
+
+  int64_t ts = arch_get_ts();
+  for(int i = 0; i < num_threads; i++)
+    hts_thread_create_joinable("thumbbench", &tids[i], ifv_bench_thread, &ib,
+                               THREAD_PRIO_BGTASK);
+  for(int i = 0; i < num_threads; i++)
+    hts_thread_join(&tids[i]);
+  ts = arch_get_ts() - ts;
+
+  int ok = atomic_get(&ib.ib_ok);
+  TRACE(TRACE_INFO, "thumbbench",
+        "%d thumbnails (%d failed) in %d ms, %.2f thumbs/s, %d requesters",
+        ok, atomic_get(&ib.ib_failed), (int)(ts / 1000),
+        ts ? ok * 1000000.0 / ts : 0, num_threads);
+
+  for(int i = 0; i < ib.ib_num_urls; i++)
+    free(ib.ib_urls[i]);
+  free(ib.ib_urls);
+  app_shutdown(0);
+}
+
+INITME(INIT_GROUP_API, ifv_bench, NULL);
+#endif
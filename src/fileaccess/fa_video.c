@@ -815,7 +815,7 @@ be_file_playvideo_fh(const char *url, media_pipe_t *mp,
     }
   }
 
-  int flags = MP_CAN_PAUSE;
+  int flags = MP_CAN_PAUSE | MP_DATA_RING;
 
   if(fctx->duration != PTS_UNSET)
     flags |= MP_CAN_SEEK;
@@ -56,6 +56,7 @@ typedef enum image_component_type {
   IMAGE_CODED,
   IMAGE_VECTOR,
   IMAGE_TEXT_INFO,
+  IMAGE_GLYPHS,
 } image_component_type_t;
 
 
@@ -109,6 +110,24 @@ typedef struct image_component_text_info {
 } image_component_text_info_t;
 
 
+/**
+ * Positioned glyphs of a rendered text, used instead of a pixmap when
+ * the text is to be drawn from a glyph atlas
+ */
+typedef struct image_glyph {
+  struct pixmap *ig_pm;  // Coverage (PIXMAP_I), shared with the glyph cache
+  uint32_t ig_id;        // Unique for the lifetime of the glyph bitmap
+  uint32_t ig_color;     // BGR host order with alpha in the top 8 bits
+  int16_t ig_x;          // Top left corner, same coordinates as the
+  int16_t ig_y;          // pixmap would have had
+} image_glyph_t;
+
+typedef struct image_component_glyphs {
+  image_glyph_t *icg_glyphs;
+  int icg_count;
+} image_component_glyphs_t;
+
+
 /**
  *
  */
@@ -120,6 +139,7 @@ typedef struct image_component {
     image_component_coded_t coded;
     image_component_vector_t vector;
     image_component_text_info_t text_info;
+    image_component_glyphs_t glyphs;
   };
 
 } image_component_t;
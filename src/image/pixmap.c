@@ -27,6 +27,7 @@
 #include "main.h"
 #include "arch/atomic.h"
 #include "pixmap.h"
+#include "pixmap_kernels.h"
 #include "misc/minmax.h"
 #include "image/jpeg.h"
 #include "backend/backend.h"
@@ -217,11 +218,7 @@ rgb24_to_bgr32(pixmap_t *src)
   for(y = 0; y < src->pm_height; y++) {
     const uint8_t *s = src->pm_data + y * src->pm_linesize;
     uint32_t *d = (uint32_t *)(dst->pm_data + y * dst->pm_linesize);
-    int x;
-    for(x = 0; x < src->pm_width; x++) {
-      *d++ = 0xff000000 | s[2] << 16 | s[1] << 8 | s[0]; 
-      s+= 3;
-    }
+    pixmap_kernels_get()->pk_rgb24_to_bgr32(d, s, src->pm_width);
   }
   return dst;
 }
@@ -364,100 +361,6 @@ composite_GRAY8_on_IA_full_alpha(uint8_t *dst, const uint8_t *src,
 }
 
 
-
-#if 0
-
-static void
-composite_GRAY8_on_BGR32(uint8_t *dst_, const uint8_t *src,
-			 int r0, int g0, int b0, int a0,
-			 int width)
-{
-  int x;
-  uint32_t *dst = (uint32_t *)dst_;
-  int a, r, g, b, pa, y;
-  uint32_t u32;
-
-  for(x = 0; x < width; x++) {
-    
-    u32 = *dst;
-
-    r = u32 & 0xff;
-    g = (u32 >> 8) & 0xff;
-    b = (u32 >> 16) & 0xff;
-    a = (u32 >> 24) & 0xff;
-
-    pa = a;
-    y = FIXMUL(a0, *src);
-    a = y + FIXMUL(a, 255 - y);
-
-    if(a) {
-      r = ((FIXMUL(r0, y) + FIX3MUL(r, pa, (255 - y))) * 255) / a;
-      g = ((FIXMUL(g0, y) + FIX3MUL(g, pa, (255 - y))) * 255) / a;
-      b = ((FIXMUL(b0, y) + FIX3MUL(b, pa, (255 - y))) * 255) / a;
-    } else {
-      r = g = b = 0;
-    }
-    u32 = a << 24 | b << 16 | g << 8 | r;
-    *dst = u32;
-    src++;
-    dst++;
-  }
-}
-
-
-#else
-
-
-
-static void
-composite_GRAY8_on_BGR32(uint8_t *dst_, const uint8_t *src,
-			 int CR, int CG, int CB, int CA,
-			 int width)
-{
-  int x;
-  uint32_t *dst = (uint32_t *)dst_;
-  uint32_t u32;
-
-  for(x = 0; x < width; x++) {
-
-    int SA = DIV255(*src * CA);
-    int SR = CR;
-    int SG = CG;
-    int SB = CB;
-
-    u32 = *dst;
-    
-    int DR =  u32        & 0xff;
-    int DG = (u32 >> 8)  & 0xff;
-    int DB = (u32 >> 16) & 0xff;
-    int DA = (u32 >> 24) & 0xff;
-
-    int FA = SA + DIV255((255 - SA) * DA);
-
-    if(FA == 0) {
-      SA = 0;
-      u32 = 0;
-    } else {
-      if(FA != 255)
-	SA = SA * 255 / FA;
-
-      DA = 255 - SA;
-      
-      DB = DIV255(SB * SA + DB * DA);
-      DG = DIV255(SG * SA + DG * DA);
-      DR = DIV255(SR * SA + DR * DA);
-      
-      u32 = FA << 24 | DB << 16 | DG << 8 | DR;
-    }
-    *dst = u32;
-
-    src++;
-    dst++;
-  }
-}
-#endif
-
-
 /**
  *
  */
@@ -485,7 +388,7 @@ pixmap_composite(pixmap_t *dst, const pixmap_t *src,
   else if(src->pm_type == PIXMAP_I && dst->pm_type == PIXMAP_IA)
     fn = composite_GRAY8_on_IA;
   else if(src->pm_type == PIXMAP_I && dst->pm_type == PIXMAP_BGR32)
-    fn = composite_GRAY8_on_BGR32;
+    fn = pixmap_kernels_get()->pk_composite_GRAY8_on_BGR32;
   else
     return;
   
@@ -559,57 +462,6 @@ box_blur_line_2chan(uint8_t *d, const uint32_t *a, const uint32_t *b,
 }
 
 
-
-static void
-box_blur_line_4chan(uint8_t *d, const uint32_t *a, const uint32_t *b,
-		    int width, int boxw, int m)
-{
-  int x;
-  unsigned int v;
-  for(x = 0; x < boxw; x++) {
-    const int x1 = 4 * MIN(x + boxw, width - 1);
-    const int x2 = 0;
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
-    *d++ = (v * m) >> 16;
-  }
-
-  for(; x < width - boxw; x++) {
-    const int x1 = 4 * (x + boxw);
-    const int x2 = 4 * (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
-    *d++ = (v * m) >> 16;
-  }
-
-  for(; x < width; x++) {
-    const int x1 = 4 * (width - 1);
-    const int x2 = 4 * (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
-    *d++ = (v * m) >> 16;
-    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
-    *d++ = (v * m) >> 16;
-  }
-}
-
-
 /**
  *
  */
@@ -634,7 +486,7 @@ pixmap_box_blur(pixmap_t *pm, int boxw, int boxh)
     fn = box_blur_line_2chan;
     break;
   case 4:
-    fn = box_blur_line_4chan;
+    fn = pixmap_kernels_get()->pk_box_blur_line_4chan;
     break;
 
 
@@ -691,89 +543,6 @@ pixmap_box_blur(pixmap_t *pm, int boxw, int boxh)
 }
 
 
-
-/**
- *
- */
-static uint32_t
-mix_bgr32(uint32_t src, uint32_t dst)
-{
-  int SR =  src        & 0xff;
-  int SG = (src >> 8)  & 0xff;
-  int SB = (src >> 16) & 0xff;
-  int SA = (src >> 24) & 0xff;
-  
-  int DR =  dst        & 0xff;
-  int DG = (dst >> 8)  & 0xff;
-  int DB = (dst >> 16) & 0xff;
-  int DA = (dst >> 24) & 0xff;
-  
-  int FA = SA + DIV255((255 - SA) * DA);
-
-  if(FA == 0) {
-    dst = 0;
-  } else {
-    if(FA != 255)
-      SA = SA * 255 / FA;
-    
-    DA = 255 - SA;
-    
-    DB = DIV255(SB * SA + DB * DA);
-    DG = DIV255(SG * SA + DG * DA);
-    DR = DIV255(SR * SA + DR * DA);
-    
-    dst = FA << 24 | DB << 16 | DG << 8 | DR;
-  }
-  return dst;
-}
-
-
-
-/**
- *
- */
-static void
-drop_shadow_rgba(uint8_t *D, const uint32_t *a, const uint32_t *b,
-                 int width, int boxw, int m)
-{
-  uint32_t *d = (uint32_t *)D;
-
-  int x;
-  unsigned int v;
-  int s;
-  for(x = 0; x < boxw; x++) {
-    const int x1 = MIN(x + boxw, width - 1);
-    const int x2 = 0;
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-
-    *d = mix_bgr32(*d, s << 24);
-    d++;
-  }
-
-  for(; x < width - boxw; x++) {
-    const int x1 = (x + boxw);
-    const int x2 = (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-    *d = mix_bgr32(*d, s << 24);
-    d++;
-  }
-
-  for(; x < width; x++) {
-    const int x1 = (width - 1);
-    const int x2 = (x - boxw);
-
-    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
-    s = (v * m) >> 16;
-    *d = mix_bgr32(*d, s << 24);
-    d++;
-  }
-}
-
-
 /**
  *
  */
@@ -874,7 +643,7 @@ pixmap_drop_shadow(pixmap_t *pm, int boxw, int boxh)
   case PIXMAP_BGR32:
     ach = 3;
     z = 4;
-    fn = drop_shadow_rgba;
+    fn = pixmap_kernels_get()->pk_drop_shadow_rgba;
     break;
 
   case PIXMAP_IA:
@@ -924,38 +693,6 @@ pixmap_drop_shadow(pixmap_t *pm, int boxw, int boxh)
 }
 
 
-
-
-// gcc -O3 src/misc/pixmap.c -o /tmp/pixmap -Isrc -DLOCAL_MAIN
-
-#ifdef LOCAL_MAIN
-
-static int64_t
-get_ts(void)
-{
-  struct timeval tv;
-  gettimeofday(&tv, NULL);
-  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
-}
-
-int
-main(int argc, char **argv)
-{
-  pixmap_t *dst = pixmap_create(2048, 2048, PIXMAP_BGR32);
-  pixmap_t *src = pixmap_create(2048, 2048, PIXMAP_GRAY8);
-
-  memset(src->pm_pixels, 0xff, src->pm_linesize * src->pm_height);
-
-  int64_t a = get_ts();
-  pixmap_composite(dst, src, 0, 0, 0xffffffff);
-  printf("Compositing in %dµs\n",(int)( get_ts() - a));
-  printf("dst pixel(0,0) = 0x%x\n", dst->pm_pixels[0]);
-  return 0;
-}
-
-#endif
-
-
 /**
  *
  */
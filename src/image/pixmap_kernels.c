@@ -0,0 +1,1186 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "misc/minmax.h"
+#include "pixmap_kernels.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define PIXMAP_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define PIXMAP_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && !defined(__clang__) && \
+  (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define PIXMAP_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+
+#define DIV255(x) (((((x)+255)>>8)+(x))>>8)
+
+
+/**
+ * Plain C versions, these define the expected output of the SIMD
+ * versions down to the last bit
+ */
+static void
+composite_GRAY8_on_BGR32(uint8_t *dst_, const uint8_t *src,
+			 int CR, int CG, int CB, int CA,
+			 int width)
+{
+  int x;
+  uint32_t *dst = (uint32_t *)dst_;
+  uint32_t u32;
+
+  for(x = 0; x < width; x++) {
+
+    int SA = DIV255(*src * CA);
+    int SR = CR;
+    int SG = CG;
+    int SB = CB;
+
+    u32 = *dst;
+
+    int DR =  u32        & 0xff;
+    int DG = (u32 >> 8)  & 0xff;
+    int DB = (u32 >> 16) & 0xff;
+    int DA = (u32 >> 24) & 0xff;
+
+    int FA = SA + DIV255((255 - SA) * DA);
+
+    if(FA == 0) {
+      SA = 0;
+      u32 = 0;
+    } else {
+      if(FA != 255)
+	SA = SA * 255 / FA;
+
+      DA = 255 - SA;
+
+      DB = DIV255(SB * SA + DB * DA);
+      DG = DIV255(SG * SA + DG * DA);
+      DR = DIV255(SR * SA + DR * DA);
+
+      u32 = FA << 24 | DB << 16 | DG << 8 | DR;
+    }
+    *dst = u32;
+
+    src++;
+    dst++;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+box_blur_line_4chan(uint8_t *d, const uint32_t *a, const uint32_t *b,
+		    int width, int boxw, int m)
+{
+  int x;
+  unsigned int v;
+  for(x = 0; x < boxw; x++) {
+    const int x1 = 4 * MIN(x + boxw, width - 1);
+    const int x2 = 0;
+
+    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
+    *d++ = (v * m) >> 16;
+  }
+
+  for(; x < width - boxw; x++) {
+    const int x1 = 4 * (x + boxw);
+    const int x2 = 4 * (x - boxw);
+
+    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
+    *d++ = (v * m) >> 16;
+  }
+
+  for(; x < width; x++) {
+    const int x1 = 4 * (width - 1);
+    const int x2 = 4 * (x - boxw);
+
+    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 1] + a[x2 + 1] - b[x2 + 1] - a[x1 + 1];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 2] + a[x2 + 2] - b[x2 + 2] - a[x1 + 2];
+    *d++ = (v * m) >> 16;
+    v = b[x1 + 3] + a[x2 + 3] - b[x2 + 3] - a[x1 + 3];
+    *d++ = (v * m) >> 16;
+  }
+}
+
+
+/**
+ *
+ */
+static uint32_t
+mix_bgr32(uint32_t src, uint32_t dst)
+{
+  int SR =  src        & 0xff;
+  int SG = (src >> 8)  & 0xff;
+  int SB = (src >> 16) & 0xff;
+  int SA = (src >> 24) & 0xff;
+
+  int DR =  dst        & 0xff;
+  int DG = (dst >> 8)  & 0xff;
+  int DB = (dst >> 16) & 0xff;
+  int DA = (dst >> 24) & 0xff;
+
+  int FA = SA + DIV255((255 - SA) * DA);
+
+  if(FA == 0) {
+    dst = 0;
+  } else {
+    if(FA != 255)
+      SA = SA * 255 / FA;
+
+    DA = 255 - SA;
+
+    DB = DIV255(SB * SA + DB * DA);
+    DG = DIV255(SG * SA + DG * DA);
+    DR = DIV255(SR * SA + DR * DA);
+
+    dst = FA << 24 | DB << 16 | DG << 8 | DR;
+  }
+  return dst;
+}
+
+
+/**
+ *
+ */
+static void
+drop_shadow_rgba(uint8_t *D, const uint32_t *a, const uint32_t *b,
+                 int width, int boxw, int m)
+{
+  uint32_t *d = (uint32_t *)D;
+
+  int x;
+  unsigned int v;
+  int s;
+  for(x = 0; x < boxw; x++) {
+    const int x1 = MIN(x + boxw, width - 1);
+    const int x2 = 0;
+
+    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
+    s = (v * m) >> 16;
+
+    *d = mix_bgr32(*d, s << 24);
+    d++;
+  }
+
+  for(; x < width - boxw; x++) {
+    const int x1 = (x + boxw);
+    const int x2 = (x - boxw);
+
+    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
+    s = (v * m) >> 16;
+    *d = mix_bgr32(*d, s << 24);
+    d++;
+  }
+
+  for(; x < width; x++) {
+    const int x1 = (width - 1);
+    const int x2 = (x - boxw);
+
+    v = b[x1 + 0] + a[x2 + 0] - b[x2 + 0] - a[x1 + 0];
+    s = (v * m) >> 16;
+    *d = mix_bgr32(*d, s << 24);
+    d++;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+rgb24_to_bgr32(uint32_t *d, const uint8_t *s, int width)
+{
+  int x;
+  for(x = 0; x < width; x++) {
+    *d++ = 0xff000000 | s[2] << 16 | s[1] << 8 | s[0];
+    s+= 3;
+  }
+}
+
+
+static const pixmap_kernels_t pixmap_kernels_c = {
+  .pk_name                     = "C",
+  .pk_composite_GRAY8_on_BGR32 = composite_GRAY8_on_BGR32,
+  .pk_box_blur_line_4chan      = box_blur_line_4chan,
+  .pk_drop_shadow_rgba         = drop_shadow_rgba,
+  .pk_rgb24_to_bgr32           = rgb24_to_bgr32,
+};
+
+
+/**
+ * The SIMD versions only vectorize the interior of the blur kernels
+ * where both sides of the box are inside the line. The edges are done
+ * with these helpers, same math as above
+ */
+static inline void
+blur_pixel_4chan(uint8_t *d, const uint32_t *a, const uint32_t *b,
+                 int x1, int x2, unsigned int m)
+{
+  for(int i = 0; i < 4; i++) {
+    unsigned int v = b[x1 + i] + a[x2 + i] - b[x2 + i] - a[x1 + i];
+    d[i] = (v * m) >> 16;
+  }
+}
+
+static inline void
+shadow_pixel_rgba(uint32_t *d, const uint32_t *a, const uint32_t *b,
+                  int x1, int x2, unsigned int m)
+{
+  unsigned int v = b[x1] + a[x2] - b[x2] - a[x1];
+  int s = (v * m) >> 16;
+  *d = mix_bgr32(*d, s << 24);
+}
+
+
+#ifdef PIXMAP_SSE2
+
+/**
+ * SSE2
+ *
+ * All math is done in 32 bit lanes, one pixel component per lane.
+ * Everything that is multiplied is < 256 so _mm_mullo_epi16() gives
+ * the full product (the upper halves of the lanes are zero).
+ */
+
+static inline __m128i
+div255_sse2(__m128i x)
+{
+  __m128i t = _mm_srli_epi32(_mm_add_epi32(x, _mm_set1_epi32(255)), 8);
+  return _mm_srli_epi32(_mm_add_epi32(t, x), 8);
+}
+
+
+/**
+ * Low 32 bits of a 32x32 bit multiply
+ */
+static inline __m128i
+mul32_sse2(__m128i a, __m128i b)
+{
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                            _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0,0,2,0)));
+}
+
+
+/**
+ * Same as mix_bgr32() for four pixels
+ */
+static inline __m128i
+mix_bgr32_sse2(__m128i SR, __m128i SG, __m128i SB, __m128i SA,
+               __m128i DR, __m128i DG, __m128i DB, __m128i DA)
+{
+  const __m128i c255 = _mm_set1_epi32(255);
+
+  __m128i FA = _mm_add_epi32(SA, div255_sse2(_mm_mullo_epi16(_mm_sub_epi32(c255, SA), DA)));
+  __m128i zero = _mm_cmpeq_epi32(FA, _mm_setzero_si128());
+
+  // SA * 255 / FA. Both operands are exact in a float and the quotient
+  // is < 256 so truncating the float quotient gives the integer one
+  __m128i den = _mm_or_si128(FA, _mm_and_si128(zero, _mm_set1_epi32(1)));
+  __m128 q = _mm_div_ps(_mm_cvtepi32_ps(_mm_mullo_epi16(SA, c255)),
+                        _mm_cvtepi32_ps(den));
+  SA = _mm_cvttps_epi32(q);
+  DA = _mm_sub_epi32(c255, SA);
+
+  DB = div255_sse2(_mm_add_epi32(_mm_mullo_epi16(SB, SA),
+                                 _mm_mullo_epi16(DB, DA)));
+  DG = div255_sse2(_mm_add_epi32(_mm_mullo_epi16(SG, SA),
+                                 _mm_mullo_epi16(DG, DA)));
+  DR = div255_sse2(_mm_add_epi32(_mm_mullo_epi16(SR, SA),
+                                 _mm_mullo_epi16(DR, DA)));
+
+  __m128i r = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(FA, 24),
+                                        _mm_slli_epi32(DB, 16)),
+                           _mm_or_si128(_mm_slli_epi32(DG, 8), DR));
+  return _mm_andnot_si128(zero, r);
+}
+
+
+/**
+ *
+ */
+static void
+composite_GRAY8_on_BGR32_sse2(uint8_t *dst, const uint8_t *src,
+                              int CR, int CG, int CB, int CA, int width)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128i SR = _mm_set1_epi32(CR);
+  const __m128i SG = _mm_set1_epi32(CG);
+  const __m128i SB = _mm_set1_epi32(CB);
+  const __m128i A  = _mm_set1_epi32(CA);
+  int x = 0;
+
+  for(; x + 4 <= width; x += 4) {
+    uint32_t s4;
+    memcpy(&s4, src + x, 4);
+    __m128i s = _mm_cvtsi32_si128(s4);
+    s = _mm_unpacklo_epi8(s, _mm_setzero_si128());
+    s = _mm_unpacklo_epi16(s, _mm_setzero_si128());
+
+    __m128i d = _mm_loadu_si128((const __m128i *)(dst + x * 4));
+
+    __m128i r = mix_bgr32_sse2(SR, SG, SB,
+                               div255_sse2(_mm_mullo_epi16(s, A)),
+                               _mm_and_si128(d, mask),
+                               _mm_and_si128(_mm_srli_epi32(d, 8), mask),
+                               _mm_and_si128(_mm_srli_epi32(d, 16), mask),
+                               _mm_srli_epi32(d, 24));
+
+    _mm_storeu_si128((__m128i *)(dst + x * 4), r);
+  }
+
+  if(x < width)
+    composite_GRAY8_on_BGR32(dst + x * 4, src + x, CR, CG, CB, CA, width - x);
+}
+
+
+/**
+ *
+ */
+static inline __m128i
+blur_pixel_4chan_sse2(const uint32_t *a, const uint32_t *b,
+                      int x1, int x2, __m128i m)
+{
+  __m128i v = _mm_sub_epi32(
+    _mm_add_epi32(_mm_loadu_si128((const __m128i *)(b + x1)),
+                  _mm_loadu_si128((const __m128i *)(a + x2))),
+    _mm_add_epi32(_mm_loadu_si128((const __m128i *)(b + x2)),
+                  _mm_loadu_si128((const __m128i *)(a + x1))));
+  return _mm_and_si128(_mm_srli_epi32(mul32_sse2(v, m), 16),
+                       _mm_set1_epi32(0xff));
+}
+
+
+/**
+ *
+ */
+static void
+box_blur_line_4chan_sse2(uint8_t *d, const uint32_t *a, const uint32_t *b,
+                         int width, int boxw, int m)
+{
+  const __m128i M = _mm_set1_epi32(m);
+  int x;
+
+  for(x = 0; x < boxw; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * MIN(x + boxw, width - 1), 0, m);
+
+  for(; x + 4 <= width - boxw; x += 4, d += 16) {
+    const int x1 = 4 * (x + boxw);
+    const int x2 = 4 * (x - boxw);
+
+    // Results are masked to 8 bits so the saturating packs are exact
+    __m128i p0 = _mm_packs_epi32(blur_pixel_4chan_sse2(a, b, x1,     x2,     M),
+                                 blur_pixel_4chan_sse2(a, b, x1 + 4, x2 + 4, M));
+    __m128i p1 = _mm_packs_epi32(blur_pixel_4chan_sse2(a, b, x1 + 8, x2 + 8, M),
+                                 blur_pixel_4chan_sse2(a, b, x1 + 12, x2 + 12, M));
+    _mm_storeu_si128((__m128i *)d, _mm_packus_epi16(p0, p1));
+  }
+
+  for(; x < width - boxw; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * (x + boxw), 4 * (x - boxw), m);
+
+  for(; x < width; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * (width - 1), 4 * (x - boxw), m);
+}
+
+
+/**
+ *
+ */
+static void
+drop_shadow_rgba_sse2(uint8_t *D, const uint32_t *a, const uint32_t *b,
+                      int width, int boxw, int m)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i M = _mm_set1_epi32(m);
+  uint32_t *d = (uint32_t *)D;
+  int x;
+
+  for(x = 0; x < boxw; x++, d++)
+    shadow_pixel_rgba(d, a, b, MIN(x + boxw, width - 1), 0, m);
+
+  for(; x + 4 <= width - boxw; x += 4, d += 4) {
+    __m128i s = blur_pixel_4chan_sse2(a, b, x + boxw, x - boxw, M);
+    __m128i p = _mm_loadu_si128((const __m128i *)d);
+
+    __m128i r = mix_bgr32_sse2(_mm_and_si128(p, mask),
+                               _mm_and_si128(_mm_srli_epi32(p, 8), mask),
+                               _mm_and_si128(_mm_srli_epi32(p, 16), mask),
+                               _mm_srli_epi32(p, 24),
+                               zero, zero, zero, s);
+    _mm_storeu_si128((__m128i *)d, r);
+  }
+
+  for(; x < width - boxw; x++, d++)
+    shadow_pixel_rgba(d, a, b, x + boxw, x - boxw, m);
+
+  for(; x < width; x++, d++)
+    shadow_pixel_rgba(d, a, b, width - 1, x - boxw, m);
+}
+
+
+/**
+ * On little endian the BGR32 word is just the three source bytes with
+ * alpha on top, so gather four unaligned words at a time
+ */
+static void
+rgb24_to_bgr32_sse2(uint32_t *d, const uint8_t *s, int width)
+{
+  const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+  int x = 0;
+
+  // Each load reads 16 bytes but we only use 12
+  for(; x + 6 <= width; x += 4, s += 12, d += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)s);
+    __m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+    __m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6),
+                                     _mm_srli_si128(v, 9));
+    v = _mm_unpacklo_epi64(p01, p23);
+    v = _mm_or_si128(_mm_and_si128(v, rgb), alpha);
+    _mm_storeu_si128((__m128i *)d, v);
+  }
+
+  if(x < width)
+    rgb24_to_bgr32(d, s, width - x);
+}
+
+
+static const pixmap_kernels_t pixmap_kernels_sse2 = {
+  .pk_name                     = "SSE2",
+  .pk_composite_GRAY8_on_BGR32 = composite_GRAY8_on_BGR32_sse2,
+  .pk_box_blur_line_4chan      = box_blur_line_4chan_sse2,
+  .pk_drop_shadow_rgba         = drop_shadow_rgba_sse2,
+  .pk_rgb24_to_bgr32           = rgb24_to_bgr32_sse2,
+};
+
+#endif // PIXMAP_SSE2
+
+
+#ifdef PIXMAP_AVX2
+
+/**
+ * AVX2, eight pixels at a time. Only compiled with a target attribute
+ * and selected at runtime if the CPU has it
+ */
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i
+div255_avx2(__m256i x)
+{
+  __m256i t = _mm256_srli_epi32(_mm256_add_epi32(x, _mm256_set1_epi32(255)),8);
+  return _mm256_srli_epi32(_mm256_add_epi32(t, x), 8);
+}
+
+
+/**
+ * Same as mix_bgr32() for eight pixels
+ */
+static inline AVX2 __m256i
+mix_bgr32_avx2(__m256i SR, __m256i SG, __m256i SB, __m256i SA,
+               __m256i DR, __m256i DG, __m256i DB, __m256i DA)
+{
+  const __m256i c255 = _mm256_set1_epi32(255);
+
+  __m256i FA = _mm256_add_epi32(SA, div255_avx2(_mm256_mullo_epi32(_mm256_sub_epi32(c255, SA), DA)));
+  __m256i zero = _mm256_cmpeq_epi32(FA, _mm256_setzero_si256());
+
+  __m256i den = _mm256_or_si256(FA, _mm256_and_si256(zero,
+                                                     _mm256_set1_epi32(1)));
+  __m256 q = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_mullo_epi32(SA, c255)),
+                           _mm256_cvtepi32_ps(den));
+  SA = _mm256_cvttps_epi32(q);
+  DA = _mm256_sub_epi32(c255, SA);
+
+  DB = div255_avx2(_mm256_add_epi32(_mm256_mullo_epi32(SB, SA),
+                                    _mm256_mullo_epi32(DB, DA)));
+  DG = div255_avx2(_mm256_add_epi32(_mm256_mullo_epi32(SG, SA),
+                                    _mm256_mullo_epi32(DG, DA)));
+  DR = div255_avx2(_mm256_add_epi32(_mm256_mullo_epi32(SR, SA),
+                                    _mm256_mullo_epi32(DR, DA)));
+
+  __m256i r = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(FA, 24),
+                                              _mm256_slli_epi32(DB, 16)),
+                              _mm256_or_si256(_mm256_slli_epi32(DG, 8), DR));
+  return _mm256_andnot_si256(zero, r);
+}
+
+
+/**
+ *
+ */
+static AVX2 void
+composite_GRAY8_on_BGR32_avx2(uint8_t *dst, const uint8_t *src,
+                              int CR, int CG, int CB, int CA, int width)
+{
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256i SR = _mm256_set1_epi32(CR);
+  const __m256i SG = _mm256_set1_epi32(CG);
+  const __m256i SB = _mm256_set1_epi32(CB);
+  const __m256i A  = _mm256_set1_epi32(CA);
+  int x = 0;
+
+  for(; x + 8 <= width; x += 8) {
+    __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + x)));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(dst + x * 4));
+
+    __m256i r = mix_bgr32_avx2(SR, SG, SB,
+                               div255_avx2(_mm256_mullo_epi32(s, A)),
+                               _mm256_and_si256(d, mask),
+                               _mm256_and_si256(_mm256_srli_epi32(d, 8), mask),
+                               _mm256_and_si256(_mm256_srli_epi32(d, 16), mask),
+                               _mm256_srli_epi32(d, 24));
+
+    _mm256_storeu_si256((__m256i *)(dst + x * 4), r);
+  }
+
+  if(x < width)
+    composite_GRAY8_on_BGR32_sse2(dst + x * 4, src + x,
+                                  CR, CG, CB, CA, width - x);
+}
+
+
+/**
+ * Two pixels (four components each) of the blur box
+ */
+static inline AVX2 __m256i
+blur_pixel_4chan_avx2(const uint32_t *a, const uint32_t *b,
+                      int x1, int x2, __m256i m)
+{
+  __m256i v = _mm256_sub_epi32(
+    _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(b + x1)),
+                     _mm256_loadu_si256((const __m256i *)(a + x2))),
+    _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(b + x2)),
+                     _mm256_loadu_si256((const __m256i *)(a + x1))));
+  return _mm256_and_si256(_mm256_srli_epi32(_mm256_mullo_epi32(v, m), 16),
+                          _mm256_set1_epi32(0xff));
+}
+
+
+/**
+ *
+ */
+static AVX2 void
+box_blur_line_4chan_avx2(uint8_t *d, const uint32_t *a, const uint32_t *b,
+                         int width, int boxw, int m)
+{
+  const __m256i M = _mm256_set1_epi32(m);
+  // The packs below work within 128 bit lanes, this puts pixels
+  // back in order
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  int x;
+
+  for(x = 0; x < boxw; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * MIN(x + boxw, width - 1), 0, m);
+
+  for(; x + 8 <= width - boxw; x += 8, d += 32) {
+    const int x1 = 4 * (x + boxw);
+    const int x2 = 4 * (x - boxw);
+
+    __m256i p0 = _mm256_packs_epi32(blur_pixel_4chan_avx2(a, b, x1,     x2,     M),
+                                    blur_pixel_4chan_avx2(a, b, x1 + 8, x2 + 8, M));
+    __m256i p1 = _mm256_packs_epi32(blur_pixel_4chan_avx2(a, b, x1 + 16, x2 + 16, M),
+                                    blur_pixel_4chan_avx2(a, b, x1 + 24, x2 + 24, M));
+    __m256i r = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(p0, p1), order);
+    _mm256_storeu_si256((__m256i *)d, r);
+  }
+
+  for(; x < width - boxw; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * (x + boxw), 4 * (x - boxw), m);
+
+  for(; x < width; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * (width - 1), 4 * (x - boxw), m);
+}
+
+
+/**
+ *
+ */
+static AVX2 void
+drop_shadow_rgba_avx2(uint8_t *D, const uint32_t *a, const uint32_t *b,
+                      int width, int boxw, int m)
+{
+  const __m256i mask = _mm256_set1_epi32(0xff);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i M = _mm256_set1_epi32(m);
+  uint32_t *d = (uint32_t *)D;
+  int x;
+
+  for(x = 0; x < boxw; x++, d++)
+    shadow_pixel_rgba(d, a, b, MIN(x + boxw, width - 1), 0, m);
+
+  for(; x + 8 <= width - boxw; x += 8, d += 8) {
+    __m256i s = blur_pixel_4chan_avx2(a, b, x + boxw, x - boxw, M);
+    __m256i p = _mm256_loadu_si256((const __m256i *)d);
+
+    __m256i r = mix_bgr32_avx2(_mm256_and_si256(p, mask),
+                               _mm256_and_si256(_mm256_srli_epi32(p, 8), mask),
+                               _mm256_and_si256(_mm256_srli_epi32(p, 16), mask),
+                               _mm256_srli_epi32(p, 24),
+                               zero, zero, zero, s);
+    _mm256_storeu_si256((__m256i *)d, r);
+  }
+
+  for(; x < width - boxw; x++, d++)
+    shadow_pixel_rgba(d, a, b, x + boxw, x - boxw, m);
+
+  for(; x < width; x++, d++)
+    shadow_pixel_rgba(d, a, b, width - 1, x - boxw, m);
+}
+
+
+static const pixmap_kernels_t pixmap_kernels_avx2 = {
+  .pk_name                     = "AVX2",
+  .pk_composite_GRAY8_on_BGR32 = composite_GRAY8_on_BGR32_avx2,
+  .pk_box_blur_line_4chan      = box_blur_line_4chan_avx2,
+  .pk_drop_shadow_rgba         = drop_shadow_rgba_avx2,
+  .pk_rgb24_to_bgr32           = rgb24_to_bgr32_sse2,  // Memory bound
+};
+
+#endif // PIXMAP_AVX2
+
+
+#ifdef PIXMAP_NEON
+
+/**
+ * NEON
+ *
+ * ARMv7 NEON has no divide so SA * 255 / FA is computed with a refined
+ * reciprocal estimate and then corrected to the exact integer quotient
+ */
+
+static inline uint32x4_t
+div255_neon(uint32x4_t x)
+{
+  uint32x4_t t = vshrq_n_u32(vaddq_u32(x, vdupq_n_u32(255)), 8);
+  return vshrq_n_u32(vaddq_u32(t, x), 8);
+}
+
+
+/**
+ * num / den for num < 65536 and 0 < den < 256
+ */
+static inline uint32x4_t
+udiv_neon(uint32x4_t num, uint32x4_t den)
+{
+  const uint32x4_t one = vdupq_n_u32(1);
+  float32x4_t fd = vcvtq_f32_u32(den);
+  float32x4_t r = vrecpeq_f32(fd);
+  r = vmulq_f32(r, vrecpsq_f32(fd, r));
+  r = vmulq_f32(r, vrecpsq_f32(fd, r));
+  uint32x4_t q = vcvtq_u32_f32(vmulq_f32(vcvtq_f32_u32(num), r));
+
+  // Off by at most one, comparison masks are all ones (-1) when true
+  q = vaddq_u32(q, vcgtq_u32(vmulq_u32(q, den), num));
+  q = vsubq_u32(q, vcleq_u32(vmulq_u32(vaddq_u32(q, one), den), num));
+  return q;
+}
+
+
+/**
+ * Same as mix_bgr32() for four pixels
+ */
+static inline uint32x4_t
+mix_bgr32_neon(uint32x4_t SR, uint32x4_t SG, uint32x4_t SB, uint32x4_t SA,
+               uint32x4_t DR, uint32x4_t DG, uint32x4_t DB, uint32x4_t DA)
+{
+  const uint32x4_t c255 = vdupq_n_u32(255);
+
+  uint32x4_t FA = vaddq_u32(SA, div255_neon(vmulq_u32(vsubq_u32(c255, SA), DA)));
+  uint32x4_t zero = vceqq_u32(FA, vdupq_n_u32(0));
+
+  SA = udiv_neon(vmulq_u32(SA, c255),
+                 vorrq_u32(FA, vandq_u32(zero, vdupq_n_u32(1))));
+  DA = vsubq_u32(c255, SA);
+
+  DB = div255_neon(vmlaq_u32(vmulq_u32(SB, SA), DB, DA));
+  DG = div255_neon(vmlaq_u32(vmulq_u32(SG, SA), DG, DA));
+  DR = div255_neon(vmlaq_u32(vmulq_u32(SR, SA), DR, DA));
+
+  uint32x4_t r = vorrq_u32(vorrq_u32(vshlq_n_u32(FA, 24), vshlq_n_u32(DB, 16)),
+                           vorrq_u32(vshlq_n_u32(DG, 8), DR));
+  return vbicq_u32(r, zero);
+}
+
+
+/**
+ *
+ */
+static void
+composite_GRAY8_on_BGR32_neon(uint8_t *dst, const uint8_t *src,
+                              int CR, int CG, int CB, int CA, int width)
+{
+  const uint32x4_t mask = vdupq_n_u32(0xff);
+  const uint32x4_t SR = vdupq_n_u32(CR);
+  const uint32x4_t SG = vdupq_n_u32(CG);
+  const uint32x4_t SB = vdupq_n_u32(CB);
+  const uint32x4_t A  = vdupq_n_u32(CA);
+  int x = 0;
+
+  for(; x + 8 <= width; x += 8) {
+    uint16x8_t s16 = vmovl_u8(vld1_u8(src + x));
+
+    for(int i = 0; i < 2; i++) {
+      uint32_t *dp = (uint32_t *)dst + x + i * 4;
+      uint32x4_t s = vmovl_u16(i ? vget_high_u16(s16) : vget_low_u16(s16));
+      uint32x4_t d = vld1q_u32(dp);
+
+      uint32x4_t r = mix_bgr32_neon(SR, SG, SB,
+                                    div255_neon(vmulq_u32(s, A)),
+                                    vandq_u32(d, mask),
+                                    vandq_u32(vshrq_n_u32(d, 8), mask),
+                                    vandq_u32(vshrq_n_u32(d, 16), mask),
+                                    vshrq_n_u32(d, 24));
+      vst1q_u32(dp, r);
+    }
+  }
+
+  if(x < width)
+    composite_GRAY8_on_BGR32(dst + x * 4, src + x, CR, CG, CB, CA, width - x);
+}
+
+
+/**
+ *
+ */
+static inline uint32x4_t
+blur_pixel_4chan_neon(const uint32_t *a, const uint32_t *b,
+                      int x1, int x2, uint32x4_t m)
+{
+  uint32x4_t v = vsubq_u32(vaddq_u32(vld1q_u32(b + x1), vld1q_u32(a + x2)),
+                           vaddq_u32(vld1q_u32(b + x2), vld1q_u32(a + x1)));
+  return vandq_u32(vshrq_n_u32(vmulq_u32(v, m), 16), vdupq_n_u32(0xff));
+}
+
+
+/**
+ *
+ */
+static void
+box_blur_line_4chan_neon(uint8_t *d, const uint32_t *a, const uint32_t *b,
+                         int width, int boxw, int m)
+{
+  const uint32x4_t M = vdupq_n_u32(m);
+  int x;
+
+  for(x = 0; x < boxw; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * MIN(x + boxw, width - 1), 0, m);
+
+  for(; x + 2 <= width - boxw; x += 2, d += 8) {
+    const int x1 = 4 * (x + boxw);
+    const int x2 = 4 * (x - boxw);
+
+    uint16x8_t p = vcombine_u16(vmovn_u32(blur_pixel_4chan_neon(a, b, x1, x2, M)),
+                                vmovn_u32(blur_pixel_4chan_neon(a, b, x1 + 4, x2 + 4, M)));
+    vst1_u8(d, vmovn_u16(p));
+  }
+
+  for(; x < width - boxw; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * (x + boxw), 4 * (x - boxw), m);
+
+  for(; x < width; x++, d += 4)
+    blur_pixel_4chan(d, a, b, 4 * (width - 1), 4 * (x - boxw), m);
+}
+
+
+/**
+ *
+ */
+static void
+drop_shadow_rgba_neon(uint8_t *D, const uint32_t *a, const uint32_t *b,
+                      int width, int boxw, int m)
+{
+  const uint32x4_t mask = vdupq_n_u32(0xff);
+  const uint32x4_t zero = vdupq_n_u32(0);
+  const uint32x4_t M = vdupq_n_u32(m);
+  uint32_t *d = (uint32_t *)D;
+  int x;
+
+  for(x = 0; x < boxw; x++, d++)
+    shadow_pixel_rgba(d, a, b, MIN(x + boxw, width - 1), 0, m);
+
+  for(; x + 4 <= width - boxw; x += 4, d += 4) {
+    uint32x4_t s = blur_pixel_4chan_neon(a, b, x + boxw, x - boxw, M);
+    uint32x4_t p = vld1q_u32(d);
+
+    uint32x4_t r = mix_bgr32_neon(vandq_u32(p, mask),
+                                  vandq_u32(vshrq_n_u32(p, 8), mask),
+                                  vandq_u32(vshrq_n_u32(p, 16), mask),
+                                  vshrq_n_u32(p, 24),
+                                  zero, zero, zero, s);
+    vst1q_u32(d, r);
+  }
+
+  for(; x < width - boxw; x++, d++)
+    shadow_pixel_rgba(d, a, b, x + boxw, x - boxw, m);
+
+  for(; x < width; x++, d++)
+    shadow_pixel_rgba(d, a, b, width - 1, x - boxw, m);
+}
+
+
+/**
+ *
+ */
+static void
+rgb24_to_bgr32_neon(uint32_t *d, const uint8_t *s, int width)
+{
+  int x = 0;
+
+  for(; x + 8 <= width; x += 8, s += 24, d += 8) {
+    uint8x8x3_t in = vld3_u8(s);
+    uint8x8x4_t out;
+    out.val[0] = in.val[0];
+    out.val[1] = in.val[1];
+    out.val[2] = in.val[2];
+    out.val[3] = vdup_n_u8(0xff);
+    vst4_u8((uint8_t *)d, out);
+  }
+
+  if(x < width)
+    rgb24_to_bgr32(d, s, width - x);
+}
+
+
+static const pixmap_kernels_t pixmap_kernels_neon = {
+  .pk_name                     = "NEON",
+  .pk_composite_GRAY8_on_BGR32 = composite_GRAY8_on_BGR32_neon,
+  .pk_box_blur_line_4chan      = box_blur_line_4chan_neon,
+  .pk_drop_shadow_rgba         = drop_shadow_rgba_neon,
+  .pk_rgb24_to_bgr32           = rgb24_to_bgr32_neon,
+};
+
+#endif // PIXMAP_NEON
+
+
+/**
+ *
+ */
+const pixmap_kernels_t *
+pixmap_kernels_get(void)
+{
+  static const pixmap_kernels_t *selected;
+
+  if(selected != NULL)
+    return selected;
+
+  const pixmap_kernels_t *pk = &pixmap_kernels_c;
+
+#if defined(PIXMAP_SSE2)
+  pk = &pixmap_kernels_sse2;
+#elif defined(PIXMAP_NEON)
+  pk = &pixmap_kernels_neon;
+#endif
+#if defined(PIXMAP_AVX2)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    pk = &pixmap_kernels_avx2;
+#endif
+  return selected = pk;
+}
+
+
+
+#ifdef PIXMAP_KERNELS_BENCH
+
+/**
+ * Benchmark and conformance test, build with 'make pixmap-bench'
+ *
+ * Runs every kernel set available on this CPU over the same random
+ * input and checks that the output is identical to the C version.
+ * The check is also done for all widths below 80 and small box widths
+ * so the scalar tails of the SIMD versions are covered
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_W 1920
+#define BENCH_H 256
+
+static int64_t
+get_ts(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static uint8_t *bench_src8;
+static uint8_t *bench_rgb24;
+static uint32_t *bench_bgr32;
+static uint32_t *bench_sat;   // Summed area table with 4 components
+static uint32_t *bench_sat1;  // Summed area table with 1 component
+static uint32_t *bench_out;
+
+static const int bench_boxw = 5;
+static const int bench_boxh = 5;
+
+
+/**
+ * Summed area tables of bench_bgr32 seen as a w * h image, same as
+ * pixmap_box_blur() / pixmap_drop_shadow()
+ */
+static void
+bench_sat_build(int w, int h, uint32_t *sat, uint32_t *sat1)
+{
+  const uint8_t *s = (const uint8_t *)bench_bgr32;
+  const int ls = w * 4;
+  for(int y = 0; y < h; y++) {
+    for(int x = 0; x < ls; x++) {
+      uint32_t v = s[y * ls + x];
+      if(x >= 4)
+        v += sat[y * ls + x - 4];
+      if(y > 0)
+        v += sat[(y - 1) * ls + x];
+      if(x >= 4 && y > 0)
+        v -= sat[(y - 1) * ls + x - 4];
+      sat[y * ls + x] = v;
+    }
+  }
+
+  for(int y = 0; y < h; y++) {
+    for(int x = 0; x < w; x++) {
+      uint32_t v = s[(y * w + x) * 4 + 3];
+      if(x > 0)
+        v += sat1[y * w + x - 1];
+      if(y > 0)
+        v += sat1[(y - 1) * w + x];
+      if(x > 0 && y > 0)
+        v -= sat1[(y - 1) * w + x - 1];
+      sat1[y * w + x] = v;
+    }
+  }
+}
+
+
+/**
+ *
+ */
+static void
+bench_init(void)
+{
+  const int n = BENCH_W * BENCH_H;
+
+  bench_src8  = malloc(n);
+  bench_rgb24 = malloc(n * 3 + 16);
+  bench_bgr32 = malloc(n * 4);
+  bench_out   = malloc(n * 4);
+  bench_sat   = malloc(n * 4 * sizeof(uint32_t));
+  bench_sat1  = malloc(n * sizeof(uint32_t));
+
+  srand(1234);
+  for(int i = 0; i < n; i++) {
+    // Plenty of fully transparent and fully opaque to hit all branches
+    int r = rand() & 0xff;
+    bench_src8[i] = r < 32 ? 0 : r > 224 ? 255 : r;
+    r = rand();
+    bench_bgr32[i] = (rand() & 0xffffff) | (r & 1 ? 0 : r & 2 ? 0xff : rand()) << 24;
+  }
+  for(int i = 0; i < n * 3; i++)
+    bench_rgb24[i] = rand();
+
+  bench_sat_build(BENCH_W, BENCH_H, bench_sat, bench_sat1);
+}
+
+
+/**
+ * Run one kernel over one line of a w pixels wide image
+ */
+static void
+bench_line(const pixmap_kernels_t *pk, int which, uint32_t *d,
+           int w, int h, int y, int boxw, int boxh,
+           const uint32_t *sat, const uint32_t *sat1)
+{
+  const int m = 65536 / ((boxw * 2 + 1) * (boxh * 2 + 1));
+  const int ya = MAX(0, y - boxh);
+  const int yb = MIN(h - 1, y + boxh);
+
+  switch(which) {
+  case 0:
+    pk->pk_composite_GRAY8_on_BGR32((uint8_t *)d, bench_src8 + y * w,
+                                    0x20, 0x80, 0xe0, 0xc0, w);
+    break;
+  case 1:
+    pk->pk_box_blur_line_4chan((uint8_t *)d, sat + ya * w * 4,
+                               sat + yb * w * 4, w, boxw, m);
+    break;
+  case 2:
+    pk->pk_rgb24_to_bgr32(d, bench_rgb24 + y * w * 3, w);
+    break;
+  case 3:
+    pk->pk_drop_shadow_rgba((uint8_t *)d, sat1 + ya * w, sat1 + yb * w,
+                            w, boxw, m);
+    break;
+  }
+}
+
+
+/**
+ * Run one kernel over the whole image
+ */
+static void
+bench_run(const pixmap_kernels_t *pk, int which, uint32_t *out)
+{
+  if(which != 2)
+    memcpy(out, bench_bgr32, BENCH_W * BENCH_H * 4);
+
+  for(int y = 0; y < BENCH_H; y++)
+    bench_line(pk, which, out + y * BENCH_W, BENCH_W, BENCH_H, y,
+               bench_boxw, bench_boxh, bench_sat, bench_sat1);
+}
+
+
+/**
+ * Compare against the C version for narrow images and small boxes.
+ * Pixels past the end of the line must be left alone
+ */
+#define CONF_MAX_W 80
+#define CONF_H     6
+
+static int
+bench_conformance(const pixmap_kernels_t *pk, int which)
+{
+  static const int boxws[] = {0, 1, 2, 3, 5, 8};
+  static uint32_t sat[CONF_MAX_W * CONF_H * 4];
+  static uint32_t sat1[CONF_MAX_W * CONF_H];
+  uint32_t ref[CONF_MAX_W + 16];
+  uint32_t out[CONF_MAX_W + 16];
+  const int numbox = which == 1 || which == 3 ?
+    sizeof(boxws) / sizeof(boxws[0]) : 1;
+  int fail = 0;
+
+  for(int w = 1; w < CONF_MAX_W; w++) {
+    bench_sat_build(w, CONF_H, sat, sat1);
+
+    for(int i = 0; i < numbox; i++) {
+      const int boxw = MIN(boxws[i], w);
+      const int boxh = MIN(boxws[i], CONF_H);
+
+      for(int y = 0; y < CONF_H; y++) {
+        for(int x = 0; x < CONF_MAX_W + 16; x++)
+          ref[x] = which == 2 ? 0xdeadbeef : bench_bgr32[y * w + x];
+        memcpy(out, ref, sizeof(ref));
+
+        bench_line(&pixmap_kernels_c, which, ref, w, CONF_H, y,
+                   boxw, boxh, sat, sat1);
+        bench_line(pk, which, out, w, CONF_H, y, boxw, boxh, sat, sat1);
+
+        if(memcmp(ref, out, sizeof(ref))) {
+          if(!fail)
+            printf("%s: mismatch at width %d box %d line %d\n",
+                   pk->pk_name, w, boxw, y);
+          fail = 1;
+        }
+      }
+    }
+  }
+  return fail;
+}
+
+
+int
+main(int argc, char **argv)
+{
+  static const char *names[] = {
+    "composite_GRAY8_on_BGR32",
+    "box_blur_line_4chan",
+    "rgb24_to_bgr32",
+    "drop_shadow_rgba",
+  };
+
+  const pixmap_kernels_t *sets[4];
+  int numsets = 0;
+  int rounds = argc > 1 ? atoi(argv[1]) : 20;
+  int fail = 0;
+
+  sets[numsets++] = &pixmap_kernels_c;
+#ifdef PIXMAP_SSE2
+  sets[numsets++] = &pixmap_kernels_sse2;
+#endif
+#ifdef PIXMAP_NEON
+  sets[numsets++] = &pixmap_kernels_neon;
+#endif
+#ifdef PIXMAP_AVX2
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))
+    sets[numsets++] = &pixmap_kernels_avx2;
+#endif
+
+  bench_init();
+
+  uint32_t *ref = malloc(BENCH_W * BENCH_H * 4);
+
+  printf("%dx%d pixels, %d rounds, selected: %s\n",
+         BENCH_W, BENCH_H, rounds, pixmap_kernels_get()->pk_name);
+
+  for(int k = 0; k < 4; k++) {
+    int64_t base = 0;
+    bench_run(&pixmap_kernels_c, k, ref);
+
+    for(int i = 0; i < numsets; i++) {
+      bench_run(sets[i], k, bench_out);
+      int ok = !memcmp(ref, bench_out, BENCH_W * BENCH_H * 4) &&
+        !bench_conformance(sets[i], k);
+      fail |= !ok;
+
+      int64_t ts = get_ts();
+      for(int r = 0; r < rounds; r++)
+        bench_run(sets[i], k, bench_out);
+      int64_t t = (get_ts() - ts) / rounds;
+      if(i == 0)
+        base = t;
+
+      printf("%-26s %-5s %7dus %5.2fx %s\n",
+             names[k], sets[i]->pk_name, (int)t,
+             t ? (double)base / t : 0.0, ok ? "" : "MISMATCH");
+    }
+  }
+  return fail;
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Per-line pixel kernels used by pixmap.c
+ *
+ * Each kernel has a plain C version and, where the CPU supports it,
+ * SIMD versions that produce bit identical output. pixmap_kernels_get()
+ * returns the best set for the CPU we are running on.
+ */
+
+typedef void (pixmap_composite_fn_t)(uint8_t *dst, const uint8_t *src,
+                                     int red, int green, int blue, int alpha,
+                                     int width);
+
+typedef void (pixmap_blur_fn_t)(uint8_t *dst, const uint32_t *a,
+                                const uint32_t *b, int width, int boxw, int m);
+
+typedef void (pixmap_convert_fn_t)(uint32_t *dst, const uint8_t *src,
+                                   int width);
+
+typedef struct pixmap_kernels {
+  const char *pk_name;
+  pixmap_composite_fn_t *pk_composite_GRAY8_on_BGR32;
+  pixmap_blur_fn_t *pk_box_blur_line_4chan;
+  pixmap_blur_fn_t *pk_drop_shadow_rgba;
+  pixmap_convert_fn_t *pk_rgb24_to_bgr32;
+} pixmap_kernels_t;
+
+const pixmap_kernels_t *pixmap_kernels_get(void);
@@ -213,6 +213,8 @@ typedef struct gconf {
   int fullscreen;
   int swrefresh;
   int debug_glw;
+  int enable_glw_profile;
+  int enable_glw_parallel_layout;
   int show_usage_events;
 
   int can_standby;
@@ -261,6 +263,7 @@ typedef struct gconf {
   char **devplugins;
   const char *plugin_repo;
   const char *load_ecmascript;
+  const char *thumb_bench;
   int bypass_ecmascript_acl;
 
   const char *initial_url;
@@ -110,6 +110,8 @@ mp_create(const char *name, int flags)
 			       sizeof(media_buf_t),
 			       POOL_ZERO_MEM);
 
+  mp->mp_mb_arena = mb_arena_create();
+
   mp->mp_flags = flags;
 
   hts_mutex_lock(&media_mutex);
@@ -201,6 +203,9 @@ mp_create(const char *name, int flags)
 
   mp->mp_prop_buffer_delay = prop_create(p, "delay");
 
+  mp->mp_prop_buffer_arena_inuse  = prop_create(p, "arena_inuse");
+  mp->mp_prop_buffer_arena_cached = prop_create(p, "arena_cached");
+
 
 
   //
@@ -389,6 +394,7 @@ mp_release(media_pipe_t *mp)
   hts_mutex_destroy(&mp->mp_overlay_mutex);
 
   pool_destroy(mp->mp_mb_pool);
+  mb_arena_release(mp->mp_mb_arena);
 
   if(mp->mp_satisfied == 0)
     atomic_dec(&media_buffer_hungry);
@@ -405,6 +411,8 @@ void
 mp_bump_epoch(media_pipe_t *mp)
 {
   hts_mutex_lock(&mp->mp_mutex);
+  mq_ring_drain(mp, &mp->mp_audio);
+  mq_ring_drain(mp, &mp->mp_video);
   mp->mp_epoch++;
   hts_mutex_unlock(&mp->mp_mutex);
 }
@@ -713,7 +721,12 @@ mp_configure(media_pipe_t *mp, int flags, int buffer_size, int64_t duration,
 
   mp->mp_max_realtime_delay = INT32_MAX;
 
+  mq_ring_drain(mp, &mp->mp_video);
+  mq_ring_drain(mp, &mp->mp_audio);
+  mp->mp_ring_credit = 0;
+
   mp_set_clr_flags_locked(mp, flags,
+                          MP_DATA_RING |
                           MP_PRE_BUFFERING |
                           MP_FLUSH_ON_HOLD |
                           MP_ALWAYS_SATISFIED |
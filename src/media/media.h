@@ -175,6 +175,7 @@ typedef struct media_pipe {
 #define MP_CAN_SEEK         0x20
 #define MP_CAN_PAUSE        0x40
 #define MP_CAN_EJECT        0x80
+#define MP_DATA_RING        0x100 // Use mq_ring for data packets
 
   AVRational mp_framerate;
 
@@ -206,12 +207,14 @@ typedef struct media_pipe {
 
 
   pool_t *mp_mb_pool;
+  mb_arena_t *mp_mb_arena; // Packet payloads
 
 
   unsigned int mp_buffer_current; // Bytes current queued (total for all queues)
   unsigned int mp_buffer_delay;   // Current delay of buffer in µs
   unsigned int mp_buffer_limit;   // Max buffer size
   unsigned int mp_max_realtime_delay; // Max delay in a queue (real time)
+  int mp_ring_credit;      // Bytes demuxer may push to rings without locking
   int mp_satisfied;        /* If true, means we are satisfied with buffer
 			      fullness */
 
@@ -305,6 +308,8 @@ typedef struct media_pipe {
   prop_t *mp_prop_buffer_current;
   prop_t *mp_prop_buffer_limit;
   prop_t *mp_prop_buffer_delay;
+  prop_t *mp_prop_buffer_arena_inuse;
+  prop_t *mp_prop_buffer_arena_cached;
 
   prop_sub_t *mp_sub_currenttime;
   prop_sub_t *mp_sub_stats;
@@ -536,6 +541,7 @@ mp_check_underrun(media_pipe_t *mp)
 {
   if(mp->mp_flags & MP_PRE_BUFFERING &&
      unlikely(TAILQ_FIRST(&mp->mp_video.mq_q_data) == NULL) &&
-     unlikely(TAILQ_FIRST(&mp->mp_audio.mq_q_data) == NULL))
+     unlikely(TAILQ_FIRST(&mp->mp_audio.mq_q_data) == NULL) &&
+     mq_ring_empty(&mp->mp_video) && mq_ring_empty(&mp->mp_audio))
     mp_underrun(mp);
 }
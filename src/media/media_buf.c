@@ -42,12 +42,202 @@ media_buf_dtor_avpacket(media_buf_t *mb)
 
 #define BUF_PAD 32
 
+/**
+ * Payload arena
+ *
+ * Packet payloads are carved out of power-of-two size classes and
+ * recycled via per-class freelists instead of going back to the
+ * system allocator for each packet. Blocks are handed out wrapped in
+ * an AVBufferRef so decoders can take references as they please. The
+ * block returns to the arena when the last reference is dropped, which
+ * may happen on any thread and after the media_pipe is gone, hence the
+ * arena is refcounted and has its own mutex.
+ */
+
+#define MB_ARENA_MIN_SHIFT   8   // Smallest class is 256 bytes
+#define MB_ARENA_CLASSES     13  // Largest class is 1MB
+#define MB_ARENA_MAX_CACHED  (8 * 1024 * 1024)
+#define MB_ARENA_HDR_SIZE    64  // Keep payload aligned for SIMD
+
+typedef struct mb_arena_block {
+  struct mb_arena_block *mab_next;
+  struct mb_arena *mab_arena;
+  int mab_class;
+} mb_arena_block_t;
+
+struct mb_arena {
+  hts_mutex_t ma_mutex;
+  int ma_refcount;
+  mb_arena_block_t *ma_free[MB_ARENA_CLASSES];
+  int ma_bytes_inuse;
+  int ma_bytes_cached;
+};
+
+
+/**
+ *
+ */
+mb_arena_t *
+mb_arena_create(void)
+{
+  mb_arena_t *ma = calloc(1, sizeof(mb_arena_t));
+  hts_mutex_init(&ma->ma_mutex);
+  ma->ma_refcount = 1;
+  return ma;
+}
+
+
+/**
+ * Must be called with ma_mutex held, will unlock it
+ */
+static void
+mb_arena_release_locked(mb_arena_t *ma)
+{
+  if(--ma->ma_refcount > 0) {
+    hts_mutex_unlock(&ma->ma_mutex);
+    return;
+  }
+  hts_mutex_unlock(&ma->ma_mutex);
+
+  for(int i = 0; i < MB_ARENA_CLASSES; i++) {
+    mb_arena_block_t *mab;
+    while((mab = ma->ma_free[i]) != NULL) {
+      ma->ma_free[i] = mab->mab_next;
+      av_free(mab);
+    }
+  }
+  hts_mutex_destroy(&ma->ma_mutex);
+  free(ma);
+}
+
+
+/**
+ *
+ */
+void
+mb_arena_release(mb_arena_t *ma)
+{
+  hts_mutex_lock(&ma->ma_mutex);
+  mb_arena_release_locked(ma);
+}
+
+
+/**
+ *
+ */
+void
+mb_arena_stats(mb_arena_t *ma, int *inuse, int *cached)
+{
+  // Unlocked reads, only for statistics
+  *inuse  = ma->ma_bytes_inuse;
+  *cached = ma->ma_bytes_cached;
+}
+
+
+/**
+ * Called by libav when last reference to the payload is gone
+ */
+static void
+mb_arena_buffer_free(void *opaque, uint8_t *data)
+{
+  mb_arena_block_t *mab = opaque;
+  mb_arena_t *ma = mab->mab_arena;
+  const int size = 1 << (mab->mab_class + MB_ARENA_MIN_SHIFT);
+
+  hts_mutex_lock(&ma->ma_mutex);
+  ma->ma_bytes_inuse -= size;
+
+  if(ma->ma_refcount > 1 &&
+     ma->ma_bytes_cached + size <= MB_ARENA_MAX_CACHED) {
+    mab->mab_next = ma->ma_free[mab->mab_class];
+    ma->ma_free[mab->mab_class] = mab;
+    ma->ma_bytes_cached += size;
+  } else {
+    av_free(mab);
+  }
+  mb_arena_release_locked(ma);
+}
+
+
+/**
+ * Get a buffer with room for 'size' bytes plus libav input padding.
+ * Returns NULL if size is too large for the arena
+ */
+static AVBufferRef *
+mb_arena_get(mb_arena_t *ma, int size)
+{
+  const int need = size + FF_INPUT_BUFFER_PADDING_SIZE;
+  int c = 0;
+  while((1 << (c + MB_ARENA_MIN_SHIFT)) < need)
+    if(++c == MB_ARENA_CLASSES)
+      return NULL;
+
+  const int csize = 1 << (c + MB_ARENA_MIN_SHIFT);
+  mb_arena_block_t *mab;
+
+  hts_mutex_lock(&ma->ma_mutex);
+  if((mab = ma->ma_free[c]) != NULL) {
+    ma->ma_free[c] = mab->mab_next;
+    ma->ma_bytes_cached -= csize;
+  }
+  ma->ma_bytes_inuse += csize;
+  ma->ma_refcount++;
+  hts_mutex_unlock(&ma->ma_mutex);
+
+  if(mab == NULL) {
+    mab = av_malloc(MB_ARENA_HDR_SIZE + csize);
+    if(mab == NULL)
+      goto bad;
+    mab->mab_arena = ma;
+    mab->mab_class = c;
+  }
+
+  uint8_t *data = (uint8_t *)mab + MB_ARENA_HDR_SIZE;
+  AVBufferRef *buf = av_buffer_create(data, csize, mb_arena_buffer_free,
+                                      mab, 0);
+  if(buf != NULL) {
+    memset(data + size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    return buf;
+  }
+
+  av_free(mab);
+ bad:
+  hts_mutex_lock(&ma->ma_mutex);
+  ma->ma_bytes_inuse -= csize;
+  mb_arena_release_locked(ma);
+  return NULL;
+}
+
+
+/**
+ * Setup packet payload from arena, fall back to libav's allocator
+ * for sizes larger than our biggest class
+ */
+static void
+mb_arena_new_packet(mb_arena_t *ma, AVPacket *pkt, int size)
+{
+  AVBufferRef *buf = mb_arena_get(ma, size);
+
+  if(buf == NULL) {
+    av_new_packet(pkt, size);
+    return;
+  }
+  av_init_packet(pkt);
+  pkt->buf  = buf;
+  pkt->data = buf->data;
+  pkt->size = size;
+}
+
+
+/**
+ *
+ */
 media_buf_t *
 media_buf_alloc_locked(media_pipe_t *mp, size_t size)
 {
   hts_mutex_assert(&mp->mp_mutex);
   media_buf_t *mb = pool_get(mp->mp_mb_pool);
-  av_new_packet(&mb->mb_pkt, size);
+  mb_arena_new_packet(mp->mp_mb_arena, &mb->mb_pkt, size);
   mb->mb_dtor = media_buf_dtor_avpacket;
   return mb;
 }
@@ -65,7 +255,9 @@ media_buf_alloc_unlocked(media_pipe_t *mp, size_t size)
 
 
 /**
- *
+ * If the packet is refcounted we just take a reference, otherwise
+ * the payload is only valid until the demuxer reads the next packet
+ * so we copy it into the arena
  */
 media_buf_t *
 media_buf_from_avpkt_unlocked(media_pipe_t *mp, AVPacket *pkt)
@@ -78,6 +270,18 @@ media_buf_from_avpkt_unlocked(media_pipe_t *mp, AVPacket *pkt)
 
   mb->mb_dtor = media_buf_dtor_avpacket;
 
+  if(pkt->buf == NULL) {
+    AVBufferRef *buf = mb_arena_get(mp->mp_mb_arena, pkt->size);
+    if(buf != NULL) {
+      av_packet_copy_props(&mb->mb_pkt, pkt);
+      mb->mb_pkt.buf  = buf;
+      mb->mb_pkt.data = buf->data;
+      mb->mb_pkt.size = pkt->size;
+      memcpy(buf->data, pkt->data, pkt->size);
+      return mb;
+    }
+  }
+
   av_packet_ref(&mb->mb_pkt, pkt);
   return mb;
 }
@@ -24,6 +24,8 @@ struct AVPacket;
 struct media_pipe;
 struct media_queue;
 
+typedef struct mb_arena mb_arena_t;
+
 /**
  *
  */
@@ -168,3 +170,9 @@ media_buf_t *media_buf_from_avpkt_unlocked(struct media_pipe *mp,
                                            struct AVPacket *pkt);
 
 void media_buf_dtor_frame_info(media_buf_t *mb);
+
+mb_arena_t *mb_arena_create(void);
+
+void mb_arena_release(mb_arena_t *ma);
+
+void mb_arena_stats(mb_arena_t *ma, int *inuse, int *cached);
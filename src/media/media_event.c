@@ -44,6 +44,9 @@ mp_seek_in_queues(media_pipe_t *mp, int64_t user_time)
   media_buf_t *abuf, *vbuf, *vk, *mb;
   int rval = 1;
 
+  mq_ring_drain(mp, &mp->mp_audio);
+  mq_ring_drain(mp, &mp->mp_video);
+
   TAILQ_FOREACH(abuf, &mp->mp_audio.mq_q_data, mb_link)
     if(abuf->mb_user_time != PTS_UNSET && abuf->mb_user_time >= user_time)
       break;
@@ -133,6 +136,9 @@ mp_direct_seek(media_pipe_t *mp, int64_t ts)
   prop_set_float_ex(mp->mp_prop_currenttime, mp->mp_sub_currenttime,
 		    ts / 1000000.0, 0);
 
+  // Packets already in the rings keep the epoch they were tagged with
+  mq_ring_drain(mp, &mp->mp_audio);
+  mq_ring_drain(mp, &mp->mp_video);
   mp->mp_epoch++;
   mp->mp_seek_base = ts;
 
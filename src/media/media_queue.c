@@ -52,6 +52,7 @@ mq_flush_q(media_pipe_t *mp, media_queue_t *mq, struct media_buf_queue *q,
 static void
 mq_flush_locked(media_pipe_t *mp, media_queue_t *mq, int full)
 {
+  mq_ring_drain(mp, mq);
   mq->mq_last_deq_dts = PTS_UNSET;
   mq_flush_q(mp, mq, &mq->mq_q_data, full);
   mq_flush_q(mp, mq, &mq->mq_q_ctrl, full);
@@ -190,6 +191,109 @@ mp_enqueue_check_pre_buffering(media_pipe_t *mp)
 }
 
 
+/**
+ * Try to enqueue a data packet without locking. Only the demuxer
+ * thread may do this.
+ *
+ * Packets are pushed as long as there is credit left, the credit is
+ * refilled in mb_enqueue_with_events() (with mp_mutex held) which is
+ * also where all the flow control happens. The consumer is only
+ * woken up if it's waiting for data, so when it's busy it will
+ * pick up packets in batches
+ */
+static int
+mq_ring_push(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
+{
+  if(mb->mb_data_type != MB_VIDEO && mb->mb_data_type != MB_AUDIO)
+    return -1;
+
+  /*
+   * Unlocked reads, if we miss something it will be dealt with later.
+   *
+   * The epoch is read first. If a seek bumps it after this point the
+   * packet is tagged with the old epoch and mq_ring_drain() drops it,
+   * same as mb_enqueue_with_events() would not enqueue it once the
+   * seek event is in mp_eq
+   */
+  const int epoch = mp->mp_epoch;
+  atomic_barrier();
+
+  if(TAILQ_FIRST(&mp->mp_eq) != NULL ||
+     mp->mp_hold_flags & MP_HOLD_PRE_BUFFERING ||
+     mp->mp_ring_credit < mb->mb_size)
+    return -1;
+
+  const unsigned int head = mq->mq_ring_head;
+  if(head - mq->mq_ring_tail == MQ_RING_SIZE)
+    return -1;
+
+  mb->mb_epoch = epoch;
+  mq->mq_ring[head & MQ_RING_MASK] = mb;
+  atomic_barrier(); // Slot must be written before head is published
+  mq->mq_ring_head = head + 1;
+  mp->mp_ring_credit -= mb->mb_size;
+
+  atomic_barrier(); // Pairs with barrier in mq_wait_data()
+  if(mq->mq_ring_sleeping && !mq->mq_no_data_interest) {
+    hts_mutex_lock(&mp->mp_mutex);
+    if(mq->mq_ring_sleeping) {
+      mq->mq_ring_sleeping = 0;
+      hts_cond_signal(&mq->mq_avail);
+    }
+    hts_mutex_unlock(&mp->mp_mutex);
+  }
+  return 0;
+}
+
+
+/**
+ * Move packets from ring to mq_q_data. Must be called with mp locked
+ *
+ * Anyone bumping mp_epoch drains the rings first, so packets tagged
+ * with an older epoch were pushed after that and predate the seek
+ */
+void
+mq_ring_drain(media_pipe_t *mp, media_queue_t *mq)
+{
+  unsigned int tail = mq->mq_ring_tail;
+  const unsigned int head = mq->mq_ring_head;
+
+  if(tail == head)
+    return;
+
+  atomic_barrier(); // Don't read slots before head
+
+  for(; tail != head; tail++) {
+    media_buf_t *mb = mq->mq_ring[tail & MQ_RING_MASK];
+    if(mb->mb_epoch != mp->mp_epoch) {
+      media_buf_free_locked(mp, mb);
+      continue;
+    }
+    TAILQ_INSERT_TAIL(&mq->mq_q_data, mb, mb_link);
+    mq->mq_packets_current++;
+    mp->mp_buffer_current += mb->mb_size;
+  }
+
+  atomic_barrier(); // Done with slots before they are handed back
+  mq->mq_ring_tail = tail;
+  mq_update_stats(mp, mq, 0);
+}
+
+
+/**
+ * Wait for data to arrive on queue. Must be called with mp locked
+ */
+void
+mq_wait_data(media_pipe_t *mp, media_queue_t *mq)
+{
+  mq->mq_ring_sleeping = 1;
+  atomic_barrier(); // Pairs with barrier in mq_ring_push()
+  if(mq_ring_empty(mq))
+    hts_cond_wait(&mq->mq_avail, &mp->mp_mutex);
+  mq->mq_ring_sleeping = 0;
+}
+
+
 /**
  *
  */
@@ -198,7 +302,13 @@ mb_enqueue_with_events(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
 {
   event_t *e = NULL;
 
+  if(mp->mp_flags & MP_DATA_RING && !mq_ring_push(mp, mq, mb))
+    return NULL;
+
   hts_mutex_lock(&mp->mp_mutex);
+
+  mq_ring_drain(mp, &mp->mp_video);
+  mq_ring_drain(mp, &mp->mp_audio);
 #if 0
   printf("ENQ %s %d %d/%d %d/%d\n",
          mq == &mp->mp_video ? "video" : "audio",
@@ -241,8 +351,19 @@ mb_enqueue_with_events(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
 
   if(e != NULL) {
     TAILQ_REMOVE(&mp->mp_eq, e, e_link);
+    mp->mp_ring_credit = 0;
   } else {
     mb_enq(mp, mq, mb);
+
+    // Let the demuxer push up to half of what's left without locking,
+    // but not for realtime streams where we must watch the delay
+
+    if(mp->mp_max_realtime_delay == INT32_MAX &&
+       mp->mp_buffer_current < mp->mp_buffer_limit)
+      mp->mp_ring_credit =
+        (mp->mp_buffer_limit - mp->mp_buffer_current) / 2;
+    else
+      mp->mp_ring_credit = 0;
   }
 
   hts_mutex_unlock(&mp->mp_mutex);
@@ -262,6 +383,7 @@ mb_enqueue_no_block(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb,
 
   hts_mutex_lock(&mp->mp_mutex);
 
+  mq_ring_drain(mp, mq);
   mp_update_buffer_delay(mp);
   mp_enqueue_check_pre_buffering(mp);
 
@@ -342,6 +464,11 @@ mq_update_stats(media_pipe_t *mp, media_queue_t *mq, int force)
   if(mp->mp_stats) {
     prop_set_int(mq->mq_prop_qlen_cur, mq->mq_packets_current);
     prop_set_int(mp->mp_prop_buffer_current, mp->mp_buffer_current);
+
+    int inuse, cached;
+    mb_arena_stats(mp->mp_mb_arena, &inuse, &cached);
+    prop_set_int(mp->mp_prop_buffer_arena_inuse, inuse);
+    prop_set_int(mp->mp_prop_buffer_arena_cached, cached);
     if(mp->mp_buffer_delay == INT32_MAX)
       prop_set_void(mp->mp_prop_buffer_delay);
     else
@@ -364,6 +491,8 @@ mq_init(media_queue_t *mq, prop_t *p, hts_mutex_t *mutex, media_pipe_t *mp)
   TAILQ_INIT(&mq->mq_q_aux);
 
   mq->mq_packets_current = 0;
+  mq->mq_ring_head = mq->mq_ring_tail = 0;
+  mq->mq_ring_sleeping = 0;
   mq->mq_stream = -1;
   hts_cond_init(&mq->mq_avail, mutex);
   mq->mq_prop_qlen_cur = prop_create(p, "dqlen");
@@ -402,10 +531,16 @@ mp_wait_for_empty_queues(media_pipe_t *mp)
   hts_mutex_lock(&mp->mp_mutex);
 
   // Only wait for data queues to drain, aux (subtitles) might be stalled
-  while((e = TAILQ_FIRST(&mp->mp_eq)) == NULL &&
-	(TAILQ_FIRST(&mp->mp_audio.mq_q_data) != NULL ||
-         TAILQ_FIRST(&mp->mp_video.mq_q_data) != NULL))
+  while(1) {
+    mq_ring_drain(mp, &mp->mp_audio);
+    mq_ring_drain(mp, &mp->mp_video);
+
+    if((e = TAILQ_FIRST(&mp->mp_eq)) != NULL ||
+       (TAILQ_FIRST(&mp->mp_audio.mq_q_data) == NULL &&
+        TAILQ_FIRST(&mp->mp_video.mq_q_data) == NULL))
+      break;
     hts_cond_wait(&mp->mp_backpressure, &mp->mp_mutex);
+  }
 
   if(e != NULL)
     TAILQ_REMOVE(&mp->mp_eq, e, e_link);
@@ -537,6 +672,7 @@ mb_enq(media_pipe_t *mp, media_queue_t *mq, media_buf_t *mb)
   } else if(mb->mb_data_type > MB_CTRL) {
     TAILQ_INSERT_TAIL(&mq->mq_q_ctrl, mb, mb_link);
   } else {
+    mq_ring_drain(mp, mq); // Keep packet order
     TAILQ_INSERT_TAIL(&mq->mq_q_data, mb, mb_link);
     do_signal = !mq->mq_no_data_interest;
   }
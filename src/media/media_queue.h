@@ -22,6 +22,9 @@ TAILQ_HEAD(media_buf_queue, media_buf);
 
 struct media_pipe;
 
+#define MQ_RING_SIZE 128 // Must be power of 2
+#define MQ_RING_MASK (MQ_RING_SIZE - 1)
+
 /**
  * Media queue
  */
@@ -38,6 +41,19 @@ typedef struct media_queue {
   int mq_demuxer_flags;      // For demuxer use
   hts_cond_t mq_avail;
 
+  /**
+   * Single producer / single consumer ring for data packets, used by
+   * mb_enqueue_with_events() when MP_DATA_RING is set so the demuxer
+   * does not need to take mp_mutex for every packet.
+   *
+   * Anyone holding mp_mutex may consume from it by calling
+   * mq_ring_drain() which moves the packets to mq_q_data
+   */
+  media_buf_t *mq_ring[MQ_RING_SIZE];
+  volatile unsigned int mq_ring_head; // Only written by producer
+  volatile unsigned int mq_ring_tail; // Only written with mp_mutex held
+  volatile int mq_ring_sleeping;      // Consumer is waiting for data
+
   int64_t mq_last_deq_dts;
 
   int64_t mq_seektarget;
@@ -108,4 +124,14 @@ void mq_destroy(media_queue_t *mq);
 
 void mq_update_stats(struct media_pipe *mp, media_queue_t *mq, int force);
 
+void mq_ring_drain(struct media_pipe *mp, media_queue_t *mq);
+
+void mq_wait_data(struct media_pipe *mp, media_queue_t *mq);
+
+static __inline int
+mq_ring_empty(const media_queue_t *mq)
+{
+  return mq->mq_ring_head == mq->mq_ring_tail;
+}
+
 void mp_update_buffer_delay(struct media_pipe *mp);
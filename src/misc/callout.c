@@ -23,25 +23,11 @@
 #include "callout.h"
 #include "arch/arch.h"
 
-static LIST_HEAD(, callout) callouts;
+static timerheap_t callouts;
 
 static hts_mutex_t callout_mutex;
 static hts_cond_t callout_cond;
 
-/**
- *htsmsg_t *props
- */
-static int
-calloutcmp(callout_t *a, callout_t *b)
-{
-  if(a->c_deadline < b->c_deadline)
-    return -1;
-  else if(a->c_deadline > b->c_deadline)
-    return 1;
- return 0;
-}
-
-
 /**
  *
  */
@@ -52,18 +38,18 @@ callout_arm_abs(callout_t *d, callout_callback_t *callback, void *opaque,
   hts_mutex_lock(&callout_mutex);
 
   if(d == NULL)
-    d = malloc(sizeof(callout_t));
-  else if(d->c_callback != NULL)
-    LIST_REMOVE(d, c_link);
-    
+    d = calloc(1, sizeof(callout_t));
+
   d->c_callback = callback;
   d->c_opaque = opaque;
-  d->c_deadline = deadline;
   d->c_armed_by_file = file;
   d->c_armed_by_line = line;
 
-  LIST_INSERT_SORTED(&callouts, d, c_link, calloutcmp, callout_t);
-  hts_cond_signal(&callout_cond);
+  timerheap_arm(&callouts, &d->c_timer, deadline);
+
+  // Only need to wake up the callout thread if we are the new head
+  if(timerheap_first(&callouts) == &d->c_timer)
+    hts_cond_signal(&callout_cond);
   hts_mutex_unlock(&callout_mutex);
 }
 
@@ -99,7 +85,7 @@ callout_disarm(callout_t *d)
 {
   hts_mutex_lock(&callout_mutex);
   if(d->c_callback) {
-    LIST_REMOVE(d, c_link);
+    timerheap_disarm(&callouts, &d->c_timer);
     d->c_callback = NULL;
   }
   hts_mutex_unlock(&callout_mutex);
@@ -113,6 +99,7 @@ static void *
 callout_loop(void *aux)
 {
   uint64_t now;
+  timerheap_entry_t *the;
   callout_t *c;
   callout_callback_t *cc;
 
@@ -122,9 +109,11 @@ callout_loop(void *aux)
 
     now = arch_get_ts();
 
-    while((c = LIST_FIRST(&callouts)) != NULL && c->c_deadline <= now) {
+    while((the = timerheap_first(&callouts)) != NULL &&
+          the->the_expire <= now) {
+      c = (callout_t *)the;
       cc = c->c_callback;
-      LIST_REMOVE(c, c_link);
+      timerheap_disarm(&callouts, the);
       c->c_callback = NULL;
       const char *file = c->c_armed_by_file;
       int line         = c->c_armed_by_line;
@@ -138,9 +127,9 @@ callout_loop(void *aux)
       now = ts;
     }
 
-    if((c = LIST_FIRST(&callouts)) != NULL) {
+    if((the = timerheap_first(&callouts)) != NULL) {
 
-      int timeout = (c->c_deadline - now + 999) / 1000;
+      int timeout = (the->the_expire - now + 999) / 1000;
       hts_cond_wait_timeout(&callout_cond, &callout_mutex, timeout);
     } else {
       hts_cond_wait(&callout_cond, &callout_mutex);
@@ -21,16 +21,15 @@
 #define CALLOUT_H__
 
 #include <stdint.h>
-#include "queue.h"
+#include "timerheap.h"
 
 struct callout;
 typedef void (callout_callback_t)(struct callout *c, void *opaque);
 
 typedef struct callout {
-  LIST_ENTRY(callout) c_link;
+  timerheap_entry_t c_timer;  // Must be first
   callout_callback_t *c_callback;
   void *c_opaque;
-  uint64_t c_deadline;
   const char *c_armed_by_file;
   int c_armed_by_line;
 } callout_t;
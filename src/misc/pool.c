@@ -121,6 +121,9 @@ pool_init(pool_t *p, const char *name, size_t item_size, int flags)
 
   p->p_item_size = item_size;
   p->p_flags = flags;
+
+  if(flags & POOL_LOCKED)
+    hts_mutex_init(&p->p_mutex);
 }
 
 
@@ -219,6 +222,9 @@ pool_destroy(pool_t *p)
     TRACE(TRACE_INFO, "pool", "Destroying pool '%s', %d items out",
 	  p->p_name, p->p_num_out);
 
+  if(p->p_flags & POOL_LOCKED)
+    hts_mutex_destroy(&p->p_mutex);
+
   free(p);
 }
 
@@ -229,12 +235,8 @@ pool_destroy(pool_t *p)
 /**
  *
  */
-void *
-#ifdef POOL_DEBUG
-pool_get_ex(pool_t *p, const char *file, int line)
-#else
-pool_get(pool_t *p)
-#endif
+static void *
+pool_get0(pool_t *p, const char *file, int line)
 {
   p->p_num_out++;
 #if defined(POOL_BY_MMAP)
@@ -274,8 +276,34 @@ pool_get(pool_t *p)
 /**
  *
  */
-void
-pool_put(pool_t *p, void *ptr)
+void *
+#ifdef POOL_DEBUG
+pool_get_ex(pool_t *p, const char *file, int line)
+#else
+pool_get(pool_t *p)
+#endif
+{
+#ifndef POOL_DEBUG
+  const char *file = NULL;
+  int line = 0;
+#endif
+  void *r;
+
+  if(!(p->p_flags & POOL_LOCKED))
+    return pool_get0(p, file, line);
+
+  hts_mutex_lock(&p->p_mutex);
+  r = pool_get0(p, file, line);
+  hts_mutex_unlock(&p->p_mutex);
+  return r;
+}
+
+
+/**
+ *
+ */
+static void
+pool_put0(pool_t *p, void *ptr)
 {
 #if defined(POOL_BY_MMAP)
 
@@ -314,6 +342,23 @@ pool_put(pool_t *p, void *ptr)
 }
 
 
+/**
+ *
+ */
+void
+pool_put(pool_t *p, void *ptr)
+{
+  if(!(p->p_flags & POOL_LOCKED)) {
+    pool_put0(p, ptr);
+    return;
+  }
+
+  hts_mutex_lock(&p->p_mutex);
+  pool_put0(p, ptr);
+  hts_mutex_unlock(&p->p_mutex);
+}
+
+
 /**
  *
  */
@@ -44,6 +44,7 @@ typedef struct pool {
 } pool_t;
 
 
+#define POOL_LOCKED    0x1 // pool_get() / pool_put() serialize on p_mutex
 #define POOL_ZERO_MEM  0x2
 
 pool_t *pool_create(const char *name, size_t item_size, int flags);
@@ -25,6 +25,7 @@
 #include "buf.h"
 #include "str.h"
 #include "main.h"
+#include "minmax.h"
 #include "sha.h"
 #include "i18n.h"
 
@@ -887,13 +888,31 @@ no_the(const char *a)
   return a + i;
 }
 
+/**
+ * Parse the rest of a run of digits, saturates on overflow
+ */
+static uint64_t
+dict_number(const char **sp, int first)
+{
+  const char *s = *sp;
+  uint64_t v = first - '0';
+
+  while(*s >= '0' && *s <= '9') {
+    const int digit = *s++ - '0';
+    v = v > (UINT64_MAX - digit) / 10 ? UINT64_MAX : v * 10 + digit;
+  }
+  *sp = s;
+  return v;
+}
+
+
 /**
  *
  */
 int
 dictcmp(const char *a, const char *b)
 {
-  long int da, db;
+  uint64_t da, db;
   int ua, ub;
 
   a = no_the(a);
@@ -921,28 +940,134 @@ dictcmp(const char *a, const char *b)
     case 2:  /* 2: a is not a digit,  b is */
 	return ua - ub;
     case 3:  /* both are digits, switch to integer compare */
-      da = ua - '0';
-      db = ub - '0';
-
-      while(*a >= '0' && *a <= '9')
-	da = da * 10L + *a++ - '0';
-      while(*b >= '0' && *b <= '9')
-	db = db * 10L + *b++ - '0';
+      da = dict_number(&a, ua);
+      db = dict_number(&b, ub);
       if(da != db)
-	return da - db;
+	return da < db ? -1 : 1;
       break;
     }
   }
 }
 
 
+/**
+ * Store a code point in an UTF-8 style encoding. Unlike utf8_put() this
+ * accepts any 31 bit value so memcmp() order equals code point order
+ */
+static uint8_t *
+utf8_put_cp(uint8_t *d, unsigned int c)
+{
+  int n;
+
+  if(c < 0x80) {
+    *d++ = c;
+    return d;
+  }
+
+  if(c < 0x800) {
+    *d++ = 0xc0 | (c >> 6);
+    n = 1;
+  } else if(c < 0x10000) {
+    *d++ = 0xe0 | (c >> 12);
+    n = 2;
+  } else if(c < 0x200000) {
+    *d++ = 0xf0 | (c >> 18);
+    n = 3;
+  } else if(c < 0x4000000) {
+    *d++ = 0xf8 | (c >> 24);
+    n = 4;
+  } else {
+    *d++ = 0xfc | (c >> 30);
+    n = 5;
+  }
+  while(n-- > 0)
+    *d++ = 0x80 | ((c >> (n * 6)) & 0x3f);
+  return d;
+}
+
+
+/**
+ * Create a collation key for dictkey_cmp()
+ *
+ * The key is the string after no_the() with every character casefolded.
+ * Each run of digits is replaced by a '0' followed by the number of
+ * bytes in its value and the value itself (big endian). A non-digit
+ * never encodes as '0'..'9' so runs of digits sort against other
+ * characters just like they do in dictcmp()
+ *
+ * Returned key should be free()d
+ */
+dictkey_t *
+dictkey_create(const char *s)
+{
+  s = no_the(s);
+
+  // A source byte expands to at most three bytes (0xfffd or a digit)
+  dictkey_t *dk = malloc(sizeof(dictkey_t) + strlen(s) * 3);
+  uint8_t *d = dk->dk_data;
+  int c;
+
+  while((c = utf8_get(&s)) != 0) {
+
+    if(c >= '0' && c <= '9') {
+      const uint64_t v = dict_number(&s, c);
+      int bytes = 0;
+      while(bytes < 8 && v >> (bytes * 8))
+        bytes++;
+
+      *d++ = '0';
+      *d++ = bytes;
+      while(bytes-- > 0)
+        *d++ = v >> (bytes * 8);
+      continue;
+    }
+    d = utf8_put_cp(d, unicode_casefold(c));
+  }
+
+  dk->dk_len = d - dk->dk_data;
+  return realloc(dk, sizeof(dictkey_t) + dk->dk_len);
+}
+
+
+/**
+ *
+ */
+int
+dictkey_cmp(const dictkey_t *a, const dictkey_t *b)
+{
+  int r = memcmp(a->dk_data, b->dk_data, MIN(a->dk_len, b->dk_len));
+  return r ? r : a->dk_len - b->dk_len;
+}
+
+
+/**
+ * Write a casefolded copy of 'src' to 'dst' which must have room for
+ * 3 * strlen(src) + 1 bytes. Returns the length of the result
+ *
+ * Invalid sequences become U+FFFD just as utf8_get() returns them, thus
+ * a plain substring search among folded strings finds the same matches
+ * as mystrstr() on the originals
+ */
+size_t
+utf8_casefold(char *dst, const char *src)
+{
+  uint8_t *d = (uint8_t *)dst;
+  int c;
+
+  while((c = utf8_get(&src)) != 0)
+    d = utf8_put_cp(d, unicode_casefold(c));
+  *d = 0;
+  return (char *)d - dst;
+}
+
+
 /**
  *
  */
 const char *
 mystrstr(const char *haystack, const char *needle)
 {
-  int h, n;
+  int h, n, c;
   const char *h1, *n1, *r;
 
   n = unicode_casefold(utf8_get(&needle));
@@ -958,11 +1083,11 @@ mystrstr(const char *haystack, const char *needle)
       n1 = needle;
 
       while(1) {
-	n = unicode_casefold(utf8_get(&n1));
-	if(n == 0)
+	c = unicode_casefold(utf8_get(&n1));
+	if(c == 0)
 	  return r;
 	h = unicode_casefold(utf8_get(&h1));
-	if(n != h)
+	if(c != h)
 	  break;
       }
     }
@@ -58,6 +58,19 @@ url_split(char *proto, int proto_size,
 
 int dictcmp(const char *a, const char *b);
 
+/**
+ * Binary collation key. Comparing two keys with dictkey_cmp() orders
+ * them the same way as dictcmp() would order the source strings
+ */
+typedef struct dictkey {
+  int dk_len;
+  uint8_t dk_data[0];
+} dictkey_t;
+
+dictkey_t *dictkey_create(const char *str);
+
+int dictkey_cmp(const dictkey_t *a, const dictkey_t *b);
+
 int utf8_get(const char **s);
 
 int utf8_verify(const char *str);
@@ -68,6 +81,8 @@ char *utf8_cleanup(const char *str);
 
 const char *mystrstr(const char *haystack, const char *needle);
 
+size_t utf8_casefold(char *dst, const char *src);
+
 void strvec_addp(char ***str, const char *v);
 
 void strvec_addpn(char ***str, const char *v, size_t len);
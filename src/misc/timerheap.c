@@ -0,0 +1,253 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include "timerheap.h"
+
+
+/**
+ * Return true if a should fire before b
+ */
+static __inline int
+the_before(const timerheap_entry_t *a, const timerheap_entry_t *b)
+{
+  if(a->the_expire != b->the_expire)
+    return a->the_expire < b->the_expire;
+  return (int)(a->the_seq - b->the_seq) < 0;
+}
+
+
+/**
+ *
+ */
+static __inline void
+the_place(timerheap_t *th, timerheap_entry_t *the, unsigned int pos)
+{
+  th->th_heap[pos] = the;
+  the->the_index = pos + 1;
+}
+
+
+/**
+ *
+ */
+static void
+sift_up(timerheap_t *th, timerheap_entry_t *the, unsigned int pos)
+{
+  while(pos > 0) {
+    unsigned int parent = (pos - 1) / 2;
+    timerheap_entry_t *p = th->th_heap[parent];
+    if(!the_before(the, p))
+      break;
+    the_place(th, p, pos);
+    pos = parent;
+  }
+  the_place(th, the, pos);
+}
+
+
+/**
+ *
+ */
+static void
+sift_down(timerheap_t *th, timerheap_entry_t *the, unsigned int pos)
+{
+  const unsigned int n = th->th_count;
+
+  while(1) {
+    unsigned int c = pos * 2 + 1;
+    if(c >= n)
+      break;
+    if(c + 1 < n && the_before(th->th_heap[c + 1], th->th_heap[c]))
+      c++;
+    if(!the_before(th->th_heap[c], the))
+      break;
+    the_place(th, th->th_heap[c], pos);
+    pos = c;
+  }
+  the_place(th, the, pos);
+}
+
+
+/**
+ * Arm (or rearm) a timer. O(log n)
+ */
+void
+timerheap_arm(timerheap_t *th, timerheap_entry_t *the, int64_t expire)
+{
+  the->the_expire = expire;
+  the->the_seq = th->th_seq++;
+
+  if(the->the_index) {
+    // Already armed, just move it to its new position
+    unsigned int pos = the->the_index - 1;
+    if(pos > 0 && the_before(the, th->th_heap[(pos - 1) / 2]))
+      sift_up(th, the, pos);
+    else
+      sift_down(th, the, pos);
+    return;
+  }
+
+  if(th->th_count == th->th_capacity) {
+    th->th_capacity = th->th_capacity * 2 + 16;
+    th->th_heap = realloc(th->th_heap,
+                          th->th_capacity * sizeof(timerheap_entry_t *));
+  }
+
+  th->th_count++;
+  sift_up(th, the, th->th_count - 1);
+}
+
+
+/**
+ * Disarm a timer. O(log n). It's fine to call this for a timer that's
+ * not armed
+ */
+void
+timerheap_disarm(timerheap_t *th, timerheap_entry_t *the)
+{
+  if(!the->the_index)
+    return;
+
+  unsigned int pos = the->the_index - 1;
+  assert(th->th_heap[pos] == the);
+  the->the_index = 0;
+
+  th->th_count--;
+  if(pos == th->th_count)
+    return;
+
+  // Fill the hole with the last entry and restore heap order
+  timerheap_entry_t *last = th->th_heap[th->th_count];
+  if(pos > 0 && the_before(last, th->th_heap[(pos - 1) / 2]))
+    sift_up(th, last, pos);
+  else
+    sift_down(th, last, pos);
+}
+
+
+/**
+ *
+ */
+void
+timerheap_free(timerheap_t *th)
+{
+  for(unsigned int i = 0; i < th->th_count; i++)
+    th->th_heap[i]->the_index = 0;
+  free(th->th_heap);
+  th->th_heap = NULL;
+  th->th_count = 0;
+  th->th_capacity = 0;
+}
+
+
+// gcc -O2 src/misc/timerheap.c -o /tmp/timerheap -Isrc -DLOCAL_MAIN
+
+#ifdef LOCAL_MAIN
+
+#include <stdio.h>
+#include <sys/time.h>
+#include "queue.h"
+
+static int64_t
+get_ts(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+typedef struct bench_timer {
+  timerheap_entry_t bt_the;
+  LIST_ENTRY(bench_timer) bt_link;
+  int64_t bt_expire;
+} bench_timer_t;
+
+static int
+bt_compar(const bench_timer_t *a, const bench_timer_t *b)
+{
+  if(a->bt_expire < b->bt_expire)
+    return -1;
+  return 1;
+}
+
+LIST_HEAD(bench_timer_list, bench_timer);
+
+int
+main(int argc, char **argv)
+{
+  int num = argc > 1 ? atoi(argv[1]) : 50000;
+  bench_timer_t *v = calloc(num, sizeof(bench_timer_t));
+  timerheap_t th = {0};
+  int64_t ts;
+
+  srand(1);
+  for(int i = 0; i < num; i++)
+    v[i].bt_expire = rand() % 10000000;
+
+  ts = get_ts();
+  for(int i = 0; i < num; i++)
+    timerheap_arm(&th, &v[i].bt_the, v[i].bt_expire);
+  printf("timerheap: %d arms in %dµs\n", num, (int)(get_ts() - ts));
+
+  ts = get_ts();
+  for(int i = 0; i < num; i++)
+    timerheap_arm(&th, &v[i].bt_the, v[i].bt_expire + rand() % 1000000);
+  printf("timerheap: %d rearms in %dµs\n", num, (int)(get_ts() - ts));
+
+  ts = get_ts();
+  for(int i = 0; i < num; i += 2)
+    timerheap_disarm(&th, &v[i].bt_the);
+  printf("timerheap: %d disarms in %dµs\n", num / 2, (int)(get_ts() - ts));
+
+  ts = get_ts();
+  int64_t prev = INT64_MIN;
+  int cnt = 0;
+  timerheap_entry_t *the;
+  while((the = timerheap_first(&th)) != NULL) {
+    if(the->the_expire < prev) {
+      printf("timerheap: ordering broken\n");
+      return 1;
+    }
+    prev = the->the_expire;
+    timerheap_disarm(&th, the);
+    cnt++;
+  }
+  printf("timerheap: %d expired in %dµs\n", cnt, (int)(get_ts() - ts));
+  if(cnt != num / 2) {
+    printf("timerheap: expected %d timers, got %d\n", num / 2, cnt);
+    return 1;
+  }
+  timerheap_free(&th);
+
+  // Same arm pattern with a sorted list for comparison
+
+  struct bench_timer_list list;
+  LIST_INIT(&list);
+  ts = get_ts();
+  for(int i = 0; i < num; i++)
+    LIST_INSERT_SORTED(&list, &v[i], bt_link, bt_compar, bench_timer_t);
+  printf("sorted list: %d arms in %dµs\n", num, (int)(get_ts() - ts));
+
+  free(v);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+#include <stdint.h>
+
+/**
+ * Binary min-heap of timers ordered on expiry time.
+ *
+ * Entries are embedded in the owning object. Timers with the same
+ * expiry time fire in the order they were armed. No locking is done
+ * here, the user is expected to serialize access to the heap.
+ */
+typedef struct timerheap_entry {
+  int64_t the_expire;
+  unsigned int the_seq;
+  unsigned int the_index;   // 1-based slot in heap, 0 if not armed
+} timerheap_entry_t;
+
+
+typedef struct timerheap {
+  timerheap_entry_t **th_heap;
+  unsigned int th_count;
+  unsigned int th_capacity;
+  unsigned int th_seq;
+} timerheap_t;
+
+
+void timerheap_arm(timerheap_t *th, timerheap_entry_t *the, int64_t expire);
+
+void timerheap_disarm(timerheap_t *th, timerheap_entry_t *the);
+
+void timerheap_free(timerheap_t *th);
+
+#define timerheap_entry_armed(the) ((the)->the_index != 0)
+
+static __inline timerheap_entry_t *
+timerheap_first(const timerheap_t *th)
+{
+  return th->th_count ? th->th_heap[0] : NULL;
+}
@@ -553,7 +553,7 @@ nav_page_icon_set(void *opaque, rstr_t *str)
 static void
 nav_page_setup_prop(nav_page_t *np, const char *view)
 {
-  np->np_prop_root = prop_create_root("page");
+  np->np_prop_root = prop_create_root_domain("page");
 
   kv_prop_bind_create(prop_create(np->np_prop_root, "persistent"),
 		      np->np_url);
@@ -670,6 +670,8 @@ nav_open_backend(nav_page_t *np)
   noba->p = prop_ref_inc(np->np_prop_root);
   noba->url = strdup(np->np_url);
 
+  // Opens may block for a long time, give each one its own thread so
+  // they can never queue up behind each other
   hts_thread_create_detached("navopen", nav_open_thread, noba,
 			     THREAD_PRIO_MODEL);
 }
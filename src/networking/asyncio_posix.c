@@ -26,6 +26,11 @@
 #include <errno.h>
 #include <netinet/in.h>
 
+#if defined(linux)
+#include <sys/epoll.h>
+#define ASYNCIO_HAVE_EPOLL
+#endif
+
 #include "main.h"
 #include "arch/arch.h"
 #include "arch/threads.h"
@@ -41,12 +46,11 @@
 
 LIST_HEAD(asyncio_fd_list, asyncio_fd);
 LIST_HEAD(asyncio_worker_list, asyncio_worker);
-LIST_HEAD(asyncio_timer_list, asyncio_timer);
 TAILQ_HEAD(asyncio_dns_req_queue, asyncio_dns_req);
 
 static hts_thread_t asyncio_thread_id;
 
-static struct asyncio_timer_list asyncio_timers;
+static timerheap_t asyncio_timers;
 
 static hts_mutex_t asyncio_worker_mutex;
 static struct asyncio_worker_list asyncio_workers;
@@ -54,6 +58,8 @@ static struct asyncio_worker_list asyncio_workers;
 static int asyncio_pipe[2];
 static struct asyncio_fd_list asyncio_fds;
 static int asyncio_num_fds;
+static int asyncio_epfd = -1;  // -1 if we use poll()
+static struct asyncio_fd_list asyncio_error_fds; // fds with af_pending_errno
 
 struct prop_courier *asyncio_courier;
 
@@ -86,6 +92,7 @@ typedef struct asyncio_worker {
  */
 struct asyncio_fd {
   LIST_ENTRY(asyncio_fd) af_link;
+  LIST_ENTRY(asyncio_fd) af_error_link;
   asyncio_fd_callback_t *af_callback;
   void *af_opaque;
   char *af_name;
@@ -101,12 +108,13 @@ struct asyncio_fd {
   htsbuf_queue_t af_sendq;
   htsbuf_queue_t af_recvq;
 
-  int64_t af_timeout;
+  asyncio_timer_t af_timer;
 
   int af_refcount;
   int af_fd;
   int af_poll_events;
-  int af_pending_errno;
+  int af_pending_errno;  // Set when linked on asyncio_error_fds
+  uint8_t af_epoll_registered;
 
   uint16_t af_port;
   uint16_t af_ext_events;
@@ -225,19 +233,7 @@ asyncio_timer_init(asyncio_timer_t *at, void (*fn)(void *opaque),
 {
   at->at_fn = fn;
   at->at_opaque = opaque;
-  at->at_expire = 0;
-}
-
-
-/**
- *
- */
-static int
-at_compar(const asyncio_timer_t *a, const asyncio_timer_t *b)
-{
-  if(a->at_expire < b->at_expire)
-    return -1;
-  return 1;
+  at->at_timer.the_index = 0;
 }
 
 
@@ -248,11 +244,7 @@ static void
 asyncio_timer_arm(asyncio_timer_t *at, int64_t expire)
 {
   asyncio_verify_thread();
-  if(at->at_expire)
-    LIST_REMOVE(at, at_link);
-
-  at->at_expire = expire;
-  LIST_INSERT_SORTED(&asyncio_timers, at, at_link, at_compar, asyncio_timer_t);
+  timerheap_arm(&asyncio_timers, &at->at_timer, expire);
 }
 
 
@@ -273,10 +265,7 @@ void
 asyncio_timer_disarm(asyncio_timer_t *at)
 {
   asyncio_verify_thread();
-  if(at->at_expire) {
-    LIST_REMOVE(at, at_link);
-    at->at_expire = 0;
-  }
+  timerheap_disarm(&asyncio_timers, &at->at_timer);
 }
 
 
@@ -296,43 +285,118 @@ af_release(asyncio_fd_t *af)
   free(af);
 }
 
+/**
+ * Queue an error to be delivered to the fd from the main loop
+ */
+static void
+asyncio_set_pending_error(asyncio_fd_t *af, int err)
+{
+  if(af->af_pending_errno == 0)
+    LIST_INSERT_HEAD(&asyncio_error_fds, af, af_error_link);
+  af->af_pending_errno = err;
+}
+
+
 /**
  *
  */
 static void
-asyncio_dopoll(void)
+asyncio_clear_pending_error(asyncio_fd_t *af)
 {
-  asyncio_timer_t *at;
+  if(af->af_pending_errno == 0)
+    return;
+  LIST_REMOVE(af, af_error_link);
+  af->af_pending_errno = 0;
+}
 
-  while((at = LIST_FIRST(&asyncio_timers)) != NULL &&
-        at->at_expire <= async_now) {
-    LIST_REMOVE(at, at_link);
-    at->at_expire = 0;
-    at->at_fn(at->at_opaque);
+
+/**
+ * Deliver pending errors. Returns 1 if a callback was invoked, in which
+ * case the caller should restart the loop as the fd set may have changed
+ */
+static int
+asyncio_check_fds(void)
+{
+  asyncio_fd_t *af = LIST_FIRST(&asyncio_error_fds);
+
+  if(af == NULL)
+    return 0;
+
+  const int err = af->af_pending_errno;
+  asyncio_clear_pending_error(af);
+  af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, err);
+  return 1;
+}
+
+
+/**
+ * fd timeouts live on the same timerheap as the asyncio timers
+ */
+static void
+asyncio_fd_timeout(void *opaque)
+{
+  asyncio_fd_t *af = opaque;
+  if(af->af_callback != NULL)
+    af->af_callback(af, af->af_opaque, ASYNCIO_TIMEOUT, 0);
+}
+
+
+/**
+ * Deliver poll() style events to an fd
+ */
+static void
+asyncio_dispatch(asyncio_fd_t *af, int revents)
+{
+  if(!(af->af_callback && revents))
+    return;
+
+  if(revents & POLLHUP) {
+    af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, ECONNRESET);
+    return;
+  }
+
+  if(revents & POLLERR) {
+    int err;
+    socklen_t errlen = sizeof(int);
+
+    if(getsockopt(af->af_fd, SOL_SOCKET, SO_ERROR, (void *)&err, &errlen)) {
+      TRACE(TRACE_ERROR, "ASYNCIO", "getsockopt failed for 0x%x -- %d",
+            af->af_fd, errno);
+    } else {
+      af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, err);
+    }
+    return;
   }
 
+  af->af_callback(af,
+                  af->af_opaque,
+                  (revents & POLLIN  ? ASYNCIO_READ  : 0) |
+                  (revents & POLLOUT ? ASYNCIO_WRITE : 0), 0);
+
+  if(0) {
+    int64_t now = arch_get_ts();
+
+    if(now - async_now > 10000) {
+      TRACE(TRACE_ERROR, "ASYNCIO", "Long callback on socktet %s (%d µs)",
+            af->af_name, (int) (now - async_now));
+    }
+    async_now = now;
+  }
+}
+
+
+/**
+ *
+ */
+static void
+asyncio_poll(int timeout)
+{
   asyncio_fd_t *af;
   struct pollfd *fds = alloca(asyncio_num_fds * sizeof(struct pollfd));
   asyncio_fd_t **afds  = alloca(asyncio_num_fds * sizeof(asyncio_fd_t *));
   int n = 0;
 
-  int timeout = INT32_MAX;
-
   LIST_FOREACH(af, &asyncio_fds, af_link) {
-    if(af->af_pending_errno) {
-      af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, af->af_pending_errno);
-      goto release;
-    }
-
-    if(af->af_timeout) {
-      if(af->af_timeout <= async_now) {
-        af->af_timeout = 0;
-        af->af_callback(af, af->af_opaque, ASYNCIO_TIMEOUT, 0);
-        goto release;
-      }
-      timeout = MIN(timeout, (af->af_timeout - async_now + 999) / 1000);
-    }
-  
     fds[n].fd = af->af_fd;
     fds[n].events = af->af_poll_events;
     fds[n].revents = 0;
@@ -344,61 +408,136 @@ asyncio_dopoll(void)
 
   assert(n == asyncio_num_fds);
 
-  if((at = LIST_FIRST(&asyncio_timers)) != NULL)
-    timeout = MIN(timeout, (at->at_expire - async_now + 999) / 1000);
+  poll(fds, n, timeout);
+
+  async_now = arch_get_ts();
 
-  if(timeout == INT32_MAX)
-    timeout = -1;
+  for(int i = 0; i < n; i++)
+    asyncio_dispatch(afds[i], fds[i].revents);
 
-  poll(fds, n, timeout);
+  for(int i = 0; i < n; i++)
+    af_release(afds[i]);
+}
+
+
+#ifdef ASYNCIO_HAVE_EPOLL
+
+#define ASYNCIO_EPOLL_EVENTS 64
+
+/**
+ *
+ */
+static uint32_t
+poll_to_epoll_events(int events)
+{
+  return
+    (events & POLLIN  ? EPOLLIN  : 0) |
+    (events & POLLOUT ? EPOLLOUT : 0) |
+    (events & POLLERR ? EPOLLERR : 0) |
+    (events & POLLHUP ? EPOLLHUP : 0);
+}
+
+
+/**
+ *
+ */
+static int
+epoll_to_poll_events(uint32_t events)
+{
+  return
+    (events & EPOLLIN  ? POLLIN  : 0) |
+    (events & EPOLLOUT ? POLLOUT : 0) |
+    (events & EPOLLERR ? POLLERR : 0) |
+    (events & EPOLLHUP ? POLLHUP : 0);
+}
+
+
+/**
+ * Interest is kept in the kernel so we only need to collect the
+ * fds that are actually ready
+ */
+static void
+asyncio_epoll(int timeout)
+{
+  struct epoll_event ev[ASYNCIO_EPOLL_EVENTS];
+
+  int n = epoll_wait(asyncio_epfd, ev, ASYNCIO_EPOLL_EVENTS, timeout);
 
   async_now = arch_get_ts();
 
+  if(n == -1) {
+    if(errno != EINTR)
+      TRACE(TRACE_ERROR, "ASYNCIO", "epoll_wait failed -- %s",
+            strerror(errno));
+    return;
+  }
+
+  // Callbacks may delete other fds in this batch, so hold references
   for(int i = 0; i < n; i++) {
-    af = afds[i];
+    asyncio_fd_t *af = ev[i].data.ptr;
+    af->af_refcount++;
+  }
 
-    if(!(af->af_callback && fds[i].revents))
-      continue;
+  for(int i = 0; i < n; i++)
+    asyncio_dispatch(ev[i].data.ptr, epoll_to_poll_events(ev[i].events));
 
-    if(fds[i].revents & POLLHUP) {
-      af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, ECONNRESET);
-      continue;
-    }
+  for(int i = 0; i < n; i++)
+    af_release(ev[i].data.ptr);
+}
 
-    if(fds[i].revents & POLLERR) {
-      int err;
-      socklen_t errlen = sizeof(int);
 
-      if(getsockopt(af->af_fd, SOL_SOCKET, SO_ERROR, (void *)&err, &errlen)) {
-        TRACE(TRACE_ERROR, "ASYNCIO", "getsockopt failed for 0x%x -- %d",
-              af->af_fd, errno);
-      } else {
-        af->af_callback(af, af->af_opaque, ASYNCIO_ERROR, err);
-      }
-      continue;
-    }
+/**
+ * Returns 0 or an errno
+ */
+static int
+asyncio_epoll_ctl(asyncio_fd_t *af, int op)
+{
+  struct epoll_event ev = {0};
+  ev.events = poll_to_epoll_events(af->af_poll_events);
+  ev.data.ptr = af;
+  if(!epoll_ctl(asyncio_epfd, op, af->af_fd, &ev))
+    return 0;
+
+  const int err = errno;
+  TRACE(TRACE_ERROR, "ASYNCIO", "epoll_ctl(%d) failed for %s -- %s",
+        op, af->af_name, strerror(err));
+  return err;
+}
 
-    af->af_callback(af,
-                    af->af_opaque,
-                    (fds[i].revents & POLLIN  ? ASYNCIO_READ  : 0) |
-                    (fds[i].revents & POLLOUT ? ASYNCIO_WRITE : 0), 0);
+#endif
 
-    if(0) {
-      int64_t now = arch_get_ts();
 
-      if(now - async_now > 10000) {
-        TRACE(TRACE_ERROR, "ASYNCIO", "Long callback on socktet %s (%d µs)",
-              af->af_name, (int) (now - async_now));
-      }
-      async_now = now;
-    }
+/**
+ *
+ */
+static void
+asyncio_dopoll(void)
+{
+  asyncio_timer_t *at;
+  timerheap_entry_t *the;
+
+  while((the = timerheap_first(&asyncio_timers)) != NULL &&
+        the->the_expire <= async_now) {
+    at = (asyncio_timer_t *)the;
+    timerheap_disarm(&asyncio_timers, the);
+    at->at_fn(at->at_opaque);
   }
 
+  if(asyncio_check_fds())
+    return;
+
+  int timeout = -1;
 
- release:
+  if((the = timerheap_first(&asyncio_timers)) != NULL)
+    timeout = MIN(INT32_MAX, (the->the_expire - async_now + 999) / 1000);
 
-  for(int i = 0; i < n; i++)
-    af_release(afds[i]);
+#ifdef ASYNCIO_HAVE_EPOLL
+  if(asyncio_epfd != -1) {
+    asyncio_epoll(timeout);
+    return;
+  }
+#endif
+  asyncio_poll(timeout);
 }
 
 
@@ -411,10 +550,20 @@ asyncio_set_events(asyncio_fd_t *af, int events)
   asyncio_verify_thread();
   af->af_ext_events = events;
 
-  af->af_poll_events =
+  int poll_events =
     (events & ASYNCIO_READ  ? POLLIN            : 0) |
     (events & ASYNCIO_WRITE ? POLLOUT           : 0) |
     (events & ASYNCIO_ERROR ? (POLLHUP|POLLERR) : 0);
+
+  if(af->af_poll_events == poll_events)
+    return;
+
+  af->af_poll_events = poll_events;
+
+#ifdef ASYNCIO_HAVE_EPOLL
+  if(af->af_epoll_registered)
+    asyncio_epoll_ctl(af, EPOLL_CTL_MOD);
+#endif
 }
 
 
@@ -455,11 +604,22 @@ asyncio_add_fd(int fd, int events, asyncio_fd_callback_t *cb, void *opaque,
   asyncio_set_events(af, events);
   af->af_callback = cb;
   af->af_opaque = opaque;
+  asyncio_timer_init(&af->af_timer, asyncio_fd_timeout, af);
 
   net_change_nonblocking(fd, 1);
 
   LIST_INSERT_HEAD(&asyncio_fds, af, af_link);
   asyncio_num_fds++;
+
+#ifdef ASYNCIO_HAVE_EPOLL
+  if(asyncio_epfd != -1) {
+    const int err = asyncio_epoll_ctl(af, EPOLL_CTL_ADD);
+    if(!err)
+      af->af_epoll_registered = 1;
+    else
+      asyncio_set_pending_error(af, err); // Never polled, tell the owner
+  }
+#endif
   return af;
 }
 
@@ -471,6 +631,14 @@ void
 asyncio_del_fd(asyncio_fd_t *af)
 {
   asyncio_verify_thread();
+#ifdef ASYNCIO_HAVE_EPOLL
+  if(af->af_epoll_registered) {
+    asyncio_epoll_ctl(af, EPOLL_CTL_DEL);
+    af->af_epoll_registered = 0;
+  }
+#endif
+  asyncio_timer_disarm(&af->af_timer);
+  asyncio_clear_pending_error(af);
   if(af->af_fd != -1)
     close(af->af_fd);
   af->af_fd = -1;
@@ -487,7 +655,7 @@ asyncio_del_fd(asyncio_fd_t *af)
 void
 asyncio_set_timeout_delta_sec(asyncio_fd_t *af, int delta)
 {
-  af->af_timeout = delta * 1000000LL + async_now;
+  asyncio_timer_arm_delta_sec(&af->af_timer, delta);
 }
 
 /**
@@ -551,6 +719,13 @@ asyncio_thread(void *aux)
 
   asyncio_courier = prop_courier_create_notify(asyncio_courier_notify, NULL);
 
+#ifdef ASYNCIO_HAVE_EPOLL
+  asyncio_epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(asyncio_epfd == -1)
+    TRACE(TRACE_ERROR, "ASYNCIO", "epoll_create1 failed -- %s, using poll()",
+          strerror(errno));
+#endif
+
   asyncio_add_fd(asyncio_pipe[0], ASYNCIO_READ, asyncio_handle_pipe,
                  asyncio_courier, "Pipe");
 
@@ -702,6 +877,12 @@ asyncio_listen(const char *name, int port, asyncio_accept_callback_t *cb,
   asyncio_fd_t *af = asyncio_add_fd(fd, ASYNCIO_READ,
                                     asyncio_tcp_accept, opaque, name);
 
+  if(af->af_pending_errno) {
+    // Not polled, asyncio_tcp_accept() only handles ASYNCIO_READ
+    asyncio_del_fd(af);
+    return NULL;
+  }
+
   af->af_accept_callback = cb;
   af->af_port = port;
   return af;
@@ -738,7 +919,7 @@ do_write(asyncio_fd_t *af)
 
     if(r == -1) {
       asyncio_rem_events(af, ASYNCIO_WRITE);
-      af->af_pending_errno = errno;
+      asyncio_set_pending_error(af, errno);
       return;
     }
 
@@ -796,20 +977,20 @@ asyncio_tcp_connected(asyncio_fd_t *af, void *opaque, int events, int error)
   if(events & ASYNCIO_ERROR) {
     char buf[256];
     snprintf(buf, sizeof(buf), "%s", strerror(error));
-    af->af_timeout = 0;
+    asyncio_timer_disarm(&af->af_timer);
     af->af_error_callback(af->af_opaque, buf);
     return;
   }
 
   if(events & ASYNCIO_READ) {
-    af->af_timeout = 0;
+    asyncio_timer_disarm(&af->af_timer);
     do_read(af);
     return;
   }
 
   if(events & ASYNCIO_WRITE) {
 
-    af->af_timeout = 0;
+    asyncio_timer_disarm(&af->af_timer);
 
     if(af->af_connected) {
       do_write(af);
@@ -898,7 +1079,7 @@ asyncio_connect(const char *name, const net_addr_t *addr,
 
   af->af_error_callback = error_cb;
   af->af_read_callback  = read_cb;
-  af->af_timeout = arch_get_ts() + timeout * 1000;
+  asyncio_timer_arm(&af->af_timer, arch_get_ts() + timeout * 1000LL);
 
   int r = connect(fd, (struct sockaddr *)&si, sizeof(struct sockaddr_in));
   if(r == -1) {
@@ -908,7 +1089,7 @@ asyncio_connect(const char *name, const net_addr_t *addr,
     } else {
       // Got fail directly, but we still want to notify the user about
       // the error asynchronously. Just to make things easier
-      af->af_pending_errno = errno;
+      asyncio_set_pending_error(af, errno);
     }
   } else {
     asyncio_add_events(af, ASYNCIO_WRITE);
@@ -1172,6 +1353,12 @@ asyncio_udp_bind(const char *name,
 
   asyncio_fd_t *af = asyncio_add_fd(fd, ASYNCIO_READ,
                                     asyncio_udp_event, opaque, name);
+
+  if(af->af_pending_errno) {
+    // Not polled, asyncio_udp_event() only handles ASYNCIO_READ
+    asyncio_del_fd(af);
+    return NULL;
+  }
   af->af_udp_callback = cb;
   af->af_port = port;
   return af;
@@ -1195,3 +1382,107 @@ asyncio_udp_send(asyncio_fd_t *af, const void *data, int size,
 	 (const struct sockaddr *)&sin, sizeof(struct sockaddr_in));
 }
 
+
+#ifdef ASYNCIO_BENCH
+
+/**
+ * Wakeup latency benchmark
+ *
+ * Registers ASYNCIO_BENCH_SOCKETS idle local socket pairs and then
+ * measures the time from a write on a random one until its read
+ * callback fires on the asyncio thread
+ */
+
+#define ASYNCIO_BENCH_SOCKETS 1000
+#define ASYNCIO_BENCH_ROUNDS  10000
+
+static int bench_wfd[ASYNCIO_BENCH_SOCKETS];
+static int bench_num_sockets;
+static hts_mutex_t bench_mutex;
+static hts_cond_t bench_cond;
+static int64_t bench_sent;
+static int64_t bench_latency;
+static int bench_done;
+
+
+/**
+ *
+ */
+static void
+asyncio_bench_input(asyncio_fd_t *af, void *opaque, int events, int error)
+{
+  char x;
+  if(read(af->af_fd, &x, 1) != 1)
+    return;
+
+  hts_mutex_lock(&bench_mutex);
+  bench_latency = arch_get_ts() - bench_sent;
+  bench_done = 1;
+  hts_cond_signal(&bench_cond);
+  hts_mutex_unlock(&bench_mutex);
+}
+
+
+/**
+ *
+ */
+static void *
+asyncio_bench_thread(void *aux)
+{
+  int64_t total = 0, max = 0;
+  char x = 0;
+
+  for(int i = 0; i < ASYNCIO_BENCH_ROUNDS; i++) {
+    int fd = bench_wfd[rand() % bench_num_sockets];
+
+    hts_mutex_lock(&bench_mutex);
+    bench_done = 0;
+    bench_sent = arch_get_ts();
+    if(write(fd, &x, 1) != 1) {
+      hts_mutex_unlock(&bench_mutex);
+      break;
+    }
+    while(!bench_done)
+      hts_cond_wait(&bench_cond, &bench_mutex);
+    total += bench_latency;
+    max = MAX(max, bench_latency);
+    hts_mutex_unlock(&bench_mutex);
+  }
+
+  TRACE(TRACE_INFO, "ASYNCIO",
+        "Wakeup latency using %s with %d sockets: avg %dus max %dus",
+        asyncio_epfd != -1 ? "epoll" : "poll", bench_num_sockets,
+        (int)(total / ASYNCIO_BENCH_ROUNDS), (int)max);
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+asyncio_bench_init(void)
+{
+  hts_mutex_init(&bench_mutex);
+  hts_cond_init(&bench_cond, &bench_mutex);
+
+  for(int i = 0; i < ASYNCIO_BENCH_SOCKETS; i++) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+      break;
+    bench_wfd[i] = fds[1];
+    asyncio_add_fd(fds[0], ASYNCIO_READ, asyncio_bench_input, NULL,
+                   "bench");
+    bench_num_sockets++;
+  }
+
+  if(bench_num_sockets == 0)
+    return;
+
+  hts_thread_create_detached("asynciobench", asyncio_bench_thread, NULL,
+                             THREAD_PRIO_BGTASK);
+}
+
+INITME(INIT_GROUP_ASYNCIO, asyncio_bench_init, NULL);
+
+#endif
@@ -152,6 +152,7 @@ void prop_init_late(void);
 #define PROP_SUB_SINGLETON            0x800
 #define PROP_SUB_USER_INT             0x1000
 #define PROP_SUB_ALT_PATH             0x2000
+#define PROP_SUB_COALESCE             0x4000 // Only deliver latest value
 // Remember that flags field is uint16_t in prop_i.h so don't go above 0x8000
 
 
@@ -215,6 +216,14 @@ prop_t *prop_create_root_ex(const char *name, int noalloc)
 #define prop_create_root(name) \
   prop_create_root_ex(name, __builtin_constant_p(name))
 
+/**
+ * Create a root with its own lock domain. Value updates and child
+ * creation inside the subtree only contend on the domain's lock
+ * instead of the global prop lock
+ */
+prop_t *prop_create_root_domain(const char *name)
+  attribute_malloc;
+
 prop_t *prop_create_after(prop_t *parent, const char *name, prop_t *after,
 			  prop_sub_t *skipme);
 
@@ -499,6 +508,8 @@ const char *propname(prop_t *p);
 
 void prop_print_tree(prop_t *p, int followlinks);
 
+void prop_print_lock_stats(void);
+
 void prop_test(void);
 
 #ifdef PROP_DEBUG
@@ -286,7 +286,7 @@ prop_concat_add_source(prop_concat_t *pc, prop_t *src, prop_t *header)
   pcs->pcs_header = header;
   pcs->pcs_pc = pc;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   TAILQ_INSERT_TAIL(&pc->pc_queue, pcs, pcs_link);
 
@@ -298,7 +298,7 @@ prop_concat_add_source(prop_concat_t *pc, prop_t *src, prop_t *header)
 
   pcs->pcs_index = pc->pc_index_tally++;
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
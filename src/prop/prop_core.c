@@ -37,9 +37,17 @@ static prop_sub_t *track_sub;
 #endif
 
 hts_mutex_t prop_mutex;
+hts_mutex_t prop_courier_mutex;
 hts_mutex_t prop_tag_mutex;
 static prop_t *prop_global;
 
+// Lock domains, see prop_domain_t in prop_i.h
+
+static struct prop_domain_queue prop_domains;
+static prop_lock_stats_t prop_global_lock_stats;
+
+static int prop_notify_coalesced; // Protected by prop_courier_mutex
+
 
 pool_t *prop_pool;
 pool_t *notify_pool;
@@ -76,6 +84,203 @@ static void prop_destroy_childs0(prop_t *p);
 static LIST_HEAD(, prop_sub) all_subs;
 #endif
 
+
+/**
+ * Lock a mutex and account for any contention
+ */
+static void
+prop_lock_counted(hts_mutex_t *m, prop_lock_stats_t *pls)
+{
+  if(hts_mutex_trylock(m)) {
+    int64_t ts = arch_get_ts();
+    hts_mutex_lock(m);
+    pls->pls_contended++;
+    pls->pls_wait_time += arch_get_ts() - ts;
+  }
+  pls->pls_locks++;
+}
+
+
+/**
+ *
+ */
+static void
+prop_domain_destroy(prop_domain_t *pd)
+{
+  const prop_lock_stats_t *pls = &pd->pd_stats;
+
+  if(pls->pls_contended)
+    PROPTRACE("Lock domain %s: %"PRId64" locks, %"PRId64" contended, "
+              "%"PRId64" us waiting",
+              pd->pd_name, pls->pls_locks, pls->pls_contended,
+              pls->pls_wait_time);
+
+  TAILQ_REMOVE(&prop_domains, pd, pd_link);
+  hts_mutex_destroy(&pd->pd_mutex);
+  free(pd->pd_name);
+  free(pd);
+}
+
+
+/**
+ * Lock all domains. Required for any operation that is not confined
+ * to a single domain
+ */
+void
+prop_lock_global(void)
+{
+  prop_domain_t *pd;
+
+  prop_lock_counted(&prop_mutex, &prop_global_lock_stats);
+
+  TAILQ_FOREACH(pd, &prop_domains, pd_link)
+    prop_lock_counted(&pd->pd_mutex, &pd->pd_stats);
+}
+
+
+/**
+ * Unlock all domains. Domains without any props left are reaped here
+ * as no-one else can reference them anymore
+ */
+void
+prop_unlock_global(void)
+{
+  prop_domain_t *pd, *next;
+
+  for(pd = TAILQ_FIRST(&prop_domains); pd != NULL; pd = next) {
+    next = TAILQ_NEXT(pd, pd_link);
+    hts_mutex_unlock(&pd->pd_mutex);
+    if(atomic_get(&pd->pd_refcount) == 0)
+      prop_domain_destroy(pd);
+  }
+
+  hts_mutex_unlock(&prop_mutex);
+}
+
+
+/**
+ *
+ */
+static void
+prop_domain_release(prop_domain_t *pd)
+{
+  if(pd != NULL)
+    atomic_dec(&pd->pd_refcount);
+}
+
+
+/**
+ * Move a subtree from the global domain into 'pd'. Subtrees that
+ * already belong to a private domain are left as is.
+ */
+static void
+prop_domain_adopt(prop_t *p, prop_domain_t *pd)
+{
+  prop_t *c;
+
+  if(p->hp_domain != NULL)
+    return;
+
+  p->hp_domain = pd;
+  atomic_inc(&pd->pd_refcount);
+
+  if(p->hp_type == PROP_DIR)
+    TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
+      prop_domain_adopt(c, pd);
+}
+
+
+/**
+ * Return 1 if all effects of changing 'p' stays within 'pd'
+ *
+ * PROP_SUB_INTERNAL subscriptions are invoked synchronously and
+ * may modify any other prop, multi notifications propagate upwards
+ * in the tree. If 'dir' is set we are about to add childs to 'p'
+ * (which would inherit PROP_MULTI_NOTIFY), otherwise we're about to
+ * change the value of it which, if it's a directory, would destroy
+ * all childs.
+ */
+static int
+prop_is_local(const prop_t *p, const prop_domain_t *pd, int dir)
+{
+  const prop_sub_t *s;
+
+  if(p->hp_domain != pd || p->hp_flags & PROP_MULTI_NOTIFY)
+    return 0;
+
+  if(dir ? p->hp_flags & PROP_MULTI_SUB : p->hp_type == PROP_DIR)
+    return 0;
+
+  LIST_FOREACH(s, &p->hp_value_subscriptions, hps_value_prop_link)
+    if(s->hps_flags & PROP_SUB_INTERNAL)
+      return 0;
+  return 1;
+}
+
+
+/**
+ * Acquire the lock required to modify 'p' (or add childs to it if
+ * 'dir' is set).
+ *
+ * Returns the private domain locked or NULL if the global lock was
+ * taken. Must be released with prop_unlock_domain()
+ */
+static prop_domain_t *
+prop_lock_domain(prop_t *p, int dir)
+{
+  prop_domain_t *pd = p->hp_domain;
+
+  if(pd != NULL) {
+    prop_lock_counted(&pd->pd_mutex, &pd->pd_stats);
+    if(prop_is_local(p, pd, dir))
+      return pd;
+    hts_mutex_unlock(&pd->pd_mutex);
+  }
+  prop_lock_global();
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+prop_unlock_domain(prop_domain_t *pd)
+{
+  if(pd != NULL)
+    hts_mutex_unlock(&pd->pd_mutex);
+  else
+    prop_unlock_global();
+}
+
+
+/**
+ *
+ */
+static void
+prop_print_lock_stats0(const char *name, const prop_lock_stats_t *pls)
+{
+  TRACE(TRACE_INFO, "prop",
+        "%-20s %10"PRId64" locks %10"PRId64" contended %10"PRId64" us",
+        name, pls->pls_locks, pls->pls_contended, pls->pls_wait_time);
+}
+
+
+/**
+ *
+ */
+void
+prop_print_lock_stats(void)
+{
+  prop_domain_t *pd;
+
+  prop_lock_global();
+  prop_print_lock_stats0("<global>", &prop_global_lock_stats);
+  TAILQ_FOREACH(pd, &prop_domains, pd_link)
+    prop_print_lock_stats0(pd->pd_name, &pd->pd_stats);
+  prop_unlock_global();
+}
+
 /**
  *
  */
@@ -117,12 +322,12 @@ rstr_t *
 prop_get_name(prop_t *p)
 {
   rstr_t *r;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   if(p->hp_name != NULL)
     r = rstr_alloc(p->hp_name);
   else
     r = NULL;
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return r;
 }
 
@@ -250,11 +455,11 @@ prop_ref_dec_traced(prop_t *p, const char *file, int line)
   extern void prop_tag_dump(prop_t *p);
   prop_tag_dump(p);
 
-  hts_mutex_lock(&prop_mutex);
-  assert(p->hp_tags == NULL);
+  assert(prop_tag_empty(p));
+  prop_domain_t *pd = p->hp_domain;
   memset(p, 0xdd, sizeof(prop_t));
   pool_put(prop_pool, p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_domain_release(pd);
 }
 
 
@@ -289,9 +494,11 @@ prop_ref_dec_traced_locked(prop_t *p, const char *file, int line)
   extern void prop_tag_dump(prop_t *p);
   prop_tag_dump(p);
 
-  assert(p->hp_tags == NULL);
+  assert(prop_tag_empty(p));
+  prop_domain_t *pd = p->hp_domain;
   memset(p, 0xdd, sizeof(prop_t));
   pool_put(prop_pool, p);
+  prop_domain_release(pd);
 }
 
 
@@ -357,14 +564,14 @@ prop_ref_dec(prop_t *p)
   if(p == NULL || atomic_dec(&p->hp_refcount))
     return;
   assert(p->hp_type == PROP_ZOMBIE);
-  assert(p->hp_tags == NULL);
+  assert(prop_tag_empty(p));
+  prop_domain_t *pd = p->hp_domain;
 #ifdef PROP_DEBUG
   assert(p->hp_magic == PROP_MAGIC);
   memset(p, 0xdd, sizeof(prop_t));
 #endif
-  hts_mutex_lock(&prop_mutex);
   pool_put(prop_pool, p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_domain_release(pd);
 }
 
 
@@ -377,12 +584,14 @@ prop_ref_dec_locked(prop_t *p)
   if(p == NULL || atomic_dec(&p->hp_refcount))
     return;
   assert(p->hp_type == PROP_ZOMBIE);
-  assert(p->hp_tags == NULL);
+  assert(prop_tag_empty(p));
+  prop_domain_t *pd = p->hp_domain;
 #ifdef PROP_DEBUG
   assert(p->hp_magic == PROP_MAGIC);
   memset(p, 0xdd, sizeof(prop_t));
 #endif
   pool_put(prop_pool, p);
+  prop_domain_release(pd);
 }
 
 /**
@@ -408,10 +617,10 @@ prop_t *
 prop_xref_addref(prop_t *p)
 {
   if(p != NULL) {
-    hts_mutex_lock(&prop_mutex);
+    prop_lock_global();
     assert(p->hp_xref < 255);
     p->hp_xref++;
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
   }
   return p;
 }
@@ -921,15 +1130,12 @@ prop_notify_dispatch(struct prop_notify_queue *q, const char *trace_name)
       prop_dispatch_one(n, PROP_LOCK_LOCK);
   }
 
-  hts_mutex_lock(&prop_mutex);
-
   for(n = TAILQ_FIRST(q); n != NULL; n = next) {
     next = TAILQ_NEXT(n, hpn_link);
 
     prop_sub_ref_dec_locked(n->hpn_sub);
     pool_put(notify_pool, n);
   }
-  hts_mutex_unlock(&prop_mutex);
 }
 
 
@@ -947,33 +1153,39 @@ prop_courier(void *aux)
   if(pc->pc_prologue)
     pc->pc_prologue();
   
-  hts_mutex_lock(&prop_mutex);
+  hts_mutex_lock(&prop_courier_mutex);
 
   while(pc->pc_run) {
 
     if(TAILQ_FIRST(&pc->pc_queue_exp) == NULL &&
        TAILQ_FIRST(&pc->pc_queue_nor) == NULL) {
-      hts_cond_wait(&pc->pc_cond, &prop_mutex);
+      hts_cond_wait(&pc->pc_cond, &prop_courier_mutex);
       continue;
     }
 
     TAILQ_MOVE(&q_exp, &pc->pc_queue_exp, hpn_link);
     TAILQ_INIT(&pc->pc_queue_exp);
+    if(TAILQ_FIRST(&q_exp) != NULL)
+      pc->pc_generation++;
 
     TAILQ_INIT(&q_nor);
     if((n = TAILQ_FIRST(&pc->pc_queue_nor)) != NULL) {
       TAILQ_REMOVE(&pc->pc_queue_nor, n, hpn_link);
       TAILQ_INSERT_TAIL(&q_nor, n, hpn_link);
+      if(n->hpn_sub->hps_pending_value == n)
+        n->hpn_sub->hps_pending_value = NULL;
     }
 
     const char *tt = pc->pc_flags & PROP_COURIER_TRACE_TIMES ?
       pc->pc_name : NULL;
-    hts_mutex_unlock(&prop_mutex);
+    hts_mutex_unlock(&prop_courier_mutex);
     prop_notify_dispatch(&q_exp, tt);
     prop_notify_dispatch(&q_nor, tt);
-    hts_mutex_lock(&prop_mutex);
+    hts_mutex_lock(&prop_courier_mutex);
   }
 
+  pc->pc_generation++;
+
   while((n = TAILQ_FIRST(&pc->pc_queue_exp)) != NULL) {
     TAILQ_REMOVE(&pc->pc_queue_exp, n, hpn_link);
     prop_notify_free(n);
@@ -987,7 +1199,7 @@ prop_courier(void *aux)
   if(pc->pc_detached)
     free(pc);
 
-  hts_mutex_unlock(&prop_mutex);
+  hts_mutex_unlock(&prop_courier_mutex);
 
   if(pc->pc_epilogue)
     pc->pc_epilogue();
@@ -1004,7 +1216,7 @@ prop_global_dispatch_thread(void *aux)
   prop_sub_dispatch_t *psd, *s;
   prop_notify_t *n;
 
-  hts_mutex_lock(&prop_mutex);
+  hts_mutex_lock(&prop_courier_mutex);
   while(1) {
     psd = TAILQ_FIRST(&prop_global_dispatch_queue);
     if(psd == NULL) {
@@ -1012,7 +1224,7 @@ prop_global_dispatch_thread(void *aux)
         break;
 
       prop_global_dispatch_avail++;
-      hts_cond_wait(&prop_global_dispatch_cond, &prop_mutex);
+      hts_cond_wait(&prop_global_dispatch_cond, &prop_courier_mutex);
       prop_global_dispatch_avail--;
       continue;
     }
@@ -1024,9 +1236,9 @@ prop_global_dispatch_thread(void *aux)
     n = TAILQ_FIRST(&psd->psd_notifications);
     assert(n != NULL);
 
-    hts_mutex_unlock(&prop_mutex);
+    hts_mutex_unlock(&prop_courier_mutex);
     int r = prop_dispatch_one(n, PROP_LOCK_TRY);
-    hts_mutex_lock(&prop_mutex);
+    hts_mutex_lock(&prop_courier_mutex);
 
     TAILQ_REMOVE(&prop_global_dispatch_dispatching_queue, psd, psd_link);
 
@@ -1057,9 +1269,9 @@ prop_global_dispatch_thread(void *aux)
 
         TAILQ_INSERT_TAIL(&prop_global_dispatch_dispatching_queue, psd,
                           psd_link);
-        hts_mutex_unlock(&prop_mutex);
+        hts_mutex_unlock(&prop_courier_mutex);
         prop_dispatch_one(n, PROP_LOCK_LOCK);
-        hts_mutex_lock(&prop_mutex);
+        hts_mutex_lock(&prop_courier_mutex);
         TAILQ_REMOVE(&prop_global_dispatch_dispatching_queue, psd, psd_link);
 
       } else {
@@ -1090,7 +1302,7 @@ prop_global_dispatch_thread(void *aux)
     pool_put(notify_pool, n);
   }
   prop_global_dispatch_running--;
-  hts_mutex_unlock(&prop_mutex);
+  hts_mutex_unlock(&prop_courier_mutex);
   return NULL;
 }
 
@@ -1132,6 +1344,8 @@ courier_notify(prop_courier_t *pc)
 static void
 courier_enqueue0(prop_sub_t *s, prop_notify_t *n, int expedite)
 {
+  hts_mutex_lock(&prop_courier_mutex);
+
   if(s->hps_global_dispatch) {
 
     prop_sub_dispatch_t *psd = s->hps_dispatch;
@@ -1155,11 +1369,16 @@ courier_enqueue0(prop_sub_t *s, prop_notify_t *n, int expedite)
     else
       TAILQ_INSERT_TAIL(&pc->pc_queue_nor, n, hpn_link);
 
+    s->hps_pending_value = NULL;
     courier_notify(pc);
   }
+
+  hts_mutex_unlock(&prop_courier_mutex);
 }
 
 
+
+
 /**
  *
  */
@@ -1170,6 +1389,46 @@ courier_enqueue(prop_sub_t *s, prop_notify_t *n)
 }
 
 
+/**
+ * Enqueue a value notification. For PROP_SUB_COALESCE subscriptions
+ * remember it so it can be replaced by get_notify_value() as long as
+ * it's still queued.
+ */
+static void
+courier_enqueue_value(prop_sub_t *s, prop_notify_t *n)
+{
+  if(!(s->hps_flags & PROP_SUB_COALESCE) || s->hps_global_dispatch) {
+    courier_enqueue(s, n);
+    return;
+  }
+
+  switch(n->hpn_event) {
+  case PROP_SET_RSTRING:
+  case PROP_SET_CSTRING:
+  case PROP_SET_URI:
+  case PROP_SET_FLOAT:
+  case PROP_SET_INT:
+    break;
+  default:
+    // Dir and void may be followed by child events, never drop those
+    courier_enqueue(s, n);
+    return;
+  }
+
+  prop_courier_t *pc = s->hps_dispatch;
+
+  hts_mutex_lock(&prop_courier_mutex);
+  if(s->hps_flags & PROP_SUB_EXPEDITE)
+    TAILQ_INSERT_TAIL(&pc->pc_queue_exp, n, hpn_link);
+  else
+    TAILQ_INSERT_TAIL(&pc->pc_queue_nor, n, hpn_link);
+  s->hps_pending_value = n;
+  s->hps_pending_gen = pc->pc_generation;
+  courier_notify(pc);
+  hts_mutex_unlock(&prop_courier_mutex);
+}
+
+
 /**
  *
  */
@@ -1183,6 +1442,49 @@ get_notify(prop_sub_t *s)
 }
 
 
+/**
+ * Get a notification for a value change.
+ *
+ * For PROP_SUB_COALESCE subscriptions, if the last notification queued
+ * for the subscription is a value change that has not yet been picked
+ * up by the courier, it's unlinked and reused as it's superseded by
+ * the new value anyway. The caller will put it back at the tail of
+ * the queue which retains ordering relative to other subscriptions
+ * on the same courier.
+ */
+static prop_notify_t *
+get_notify_value(prop_sub_t *s)
+{
+  prop_notify_t *n = NULL;
+
+  if(s->hps_flags & PROP_SUB_COALESCE && !s->hps_global_dispatch &&
+     s->hps_pending_value != NULL) {
+    prop_courier_t *pc = s->hps_dispatch;
+
+    hts_mutex_lock(&prop_courier_mutex);
+    if(s->hps_pending_value != NULL &&
+       s->hps_pending_gen == pc->pc_generation) {
+      n = s->hps_pending_value;
+      if(s->hps_flags & PROP_SUB_EXPEDITE)
+        TAILQ_REMOVE(&pc->pc_queue_exp, n, hpn_link);
+      else
+        TAILQ_REMOVE(&pc->pc_queue_nor, n, hpn_link);
+      pc->pc_num_coalesced++;
+      prop_notify_coalesced++;
+    }
+    s->hps_pending_value = NULL;
+    hts_mutex_unlock(&prop_courier_mutex);
+  }
+
+  if(n == NULL)
+    return get_notify(s);
+
+  // Keep the subscription reference, just release the old payload
+  prop_notify_free_payload(n);
+  return n;
+}
+
+
 /**
  *
  */
@@ -1308,7 +1610,10 @@ prop_build_notify_value(prop_sub_t *s, int direct, const char *origin,
     return;
   }
 
-  n = get_notify(s);
+  if(pnq == NULL && !(s->hps_flags & PROP_SUB_MULTI))
+    n = get_notify_value(s);
+  else
+    n = get_notify(s);
 
   n->hpn_prop2 = prop_ref_inc(p);
 
@@ -1361,8 +1666,10 @@ prop_build_notify_value(prop_sub_t *s, int direct, const char *origin,
 
   if(pnq) {
     TAILQ_INSERT_TAIL(pnq, n, hpn_link);
-  } else {
+  } else if(s->hps_flags & PROP_SUB_MULTI) {
     courier_enqueue(s, n);
+  } else {
+    courier_enqueue_value(s, n);
   }
 }
 
@@ -1663,9 +1970,9 @@ prop_send_ext_event(prop_t *p, event_t *e)
 {
   if(p == NULL)
     return;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_send_ext_event0(p, e);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -1748,6 +2055,279 @@ prop_clean(prop_t *p)
 }
 
 
+/**
+ * Child name index
+ *
+ * Directories with many childs get a hash table mapping names to
+ * childs so that prop_create() and friends don't have to scan the
+ * entire list. The index is built the first time a lookup has to
+ * walk past PROP_CHILD_INDEX_THRESHOLD childs and is dropped again
+ * when the directory shrinks.
+ *
+ * Names are not required to be unique. The index always points to the
+ * first child (in list order) with a given name and pci_dups counts
+ * the named childs that are shadowed by an earlier one.
+ *
+ * Protected by the same lock as hp_childs
+ */
+
+#define PROP_CHILD_INDEX_THRESHOLD 32
+
+typedef struct prop_child_slot {
+  unsigned int hash;
+  prop_t *p;
+} prop_child_slot_t;
+
+typedef struct prop_child_index {
+  unsigned int pci_size; // Always a power of 2
+  unsigned int pci_count;
+  unsigned int pci_dups;
+  prop_child_slot_t pci_slots[0];
+} prop_child_index_t;
+
+
+/**
+ *
+ */
+static unsigned int
+prop_name_hash(const prop_t *p)
+{
+  if(p->hp_flags & PROP_NAME_NOT_ALLOCATED)
+    return mystrhash(p->hp_name);
+  return prop_name_get_hash(p->hp_name);
+}
+
+
+/**
+ * Return slot holding the given name or the empty slot where it
+ * should go
+ */
+static prop_child_slot_t *
+prop_child_index_slot(prop_child_index_t *pci, const char *name,
+                      unsigned int hash)
+{
+  const unsigned int mask = pci->pci_size - 1;
+  unsigned int i = hash & mask;
+  prop_child_slot_t *s;
+
+  while(1) {
+    s = &pci->pci_slots[i];
+    if(s->p == NULL)
+      return s;
+    if(s->hash == hash && (s->p->hp_name == name ||
+                           !strcmp(s->p->hp_name, name)))
+      return s;
+    i = (i + 1) & mask;
+  }
+}
+
+
+/**
+ * Remove a slot. Following entries in the same cluster are moved back
+ * so lookups never have to skip over deleted slots
+ */
+static void
+prop_child_index_remove_slot(prop_child_index_t *pci, prop_child_slot_t *s)
+{
+  const unsigned int mask = pci->pci_size - 1;
+  unsigned int i = s - pci->pci_slots;
+  unsigned int j = i;
+
+  while(1) {
+    j = (j + 1) & mask;
+    prop_child_slot_t *n = &pci->pci_slots[j];
+    if(n->p == NULL)
+      break;
+    const unsigned int home = n->hash & mask;
+    // Move entry at j to i unless its home lies cyclically in (i, j]
+    if(i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+      pci->pci_slots[i] = *n;
+      i = j;
+    }
+  }
+  pci->pci_slots[i].p = NULL;
+  pci->pci_count--;
+}
+
+
+/**
+ *
+ */
+static prop_child_index_t *
+prop_child_index_alloc(unsigned int count)
+{
+  unsigned int size = 64;
+  while(size < count * 2)
+    size *= 2;
+
+  prop_child_index_t *pci =
+    calloc(1, sizeof(prop_child_index_t) + size * sizeof(prop_child_slot_t));
+  pci->pci_size = size;
+  return pci;
+}
+
+
+/**
+ *
+ */
+static void
+prop_child_index_build(prop_t *parent)
+{
+  prop_child_index_t *pci;
+  prop_child_slot_t *s;
+  prop_t *c;
+  unsigned int count = 0;
+
+  TAILQ_FOREACH(c, &parent->hp_childs, hp_parent_link)
+    count++;
+
+  pci = prop_child_index_alloc(count);
+
+  TAILQ_FOREACH(c, &parent->hp_childs, hp_parent_link) {
+    if(c->hp_name == NULL)
+      continue;
+    const unsigned int hash = prop_name_hash(c);
+    s = prop_child_index_slot(pci, c->hp_name, hash);
+    if(s->p != NULL) {
+      pci->pci_dups++;
+      continue;
+    }
+    s->hash = hash;
+    s->p = c;
+    pci->pci_count++;
+  }
+  parent->hp_child_index = pci;
+}
+
+
+/**
+ *
+ */
+static void
+prop_child_index_free(prop_t *parent)
+{
+  free(parent->hp_child_index);
+  parent->hp_child_index = NULL;
+}
+
+
+/**
+ *
+ */
+static prop_t *
+prop_child_find_first(prop_t *parent, const char *name)
+{
+  prop_t *c;
+  TAILQ_FOREACH(c, &parent->hp_childs, hp_parent_link)
+    if(c->hp_name != NULL && !strcmp(c->hp_name, name))
+      break;
+  return c;
+}
+
+
+/**
+ * Must be called after 'p' has been inserted in parent's child list
+ */
+static void
+prop_child_index_add(prop_t *parent, prop_t *p)
+{
+  prop_child_index_t *pci = parent->hp_child_index;
+  prop_child_slot_t *s;
+
+  if(pci == NULL || p->hp_name == NULL)
+    return;
+
+  if((pci->pci_count + 1) * 2 > pci->pci_size) {
+    prop_child_index_t *n = prop_child_index_alloc(pci->pci_count + 1);
+    n->pci_count = pci->pci_count;
+    n->pci_dups = pci->pci_dups;
+    for(unsigned int i = 0; i < pci->pci_size; i++) {
+      if(pci->pci_slots[i].p == NULL)
+        continue;
+      *prop_child_index_slot(n, pci->pci_slots[i].p->hp_name,
+                             pci->pci_slots[i].hash) = pci->pci_slots[i];
+    }
+    free(pci);
+    parent->hp_child_index = pci = n;
+  }
+
+  const unsigned int hash = prop_name_hash(p);
+  s = prop_child_index_slot(pci, p->hp_name, hash);
+
+  if(s->p == NULL) {
+    s->hash = hash;
+    s->p = p;
+    pci->pci_count++;
+    return;
+  }
+
+  pci->pci_dups++;
+  if(TAILQ_NEXT(p, hp_parent_link) != NULL)
+    s->p = prop_child_find_first(parent, p->hp_name);
+}
+
+
+/**
+ * Must be called after 'p' has been removed from parent's child list
+ */
+static void
+prop_child_index_del(prop_t *parent, prop_t *p)
+{
+  prop_child_index_t *pci = parent->hp_child_index;
+  prop_child_slot_t *s;
+  prop_t *c;
+
+  if(pci == NULL || p->hp_name == NULL)
+    return;
+
+  const unsigned int hash = prop_name_hash(p);
+  s = prop_child_index_slot(pci, p->hp_name, hash);
+  assert(s->p != NULL);
+
+  if(s->p != p) {
+    // Was shadowed by an earlier child with the same name
+    pci->pci_dups--;
+    return;
+  }
+
+  if(pci->pci_dups && (c = prop_child_find_first(parent, p->hp_name)) != NULL) {
+    s->p = c;
+    pci->pci_dups--;
+    return;
+  }
+
+  prop_child_index_remove_slot(pci, s);
+
+  if(pci->pci_count < PROP_CHILD_INDEX_THRESHOLD / 2)
+    prop_child_index_free(parent);
+}
+
+
+/**
+ * Find first child with the given name
+ */
+static prop_t *
+prop_child_find(prop_t *parent, const char *name)
+{
+  prop_child_index_t *pci = parent->hp_child_index;
+  prop_t *c;
+
+  if(pci != NULL)
+    return prop_child_index_slot(pci, name, mystrhash(name))->p;
+
+  int n = 0;
+  TAILQ_FOREACH(c, &parent->hp_childs, hp_parent_link) {
+    if(c->hp_name != NULL && (c->hp_name == name || !strcmp(c->hp_name, name)))
+      break;
+    n++;
+  }
+
+  if(n >= PROP_CHILD_INDEX_THRESHOLD)
+    prop_child_index_build(parent);
+  return c;
+}
+
+
 /**
  *
  */
@@ -1762,6 +2342,7 @@ prop_make_dir(prop_t *p, prop_sub_t *skipme, const char *origin)
   
   TAILQ_INIT(&p->hp_childs);
   p->hp_selected = NULL;
+  p->hp_child_index = NULL;
   p->hp_type = PROP_DIR;
   
   prop_notify_value(p, skipme, origin, 0);
@@ -1777,9 +2358,11 @@ prop_insert(prop_t *p, prop_t *parent, prop_t *before, prop_sub_t *skipme)
   if(before != NULL) {
     assert(before->hp_parent == parent);
     TAILQ_INSERT_BEFORE(before, p, hp_parent_link);
+    prop_child_index_add(parent, p);
     prop_notify_child2(p, parent, before, PROP_ADD_CHILD_BEFORE, skipme, 0);
   } else {
     TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
+    prop_child_index_add(parent, p);
     prop_notify_child(p, parent, PROP_ADD_CHILD, skipme, 0);
   }
 }
@@ -1804,14 +2387,19 @@ prop_make(const char *name, int noalloc, prop_t *parent)
   if(noalloc)
     hp->hp_name = name;
   else
-    hp->hp_name = name ? strdup(name) : NULL;
+    hp->hp_name = name ? prop_name_intern(name) : NULL;
 
+  for(int i = 0; i < PROP_TAG_INLINE; i++)
+    hp->hp_tag_slots[i].key = NULL;
   hp->hp_tags = NULL;
   LIST_INIT(&hp->hp_targets);
   LIST_INIT(&hp->hp_value_subscriptions);
   LIST_INIT(&hp->hp_canonical_subscriptions);
 
   hp->hp_parent = parent;
+  hp->hp_domain = parent != NULL ? parent->hp_domain : NULL;
+  if(hp->hp_domain != NULL)
+    atomic_inc(&hp->hp_domain->pd_refcount);
   return hp;
 }
 
@@ -1828,21 +2416,17 @@ prop_create0(prop_t *parent, const char *name, prop_sub_t *skipme, int noalloc)
 
   prop_make_dir(parent, skipme, "prop_create()");
 
-  if(name != NULL) {
-    TAILQ_FOREACH(hp, &parent->hp_childs, hp_parent_link) {
-      if(hp->hp_name != NULL && !strcmp(hp->hp_name, name)) {
-
-	if(!(hp->hp_flags & PROP_NAME_NOT_ALLOCATED) && noalloc) {
-	  // Trick: We have a pointer to a compile time constant string
-	  // and the current prop does not have that, we could switch to
-	  // it and thus save some memory allocation
-	  free((void *)hp->hp_name);
-	  hp->hp_name = name;
-	  hp->hp_flags |= PROP_NAME_NOT_ALLOCATED;
-	}
-	return hp;
-      }
+  if(name != NULL && (hp = prop_child_find(parent, name)) != NULL) {
+
+    if(!(hp->hp_flags & PROP_NAME_NOT_ALLOCATED) && noalloc) {
+      // Trick: We have a pointer to a compile time constant string
+      // and the current prop does not have that, we could switch to
+      // it and thus drop our reference on the interned name
+      prop_name_release(hp->hp_name);
+      hp->hp_name = name;
+      hp->hp_flags |= PROP_NAME_NOT_ALLOCATED;
     }
+    return hp;
   }
 
   hp = prop_make(name, noalloc, parent);
@@ -1864,15 +2448,20 @@ prop_create_ex(prop_t *parent, const char *name, prop_sub_t *skipme,
 	       int noalloc, int incref)
 {
   prop_t *p;
-  hts_mutex_lock(&prop_mutex);
-  if(parent != NULL && parent->hp_type != PROP_ZOMBIE) {
+  prop_domain_t *pd;
+
+  if(parent == NULL)
+    return NULL;
+
+  pd = prop_lock_domain(parent, 1);
+  if(parent->hp_type != PROP_ZOMBIE) {
     p = prop_create0(parent, name, skipme, noalloc);
   } else {
     p = NULL;
   }
   if(incref)
     p = prop_ref_inc(p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
   return p;
 }
 
@@ -1883,9 +2472,35 @@ prop_create_ex(prop_t *parent, const char *name, prop_sub_t *skipme,
 prop_t *
 prop_create_root_ex(const char *name, int noalloc)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_t *p = prop_make(name, noalloc, NULL);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
+  return p;
+}
+
+
+/**
+ * Create a root prop with its own lock domain. Everything created
+ * below it (or moved into it) will be protected by the domain's mutex
+ * instead of the global one
+ */
+prop_t *
+prop_create_root_domain(const char *name)
+{
+  prop_domain_t *pd = calloc(1, sizeof(prop_domain_t));
+
+  hts_mutex_init(&pd->pd_mutex);
+  pd->pd_name = strdup(name ?: "<noname>");
+  atomic_set(&pd->pd_refcount, 1);
+
+  prop_lock_global();
+  prop_t *p = prop_make(name, 0, NULL);
+  p->hp_domain = pd;
+
+  // Will be unlocked in prop_unlock_global()
+  hts_mutex_lock(&pd->pd_mutex);
+  TAILQ_INSERT_TAIL(&prop_domains, pd, pd_link);
+  prop_unlock_global();
   return p;
 }
 
@@ -1903,10 +2518,10 @@ prop_create_multi(prop_t *p, ...)
   if(p == NULL)
     return NULL;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type != PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
     return p;
   }
 
@@ -1914,7 +2529,7 @@ prop_create_multi(prop_t *p, ...)
     p = prop_create0(p, name, NULL, 0);
 
   p = prop_ref_inc(p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return p;
 }
 
@@ -1927,15 +2542,13 @@ prop_create_after(prop_t *parent, const char *name, prop_t *after,
 		  prop_sub_t *skipme)
 {
   prop_t *p;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(parent != NULL && parent->hp_type != PROP_ZOMBIE) {
 
     prop_make_dir(parent, skipme, "prop_create_after()");
 
-    TAILQ_FOREACH(p, &parent->hp_childs, hp_parent_link)
-      if(p->hp_name != NULL && !strcmp(p->hp_name, name))
-	break;
+    p = prop_child_find(parent, name);
 
     if(p == NULL) {
 
@@ -1946,6 +2559,7 @@ prop_create_after(prop_t *parent, const char *name, prop_t *after,
       } else {
 	TAILQ_INSERT_AFTER(&parent->hp_childs, after, p, hp_parent_link);
       }
+      prop_child_index_add(parent, p);
 
       prop_t *next = TAILQ_NEXT(p, hp_parent_link);
       if(next == NULL) {
@@ -1961,12 +2575,14 @@ prop_create_after(prop_t *parent, const char *name, prop_t *after,
       if(prev != after) {
 	
 	TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
+	prop_child_index_del(parent, p);
 
 	if(after == NULL) {
 	  TAILQ_INSERT_HEAD(&parent->hp_childs, p, hp_parent_link);
 	} else {
 	  TAILQ_INSERT_AFTER(&parent->hp_childs, after, p, hp_parent_link);
 	}
+	prop_child_index_add(parent, p);
 	
 	prop_t *next = TAILQ_NEXT(p, hp_parent_link);
 	prop_notify_child2(p, parent, next, PROP_MOVE_CHILD, skipme, 0);
@@ -1978,7 +2594,7 @@ prop_create_after(prop_t *parent, const char *name, prop_t *after,
     p = NULL;
   }
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return p;
 }
 
@@ -2001,6 +2617,8 @@ prop_set_parent0(prop_t *p, prop_t *parent, prop_t *before, prop_sub_t *skipme)
     p->hp_parent = parent;
     if(parent->hp_flags & (PROP_MULTI_SUB | PROP_MULTI_NOTIFY))
       prop_flood_flag(p, PROP_MULTI_NOTIFY, 0);
+    if(parent->hp_domain != NULL)
+      prop_domain_adopt(p, parent->hp_domain);
     prop_insert(p, parent, before, skipme);
   } else {
     prop_move0(p, before, skipme);
@@ -2020,9 +2638,9 @@ prop_set_parent_ex(prop_t *p, prop_t *parent, prop_t *before,
   if(parent == NULL)
     return -1;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   r = prop_set_parent0(p, parent, before, skipme);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return r;
 }
 
@@ -2036,7 +2654,7 @@ prop_set_parent_vector(prop_vec_t *pv, prop_t *parent, prop_t *before,
 {
   int i;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(parent == NULL || parent->hp_type == PROP_ZOMBIE) {
 
@@ -2054,17 +2672,20 @@ prop_set_parent_vector(prop_vec_t *pv, prop_t *parent, prop_t *before,
       p->hp_parent = parent;
       if(parent->hp_flags & (PROP_MULTI_SUB | PROP_MULTI_NOTIFY))
 	prop_flood_flag(p, PROP_MULTI_NOTIFY, 0);
+      if(parent->hp_domain != NULL)
+        prop_domain_adopt(p, parent->hp_domain);
     
       if(before) {
 	TAILQ_INSERT_BEFORE(before, p, hp_parent_link);
       } else {
 	TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
       }
+      prop_child_index_add(parent, p);
     }
     prop_notify_childv(pv, parent, before ? PROP_ADD_CHILD_VECTOR_BEFORE : 
 		       PROP_ADD_CHILD_VECTOR, skipme, before);
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -2083,6 +2704,7 @@ prop_unparent0(prop_t *p, prop_sub_t *skipme)
   prop_notify_child(p, parent, PROP_DEL_CHILD, NULL, 0);
   
   TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
+  prop_child_index_del(parent, p);
   p->hp_parent = NULL;
   
   if(parent->hp_selected == p)
@@ -2095,9 +2717,9 @@ prop_unparent0(prop_t *p, prop_sub_t *skipme)
 void
 prop_unparent_ex(prop_t *p, prop_sub_t *skipme)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_unparent0(p, skipme);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 /**
@@ -2106,7 +2728,7 @@ prop_unparent_ex(prop_t *p, prop_sub_t *skipme)
 void
 prop_unparent_childs(prop_t *p)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   if(p->hp_type == PROP_DIR) {
     prop_t *c, *next;
     for(c = TAILQ_FIRST(&p->hp_childs); c != NULL; c = next) {
@@ -2114,7 +2736,7 @@ prop_unparent_childs(prop_t *p)
       prop_unparent0(p, NULL);
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -2127,6 +2749,7 @@ prop_destroy_child(prop_t *p, prop_t *c)
   if(!prop_destroy0(c)) {
     prop_notify_child(c, p, PROP_DEL_CHILD, NULL, 0);
     TAILQ_REMOVE(&p->hp_childs, c, hp_parent_link);
+    prop_child_index_del(p, c);
     c->hp_parent = NULL;
   }
 }
@@ -2184,6 +2807,7 @@ prop_destroy0(prop_t *p)
     abort();
 
   case PROP_DIR:
+    prop_child_index_free(p);
     for(c = TAILQ_FIRST(&p->hp_childs); c != NULL; c = next) {
       next = TAILQ_NEXT(c, hp_parent_link);
       prop_destroy_child(p, c);
@@ -2249,6 +2873,7 @@ prop_destroy0(prop_t *p)
     parent = p->hp_parent;
 
     TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
+    prop_child_index_del(parent, p);
     p->hp_parent = NULL;
 
     if(parent->hp_selected == p)
@@ -2256,7 +2881,7 @@ prop_destroy0(prop_t *p)
   }
 
   if(!(p->hp_flags & PROP_NAME_NOT_ALLOCATED))
-    free((void *)p->hp_name);
+    prop_name_release(p->hp_name);
   p->hp_name = NULL;
 
   prop_ref_dec_locked(p);
@@ -2272,9 +2897,9 @@ prop_destroy(prop_t *p)
 {
   if(p == NULL)
     return;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_destroy0(p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -2287,6 +2912,7 @@ prop_destroy_childs0(prop_t *p)
   prop_t *c, *next;
 
   struct prop_queue childs;
+  prop_child_index_free(p);
   TAILQ_MOVE(&childs, &p->hp_childs, hp_parent_link);
   TAILQ_INIT(&p->hp_childs);
 
@@ -2311,10 +2937,10 @@ prop_destroy_childs(prop_t *p)
 {
   if(p == NULL)
     return;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   if(p->hp_type == PROP_DIR)
     prop_destroy_childs0(p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -2347,9 +2973,9 @@ prop_void_childs(prop_t *p)
 {
   if(p == NULL)
     return;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_void_childs0(p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 /**
@@ -2358,7 +2984,7 @@ prop_void_childs(prop_t *p)
 void
 prop_destroy_by_name(prop_t *p, const char *name)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   if(p->hp_type == PROP_DIR) {
     prop_t *c;
     if(name == NULL) {
@@ -2369,15 +2995,11 @@ prop_destroy_by_name(prop_t *p, const char *name)
 	  prop_destroy_child(p, c);
       }
     } else {
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
-	if(c->hp_name != NULL && !strcmp(c->hp_name, name)) {
-	  prop_destroy_child(p, c);
-	  break;
-	}
-      }
+      if((c = prop_child_find(p, name)) != NULL)
+	prop_destroy_child(p, c);
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -2387,13 +3009,13 @@ prop_destroy_by_name(prop_t *p, const char *name)
 void
 prop_destroy_first(prop_t *p)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   if(p->hp_type == PROP_DIR) {
     prop_t *c = TAILQ_FIRST(&p->hp_childs);
     if(c != NULL)
       prop_destroy_child(p, c);
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -2475,12 +3097,14 @@ prop_move0(prop_t *p, prop_t *before, prop_sub_t *skipme)
       return;
 
     TAILQ_REMOVE(&parent->hp_childs, p, hp_parent_link);
+    prop_child_index_del(parent, p);
   
     if(before != NULL) {
       TAILQ_INSERT_BEFORE(before, p, hp_parent_link);
     } else {
       TAILQ_INSERT_TAIL(&parent->hp_childs, p, hp_parent_link);
     }  
+    prop_child_index_add(parent, p);
     prop_notify_child2(p, parent, before, PROP_MOVE_CHILD, skipme, 0);
   }
 }
@@ -2492,9 +3116,9 @@ prop_move0(prop_t *p, prop_t *before, prop_sub_t *skipme)
 void
 prop_move(prop_t *p, prop_t *before)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_move0(p, before, NULL);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -2522,9 +3146,9 @@ prop_req_move0(prop_t *p, prop_t *before, prop_sub_t *skipme)
 void
 prop_req_move(prop_t *p, prop_t *before)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_req_move0(p, before, NULL);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -2554,6 +3178,7 @@ prop_subfind(prop_t *p, const char **name, int follow_symlinks, int allow_indexi
 
       TAILQ_INIT(&p->hp_childs);
       p->hp_selected = NULL;
+      p->hp_child_index = NULL;
       p->hp_type = PROP_DIR;
 
       prop_notify_value(p, NULL, "prop_subfind()", 0);
@@ -2570,11 +3195,7 @@ prop_subfind(prop_t *p, const char **name, int follow_symlinks, int allow_indexi
 	return NULL;
 
     } else {
-
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
-	if(c->hp_name != NULL && !strcmp(c->hp_name, name[0]))
-	  break;
-      }
+      c = prop_child_find(p, name[0]);
     }
     p = c ?: prop_create0(p, name[0], NULL, 0);    
     name++;
@@ -2681,12 +3302,12 @@ prop_get_by_name(const char **name, int follow_symlinks, ...)
     return NULL;
 
   name++;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   p = prop_subfind(p, name, follow_symlinks, 1, NULL);
 
   p = prop_ref_inc(p);
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return p;
 }
 
@@ -2892,7 +3513,7 @@ prop_subscribe(int flags, ...)
 
     canonical = value = pr ? pr->p : NULL;
     if(dolock)
-      hts_mutex_lock(&prop_mutex);
+      prop_lock_global();
 
   } else {
 
@@ -2904,7 +3525,7 @@ prop_subscribe(int flags, ...)
     }
 
     if(dolock)
-      hts_mutex_lock(&prop_mutex);
+      prop_lock_global();
 
     if(p != NULL) {
       /* Canonical name is the resolved props without following symlinks */
@@ -2920,7 +3541,7 @@ prop_subscribe(int flags, ...)
   if(flags & PROP_SUB_SINGLETON) {
     LIST_FOREACH(s, &value->hp_value_subscriptions, hps_value_prop_link) {
       if(s->hps_callback == cb && s->hps_opaque == opaque) {
-	hts_mutex_unlock(&prop_mutex);
+	prop_unlock_global();
 	return NULL;
       }
     }
@@ -2952,6 +3573,7 @@ prop_subscribe(int flags, ...)
   s->hps_opaque = opaque;
   atomic_set(&s->hps_refcount, 1);
   s->hps_user_int = user_int;
+  s->hps_pending_value = NULL;
 
   if(origin_chain[0] != NULL) {
     
@@ -3083,7 +3705,7 @@ prop_subscribe(int flags, ...)
     }
   }
   if(dolock)
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
   return s;
 }
 
@@ -3172,9 +3794,9 @@ prop_unsubscribe(prop_sub_t *s)
   if(s == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_unsubscribe0(s);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -3187,9 +3809,9 @@ prop_sub_reemit(prop_sub_t *s)
   if(s == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_build_notify_value(s, 0, "reemit", s->hps_value_prop, NULL, 0);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -3201,22 +3823,26 @@ void
 prop_init(void)
 {
   hts_mutex_init(&prop_mutex);
+  hts_mutex_init(&prop_courier_mutex);
+  TAILQ_INIT(&prop_domains);
   hts_mutex_init(&prop_tag_mutex);
-  hts_cond_init(&prop_global_dispatch_cond, &prop_mutex);
+  prop_name_init();
+  hts_cond_init(&prop_global_dispatch_cond, &prop_courier_mutex);
 
   TAILQ_INIT(&prop_global_dispatch_queue);
   TAILQ_INIT(&prop_global_dispatch_dispatching_queue);
 
 
-  prop_pool   = pool_create("prop", sizeof(prop_t), 0);
-  notify_pool = pool_create("notify", sizeof(prop_notify_t), 0);
-  sub_pool    = pool_create("subs", sizeof(prop_sub_t), 0);
-  pot_pool    = pool_create("pots", sizeof(prop_originator_tracking_t), 0);
-  psd_pool    = pool_create("psds", sizeof(prop_sub_dispatch_t), 0);
+  prop_pool   = pool_create("prop", sizeof(prop_t), POOL_LOCKED);
+  notify_pool = pool_create("notify", sizeof(prop_notify_t), POOL_LOCKED);
+  sub_pool    = pool_create("subs", sizeof(prop_sub_t), POOL_LOCKED);
+  pot_pool    = pool_create("pots", sizeof(prop_originator_tracking_t),
+                            POOL_LOCKED);
+  psd_pool    = pool_create("psds", sizeof(prop_sub_dispatch_t), POOL_LOCKED);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_global = prop_make("global", 1, NULL);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -3234,11 +3860,12 @@ prop_get_global(void)
  *
  */
 static void
-prop_set_epilogue(prop_sub_t *skipme, prop_t *p, const char *origin)
+prop_set_epilogue(prop_sub_t *skipme, prop_t *p, const char *origin,
+                  prop_domain_t *pd)
 {
   prop_notify_value(p, skipme, origin, 0);
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3282,9 +3909,9 @@ prop_set_string_ex(prop_t *p, prop_sub_t *skipme, const char *str,
     return;
   }
 
-  hts_mutex_lock(&prop_mutex);
+  prop_domain_t *pd = prop_lock_domain(p, 0);
   prop_set_string_exl(p, skipme, str, type);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3331,9 +3958,9 @@ prop_set_rstring_ex(prop_t *p, prop_sub_t *skipme, rstr_t *rstr)
     return;
   }
 
-  hts_mutex_lock(&prop_mutex);
+  prop_domain_t *pd = prop_lock_domain(p, 0);
   prop_set_rstring_exl(p, skipme, rstr);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3377,9 +4004,9 @@ prop_set_cstring_ex(prop_t *p, prop_sub_t *skipme, const char *cstr)
     return;
   }
 
-  hts_mutex_lock(&prop_mutex);
+  prop_domain_t *pd = prop_lock_domain(p, 0);
   prop_set_cstring_exl(p, skipme, cstr);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3398,23 +4025,23 @@ prop_set_uri_ex(prop_t *p, prop_sub_t *skipme, const char *title,
     return;
   }
 
-  hts_mutex_lock(&prop_mutex);
+  prop_domain_t *pd = prop_lock_domain(p, 0);
 
   if(p->hp_type == PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_domain(pd);
     return;
   }
 
   if(p->hp_type != PROP_URI) {
 
     if(prop_clean(p)) {
-      hts_mutex_unlock(&prop_mutex);
+      prop_unlock_domain(pd);
       return;
     }
 
   } else if(!strcmp(rstr_get(p->hp_uri_title) ?: "", title ?: "") &&
 	    !strcmp(rstr_get(p->hp_uri)   ?: "", url   ?: "")) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_domain(pd);
     return;
   } else {
     rstr_release(p->hp_uri_title);
@@ -3425,7 +4052,7 @@ prop_set_uri_ex(prop_t *p, prop_sub_t *skipme, const char *title,
   p->hp_uri   = rstr_alloc(url);
   p->hp_type = PROP_URI;
 
-  prop_set_epilogue(skipme, p, "prop_set_link()");
+  prop_set_epilogue(skipme, p, "prop_set_link()", pd);
 }
 
 
@@ -3548,9 +4175,12 @@ prop_set_float_exl(prop_t *p, prop_sub_t *skipme, float v, int how)
 void
 prop_set_float_ex(prop_t *p, prop_sub_t *skipme, float v, int how)
 {
-  hts_mutex_lock(&prop_mutex);
+  if(p == NULL)
+    return;
+
+  prop_domain_t *pd = prop_lock_domain(p, 0);
   prop_set_float_exl(p, skipme, v, how);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3560,7 +4190,10 @@ prop_set_float_ex(prop_t *p, prop_sub_t *skipme, float v, int how)
 void
 prop_add_float_ex(prop_t *p, prop_sub_t *skipme, float v)
 {
-  hts_mutex_lock(&prop_mutex);
+  if(p == NULL)
+    return;
+
+  prop_domain_t *pd = prop_lock_domain(p, 0);
 
   if((p = prop_get_float_locked(p, NULL)) != NULL) {
     float n = p->hp_float + v;
@@ -3577,7 +4210,7 @@ prop_add_float_ex(prop_t *p, prop_sub_t *skipme, float v)
       prop_notify_value(p, skipme, "prop_add_float()", 0);
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3587,7 +4220,7 @@ prop_add_float_ex(prop_t *p, prop_sub_t *skipme, float v)
 void
 prop_set_float_clipping_range(prop_t *p, float min, float max)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if((p = prop_get_float_locked(p, NULL)) != NULL) {
 
@@ -3609,7 +4242,7 @@ prop_set_float_clipping_range(prop_t *p, float min, float max)
     }
   }
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -3656,9 +4289,9 @@ prop_set_int_ex(prop_t *p, prop_sub_t *skipme, int v)
   if(p == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_domain_t *pd = prop_lock_domain(p, 0);
   prop_set_int_exl(p, skipme, v);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3672,10 +4305,10 @@ prop_add_int_ex(prop_t *p, prop_sub_t *skipme, int v)
   if(p == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_domain_t *pd = prop_lock_domain(p, 0);
 
   if(p->hp_type == PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_domain(pd);
     return;
   }
 
@@ -3684,7 +4317,7 @@ prop_add_int_ex(prop_t *p, prop_sub_t *skipme, int v)
     if(p->hp_type == PROP_FLOAT) {
       prop_float_to_int(p);
     } else if(prop_clean(p)) {
-      hts_mutex_unlock(&prop_mutex);
+      prop_unlock_domain(pd);
       return;
     } else {
       p->hp_int = 0;
@@ -3706,7 +4339,7 @@ prop_add_int_ex(prop_t *p, prop_sub_t *skipme, int v)
     p->hp_int = n;
     prop_notify_value(p, skipme, "prop_add_int()", 0);
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3719,10 +4352,10 @@ prop_toggle_int_ex(prop_t *p, prop_sub_t *skipme)
   if(p == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_domain_t *pd = prop_lock_domain(p, 0);
 
   if(p->hp_type == PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_domain(pd);
     return;
   }
 
@@ -3731,7 +4364,7 @@ prop_toggle_int_ex(prop_t *p, prop_sub_t *skipme)
     if(p->hp_type == PROP_FLOAT) {
       prop_float_to_int(p);
     } else if(prop_clean(p)) {
-      hts_mutex_unlock(&prop_mutex);
+      prop_unlock_domain(pd);
       return;
     } else {
       p->hp_int = 0;
@@ -3741,7 +4374,7 @@ prop_toggle_int_ex(prop_t *p, prop_sub_t *skipme)
 
   p->hp_int = !p->hp_int;
 
-  prop_set_epilogue(skipme, p, "prop_toggle_int()");
+  prop_set_epilogue(skipme, p, "prop_toggle_int()", pd);
 }
 
 /**
@@ -3755,10 +4388,10 @@ prop_set_int_clipping_range(prop_t *p, int min, int max)
   if(p == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
     return;
   }
 
@@ -3767,7 +4400,7 @@ prop_set_int_clipping_range(prop_t *p, int min, int max)
     if(p->hp_type == PROP_FLOAT) {
       prop_float_to_int(p);
     } else if(prop_clean(p)) {
-      hts_mutex_unlock(&prop_mutex);
+      prop_unlock_global();
       return;
     } else {
       p->hp_int = 0;
@@ -3792,7 +4425,7 @@ prop_set_int_clipping_range(prop_t *p, int min, int max)
     prop_notify_value(p, NULL, "prop_set_int_clipping_range()", 0);
   }
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -3825,9 +4458,9 @@ prop_set_void_ex(prop_t *p, prop_sub_t *skipme)
   if(p == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_domain_t *pd = prop_lock_domain(p, 0);
   prop_set_void_exl(p, skipme);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_domain(pd);
 }
 
 
@@ -3866,7 +4499,7 @@ prop_copy_ex(prop_t *dst, prop_sub_t *skipme, prop_t *src)
   if(dst == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(src == NULL) {
     prop_set_void_exl(dst, skipme);
@@ -3891,7 +4524,7 @@ prop_copy_ex(prop_t *dst, prop_sub_t *skipme, prop_t *src)
     }
   }
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4444,9 +5077,9 @@ prop_link_ex(prop_t *src, prop_t *dst, prop_sub_t *skipme, int hard, int debug)
   if(src == NULL || dst == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_link0(src, dst, skipme, hard, debug);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4461,17 +5094,17 @@ prop_unlink_ex(prop_t *p, prop_sub_t *skipme)
   if(p == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
     return;
   }
 
   if(p->hp_originator != NULL)
     prop_unlink0(p, skipme, "prop_unlink()/childs", NULL);
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4481,13 +5114,13 @@ prop_unlink_ex(prop_t *p, prop_sub_t *skipme)
 prop_t *
 prop_follow(prop_t *p)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   while(p->hp_originator != NULL)
     p = p->hp_originator;
   
   p = prop_ref_inc(p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return p;
 }
 
@@ -4498,7 +5131,7 @@ prop_follow(prop_t *p)
 int
 prop_compare(const prop_t *a, const prop_t *b)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   while(a->hp_originator != NULL)
     a = a->hp_originator;
@@ -4506,7 +5139,7 @@ prop_compare(const prop_t *a, const prop_t *b)
   while(b->hp_originator != NULL)
     b = b->hp_originator;
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return a == b;
 }
 
@@ -4519,10 +5152,10 @@ prop_select_ex(prop_t *p, prop_t *extra, prop_sub_t *skipme)
 {
   prop_t *parent;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_ZOMBIE) {
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
     return;
   }
 
@@ -4534,7 +5167,7 @@ prop_select_ex(prop_t *p, prop_t *extra, prop_sub_t *skipme)
     parent->hp_selected = p;
   }
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4544,14 +5177,14 @@ prop_select_ex(prop_t *p, prop_t *extra, prop_sub_t *skipme)
 void
 prop_unselect_ex(prop_t *parent, prop_sub_t *skipme)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(parent->hp_type == PROP_DIR) {
     prop_notify_child(NULL, parent, PROP_SELECT_CHILD, skipme, 0);
     parent->hp_selected = NULL;
   }
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4561,18 +5194,15 @@ prop_unselect_ex(prop_t *parent, prop_sub_t *skipme)
 void
 prop_select_by_value_ex(prop_t *p, const char *name, prop_sub_t *skipme)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_DIR) {
-    prop_t *c;
-    TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-      if(c->hp_name != NULL && !strcmp(c->hp_name, name))
-        break;
+    prop_t *c = prop_child_find(p, name);
 
     prop_notify_child(c, p, PROP_SELECT_CHILD, skipme, 0);
     p->hp_selected = c;
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4602,9 +5232,9 @@ prop_suggest_focus0(prop_t *p)
 void
 prop_suggest_focus(prop_t *p)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_suggest_focus0(p);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4624,11 +5254,8 @@ prop_find0(prop_t *p, va_list ap)
       break;
     }
 
-    TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-      if(c->hp_name != NULL && !strcmp(c->hp_name, n))
-	break;
-    if(c == NULL)
-	return NULL;
+    if((c = prop_child_find(p, n)) == NULL)
+      return NULL;
     p = c;
   }
   return c;
@@ -4644,9 +5271,9 @@ prop_find(prop_t *p, ...)
   va_list ap;
   va_start(ap, p);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_t *c = prop_ref_inc(prop_find0(p, ap));
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   va_end(ap);
   return c;
 }
@@ -4658,10 +5285,10 @@ prop_find(prop_t *p, ...)
 prop_t *
 prop_first_child(prop_t *p)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_t *c = p && p->hp_type == PROP_DIR ? TAILQ_FIRST(&p->hp_childs) : NULL;
   c = prop_ref_inc(c);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return c;
 }
 
@@ -4672,12 +5299,12 @@ prop_first_child(prop_t *p)
 void
 prop_request_new_child(prop_t *p)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_DIR || p->hp_type == PROP_VOID)
     prop_notify_child(NULL, p, PROP_REQ_NEW_CHILD, NULL, 0);
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4688,7 +5315,7 @@ void
 prop_request_delete(prop_t *c)
 {
   prop_t *p;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(c->hp_type != PROP_ZOMBIE) {
     p = c->hp_parent;
@@ -4700,7 +5327,7 @@ prop_request_delete(prop_t *c)
       prop_vec_release(pv);
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -4710,10 +5337,10 @@ prop_request_delete(prop_t *c)
 void
 prop_request_delete_multi(prop_vec_t *pv)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_notify_childv(pv, pv->pv_vec[0]->hp_parent,
 		     PROP_REQ_DELETE_VECTOR, NULL, NULL);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 /**
@@ -4744,7 +5371,7 @@ prop_courier_create_thread(hts_mutex_t *entrymutex, const char *name,
   snprintf(buf, sizeof(buf), "PC:%s", name);
   pc->pc_flags = flags;
   pc->pc_has_cond = 1;
-  hts_cond_init(&pc->pc_cond, &prop_mutex);
+  hts_cond_init(&pc->pc_cond, &prop_courier_mutex);
 
   pc->pc_name = strdup(name);
   pc->pc_run = 1;
@@ -4789,7 +5416,7 @@ prop_courier_create_waitable(void)
   prop_courier_t *pc = prop_courier_create();
   
   pc->pc_has_cond = 1;
-  hts_cond_init(&pc->pc_cond, &prop_mutex);
+  hts_cond_init(&pc->pc_cond, &prop_courier_mutex);
 
   return pc;
 }
@@ -4814,7 +5441,7 @@ prop_courier_create_lockmgr(const char *name, prop_lockmgr_t *mgr, void *lock,
   snprintf(buf, sizeof(buf), "PC:%s", name);
 
   pc->pc_has_cond = 1;
-  hts_cond_init(&pc->pc_cond, &prop_mutex);
+  hts_cond_init(&pc->pc_cond, &prop_courier_mutex);
 
   pc->pc_run = 1;
   hts_thread_create_joinable(buf, &pc->pc_thread, prop_courier, pc,
@@ -4830,18 +5457,19 @@ int
 prop_courier_wait(prop_courier_t *pc, struct prop_notify_queue *q, int timeout)
 {
   int r = 0;
-  hts_mutex_lock(&prop_mutex);
+  hts_mutex_lock(&prop_courier_mutex);
   if(TAILQ_FIRST(&pc->pc_queue_exp) == NULL &&
      TAILQ_FIRST(&pc->pc_queue_nor) == NULL) {
     if(timeout)
-      r = hts_cond_wait_timeout(&pc->pc_cond, &prop_mutex, timeout);
+      r = hts_cond_wait_timeout(&pc->pc_cond, &prop_courier_mutex, timeout);
     else
-      hts_cond_wait(&pc->pc_cond, &prop_mutex);
+      hts_cond_wait(&pc->pc_cond, &prop_courier_mutex);
   }
 
   TAILQ_MOVE(q, &pc->pc_queue_exp, hpn_link);
   TAILQ_MERGE(q, &pc->pc_queue_nor, hpn_link);
-  hts_mutex_unlock(&prop_mutex);
+  pc->pc_generation++;
+  hts_mutex_unlock(&prop_courier_mutex);
   return r;
 }
 
@@ -4889,17 +5517,17 @@ prop_courier_destroy(prop_courier_t *pc)
           pc->pc_name);
 
 #ifdef POOL_DEBUG
-    hts_mutex_lock(&prop_mutex);
+    prop_lock_global();
     pool_foreach(sub_pool, debug_check_courier, pc);
-    hts_mutex_unlock(&prop_mutex);
+    prop_unlock_global();
 #endif
   }
 
   if(pc->pc_run) {
-    hts_mutex_lock(&prop_mutex);
+    hts_mutex_lock(&prop_courier_mutex);
     pc->pc_run = 0;
     hts_cond_signal(&pc->pc_cond);
-    hts_mutex_unlock(&prop_mutex);
+    hts_mutex_unlock(&prop_courier_mutex);
 
     hts_thread_join(&pc->pc_thread);
   }
@@ -4907,6 +5535,10 @@ prop_courier_destroy(prop_courier_t *pc)
   if(pc->pc_has_cond)
     hts_cond_destroy(&pc->pc_cond);
 
+  if(pc->pc_num_coalesced)
+    PROPTRACE("Courier %s: %d notifications coalesced",
+              pc->pc_name ?: "<noname>", pc->pc_num_coalesced);
+
   free(pc->pc_name);
 
   free(pc);
@@ -4932,10 +5564,11 @@ void
 prop_courier_poll(prop_courier_t *pc)
 {
   struct prop_notify_queue q;
-  hts_mutex_lock(&prop_mutex);
+  hts_mutex_lock(&prop_courier_mutex);
   TAILQ_MOVE(&q, &pc->pc_queue_exp, hpn_link);
   TAILQ_MERGE(&q, &pc->pc_queue_nor, hpn_link);
-  hts_mutex_unlock(&prop_mutex);
+  pc->pc_generation++;
+  hts_mutex_unlock(&prop_courier_mutex);
   prop_notify_dispatch(&q, 0);
 }
 
@@ -4951,9 +5584,11 @@ prop_courier_poll_timed(prop_courier_t *pc, int maxtime)
 
   prop_notify_t *n, *next;
 
-  if(!hts_mutex_trylock(&prop_mutex)) {
+  if(!hts_mutex_trylock(&prop_courier_mutex)) {
     TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_exp, hpn_link);
     TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_nor, hpn_link);
+    pc->pc_generation++;
+    hts_mutex_unlock(&prop_courier_mutex);
 
     for(n = TAILQ_FIRST(&pc->pc_free_queue); n != NULL; n = next) {
       next = TAILQ_NEXT(n, hpn_link);
@@ -4962,8 +5597,6 @@ prop_courier_poll_timed(prop_courier_t *pc, int maxtime)
       pool_put(notify_pool, n);
     }
     TAILQ_INIT(&pc->pc_free_queue);
-
-    hts_mutex_unlock(&prop_mutex);
   }
 
   int64_t ts = arch_get_ts();
@@ -4984,9 +5617,9 @@ prop_courier_poll_timed(prop_courier_t *pc, int maxtime)
 int
 prop_courier_check(prop_courier_t *pc)
 {
-  hts_mutex_lock(&prop_mutex);
+  hts_mutex_lock(&prop_courier_mutex);
   int r = TAILQ_FIRST(&pc->pc_queue_exp) || TAILQ_FIRST(&pc->pc_queue_nor);
-  hts_mutex_unlock(&prop_mutex);
+  hts_mutex_unlock(&prop_courier_mutex);
   return r;
 
 }
@@ -5004,7 +5637,7 @@ prop_get_string(prop_t *p, ...)
 
   va_start(ap, p);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   p = prop_find0(p, ap);
 
   if(p != NULL) {
@@ -5031,7 +5664,7 @@ prop_get_string(prop_t *p, ...)
       break;
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   va_end(ap);
   return r;
 }
@@ -5048,7 +5681,7 @@ prop_get_int(prop_t *p, ...)
 
   va_start(ap, p);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   p = prop_find0(p, ap);
 
   if(p != NULL) {
@@ -5073,7 +5706,7 @@ prop_get_int(prop_t *p, ...)
       break;
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   va_end(ap);
   return r;
 }
@@ -5142,7 +5775,7 @@ prop_setv_ex(prop_sub_t *skipme, prop_t *p, ...)
 
   va_start(ap, p);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(p->hp_type == PROP_ZOMBIE)
     goto bad;
@@ -5150,11 +5783,9 @@ prop_setv_ex(prop_sub_t *skipme, prop_t *p, ...)
   while((n = va_arg(ap, const char *)) != NULL) {
     if(p->hp_type == PROP_ZOMBIE)
       goto bad;
-    if(p->hp_type == PROP_DIR) {
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-	if(c->hp_name != NULL && !strcmp(c->hp_name, n))
-	  break;
-    } else 
+    if(p->hp_type == PROP_DIR)
+      c = prop_child_find(p, n);
+    else
       c = NULL;
     if(c == NULL)
       c = prop_create0(p, n, skipme, 0);
@@ -5164,7 +5795,7 @@ prop_setv_ex(prop_sub_t *skipme, prop_t *p, ...)
   prop_seti(skipme, p, ap);
 
  bad:
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   va_end(ap);
 }
 
@@ -5183,7 +5814,7 @@ prop_setdn(prop_sub_t *skipme, prop_t *p, const char *str, ...)
 
   va_start(ap, str);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   while(1) {
     if(p->hp_type == PROP_ZOMBIE)
@@ -5202,11 +5833,9 @@ prop_setdn(prop_sub_t *skipme, prop_t *p, const char *str, ...)
     }
 
 
-    if(p->hp_type == PROP_DIR) {
-      TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-	if(c->hp_name != NULL && !strcmp(c->hp_name, str))
-	  break;
-    } else 
+    if(p->hp_type == PROP_DIR)
+      c = prop_child_find(p, str);
+    else
       c = NULL;
     if(c == NULL)
       c = prop_create0(p, str, skipme, 0);
@@ -5217,7 +5846,7 @@ prop_setdn(prop_sub_t *skipme, prop_t *p, const char *str, ...)
   prop_seti(skipme, p, ap);
 
  bad:
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   va_end(ap);
 }
 
@@ -5230,19 +5859,33 @@ void
 prop_set_ex(prop_t *p, const char *name, int noalloc, ...)
 {
   va_list ap;
+  prop_domain_t *pd;
+  prop_t *c;
 
   if(p == NULL)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  pd = prop_lock_domain(p, 1);
 
   if(p->hp_type != PROP_ZOMBIE) {
-    p = prop_create0(p, name, NULL, noalloc);
+    c = prop_create0(p, name, NULL, noalloc);
+
+    if(pd != NULL && !prop_is_local(c, pd, 0)) {
+      // Child already existed and is not confined to the domain
+      hts_mutex_unlock(&pd->pd_mutex);
+      pd = NULL;
+      prop_lock_global();
+      if(p->hp_type == PROP_ZOMBIE)
+        goto out;
+      c = prop_create0(p, name, NULL, noalloc);
+    }
+
     va_start(ap, noalloc);
-    prop_seti(NULL, p, ap);
+    prop_seti(NULL, c, ap);
     va_end(ap);
   }
-  hts_mutex_unlock(&prop_mutex);
+ out:
+  prop_unlock_domain(pd);
 }
 
 
@@ -5259,7 +5902,7 @@ prop_get_name_of_childs(prop_t *p)
   if(p->hp_type != PROP_DIR)
     return NULL;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link) {
     if(c->hp_type == PROP_VOID || c->hp_type == PROP_ZOMBIE)
@@ -5275,7 +5918,7 @@ prop_get_name_of_childs(prop_t *p)
     i++;
   }
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 
   return rval;
 }
@@ -5298,9 +5941,9 @@ prop_want_more_childs0(prop_sub_t *s)
 void
 prop_want_more_childs(prop_sub_t *s)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_want_more_childs0(s);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -5321,9 +5964,9 @@ prop_have_more_childs0(prop_t *p, int yes)
 void
 prop_have_more_childs(prop_t *p, int yes)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_have_more_childs0(p, yes);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -5334,12 +5977,12 @@ void
 prop_mark_childs(prop_t *p)
 {
   prop_t *c;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   if(p->hp_type == PROP_DIR) {
     TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
       c->hp_flags |= PROP_MARKED;
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -5351,9 +5994,9 @@ prop_unmark(prop_t *p)
 {
   if(p == NULL)
     return;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   p->hp_flags &= ~PROP_MARKED;
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -5373,7 +6016,7 @@ prop_is_marked(prop_t *p)
 void
 prop_destroy_marked_childs(prop_t *p)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   if(p->hp_type == PROP_DIR) {
     prop_t *c, *next;
     for(c = TAILQ_FIRST(&p->hp_childs); c != NULL; c = next) {
@@ -5382,7 +6025,7 @@ prop_destroy_marked_childs(prop_t *p)
         prop_destroy0(c);
     }
   }
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -5514,11 +6157,11 @@ prop_print_tree0(prop_t *p, int indent, int flags)
 void
 prop_print_tree(prop_t *p, int followlinks)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   fprintf(stderr, "Print tree form %s\n",
           prop_get_DN(p, 1));
   prop_print_tree0(p, 0, followlinks);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -5535,7 +6178,7 @@ prop_report_stats(callout_t *c, void *aux)
   int num_subs = 0;
   int origin_link_hist[4] = {};
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   LIST_FOREACH(s, &all_subs, hps_all_sub_link) {
     num_subs++;
 
@@ -5556,13 +6199,17 @@ prop_report_stats(callout_t *c, void *aux)
   }
 
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   printf("%d subs: %d %d %d %d\n",
 	 num_subs, 
 	 origin_link_hist[0],
 	 origin_link_hist[1],
 	 origin_link_hist[2],
 	 origin_link_hist[3]);
+  hts_mutex_lock(&prop_courier_mutex);
+  printf("%d notifications coalesced\n", prop_notify_coalesced);
+  hts_mutex_unlock(&prop_courier_mutex);
+  prop_print_lock_stats();
   callout_arm(&prop_stats_callout, prop_report_stats, NULL, 1);
 
 }
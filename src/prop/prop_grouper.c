@@ -57,7 +57,9 @@ typedef struct pg_node {
  */
 typedef struct pg_group {
   char *pgg_name;
+  unsigned int pgg_hash;
   LIST_ENTRY(pg_group) pgg_link;
+  LIST_ENTRY(pg_group) pgg_hash_link;
   prop_t *pgg_root;
   prop_t *pgg_nodes;
   struct pg_node_list pgg_entries;
@@ -74,6 +76,14 @@ struct prop_grouper {
 
   struct pg_group_list pg_groups;
 
+  /**
+   * Groups hashed on name. Size is always a power of 2 and is grown
+   * to keep the average chain length below 1
+   */
+  struct pg_group_list *pg_group_hash;
+  unsigned int pg_group_hash_size;
+  unsigned int pg_num_groups;
+
   char **pg_groupingpath;
   prop_sub_t *pg_srcsub;
 
@@ -82,19 +92,47 @@ struct prop_grouper {
 };
 
 
+/**
+ *
+ */
+static void
+group_rehash(prop_grouper_t *pg, unsigned int size)
+{
+  struct pg_group_list *h = calloc(size, sizeof(struct pg_group_list));
+  pg_group_t *pgg;
+
+  LIST_FOREACH(pgg, &pg->pg_groups, pgg_link)
+    LIST_INSERT_HEAD(&h[pgg->pgg_hash & (size - 1)], pgg, pgg_hash_link);
+
+  free(pg->pg_group_hash);
+  pg->pg_group_hash = h;
+  pg->pg_group_hash_size = size;
+}
+
+
 /**
  *
  */
 static pg_group_t *
 group_find(prop_grouper_t *pg, const char *name)
 {
+  const unsigned int hash = mystrhash(name);
   pg_group_t *pgg;
 
-  LIST_FOREACH(pgg, &pg->pg_groups, pgg_link)
-    if(!strcmp(pgg->pgg_name, name))
+  LIST_FOREACH(pgg, &pg->pg_group_hash[hash & (pg->pg_group_hash_size - 1)],
+               pgg_hash_link)
+    if(pgg->pgg_hash == hash && !strcmp(pgg->pgg_name, name))
       return pgg;
+
+  if(pg->pg_num_groups >= pg->pg_group_hash_size)
+    group_rehash(pg, pg->pg_group_hash_size * 2);
+
   pgg = calloc(1, sizeof(pg_group_t));
   LIST_INSERT_HEAD(&pg->pg_groups, pgg, pgg_link);
+  LIST_INSERT_HEAD(&pg->pg_group_hash[hash & (pg->pg_group_hash_size - 1)],
+                   pgg, pgg_hash_link);
+  pg->pg_num_groups++;
+  pgg->pgg_hash = hash;
   pgg->pgg_name = strdup(name);
   pgg->pgg_root = prop_create0(pg->pg_dst, NULL, NULL, 0);
   prop_set_string_exl(prop_create0(pgg->pgg_root, "name", NULL, 0), 
@@ -108,10 +146,12 @@ group_find(prop_grouper_t *pg, const char *name)
  *
  */
 static void
-group_destroy(pg_group_t *pgg)
+group_destroy(prop_grouper_t *pg, pg_group_t *pgg)
 {
   prop_destroy0(pgg->pgg_root);
   LIST_REMOVE(pgg, pgg_link);
+  LIST_REMOVE(pgg, pgg_hash_link);
+  pg->pg_num_groups--;
   free(pgg->pgg_name);
   free(pgg);
 }
@@ -129,7 +169,7 @@ node_unset(pg_node_t *pgn)
   if(pgn->pgn_group != NULL) {
     LIST_REMOVE(pgn, pgn_group_link);
     if(LIST_FIRST(&pgn->pgn_group->pgg_entries) == NULL)
-      group_destroy(pgn->pgn_group);
+      group_destroy(pgn->pgn_grouper, pgn->pgn_group);
   }
 }
 
@@ -140,6 +180,10 @@ node_unset(pg_node_t *pgn)
 static void
 node_update_group(pg_node_t *pgn, const char *group)
 {
+  if(group != NULL && pgn->pgn_group != NULL &&
+     !strcmp(pgn->pgn_group->pgg_name, group))
+    return;
+
   node_unset(pgn);
 
   if(group == NULL) {
@@ -319,14 +363,15 @@ prop_grouper_create(prop_t *dst, prop_t *src, const char *groupkey,
     ? dst : prop_xref_addref(dst);
 
   pg->pg_groupingpath = strvec_split(groupkey, '.');
+  group_rehash(pg, 16);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   pg->pg_srcsub = prop_subscribe(PROP_SUB_INTERNAL | PROP_SUB_DONTLOCK,
 				 PROP_TAG_CALLBACK, src_cb, pg,
 				 PROP_TAG_ROOT, src,
 				 NULL);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return pg;
 }
 
@@ -338,7 +383,7 @@ prop_grouper_create(prop_t *dst, prop_t *src, const char *groupkey,
 void
 prop_grouper_destroy(prop_grouper_t *pg)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   pg_clear(pg);
   prop_unsubscribe0(pg->pg_srcsub);
@@ -346,8 +391,9 @@ prop_grouper_destroy(prop_grouper_t *pg)
 
   assert(LIST_FIRST(&pg->pg_nodes) == NULL);
   assert(LIST_FIRST(&pg->pg_groups) == NULL);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 
   strvec_free(pg->pg_groupingpath);
+  free(pg->pg_group_hash);
   free(pg);
 }
@@ -28,6 +28,7 @@
 #include "misc/pool.h"
 
 extern hts_mutex_t prop_mutex;
+extern hts_mutex_t prop_courier_mutex;
 extern hts_mutex_t prop_tag_mutex;
 extern pool_t *prop_pool;
 extern pool_t *notify_pool;
@@ -39,6 +40,51 @@ TAILQ_HEAD(prop_queue, prop);
 LIST_HEAD(prop_list, prop);
 LIST_HEAD(prop_sub_list, prop_sub);
 TAILQ_HEAD(prop_sub_dispatch_queue, prop_sub_dispatch);
+TAILQ_HEAD(prop_domain_queue, prop_domain);
+
+
+/**
+ * Lock contention counters. Protected by the lock they describe
+ */
+typedef struct prop_lock_stats {
+  int64_t pls_locks;      // Number of times acquired
+  int64_t pls_contended;  // Number of times we had to wait
+  int64_t pls_wait_time;  // Total time spent waiting (in us)
+} prop_lock_stats_t;
+
+
+/**
+ * A lock domain.
+ *
+ * Props are either in the global domain (hp_domain == NULL) protected
+ * by prop_mutex or in a private domain created with
+ * prop_create_root_domain(). Changing the value of a prop or adding
+ * a child to a dir only requires the domain mutex as long as the
+ * change can't be observed synchronously outside of the domain
+ * (ie, no PROP_SUB_INTERNAL subscriptions and no multi notifications)
+ *
+ * Everything else (linking, subscribing, reparenting, destroying, etc)
+ * locks all domains via prop_lock_global()
+ */
+typedef struct prop_domain {
+  hts_mutex_t pd_mutex;
+
+  /**
+   * Linkage in prop_domains. Protected by prop_mutex. New domains are
+   * added at the tail which also defines the locking order
+   */
+  TAILQ_ENTRY(prop_domain) pd_link;
+
+  /**
+   * Number of props in this domain. When it reaches zero the domain
+   * is freed the next time the global lock is released
+   */
+  atomic_t pd_refcount;
+
+  char *pd_name;
+
+  prop_lock_stats_t pd_stats;
+} prop_domain_t;
 
 
 /**
@@ -71,6 +117,16 @@ struct prop_courier {
 
   int pc_refcount;
   char *pc_name;
+
+  /**
+   * Bumped every time notifications are moved off pc_queue_exp and
+   * pc_queue_nor. Used to tell if a subscription's hps_pending_value
+   * is still queued (and thus can be coalesced). Protected by
+   * prop_courier_mutex
+   */
+  unsigned int pc_generation;
+
+  int pc_num_coalesced;
 };
 
 
@@ -123,6 +179,21 @@ typedef struct prop_notify {
 
 
 
+/**
+ * Inline tag slot, see prop_tags.c
+ */
+#define PROP_TAG_INLINE 2
+
+struct prop_tag_slot {
+  void *key;
+  void *value;
+#ifdef PROP_DEBUG
+  const char *file;
+  int line;
+#endif
+};
+
+
 /**
  * Property types
  */
@@ -158,7 +229,8 @@ struct prop {
   atomic_t hp_refcount;
 
   /**
-   * Property name. Protected by mutex
+   * Property name. Interned (see prop_intern.c) unless
+   * PROP_NAME_NOT_ALLOCATED is set. Protected by mutex
    */
   const char *hp_name;
 
@@ -220,8 +292,8 @@ struct prop {
 #define PROP_CLIPPED_VALUE         0x1
 
   /**
-   * hp_name is not malloc()ed but rather points to a compile const string
-   * that should not be free()d upon prop finalization
+   * hp_name is not interned but rather points to a compile const string
+   * that should not be released upon prop finalization
    */
 #define PROP_NAME_NOT_ALLOCATED    0x2
 
@@ -266,8 +338,20 @@ struct prop {
 
 
   /**
-   * Tags. Protected by prop_tag_mutex
+   * Lock domain, NULL for the global domain. May only transition from
+   * NULL to non-NULL (when adopted into a private domain) which is done
+   * while holding the global lock. Thus it's safe to read this without
+   * holding any lock as long as a reference to the prop is held
+   */
+  struct prop_domain *hp_domain;
+
+  /**
+   * Tags. The first PROP_TAG_INLINE tags are stored inline and may be
+   * read without locking, see prop_tags.c. Any further tags are kept
+   * on the hp_tags list. All modifications are protected by
+   * prop_tag_mutex
    */
+  struct prop_tag_slot hp_tag_slots[PROP_TAG_INLINE];
   struct prop_tag *hp_tags;
 
 
@@ -290,6 +374,7 @@ struct prop {
     struct {
       struct prop_queue childs;
       struct prop *selected;
+      struct prop_child_index *index; // Name index for large dirs, or NULL
     } c;
     struct pixmap *pixmap;
     struct {
@@ -306,6 +391,7 @@ struct prop {
 #define hp_int      u.i.val
 #define hp_childs   u.c.childs
 #define hp_selected u.c.selected
+#define hp_child_index u.c.index
 #define hp_pixmap   u.pixmap
 #define hp_uri_title u.uri.title
 #define hp_uri       u.uri.uri
@@ -423,6 +509,15 @@ struct prop_sub {
    */
   atomic_t hps_refcount;
 
+  /**
+   * For PROP_SUB_COALESCE. Last value notification enqueued on the
+   * courier if it's also the last notification enqueued for this
+   * subscription. Only valid if hps_pending_gen matches the courier's
+   * pc_generation. Protected by prop_courier_mutex
+   */
+  struct prop_notify *hps_pending_value;
+  unsigned int hps_pending_gen;
+
 
   /**
    * Set when a subscription is destroyed. Protected by hps_lock.
@@ -456,6 +551,10 @@ struct prop_sub {
 #endif
 };
 
+void prop_lock_global(void);
+
+void prop_unlock_global(void);
+
 #ifdef PROP_DEBUG
 #define prop_ref_dec_locked(p) prop_ref_dec_traced_locked(p, __FILE__, __LINE__)
 
@@ -510,4 +609,14 @@ void prop_sub_ref_dec_locked(prop_sub_t *s);
 
 int prop_dispatch_one(prop_notify_t *n, int lockmode);
 
+void prop_name_init(void);
+
+const char *prop_name_intern(const char *str);
+
+void prop_name_release(const char *str);
+
+unsigned int prop_name_get_hash(const char *str);
+
+int prop_tag_empty(const prop_t *p);
+
 #endif // PROP_I_H__
@@ -0,0 +1,169 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "prop_i.h"
+
+/**
+ * Interned property names
+ *
+ * Dynamically allocated prop names are stored once in a global table
+ * and shared by all props with the same name. Thus equal names usually
+ * compare equal by pointer and the hash of a name is computed only once.
+ *
+ * The table has its own mutex since props in different lock domains
+ * may create and destroy names concurrently.
+ */
+
+#define PROP_NAME_HASH_INITIAL_SIZE 1024
+
+typedef struct prop_name {
+  struct prop_name *pn_next;
+  unsigned int pn_hash;
+  int pn_refcount;
+  char pn_str[0];
+} prop_name_t;
+
+static hts_mutex_t prop_name_mutex;
+static prop_name_t **prop_name_hash;
+static unsigned int prop_name_hash_size; // Always a power of 2
+static unsigned int prop_name_count;
+
+
+/**
+ *
+ */
+static prop_name_t *
+prop_name_from_str(const char *str)
+{
+  return (prop_name_t *)(str - offsetof(prop_name_t, pn_str));
+}
+
+
+/**
+ *
+ */
+static void
+prop_name_rehash(unsigned int size)
+{
+  prop_name_t **h = calloc(size, sizeof(prop_name_t *));
+  prop_name_t *pn, *next;
+
+  for(unsigned int i = 0; i < prop_name_hash_size; i++) {
+    for(pn = prop_name_hash[i]; pn != NULL; pn = next) {
+      next = pn->pn_next;
+      pn->pn_next = h[pn->pn_hash & (size - 1)];
+      h[pn->pn_hash & (size - 1)] = pn;
+    }
+  }
+  free(prop_name_hash);
+  prop_name_hash = h;
+  prop_name_hash_size = size;
+}
+
+
+/**
+ *
+ */
+void
+prop_name_init(void)
+{
+  hts_mutex_init(&prop_name_mutex);
+  prop_name_rehash(PROP_NAME_HASH_INITIAL_SIZE);
+}
+
+
+/**
+ * Return an interned copy of the given string. Must be released
+ * with prop_name_release()
+ */
+const char *
+prop_name_intern(const char *str)
+{
+  const unsigned int hash = mystrhash(str);
+  prop_name_t *pn;
+
+  hts_mutex_lock(&prop_name_mutex);
+
+  for(pn = prop_name_hash[hash & (prop_name_hash_size - 1)]; pn != NULL;
+      pn = pn->pn_next) {
+    if(pn->pn_hash == hash && !strcmp(pn->pn_str, str)) {
+      pn->pn_refcount++;
+      hts_mutex_unlock(&prop_name_mutex);
+      return pn->pn_str;
+    }
+  }
+
+  const size_t len = strlen(str);
+  pn = malloc(sizeof(prop_name_t) + len + 1);
+  memcpy(pn->pn_str, str, len + 1);
+  pn->pn_hash = hash;
+  pn->pn_refcount = 1;
+
+  if(prop_name_count >= prop_name_hash_size)
+    prop_name_rehash(prop_name_hash_size * 2);
+
+  pn->pn_next = prop_name_hash[hash & (prop_name_hash_size - 1)];
+  prop_name_hash[hash & (prop_name_hash_size - 1)] = pn;
+  prop_name_count++;
+
+  hts_mutex_unlock(&prop_name_mutex);
+  return pn->pn_str;
+}
+
+
+/**
+ *
+ */
+void
+prop_name_release(const char *str)
+{
+  if(str == NULL)
+    return;
+
+  prop_name_t *pn = prop_name_from_str(str);
+  prop_name_t **pp;
+
+  hts_mutex_lock(&prop_name_mutex);
+
+  if(--pn->pn_refcount == 0) {
+    for(pp = &prop_name_hash[pn->pn_hash & (prop_name_hash_size - 1)];
+        *pp != pn; pp = &(*pp)->pn_next) {}
+    *pp = pn->pn_next;
+    prop_name_count--;
+    free(pn);
+  }
+
+  hts_mutex_unlock(&prop_name_mutex);
+}
+
+
+/**
+ * Hash of an interned name, same as mystrhash() of the string.
+ * Safe without locking as long as caller holds a reference
+ */
+unsigned int
+prop_name_get_hash(const char *str)
+{
+  return prop_name_from_str(str)->pn_hash;
+}
@@ -29,6 +29,7 @@
 
 #include "main.h"
 #include "prop_i.h"
+#include "misc/minmax.h"
 #include "prop_nodefilter.h"
 #include "misc/str.h"
 #include "misc/redblack.h"
@@ -80,10 +81,16 @@ typedef struct nfnode {
 
   struct prop_nf *nf;
   char inserted:1;
+  char filter_match;
+
+#define FILTER_UNKNOWN 0
+#define FILTER_MATCH   1
+#define FILTER_NOMATCH 2
+
   char sortkey_type[MAX_SORT_KEYS];
 
 #define SORTKEY_NONE  0
-#define SORTKEY_RSTR  1
+#define SORTKEY_STR   1 // Collation key from dictkey_create()
 #define SORTKEY_INT   2
 #define SORTKEY_FLOAT 3
 #define SORTKEY_CSTR  4
@@ -92,11 +99,18 @@ typedef struct nfnode {
   prop_sub_t *sortsub[MAX_SORT_KEYS];
 
   union {
-    rstr_t *rstr;
+    dictkey_t *key;
     const char *cstr;
     int i;
     float f;
   } sk[MAX_SORT_KEYS];
+
+  /**
+   * All strings in the node, casefolded and NUL separated. Built when
+   * the filter is first checked and dropped when the node changes
+   */
+  char *ftext;
+  int ftext_len;
 } nfnode_t;
 
 
@@ -145,6 +159,7 @@ typedef struct prop_nf {
   struct nfnode_tree out_tree;
 
   char *filter;
+  char *filter_folded;
 
   char *sortkey[MAX_SORT_KEYS];
   sortmap_t *sortmap[MAX_SORT_KEYS];
@@ -239,18 +254,26 @@ eval_preds(nfnode_t *nfn)
 /**
  *
  */
-static int
-filterstr(const char *s, const char *q)
+static void
+ftext_append(nfnode_t *nfn, int *allocp, const char *str)
 {
-  return !!mystrstr(s, q);
+  if(str == NULL)
+    return;
+
+  const int need = nfn->ftext_len + strlen(str) * 3 + 2;
+  if(need > *allocp) {
+    *allocp = MAX(need, *allocp * 2);
+    nfn->ftext = realloc(nfn->ftext, *allocp);
+  }
+  nfn->ftext_len += utf8_casefold(nfn->ftext + nfn->ftext_len, str) + 1;
 }
 
 
 /**
  *
  */
-static int
-nf_filtercheck(prop_t *p, const char *q)
+static void
+ftext_build(nfnode_t *nfn, int *allocp, prop_t *p)
 {
   prop_t *c;
 
@@ -259,23 +282,64 @@ nf_filtercheck(prop_t *p, const char *q)
 
   switch(p->hp_type) {
   case PROP_RSTRING:
-    return filterstr(rstr_get(p->hp_rstring), q);
+    ftext_append(nfn, allocp, rstr_get(p->hp_rstring));
+    break;
 
   case PROP_CSTRING:
-    return filterstr(p->hp_cstring, q);
+    ftext_append(nfn, allocp, p->hp_cstring);
+    break;
 
   case PROP_URI:
-    return filterstr(rstr_get(p->hp_uri_title), q);
+    ftext_append(nfn, allocp, rstr_get(p->hp_uri_title));
+    break;
 
   case PROP_DIR:
     TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
-      if(nf_filtercheck(c, q))
-	return 1;
+      ftext_build(nfn, allocp, c);
     break;
   default:
     break;
   }
-  return 0;
+}
+
+
+/**
+ * Check node against the filter. Strings are collected and casefolded
+ * once so we just need to do a plain substring search here. NUL
+ * separators make sure a match can't span two strings
+ */
+static int
+nf_filtercheck(prop_nf_t *nf, nfnode_t *nfn)
+{
+  if(nfn->filter_match == FILTER_UNKNOWN) {
+
+    if(nfn->ftext == NULL) {
+      int alloc = 0;
+      nfn->ftext_len = 0;
+      ftext_build(nfn, &alloc, nfn->in);
+      if(nfn->ftext == NULL)
+        nfn->ftext = strdup("");
+      else
+        nfn->ftext = realloc(nfn->ftext, nfn->ftext_len);
+    }
+
+    nfn->filter_match =
+      find_str(nfn->ftext, nfn->ftext_len, nf->filter_folded) ?
+      FILTER_MATCH : FILTER_NOMATCH;
+  }
+  return nfn->filter_match == FILTER_MATCH;
+}
+
+
+/**
+ *
+ */
+static void
+nf_ftext_flush(nfnode_t *nfn)
+{
+  free(nfn->ftext);
+  nfn->ftext = NULL;
+  nfn->filter_match = FILTER_UNKNOWN;
 }
 
 
@@ -295,8 +359,8 @@ nf_egress_cmp(const nfnode_t *a, const nfnode_t *b)
       return a->sortkey_type[i] - b->sortkey_type[i];
     
     switch(a->sortkey_type[i]) {
-    case SORTKEY_RSTR:
-      r = dictcmp(rstr_get(a->sk[i].rstr), rstr_get(b->sk[i].rstr));
+    case SORTKEY_STR:
+      r = dictkey_cmp(a->sk[i].key, b->sk[i].key);
       break;
       
     case SORTKEY_CSTR:
@@ -400,7 +464,7 @@ nf_update_egress(prop_nf_t *nf, nfnode_t *nfn)
       en = 0;
 
   // Check filtering
-  if(en && nf->filter != NULL && !nf_filtercheck(nfn->in, nf->filter))
+  if(en && nf->filter != NULL && !nf_filtercheck(nf, nfn))
     en = 0;
 
   if(eval_preds(nfn))
@@ -442,6 +506,7 @@ nf_multi_filter(void *opaque, prop_event_t event, ...)
   nfnode_t *nfn = opaque;
   prop_nf_t *nf = nfn->nf;
 
+  nf_ftext_flush(nfn);
   nf_update_egress(nf, nfn);
 }
 
@@ -467,6 +532,8 @@ nf_update_multisub(prop_nf_t *nf, nfnode_t *nfn)
 
     prop_unsubscribe0(nfn->multisub);
     nfn->multisub = NULL;
+    // Without the subscription we won't know when the text changes
+    nf_ftext_flush(nfn);
   }
 }
 
@@ -573,8 +640,8 @@ static void
 nf_set_sortkey_x(int x, nfnode_t *nfn, prop_event_t event, va_list ap)
 {
   rstr_t *r;
-  if(nfn->sortkey_type[x] == SORTKEY_RSTR)
-    rstr_release(nfn->sk[x].rstr);
+  if(nfn->sortkey_type[x] == SORTKEY_STR)
+    free(nfn->sk[x].key);
 
   switch(event) {
   case PROP_SET_RSTRING:
@@ -589,8 +656,8 @@ nf_set_sortkey_x(int x, nfnode_t *nfn, prop_event_t event, va_list ap)
       nfn->sk[x].i = map->val;
       nfn->sortkey_type[x] = SORTKEY_INT;
     } else {
-      nfn->sk[x].rstr = rstr_dup(r);
-      nfn->sortkey_type[x] = SORTKEY_RSTR;
+      nfn->sk[x].key = dictkey_create(rstr_get(r));
+      nfn->sortkey_type[x] = SORTKEY_STR;
     }
     break;
 
@@ -681,8 +748,8 @@ nf_update_order_x(prop_nf_t *nf, nfnode_t *nfn, int x)
 
   if(nf->sortkey[x] == NULL) {
 
-    if(nfn->sortkey_type[x] == SORTKEY_RSTR)
-      rstr_release(nfn->sk[x].rstr);
+    if(nfn->sortkey_type[x] == SORTKEY_STR)
+      free(nfn->sk[x].key);
     nfn->sortkey_type[x] = SORTKEY_NONE;
 
     nf_insert_node(nf, nfn);      
@@ -809,9 +876,10 @@ nf_del_node(prop_nf_t *nf, nfnode_t *nfn)
     nfnp_destroy(nfnp);
   
   for(i = 0; i < MAX_SORT_KEYS; i++)
-    if(nfn->sortkey_type[i] == SORTKEY_RSTR)
-      rstr_release(nfn->sk[i].rstr);
+    if(nfn->sortkey_type[i] == SORTKEY_STR)
+      free(nfn->sk[i].key);
 
+  free(nfn->ftext);
   free(nfn);
 }
 
@@ -928,6 +996,7 @@ prop_nf_release0(struct prop_nf *pnf)
   }
 
   free(pnf->filter);
+  free(pnf->filter_folded);
 
   nf_destroy_preds(pnf);
   free(pnf);
@@ -1127,6 +1196,33 @@ nf_set_filter(void *opaque, const char *str)
   if(str != NULL && str[0] == 0)
     str = NULL;
 
+  char *folded = NULL;
+  if(str != NULL) {
+    folded = malloc(strlen(str) * 3 + 1);
+    utf8_casefold(folded, str);
+  }
+
+  /*
+   * When the new filter contains the old one (typically another
+   * character was typed) nodes that did not match still can't match.
+   * Likewise, when it's contained in the old filter (backspace) all
+   * matching nodes still match. So only the others need to be checked
+   */
+  int keep = FILTER_UNKNOWN;
+  if(folded != NULL && nf->filter_folded != NULL) {
+    if(strstr(folded, nf->filter_folded))
+      keep = FILTER_NOMATCH;
+    else if(strstr(nf->filter_folded, folded))
+      keep = FILTER_MATCH;
+  }
+
+  TAILQ_FOREACH(nfn, &nf->in, in_link)
+    if(nfn->filter_match != keep)
+      nfn->filter_match = FILTER_UNKNOWN;
+
+  free(nf->filter_folded);
+  nf->filter_folded = folded;
+
   mystrset(&nf->filter, str);
 
   if(nf->filter == NULL && nf->pending_have_more) {
@@ -1135,10 +1231,23 @@ nf_set_filter(void *opaque, const char *str)
     nf->pending_have_more = 0;
   }
 
-
   TAILQ_FOREACH(nfn, &nf->in, in_link) {
     nf_update_multisub(nf, nfn);
-    nf_update_egress(nf, nfn);
+    if(!nfn->inserted)
+      nf_update_egress(nf, nfn);
+  }
+
+  /*
+   * Update in reverse output order. A node that becomes visible will
+   * then find its successor without having to skip over long runs of
+   * nodes that are about to become visible as well
+   */
+  if(nf->sorted) {
+    RB_FOREACH_REVERSE(nfn, &nf->out_tree, out_tree_link)
+      nf_update_egress(nf, nfn);
+  } else {
+    TAILQ_FOREACH_REVERSE(nfn, &nf->out_queue, nfnode_queue, out_queue_link)
+      nf_update_egress(nf, nfn);
   }
 }
 
@@ -1159,7 +1268,7 @@ prop_nf_create(prop_t *dst, prop_t *src, prop_t *filter, int flags)
   nf->dst = flags & PROP_NF_TAKE_DST_OWNERSHIP ? dst : prop_xref_addref(dst);
   nf->src = src;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   if(filter != NULL)
     nf->filtersub = prop_subscribe(PROP_SUB_INTERNAL | PROP_SUB_DONTLOCK,
@@ -1180,7 +1289,7 @@ prop_nf_create(prop_t *dst, prop_t *src, prop_t *filter, int flags)
 			      NULL);
 
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 
   return nf;
 }
@@ -1192,9 +1301,9 @@ prop_nf_create(prop_t *dst, prop_t *src, prop_t *filter, int flags)
 void
 prop_nf_release(struct prop_nf *pnf)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   prop_nf_release0(pnf);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -1204,9 +1313,9 @@ prop_nf_release(struct prop_nf *pnf)
 struct prop_nf *
 prop_nf_retain(struct prop_nf *pnf)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   pnf->pnf_refcount++;
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return pnf;
 }
 
@@ -1279,9 +1388,9 @@ prop_nf_pred_str_add(struct prop_nf *nf,
 {
   struct prop_nf_pred *pnp = calloc(1, sizeof(struct prop_nf_pred));
   pnp->pnp_str = strdup(str);
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   int id = prop_nf_pred_add(nf, path, cf, enable, mode, pnp);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return id;
 }
 
@@ -1297,9 +1406,9 @@ prop_nf_pred_int_add(struct prop_nf *nf,
 {
   struct prop_nf_pred *pnp = calloc(1, sizeof(struct prop_nf_pred));
   pnp->pnp_int = value;
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   int id = prop_nf_pred_add(nf, path, cf, enable, mode, pnp);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return id;
 }
 
@@ -1317,7 +1426,7 @@ prop_nf_pred_remove(struct prop_nf *nf, int id)
   if(id == 0)
     return;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   LIST_FOREACH(pnp, &nf->preds, pnp_link)
     if(pnp->pnp_id == id)
       break;
@@ -1336,7 +1445,7 @@ prop_nf_pred_remove(struct prop_nf *nf, int id)
     nf_destroy_pred(pnp);
   }
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
 
 
@@ -1363,7 +1472,7 @@ prop_nf_sort(struct prop_nf *nf, const char *path, int desc, unsigned int idx,
   nfnode_t *nfn;
   int m = desc ? -1 : 1;
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
   
   assert(idx < MAX_SORT_KEYS);
 
@@ -1407,5 +1516,5 @@ prop_nf_sort(struct prop_nf *nf, const char *path, int desc, unsigned int idx,
   TAILQ_FOREACH(nfn, &nf->in, in_link)
     nf_update_order_x(nf, nfn, idx);
  done:
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
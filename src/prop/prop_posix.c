@@ -46,9 +46,11 @@ prop_courier_poll_with_alarm(prop_courier_t *pc, int maxtime)
 {
   prop_notify_t *n, *next;
 
-  if(!hts_mutex_trylock(&prop_mutex)) {
+  if(!hts_mutex_trylock(&prop_courier_mutex)) {
     TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_exp, hpn_link);
     TAILQ_MERGE(&pc->pc_dispatch_queue, &pc->pc_queue_nor, hpn_link);
+    pc->pc_generation++;
+    hts_mutex_unlock(&prop_courier_mutex);
 
     for(n = TAILQ_FIRST(&pc->pc_free_queue); n != NULL; n = next) {
       next = TAILQ_NEXT(n, hpn_link);
@@ -57,8 +59,6 @@ prop_courier_poll_with_alarm(prop_courier_t *pc, int maxtime)
       pool_put(notify_pool, n);
     }
     TAILQ_INIT(&pc->pc_free_queue);
-
-    hts_mutex_unlock(&prop_mutex);
   }
 
   if(TAILQ_FIRST(&pc->pc_dispatch_queue) == NULL)
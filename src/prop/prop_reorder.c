@@ -211,7 +211,7 @@ prop_reorder_create(prop_t *dst, prop_t *src, int flags, const char *id)
   pr->pr_dst = flags & PROP_REORDER_TAKE_DST_OWNERSHIP ?
     dst : prop_xref_addref(dst);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   pr->pr_srcsub = prop_subscribe(PROP_SUB_INTERNAL | PROP_SUB_DONTLOCK | 
 				 PROP_SUB_TRACK_DESTROY,
@@ -225,5 +225,5 @@ prop_reorder_create(prop_t *dst, prop_t *src, int flags, const char *id)
 				 PROP_TAG_ROOT, dst,
 				 NULL);
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 }
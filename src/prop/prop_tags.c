@@ -19,10 +19,22 @@
  */
 #include <stdio.h>
 #include "main.h"
+#include "arch/atomic.h"
 #include "prop_i.h"
 
 /**
+ * Prop tags
  *
+ * A tag associates a value with a (prop, key) pair. Keys are owned by
+ * whoever sets the tag (a nodefilter, a view cloner, etc) and that
+ * owner also serializes all get, set and clear operations for its key.
+ *
+ * The first PROP_TAG_INLINE tags on a prop are stored directly in the
+ * prop. A slot is claimed by writing the value before publishing the
+ * key and released by resetting the key. Since no one else can claim
+ * or release a slot holding our key, prop_tag_get() can scan the
+ * inline slots without taking prop_tag_mutex. It's only needed for
+ * modifications and for the (rare) overflow list.
  */
 typedef struct prop_tag {
   struct prop_tag *next;
@@ -35,6 +47,16 @@ typedef struct prop_tag {
 } prop_tag_t;
 
 
+/**
+ *
+ */
+static inline void *
+slot_key(const struct prop_tag_slot *pts)
+{
+  return *(void * const volatile *)&pts->key;
+}
+
+
 /**
  *
  */
@@ -43,6 +65,14 @@ prop_tag_get(prop_t *p, void *key)
 {
   prop_tag_t *pt;
   void *v = NULL;
+
+  for(int i = 0; i < PROP_TAG_INLINE; i++)
+    if(slot_key(&p->hp_tag_slots[i]) == key)
+      return p->hp_tag_slots[i].value;
+
+  if(*(prop_tag_t * volatile *)&p->hp_tags == NULL)
+    return NULL;
+
   hts_mutex_lock(&prop_tag_mutex);
   for(pt = p->hp_tags; pt != NULL; pt = pt->next)
     if(pt->key == key) {
@@ -54,6 +84,37 @@ prop_tag_get(prop_t *p, void *key)
 }
 
 
+/**
+ * Store a new tag, prop_tag_mutex must be held
+ */
+static void
+prop_tag_insert(prop_t *p, void *key, void *value,
+                const char *file, int line)
+{
+  for(int i = 0; i < PROP_TAG_INLINE; i++) {
+    struct prop_tag_slot *pts = &p->hp_tag_slots[i];
+    if(pts->key != NULL)
+      continue;
+    pts->value = value;
+#ifdef PROP_DEBUG
+    pts->file = file;
+    pts->line = line;
+#endif
+    atomic_barrier();
+    *(void * volatile *)&pts->key = key;
+    return;
+  }
+
+  prop_tag_t *pt = malloc(sizeof(prop_tag_t));
+  pt->key = key;
+  pt->value = value;
+#ifdef PROP_DEBUG
+  pt->file = file;
+  pt->line = line;
+#endif
+  pt->next = p->hp_tags;
+  p->hp_tags = pt;
+}
 
 
 #ifdef PROP_DEBUG
@@ -64,14 +125,8 @@ void
 prop_tag_set_debug(prop_t *p, void *key, void *value,
 		   const char *file, int line)
 {
-  prop_tag_t *pt = malloc(sizeof(prop_tag_t));
-  pt->key = key;
-  pt->value = value;
-  pt->file = file;
-  pt->line = line;
   hts_mutex_lock(&prop_tag_mutex);
-  pt->next = p->hp_tags;
-  p->hp_tags = pt;
+  prop_tag_insert(p, key, value, file, line);
   hts_mutex_unlock(&prop_tag_mutex);
 }
 
@@ -83,13 +138,8 @@ prop_tag_set_debug(prop_t *p, void *key, void *value,
 void
 prop_tag_set(prop_t *p, void *key, void *value)
 {
-  prop_tag_t *pt = malloc(sizeof(prop_tag_t));
-  pt->key = key;
-  pt->value = value;
-
   hts_mutex_lock(&prop_tag_mutex);
-  pt->next = p->hp_tags;
-  p->hp_tags = pt;
+  prop_tag_insert(p, key, value, NULL, 0);
   hts_mutex_unlock(&prop_tag_mutex);
 }
 
@@ -106,6 +156,16 @@ prop_tag_clear(prop_t *p, void *key)
 
   hts_mutex_lock(&prop_tag_mutex);
 
+  for(int i = 0; i < PROP_TAG_INLINE; i++) {
+    struct prop_tag_slot *pts = &p->hp_tag_slots[i];
+    if(pts->key == key) {
+      void *v = pts->value;
+      *(void * volatile *)&pts->key = NULL;
+      hts_mutex_unlock(&prop_tag_mutex);
+      return v;
+    }
+  }
+
   while((pt = *q) != NULL) {
     if(pt->key == key) {
       void *v = pt->value;
@@ -122,16 +182,35 @@ prop_tag_clear(prop_t *p, void *key)
 }
 
 
+/**
+ *
+ */
+int
+prop_tag_empty(const prop_t *p)
+{
+  for(int i = 0; i < PROP_TAG_INLINE; i++)
+    if(p->hp_tag_slots[i].key != NULL)
+      return 0;
+  return p->hp_tags == NULL;
+}
+
+
 #ifdef PROP_DEBUG
 void prop_tag_dump(prop_t *p);
 void
 prop_tag_dump(prop_t *p)
 {
   prop_tag_t *pt;
-  if(p->hp_tags == NULL)
+  if(prop_tag_empty(p))
     return;
 
   printf("Stale tags on prop %p\n", p);
+  for(int i = 0; i < PROP_TAG_INLINE; i++) {
+    const struct prop_tag_slot *pts = &p->hp_tag_slots[i];
+    if(pts->key != NULL)
+      printf("slot %d  key=%p value=%p by %s:%d\n",
+             i, pts->key, pts->value, pts->file, pts->line);
+  }
   for(pt = p->hp_tags; pt != NULL; pt = pt->next) {
     printf("pt %p  key=%p value=%p by %s:%d\n",
 	   pt, pt->key, pt->value, pt->file, pt->line);
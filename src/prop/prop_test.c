@@ -30,6 +30,9 @@
 
 #include "prop.h"
 #include "prop_i.h"
+#include "prop_nodefilter.h"
+#include "prop_grouper.h"
+#include "misc/str.h"
 
 #ifdef PROP_DEBUG
 
@@ -318,6 +321,543 @@ prop_test2(void)
 
 
 
+/**
+ * Lock domains
+ */
+#define DOMAIN_TEST_THREADS 4
+#define DOMAIN_TEST_ROUNDS  100000
+
+static void *
+prop_test3_thread(void *aux)
+{
+  prop_t *root = aux;
+  prop_t *model = prop_create(root, "model");
+  int i;
+
+  for(i = 1; i <= DOMAIN_TEST_ROUNDS; i++) {
+    prop_set(model, "counter", PROP_SET_INT, i);
+    prop_set(model, "title", PROP_SET_STRING, i & 1 ? "odd" : "even");
+  }
+  return NULL;
+}
+
+
+static void
+prop_test3(void)
+{
+  printf("Running test 3\n");
+  int i;
+  hts_thread_t tids[DOMAIN_TEST_THREADS];
+  prop_t *roots[DOMAIN_TEST_THREADS];
+
+  prop_t *d = prop_create_root_domain("test3");
+  prop_t *a = prop_create(d, "a");
+  assert(a->hp_domain == d->hp_domain);
+
+  // A global subtree mounted in the domain should be adopted
+  prop_t *g = prop_create_root(NULL);
+  prop_create(g, "child");
+  assert(TAILQ_FIRST(&g->hp_childs)->hp_domain == NULL);
+  if(prop_set_parent(g, d))
+    abort();
+  assert(g->hp_domain == d->hp_domain);
+  assert(TAILQ_FIRST(&g->hp_childs)->hp_domain == d->hp_domain);
+
+  // Internal subscriptions must still be invoked synchronously
+  prop_subscribe(PROP_SUB_INTERNAL,
+                 PROP_TAG_CALLBACK_INT, set_testval, NULL,
+                 PROP_TAG_ROOT, a,
+                 NULL);
+  prop_set_int(a, 42);
+  CHECKTESTVAL(42);
+  prop_set(d, "a", PROP_SET_INT, 43);
+  CHECKTESTVAL(43);
+
+  // A second domain mounted inside stays in its own domain
+  prop_t *d2 = prop_create_root_domain("test3b");
+  if(prop_set_parent(d2, a))
+    abort();
+  assert(d2->hp_domain != d->hp_domain);
+
+  // Hammer a bunch of independent domains concurrently
+  for(i = 0; i < DOMAIN_TEST_THREADS; i++) {
+    roots[i] = prop_create_root_domain("test3t");
+    if(prop_set_parent(roots[i], d))
+      abort();
+    hts_thread_create_joinable("proptest", &tids[i], prop_test3_thread,
+                               roots[i], THREAD_PRIO_MODEL);
+  }
+
+  for(i = 0; i < DOMAIN_TEST_THREADS; i++) {
+    hts_thread_join(&tids[i]);
+    if(prop_get_int(roots[i], "model", "counter", NULL) !=
+       DOMAIN_TEST_ROUNDS) {
+      printf("Domain %d has wrong counter value\n", i);
+      exit(1);
+    }
+  }
+
+  prop_print_lock_stats();
+  prop_destroy(d);
+}
+
+
+/**
+ * Coalescing of value notifications
+ */
+static int test4_calls;
+
+static void
+test4_cb(void *opaque, int value)
+{
+  test4_calls++;
+  testval = value;
+}
+
+
+static void
+prop_test4(void)
+{
+  printf("Running test 4\n");
+  int i;
+  prop_courier_t *pc = prop_courier_create_passive();
+  prop_t *r = prop_create_root(NULL);
+  prop_t *a = prop_create(r, "a");
+  prop_t *b = prop_create(r, "b");
+
+  prop_sub_t *s1 =
+    prop_subscribe(PROP_SUB_COALESCE | PROP_SUB_NO_INITIAL_UPDATE,
+                   PROP_TAG_CALLBACK_INT, test4_cb, NULL,
+                   PROP_TAG_COURIER, pc,
+                   PROP_TAG_ROOT, a,
+                   NULL);
+
+  prop_sub_t *s2 =
+    prop_subscribe(PROP_SUB_NO_INITIAL_UPDATE,
+                   PROP_TAG_CALLBACK_INT, set_testval, NULL,
+                   PROP_TAG_COURIER, pc,
+                   PROP_TAG_ROOT, b,
+                   NULL);
+
+  for(i = 1; i <= 1000; i++)
+    prop_set_int(a, i);
+
+  prop_courier_poll(pc);
+  if(test4_calls != 1) {
+    printf("Expected 1 callback got %d\n", test4_calls);
+    exit(1);
+  }
+  CHECKTESTVAL(1000);
+
+  // Coalesced notification must be delivered after anything queued
+  // on the same courier in between
+  prop_set_int(a, 1);
+  prop_set_int(b, 2);
+  prop_set_int(a, 3);
+  prop_courier_poll(pc);
+  CHECKTESTVAL(3);
+
+  prop_unsubscribe(s1);
+  prop_unsubscribe(s2);
+  prop_destroy(r);
+  prop_courier_destroy(pc);
+}
+
+
+/**
+ * Child lookup in large directories, also a benchmark
+ */
+#define TEST5_CHILDS 50000
+
+static void
+prop_test5(void)
+{
+  printf("Running test 5\n");
+  char name[32];
+  int i;
+  prop_t *r = prop_create_root(NULL);
+  int64_t ts = arch_get_ts();
+
+  for(i = 0; i < TEST5_CHILDS; i++) {
+    snprintf(name, sizeof(name), "child%d", i);
+    prop_set(r, name, PROP_SET_INT, i);
+  }
+
+  int64_t ts2 = arch_get_ts();
+
+  for(i = 0; i < TEST5_CHILDS; i++) {
+    snprintf(name, sizeof(name), "child%d", (i * 7919) % TEST5_CHILDS);
+    prop_t *c = prop_find(r, name, NULL);
+    if(c == NULL || prop_get_int(c, NULL) != (i * 7919) % TEST5_CHILDS) {
+      printf("Lookup of %s failed\n", name);
+      exit(1);
+    }
+    prop_ref_dec(c);
+  }
+
+  int64_t ts3 = arch_get_ts();
+  printf("%d childs: create %d ms, lookup %d ms\n", TEST5_CHILDS,
+         (int)((ts2 - ts) / 1000), (int)((ts3 - ts2) / 1000));
+
+  // Names are shared and duplicates resolve to the first child in order
+  prop_t *c0 = prop_find(r, "child0", NULL);
+  prop_t *c1 = prop_find(r, "child1", NULL);
+  snprintf(name, sizeof(name), "child%d", 1);
+  prop_t *a = prop_create_root(name);
+  if(a->hp_name != c1->hp_name) {
+    printf("Names not interned\n");
+    exit(1);
+  }
+  if(prop_set_parent(a, r))
+    abort();
+  prop_t *f = prop_find(r, "child1", NULL);
+  if(f != c1) {
+    printf("Duplicate appended before original\n");
+    exit(1);
+  }
+  prop_ref_dec(f);
+  prop_move(a, c0);
+  f = prop_find(r, "child1", NULL);
+  if(f != a) {
+    printf("Moved duplicate not found first\n");
+    exit(1);
+  }
+  prop_ref_dec(f);
+  prop_destroy(a);
+  if(prop_get_int(r, "child1", NULL) != 1) {
+    printf("Original lost after duplicate destroyed\n");
+    exit(1);
+  }
+  prop_ref_dec(c0);
+  prop_ref_dec(c1);
+
+  for(i = 0; i < TEST5_CHILDS; i += 2) {
+    snprintf(name, sizeof(name), "child%d", i);
+    prop_destroy_by_name(r, name);
+  }
+  f = prop_find(r, "child2", NULL);
+  if(f != NULL || prop_get_int(r, "child3", NULL) != 3) {
+    printf("Lookup after removal failed\n");
+    exit(1);
+  }
+
+  prop_destroy(r);
+}
+
+
+/**
+ * Sorting with prop_nodefilter, also a benchmark over a synthetic
+ * music library
+ */
+#define TEST6_TRACKS 20000
+
+static const char *test6_strings[] = {
+  "The Beatles", "beatles", "Beatles, The", "the.the", "Them",
+  "Track 2", "track 10", "Track 010", "Track 9b", "Track9", "Track",
+  "99 Luftballons", "100", "007", "7", "", " ", "#1", "Abba", "ABBA",
+  "Ä", "ä", "Åsa", "Zorro", "Émile", "emile", "Ökänd", "Ω", "ω",
+  "12345678901234567890", "1.5", "1.10", "a1b2", "A1B10", "\xff\xfe",
+  NULL
+};
+
+static int
+sign(int x)
+{
+  return x < 0 ? -1 : x > 0;
+}
+
+static void
+prop_test6(void)
+{
+  printf("Running test 6\n");
+  char str[64];
+  int i, j;
+
+  for(i = 0; test6_strings[i] != NULL; i++) {
+    dictkey_t *a = dictkey_create(test6_strings[i]);
+    for(j = 0; test6_strings[j] != NULL; j++) {
+      dictkey_t *b = dictkey_create(test6_strings[j]);
+      if(sign(dictkey_cmp(a, b)) !=
+         sign(dictcmp(test6_strings[i], test6_strings[j]))) {
+        printf("Collation key of '%s' and '%s' does not match dictcmp\n",
+               test6_strings[i], test6_strings[j]);
+        exit(1);
+      }
+      free(b);
+    }
+    free(a);
+  }
+
+  static const char *words[] = {
+    "Love", "the", "Night", "Blue", "Ärlig", "Song", "Dance", "Rain",
+    "Fire", "Élan", "Heart", "Way", "Dream", "World", "Time", "Home"
+  };
+
+  prop_t *src = prop_create_root(NULL);
+  prop_t *dst = prop_create_root(NULL);
+  unsigned int seed = 1;
+
+  for(i = 0; i < TEST6_TRACKS; i++) {
+    prop_t *m = prop_create(prop_create(src, NULL), "metadata");
+    seed = seed * 1103515245 + 12345;
+    snprintf(str, sizeof(str), "%s %s %d", words[(seed >> 8) & 15],
+             words[(seed >> 12) & 15], (seed >> 16) % 50);
+    prop_set(m, "title", PROP_SET_STRING, str);
+    snprintf(str, sizeof(str), "The %s Band", words[(seed >> 20) & 15]);
+    prop_set(m, "artist", PROP_SET_STRING, str);
+    prop_set(m, "album", PROP_SET_STRING, words[(seed >> 24) & 15]);
+  }
+
+  struct prop_nf *nf = prop_nf_create(dst, src, NULL, 0);
+  int64_t ts = arch_get_ts();
+  prop_nf_sort(nf, "node.metadata.title", 0, 0, NULL, 0);
+  int64_t ts2 = arch_get_ts();
+  prop_nf_sort(nf, "node.metadata.artist", 0, 0, NULL, 0);
+  prop_nf_sort(nf, "node.metadata.album", 0, 1, NULL, 0);
+  int64_t ts3 = arch_get_ts();
+
+  // Output must follow dictcmp() order
+  prop_t **out = malloc(sizeof(prop_t *) * TEST6_TRACKS);
+  int n = 0;
+  prop_t *c;
+  prop_lock_global();
+  TAILQ_FOREACH(c, &dst->hp_childs, hp_parent_link)
+    out[n++] = prop_ref_inc(c);
+  prop_unlock_global();
+
+  rstr_t *pa = NULL, *pb = NULL;
+  for(i = 0; i < n; i++) {
+    rstr_t *a = prop_get_string(out[i], "metadata", "artist", NULL);
+    rstr_t *b = prop_get_string(out[i], "metadata", "album", NULL);
+    if(pa != NULL) {
+      int r = dictcmp(rstr_get(pa), rstr_get(a));
+      if(r > 0 || (r == 0 && dictcmp(rstr_get(pb), rstr_get(b)) > 0)) {
+        printf("Track %d out of order\n", i);
+        exit(1);
+      }
+    }
+    rstr_release(pa);
+    rstr_release(pb);
+    pa = a;
+    pb = b;
+    prop_ref_dec(out[i]);
+  }
+  rstr_release(pa);
+  rstr_release(pb);
+  free(out);
+
+  if(n != TEST6_TRACKS) {
+    printf("Expected %d tracks got %d\n", TEST6_TRACKS, n);
+    exit(1);
+  }
+
+  printf("%d tracks: sort by title %d ms, by artist and album %d ms\n",
+         TEST6_TRACKS, (int)((ts2 - ts) / 1000), (int)((ts3 - ts2) / 1000));
+
+  prop_nf_release(nf);
+  prop_destroy(dst);
+  prop_destroy(src);
+}
+
+
+/**
+ * Search as you type with prop_nodefilter, also a benchmark
+ */
+#define TEST7_ITEMS 50000
+
+static int
+test7_count(prop_t *p)
+{
+  prop_t *c;
+  int n = 0;
+  prop_lock_global();
+  TAILQ_FOREACH(c, &p->hp_childs, hp_parent_link)
+    n++;
+  prop_unlock_global();
+  return n;
+}
+
+static int
+test7_expect(char **titles, const char *q)
+{
+  int i, n = 0;
+  if(*q == 0)
+    return TEST7_ITEMS;
+  for(i = 0; i < TEST7_ITEMS; i++)
+    if(mystrstr(titles[i], q) || mystrstr("Ärlig Artist", q))
+      n++;
+  return n;
+}
+
+static void
+prop_test7(void)
+{
+  printf("Running test 7\n");
+  static const char *words[] = {
+    "Love", "the", "Night", "Blue", "ÄRLIG", "Song", "Dance", "Rain",
+    "Fire", "Élan", "Heart", "Way", "Dream", "World", "Time", "Home"
+  };
+  static const char *typed[] = {
+    "l", "lo", "lov", "love", "love ", "love d", "love dr", "love d",
+    "love ", "élan", "ÉLAN W", "x", "ärlig a", "", NULL,
+  };
+  char **titles = malloc(sizeof(char *) * TEST7_ITEMS);
+  char str[64];
+  int i;
+  unsigned int seed = 1;
+
+  prop_t *src = prop_create_root(NULL);
+  prop_t *dst = prop_create_root(NULL);
+  prop_t *filter = prop_create_root(NULL);
+
+  for(i = 0; i < TEST7_ITEMS; i++) {
+    prop_t *m = prop_create(prop_create(src, NULL), "metadata");
+    seed = seed * 1103515245 + 12345;
+    snprintf(str, sizeof(str), "%s %s %d", words[(seed >> 8) & 15],
+             words[(seed >> 12) & 15], (seed >> 16) % 1000);
+    titles[i] = strdup(str);
+    prop_set(m, "title", PROP_SET_STRING, str);
+    prop_set(m, "artist", PROP_SET_STRING, "Ärlig Artist");
+  }
+
+  struct prop_nf *nf = prop_nf_create(dst, src, filter, 0);
+
+  for(i = 0; typed[i] != NULL; i++) {
+    int64_t ts = arch_get_ts();
+    prop_set_string(filter, typed[i]);
+    int64_t ts2 = arch_get_ts();
+    int n = test7_count(dst);
+    printf("Filter '%s': %d matches in %d us\n", typed[i], n, (int)(ts2 - ts));
+    if(n != test7_expect(titles, typed[i])) {
+      printf("Expected %d matches\n", test7_expect(titles, typed[i]));
+      exit(1);
+    }
+  }
+
+  // Changes must be picked up while filtering
+  prop_set_string(filter, "zebra");
+  prop_t *c = prop_first_child(src);
+  prop_setv(c, "metadata", "title", NULL, PROP_SET_STRING, "Zebra crossing");
+  if(test7_count(dst) != 1) {
+    printf("Changed node not found\n");
+    exit(1);
+  }
+  prop_setv(c, "metadata", "title", NULL, PROP_SET_STRING, "Horse");
+  if(test7_count(dst) != 0) {
+    printf("Changed node not removed\n");
+    exit(1);
+  }
+  prop_ref_dec(c);
+
+  prop_nf_release(nf);
+  prop_destroy(dst);
+  prop_destroy(src);
+  prop_destroy(filter);
+  for(i = 0; i < TEST7_ITEMS; i++)
+    free(titles[i]);
+  free(titles);
+}
+
+
+/**
+ * Grouping with prop_grouper, also a benchmark
+ */
+#define TEST8_NODES  100000
+#define TEST8_GROUPS 5000
+
+static void
+prop_test8(void)
+{
+  printf("Running test 8\n");
+  prop_t *src = prop_create_root(NULL);
+  prop_t *dst = prop_create_root(NULL);
+  prop_t **nodes = malloc(sizeof(prop_t *) * TEST8_NODES);
+  char str[64];
+  int i, n;
+
+  for(i = 0; i < TEST8_NODES; i++) {
+    nodes[i] = prop_create_r(src, NULL);
+    snprintf(str, sizeof(str), "Artist %d", i % TEST8_GROUPS);
+    prop_setv(nodes[i], "metadata", "artist", NULL, PROP_SET_STRING, str);
+  }
+
+  int64_t ts = arch_get_ts();
+  prop_grouper_t *pg = prop_grouper_create(dst, src, "node.metadata.artist",
+                                           0);
+  int64_t ts2 = arch_get_ts();
+
+  // Move a tenth of the nodes to the next group, group sizes stay equal
+  for(i = 0; i < TEST8_NODES; i++) {
+    if((i / TEST8_GROUPS) % 10)
+      continue;
+    snprintf(str, sizeof(str), "Artist %d", (i + 1) % TEST8_GROUPS);
+    prop_setv(nodes[i], "metadata", "artist", NULL, PROP_SET_STRING, str);
+  }
+  int64_t ts3 = arch_get_ts();
+
+  // Tag lookups with the grouper tag already present on each node
+  static int key1, key2;
+  for(i = 0; i < TEST8_NODES; i++) {
+    prop_tag_set(nodes[i], &key1, nodes[i]);
+    prop_tag_set(nodes[i], &key2, &key2);
+  }
+  int64_t ts4 = arch_get_ts();
+  for(n = 0; n < 10; n++) {
+    for(i = 0; i < TEST8_NODES; i++) {
+      if(prop_tag_get(nodes[i], &key1) != nodes[i] ||
+         prop_tag_get(nodes[i], &key2) != &key2) {
+        printf("Tag lookup failed\n");
+        exit(1);
+      }
+    }
+  }
+  int64_t ts5 = arch_get_ts();
+  for(i = 0; i < TEST8_NODES; i++) {
+    if(prop_tag_clear(nodes[i], &key1) != nodes[i] ||
+       prop_tag_clear(nodes[i], &key2) != &key2 ||
+       prop_tag_get(nodes[i], &key1) != NULL) {
+      printf("Tag clear failed\n");
+      exit(1);
+    }
+  }
+
+  prop_t *g;
+  int groups = 0, total = 0;
+  prop_lock_global();
+  TAILQ_FOREACH(g, &dst->hp_childs, hp_parent_link) {
+    prop_t *c, *ns = prop_create0(g, "nodes", NULL, 0);
+    n = 0;
+    TAILQ_FOREACH(c, &ns->hp_childs, hp_parent_link)
+      n++;
+    if(n != TEST8_NODES / TEST8_GROUPS) {
+      printf("Group %d has %d nodes\n", groups, n);
+      exit(1);
+    }
+    total += n;
+    groups++;
+  }
+  prop_unlock_global();
+
+  if(groups != TEST8_GROUPS || total != TEST8_NODES) {
+    printf("Expected %d groups got %d\n", TEST8_GROUPS, groups);
+    exit(1);
+  }
+
+  printf("%d nodes in %d groups: grouping %d ms, regrouping %d ms, "
+         "%d tag lookups %d ms\n",
+         TEST8_NODES, TEST8_GROUPS,
+         (int)((ts2 - ts) / 1000), (int)((ts3 - ts2) / 1000),
+         TEST8_NODES * 20, (int)((ts5 - ts4) / 1000));
+
+  prop_grouper_destroy(pg);
+  for(i = 0; i < TEST8_NODES; i++)
+    prop_ref_dec(nodes[i]);
+  free(nodes);
+  prop_destroy(dst);
+  prop_destroy(src);
+}
+
+
 /**
  *
  */
@@ -326,5 +866,11 @@ prop_test(void)
 {
   prop_test1();
   prop_test2();
+  prop_test3();
+  prop_test4();
+  prop_test5();
+  prop_test6();
+  prop_test7();
+  prop_test8();
 }
 #endif
@@ -205,13 +205,13 @@ prop_window_create(prop_t *dst, prop_t *src,
   pw->pw_win_length = length;
   TAILQ_INIT(&pw->pw_queue);
 
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   pw->pw_srcsub = prop_subscribe(PROP_SUB_INTERNAL | PROP_SUB_DONTLOCK,
 				 PROP_TAG_CALLBACK, src_cb, pw,
 				 PROP_TAG_ROOT, src,
 				 NULL);
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
   return pw;
 }
 
@@ -223,13 +223,13 @@ prop_window_create(prop_t *dst, prop_t *src,
 void
 prop_window_destroy(prop_window_t *pw)
 {
-  hts_mutex_lock(&prop_mutex);
+  prop_lock_global();
 
   pw_clear(pw);
   prop_unsubscribe0(pw->pw_srcsub);
   prop_destroy0(pw->pw_dst);
 
-  hts_mutex_unlock(&prop_mutex);
+  prop_unlock_global();
 
   free(pw);
 }
@@ -1474,6 +1474,12 @@ init_dev_settings(void)
   add_dev_bool(s, "Debug icecast streaming",
 	       "icecastdebug", &gconf.enable_icecast_debug);
 
+  add_dev_bool(s, "Profile GLW layout and rendering per widget class",
+	       "glwprofile", &gconf.enable_glw_profile);
+
+  add_dev_bool(s, "Parallel GLW layout",
+	       "glwparallellayout", &gconf.enable_glw_parallel_layout);
+
   add_dev_bool(s, "Debug image loading and decoding",
 	       "imagedebug", &gconf.enable_image_debug);
 
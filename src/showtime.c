@@ -457,6 +457,9 @@ parse_opts(int argc, char **argv)
 	     "                       Intended for plugin development\n"
 	     "   -j <path>           Load javascript file\n"
 	     "   --skin <skin>     Select skin (for GLW ui)\n"
+#if ENABLE_LIBAV
+	     "   --thumb-bench <dir> Benchmark video thumbnail extraction\n"
+#endif
 	     "\n"
 	     "  URL is any URL-type supported, "
 	     "e.g., \"file:///...\"\n"
@@ -554,6 +557,10 @@ parse_opts(int argc, char **argv)
       gconf.load_ecmascript = argv[1];
       argc -= 2; argv += 2;
       continue;
+    } else if(!strcmp(argv[0], "--thumb-bench") && argc > 1) {
+      gconf.thumb_bench = argv[1];
+      argc -= 2; argv += 2;
+      continue;
     } else if (!strcmp(argv[0], "-v") && argc > 1) {
       gconf.initial_view = argv[1];
       argc -= 2; argv += 2;
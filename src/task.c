@@ -19,12 +19,16 @@
  */
 #include "main.h"
 #include "arch/threads.h"
+#include "arch/atomic.h"
+#include "arch/arch.h"
 
 #include "task.h"
 #include "misc/queue.h"
+#include "misc/minmax.h"
 
 #define MAX_TASK_THREADS 16
-#define MAX_IDLE_TASK_THREADS 2
+#define MIN_TASK_THREADS 4
+#define TASK_THREADS_PER_CPU 4 // Tasks often block on I/O
 
 TAILQ_HEAD(task_queue, task);
 
@@ -32,13 +36,133 @@ typedef struct task {
   TAILQ_ENTRY(task) t_link;
   task_fn_t *t_fn;
   void *t_opaque;
+  int64_t t_enqueued;
+  uint8_t t_pinned;
 } task_t;
 
-static struct task_queue tasks = TAILQ_HEAD_INITIALIZER(tasks);
-static unsigned int num_task_threads;
-static unsigned int num_task_threads_avail;
+
+/**
+ * Stats are per worker and protected by tw_mutex. Depth is for the
+ * worker's own queue, run count and latency is for tasks executed
+ * by the worker (including stolen ones)
+ */
+typedef struct task_stats {
+  int ts_depth;
+  int ts_max_depth;
+  int ts_run;
+  int64_t ts_latency_sum;
+  int64_t ts_latency_max;
+} task_stats_t;
+
+
+/**
+ * A worker only ever runs tasks of its own group's priority
+ */
+typedef struct task_worker {
+  hts_mutex_t tw_mutex;
+  struct task_queue tw_queue;
+  task_stats_t tw_stats;
+  int tw_steals;
+  int tw_id;
+  int tw_prio;
+} task_worker_t;
+
+
+/**
+ * Workers are split in one group per priority. Interactive tasks run
+ * on their own workers at THREAD_PRIO_MODEL so they never wait for
+ * background work, which runs at THREAD_PRIO_BGTASK. Workers only
+ * steal within their own group
+ */
+typedef struct task_group {
+  int tg_first;   // Index of first worker in task_workers[]
+  int tg_num;
+  atomic_t tg_rr;
+  hts_cond_t tg_cond;
+  int tg_idle;
+} task_group_t;
+
+static task_worker_t task_workers[MAX_TASK_THREADS];
+static task_group_t task_groups[TASK_PRIO_num];
+static atomic_t task_num_workers;
+
+/**
+ * task_mutex / tg_cond is only used for putting idle workers to
+ * sleep. task_seq is bumped (with task_mutex held) on every enqueue
+ * so a worker can detect that something was added while it was
+ * scanning the queues
+ */
 static hts_mutex_t task_mutex;
-static hts_cond_t task_cond;
+static atomic_t task_seq;
+
+static __thread task_worker_t *task_current_worker;
+
+
+/**
+ *
+ */
+static task_t *
+task_take(task_worker_t *tw, int stealing)
+{
+  task_t *t;
+
+  hts_mutex_lock(&tw->tw_mutex);
+  TAILQ_FOREACH(t, &tw->tw_queue, t_link)
+    if(!stealing || !t->t_pinned)
+      break;
+
+  if(t != NULL) {
+    TAILQ_REMOVE(&tw->tw_queue, t, t_link);
+    tw->tw_stats.ts_depth--;
+  }
+  hts_mutex_unlock(&tw->tw_mutex);
+  return t;
+}
+
+
+/**
+ * Look in our own queue first, then try to steal from the other
+ * workers in our group
+ */
+static task_t *
+task_find(task_worker_t *self)
+{
+  const task_group_t *tg = &task_groups[self->tw_prio];
+  task_t *t;
+
+  if((t = task_take(self, 0)) != NULL)
+    return t;
+
+  for(int i = 1; i < tg->tg_num; i++) {
+    const int idx = (self->tw_id - tg->tg_first + i) % tg->tg_num;
+    task_worker_t *tw = &task_workers[tg->tg_first + idx];
+    if((t = task_take(tw, 1)) != NULL) {
+      hts_mutex_lock(&self->tw_mutex);
+      self->tw_steals++;
+      hts_mutex_unlock(&self->tw_mutex);
+      return t;
+    }
+  }
+  return NULL;
+}
+
+
+/**
+ *
+ */
+static void
+task_wakeup(task_group_t *tg, int all)
+{
+  hts_mutex_lock(&task_mutex);
+  atomic_inc(&task_seq);
+  if(tg->tg_idle) {
+    if(all)
+      hts_cond_broadcast(&tg->tg_cond);
+    else
+      hts_cond_signal(&tg->tg_cond);
+  }
+  hts_mutex_unlock(&task_mutex);
+}
 
 
 /**
@@ -47,43 +171,99 @@ static hts_cond_t task_cond;
 static void *
 task_thread(void *aux)
 {
+  task_worker_t *tw = aux;
+  task_group_t *tg = &task_groups[tw->tw_prio];
   task_t *t;
 
-  hts_mutex_lock(&task_mutex);
-  while(1) {
-    t = TAILQ_FIRST(&tasks);
-    if(t == NULL) {
+  task_current_worker = tw;
 
-      if(num_task_threads_avail == MAX_IDLE_TASK_THREADS)
-        break;
+  while(1) {
+    const int seq = atomic_get(&task_seq);
 
-      num_task_threads_avail++;
-      hts_cond_wait(&task_cond, &task_mutex);
-      num_task_threads_avail--;
+    if((t = task_find(tw)) == NULL) {
+      hts_mutex_lock(&task_mutex);
+      if(seq == atomic_get(&task_seq)) {
+        tg->tg_idle++;
+        hts_cond_wait(&tg->tg_cond, &task_mutex);
+        tg->tg_idle--;
+      }
+      hts_mutex_unlock(&task_mutex);
       continue;
     }
-    TAILQ_REMOVE(&tasks, t, t_link);
 
-    hts_mutex_unlock(&task_mutex);
+    const int64_t latency = arch_get_ts() - t->t_enqueued;
+
+    hts_mutex_lock(&tw->tw_mutex);
+    task_stats_t *ts = &tw->tw_stats;
+    ts->ts_run++;
+    ts->ts_latency_sum += latency;
+    ts->ts_latency_max = MAX(ts->ts_latency_max, latency);
+    hts_mutex_unlock(&tw->tw_mutex);
+
     t->t_fn(t->t_opaque);
     free(t);
-    hts_mutex_lock(&task_mutex);
   }
-
-  num_task_threads--;
-  hts_mutex_unlock(&task_mutex);
   return NULL;
 }
 
 
+#ifdef TASK_STATS
+#include "misc/callout.h"
+
+static callout_t task_stats_callout;
+
+static void
+task_report_stats(callout_t *c, void *aux)
+{
+  task_print_stats();
+  callout_arm(&task_stats_callout, task_report_stats, NULL, 10);
+}
+#endif
+
+
 /**
  *
  */
 static void
-task_launch_thread(void)
+task_start_workers(void)
 {
-  num_task_threads++;
-  hts_thread_create_detached("tasks", task_thread, NULL, THREAD_PRIO_BGTASK);
+  hts_mutex_lock(&task_mutex);
+  if(atomic_get(&task_num_workers) == 0) {
+    int n = MAX(gconf.concurrency, 1) * TASK_THREADS_PER_CPU;
+    n = MAX(MIN(n, MAX_TASK_THREADS), MIN_TASK_THREADS);
+
+    const int fg = MAX(n / 4, 2);
+
+    task_groups[TASK_PRIO_INTERACTIVE].tg_first = 0;
+    task_groups[TASK_PRIO_INTERACTIVE].tg_num = fg;
+    task_groups[TASK_PRIO_BACKGROUND].tg_first = fg;
+    task_groups[TASK_PRIO_BACKGROUND].tg_num = n - fg;
+
+    for(int i = 0; i < n; i++) {
+      task_worker_t *tw = &task_workers[i];
+      hts_mutex_init(&tw->tw_mutex);
+      TAILQ_INIT(&tw->tw_queue);
+      tw->tw_id = i;
+      tw->tw_prio = i < fg ? TASK_PRIO_INTERACTIVE : TASK_PRIO_BACKGROUND;
+    }
+
+    /*
+     * Workers and task_run_ex() look at task_num_workers so set it
+     * before starting them. task_run_ex() does not take task_mutex
+     * once it's set so make sure the setup above is visible first
+     */
+    atomic_barrier();
+    atomic_set(&task_num_workers, n);
+
+    for(int i = 0; i < n; i++)
+      hts_thread_create_detached("tasks", task_thread, &task_workers[i],
+                                 i < fg ? THREAD_PRIO_MODEL :
+                                 THREAD_PRIO_BGTASK);
+#ifdef TASK_STATS
+    callout_arm(&task_stats_callout, task_report_stats, NULL, 10);
+#endif
+  }
+  hts_mutex_unlock(&task_mutex);
 }
 
 
@@ -91,30 +271,82 @@ task_launch_thread(void)
  *
  */
 void
-task_run(task_fn_t *fn, void *opaque)
+task_run_ex(task_fn_t *fn, void *opaque, task_prio_t prio, int affinity)
 {
-  task_t *t = calloc(1, sizeof(task_t));
+  task_worker_t *tw;
+
+  if(atomic_get(&task_num_workers) == 0)
+    task_start_workers();
+  else
+    atomic_barrier(); // Pairs with the barrier in task_start_workers()
+
+  task_group_t *tg = &task_groups[prio];
+
+  task_t *t = malloc(sizeof(task_t));
   t->t_fn = fn;
   t->t_opaque = opaque;
-  hts_mutex_lock(&task_mutex);
-  TAILQ_INSERT_TAIL(&tasks, t, t_link);
+  t->t_pinned = affinity != TASK_ANY_WORKER;
+  t->t_enqueued = arch_get_ts();
 
-  if(num_task_threads_avail > 0) {
-    hts_cond_signal(&task_cond);
-  } else {
-    if(num_task_threads < MAX_TASK_THREADS) {
-      task_launch_thread();
-    }
+  if(t->t_pinned)
+    tw = &task_workers[tg->tg_first + affinity % tg->tg_num];
+  else if(task_current_worker != NULL && task_current_worker->tw_prio == prio)
+    tw = task_current_worker;
+  else
+    tw = &task_workers[tg->tg_first +
+                       atomic_add_and_fetch(&tg->tg_rr, 1) % tg->tg_num];
+
+  hts_mutex_lock(&tw->tw_mutex);
+  TAILQ_INSERT_TAIL(&tw->tw_queue, t, t_link);
+  task_stats_t *ts = &tw->tw_stats;
+  ts->ts_depth++;
+  ts->ts_max_depth = MAX(ts->ts_max_depth, ts->ts_depth);
+  hts_mutex_unlock(&tw->tw_mutex);
+
+  // Pinned tasks must wake up a specific worker, so wake them all
+  task_wakeup(tg, affinity != TASK_ANY_WORKER);
+}
+
+
+/**
+ *
+ */
+void
+task_print_stats(void)
+{
+  static const char *prionames[TASK_PRIO_num] = {
+    "interactive", "background"
+  };
+  const int num_workers = atomic_get(&task_num_workers);
+
+  for(int i = 0; i < num_workers; i++) {
+    task_worker_t *tw = &task_workers[i];
+    const task_stats_t *ts = &tw->tw_stats;
+    hts_mutex_lock(&tw->tw_mutex);
+    if(ts->ts_run || ts->ts_depth)
+      TRACE(TRACE_DEBUG, "task",
+            "Worker %2d %-11s: %d run, depth %d (max %d), "
+            "latency avg %dus max %dus",
+            i, prionames[tw->tw_prio], ts->ts_run, ts->ts_depth,
+            ts->ts_max_depth,
+            ts->ts_run ? (int)(ts->ts_latency_sum / ts->ts_run) : 0,
+            (int)ts->ts_latency_max);
+    if(tw->tw_steals)
+      TRACE(TRACE_DEBUG, "task", "Worker %2d stole %d tasks",
+            i, tw->tw_steals);
+    hts_mutex_unlock(&tw->tw_mutex);
   }
-  hts_mutex_unlock(&task_mutex);
 }
 
 
+
+
 /**
  *
  */
 INITIALIZER(taskinit)
 {
   hts_mutex_init(&task_mutex);
-  hts_cond_init(&task_cond, &task_mutex);
+  for(int i = 0; i < TASK_PRIO_num; i++)
+    hts_cond_init(&task_groups[i].tg_cond, &task_mutex);
 }
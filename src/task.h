@@ -20,5 +20,23 @@
 #pragma once
 typedef void (task_fn_t)(void *opaque);
 
-void task_run(task_fn_t *fn, void *opaque);
+typedef enum {
+  TASK_PRIO_INTERACTIVE,  // Triggered by the user
+  TASK_PRIO_BACKGROUND,   // Everything else
+  TASK_PRIO_num,
+} task_prio_t;
 
+#define TASK_ANY_WORKER -1
+
+/**
+ * Run fn on the task pool. If affinity is not TASK_ANY_WORKER the
+ * task is pinned to that worker (modulo number of workers for prio)
+ * and will never be stolen by any other worker. Tasks pinned to the
+ * same worker execute in the order they were submitted.
+ */
+void task_run_ex(task_fn_t *fn, void *opaque, task_prio_t prio, int affinity);
+
+#define task_run(fn, opaque) \
+  task_run_ex(fn, opaque, TASK_PRIO_BACKGROUND, TASK_ANY_WORKER)
+
+void task_print_stats(void);
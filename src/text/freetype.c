@@ -118,11 +118,21 @@ typedef struct glyph {
 
   FT_BBox bbox;
 
+  pixmap_t *pm;    // Coverage of bmp for glyph runs, created on demand
+  uint32_t id;
+
 } glyph_t;
 
 static struct glyph_list glyph_hash[GLYPH_HASH_SIZE];
 static struct glyph_queue allglyphs;
 static int num_glyphs;
+static uint32_t glyph_id_tally;
+
+/**
+ * Glyph runs are drawn from a texture atlas so we don't emit them for
+ * very large text, it would just churn the atlas
+ */
+#define GLYPH_RUN_MAX_SIZE 96
 
 /**
  *
@@ -173,6 +183,8 @@ glyph_destroy(glyph_t *g)
     FT_Done_Glyph(g->bmp);
   if(g->outline)
     FT_Done_Glyph(g->outline);
+  if(g->pm != NULL)
+    pixmap_release(g->pm);
   free(g);
   num_glyphs--;
 }
@@ -616,6 +628,7 @@ glyph_get(int uc, int size, uint8_t style, const char *font,
     g->size = size;
 
     g->adv_x = gs->advance.x;
+    g->id = ++glyph_id_tally;
     LIST_INSERT_HEAD(&glyph_hash[hash], g, hash_link);
     num_glyphs++;
   } else {
@@ -655,6 +668,36 @@ draw_glyph(pixmap_t *pm, int left, int top, FT_Bitmap *bmp, int color)
 }
 
 
+/**
+ * Append a glyph to a glyph run. The coverage is copied to a pixmap
+ * once per cached glyph and shared by all runs referring to it
+ */
+static void
+emit_glyph(image_component_glyphs_t *icg, glyph_t *g, int left, int top,
+           FT_Bitmap *bmp, uint32_t color)
+{
+  if(bmp->width == 0 || bmp->rows == 0)
+    return;
+
+  if(g->pm == NULL) {
+    const int pitch = bmp->pitch < 0 ? -bmp->pitch : bmp->pitch;
+    g->pm = pixmap_create(bmp->width, bmp->rows, PIXMAP_I, 0);
+    if(g->pm == NULL)
+      return;
+    for(int y = 0; y < bmp->rows; y++)
+      memcpy(g->pm->pm_data + y * g->pm->pm_linesize,
+             bmp->buffer + y * pitch, bmp->width);
+  }
+
+  image_glyph_t *ig = &icg->icg_glyphs[icg->icg_count++];
+  ig->ig_pm = pixmap_dup(g->pm);
+  ig->ig_id = g->id;
+  ig->ig_color = color;
+  ig->ig_x = left;
+  ig->ig_y = top;
+}
+
+
 /**
  *
  */
@@ -715,7 +758,7 @@ static void
 draw_glyphs(pixmap_t *pm, struct line_queue *lq, int target_height,
 	    int siz_x, item_t *items, int start_x, int start_y,
 	    int origin_y, int margin, int pass,
-            image_component_text_info_t *ti)
+            image_component_text_info_t *ti, image_component_glyphs_t *icg)
 {
   FT_Vector pen;
   line_t *li;
@@ -864,11 +907,18 @@ draw_glyphs(pixmap_t *pm, struct line_queue *lq, int target_height,
 
       if(pass == 2 && g->bmp != NULL) {
 	FT_BitmapGlyph bmp = (FT_BitmapGlyph)g->bmp;
-	draw_glyph(pm,
-		   bmp->left + margin + pen.x,
-		   target_height - bmp->top + margin - pen.y,
-		   &bmp->bitmap,
-		   items[i].color);
+        if(icg != NULL)
+          emit_glyph(icg, g,
+                     bmp->left + margin + pen.x,
+                     target_height - bmp->top + margin - pen.y,
+                     &bmp->bitmap,
+                     items[i].color);
+        else
+          draw_glyph(pm,
+                     bmp->left + margin + pen.x,
+                     target_height - bmp->top + margin - pen.y,
+                     &bmp->bitmap,
+                     items[i].color);
 
 	if(ti != NULL && ti->ti_charpos != NULL) {
 	  ti->ti_charpos[i * 2 + 0] = bmp->left + pen.x;
@@ -930,6 +980,7 @@ text_render0(const uint32_t *uc, const int len,
 
   int need_shadow_pass = 0;
   int need_outline_pass = 0;
+  int glyph_run = !!(flags & TR_RENDER_GLYPHS) && !(flags & TR_RENDER_DEBUG);
 
   const char *current_font = default_font;
   int current_domain = default_domain;
@@ -1011,6 +1062,7 @@ text_render0(const uint32_t *uc, const int len,
       li->color = current_color | current_alpha;
       TAILQ_INSERT_TAIL(&lq, li, link);
       li = NULL;
+      glyph_run = 0;
       continue;
 
     case TR_CODE_CENTER_ON:
@@ -1139,6 +1191,9 @@ text_render0(const uint32_t *uc, const int len,
     } else {
       items[out].kerning = 0;
     }
+    if(current_size > GLYPH_RUN_MAX_SIZE)
+      glyph_run = 0;
+
     items[out].adv_x = g->adv_x;
     items[out].g = g;
     items[out].code = uc[i];
@@ -1367,6 +1422,9 @@ text_render0(const uint32_t *uc, const int len,
 
   margin = (margin + 63) / 64;
 
+  if(need_shadow_pass || need_outline_pass)
+    glyph_run = 0;
+
   // --- allocate and init image
 
   image_t *img = image_alloc(flags & TR_RENDER_NO_OUTPUT ? 1 : 2);
@@ -1377,7 +1435,15 @@ text_render0(const uint32_t *uc, const int len,
 
   pixmap_t *pm = NULL;
 
-  if(!(flags & TR_RENDER_NO_OUTPUT)) {
+  image_component_glyphs_t *icg = NULL;
+
+  if(flags & TR_RENDER_NO_OUTPUT) {
+    // Only dimensions requested
+  } else if(glyph_run) {
+    img->im_components[1].type = IMAGE_GLYPHS;
+    icg = &img->im_components[1].glyphs;
+    icg->icg_glyphs = malloc(sizeof(image_glyph_t) * out);
+  } else {
     pm = pixmap_create(target_width, target_height,
                        color_output ? PIXMAP_BGR32 : PIXMAP_IA, margin);
 
@@ -1412,17 +1478,20 @@ text_render0(const uint32_t *uc, const int len,
 
     if(need_shadow_pass) {
       draw_glyphs(pm, &lq, target_height, siz_x, items, start_x, start_y,
-                  origin_y, margin, 0, NULL);
+                  origin_y, margin, 0, NULL, NULL);
       pixmap_box_blur(pm, 4, 4);
     }
 
     if(need_outline_pass)
       draw_glyphs(pm, &lq, target_height, siz_x, items, start_x, start_y,
-                  origin_y, margin, 1, NULL);
+                  origin_y, margin, 1, NULL, NULL);
 
 
     draw_glyphs(pm, &lq, target_height, siz_x, items, start_x, start_y,
-                origin_y, margin, 2, ti);
+                origin_y, margin, 2, ti, NULL);
+  } else if(icg != NULL) {
+    draw_glyphs(NULL, &lq, target_height, siz_x, items, start_x, start_y,
+                origin_y, margin, 2, ti, icg);
   }
   free(items);
 
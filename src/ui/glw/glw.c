@@ -26,16 +26,19 @@
 #include "keymapper.h"
 
 #include "arch/threads.h"
+#include "arch/atomic.h"
 #include "text/text.h"
 
 #include "glw.h"
 #include "glw_settings.h"
 #include "glw_text_bitmap.h"
+#include "glw_glyph_atlas.h"
 #include "glw_texture.h"
 #include "glw_view.h"
 #include "glw_event.h"
 #include "glw_style.h"
 #include "glw_navigation.h"
+#include "task.h"
 
 static void glw_focus_init_widget(glw_t *w, float weight);
 static void glw_focus_leave(glw_t *w);
@@ -195,6 +198,12 @@ glw_init3(glw_root_t *gr,
   gr->gr_prop_width         = prop_create(gr->gr_prop_ui, "width");
   gr->gr_prop_height        = prop_create(gr->gr_prop_ui, "height");
 
+  prop_t *r = prop_create(gr->gr_prop_ui, "renderer");
+  gr->gr_prop_render_jobs       = prop_create(r, "jobs");
+  gr->gr_prop_render_draw_calls = prop_create(r, "drawCalls");
+  gr->gr_prop_render_vertices   = prop_create(r, "vertices");
+  gr->gr_prop_render_sort_time  = prop_create(r, "sortTime");
+
   prop_set_int(gr->gr_screensaver_active, 0);
 
   gr->gr_evsub =
@@ -283,6 +292,7 @@ glw_fini(glw_root_t *gr)
   free(gr->gr_render_jobs);
   free(gr->gr_render_order);
   free(gr->gr_vertex_buffer);
+  free(gr->gr_class_profile);
   free(gr->gr_skin);
 }
 
@@ -339,11 +349,370 @@ update_in_path(glw_t *w)
 }
 
 
+/**
+ * Per widget class profiling
+ *
+ * Times are self times, ie. time spent in children is subtracted
+ */
+#define GLW_PROFILE_LAYOUT 0
+#define GLW_PROFILE_RENDER 1
+
+typedef struct glw_class_profile {
+  int64_t gcp_time[2];  // usec
+  int gcp_count[2];
+} glw_class_profile_t;
+
+static LIST_HEAD(, glw_class) glw_classes;
+static int glw_num_classes;
+
+static void glw_layout1(glw_t *w, const glw_rctx_t *rc);
+
+
+/**
+ *
+ */
+static void
+glw_profile_call(glw_t *w, const glw_rctx_t *rc, int what)
+{
+  glw_root_t *gr = w->glw_root;
+
+  if(gr->gr_class_profile == NULL)
+    gr->gr_class_profile = calloc(glw_num_classes,
+                                  sizeof(glw_class_profile_t));
+
+  glw_class_profile_t *gcp = &gr->gr_class_profile[w->glw_class->gc_index];
+  const int64_t outer = gr->gr_profile_child_time;
+  gr->gr_profile_child_time = 0;
+
+  int64_t ts = arch_get_ts();
+
+  if(what == GLW_PROFILE_LAYOUT)
+    glw_layout1(w, rc);
+  else
+    w->glw_class->gc_render(w, rc);
+
+  ts = arch_get_ts() - ts;
+
+  gcp->gcp_time[what] += ts - gr->gr_profile_child_time;
+  gcp->gcp_count[what]++;
+  gr->gr_profile_child_time = outer + ts;
+}
+
+
+/**
+ *
+ */
+void
+glw_render_profiled(glw_t *w, const glw_rctx_t *rc)
+{
+  glw_profile_call(w, rc, GLW_PROFILE_RENDER);
+}
+
+
+/**
+ *
+ */
+static int
+profile_cmp(const void *A, const void *B)
+{
+  const glw_class_profile_t *a = *(const glw_class_profile_t **)A;
+  const glw_class_profile_t *b = *(const glw_class_profile_t **)B;
+  int64_t ta = a->gcp_time[0] + a->gcp_time[1];
+  int64_t tb = b->gcp_time[0] + b->gcp_time[1];
+  return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
+
+
+/**
+ * Log the most expensive classes and reset counters
+ */
+static void
+glw_profile_report(glw_root_t *gr)
+{
+  glw_class_profile_t *v[glw_num_classes];
+  const glw_class_t *classes[glw_num_classes];
+  const glw_class_t *gc;
+  const int frames = gr->gr_profile_frames;
+  int i;
+
+  if(gr->gr_class_profile == NULL || frames == 0)
+    return;
+
+  LIST_FOREACH(gc, &glw_classes, gc_link)
+    classes[gc->gc_index] = gc;
+
+  for(i = 0; i < glw_num_classes; i++)
+    v[i] = &gr->gr_class_profile[i];
+
+  qsort(v, glw_num_classes, sizeof(v[0]), profile_cmp);
+
+  TRACE(TRACE_DEBUG, "GLW",
+        "Per class self time over %d frames (usec/frame, calls/frame)",
+        frames);
+
+  for(i = 0; i < glw_num_classes && i < 12; i++) {
+    const glw_class_profile_t *gcp = v[i];
+    if(gcp->gcp_count[0] == 0 && gcp->gcp_count[1] == 0)
+      break;
+    TRACE(TRACE_DEBUG, "GLW",
+          "  %-20s layout: %7.1f (%5d)  render: %7.1f (%5d)",
+          classes[gcp - gr->gr_class_profile]->gc_name,
+          (float)gcp->gcp_time[0] / frames, gcp->gcp_count[0] / frames,
+          (float)gcp->gcp_time[1] / frames, gcp->gcp_count[1] / frames);
+  }
+
+  memset(gr->gr_class_profile, 0,
+         sizeof(glw_class_profile_t) * glw_num_classes);
+  gr->gr_profile_frames = 0;
+}
+
+
+/**
+ * Parallel layout
+ *
+ * When a GLW_PARALLEL_LAYOUT widget is laid out on the GLW thread its
+ * children are collected in a batch instead of being laid out
+ * directly. Each child is a job and the jobs are run on the task pool
+ * with the GLW thread helping out. The GLW lock is held by the GLW
+ * thread all along, it just waits for the helpers before moving on.
+ *
+ * Inside a job only GLW_PARALLEL_LAYOUT widgets are laid out. Anything
+ * else (or a widget that needs to fire signals or evaluate view
+ * expressions) is deferred with its whole subtree. Each job records
+ * what it did in order and once all jobs are done the records are
+ * replayed on the GLW thread, job by job: active list relinks and
+ * deferred layouts. So the end result is the same as a serial layout,
+ * no matter how the jobs were scheduled.
+ */
+#define GLW_LAYOUT_PARALLEL_MIN 4  // Fewer children than this is not worth it
+#define GLW_LAYOUT_HELPERS      3
+
+typedef struct glw_layout_op {
+  glw_t *glo_widget;
+  glw_rctx_t glo_rc;      // Only for deferred
+  int glo_deferred;
+} glw_layout_op_t;
+
+
+typedef struct glw_layout_job {
+  glw_t *glj_widget;
+  glw_rctx_t glj_rc;
+  glw_layout_op_t *glj_ops;
+  int glj_num_ops;
+  int glj_ops_capacity;
+} glw_layout_job_t;
+
+
+typedef struct glw_layout_batch {
+  atomic_t glb_refcount;
+  atomic_t glb_next;
+  glw_layout_job_t *glb_jobs;
+  int glb_num_jobs;
+  int glb_jobs_capacity;
+
+  hts_mutex_t glb_mutex;
+  hts_cond_t glb_cond;
+  int glb_done;
+} glw_layout_batch_t;
+
+static __thread glw_layout_job_t *glw_layout_current_job;
+
+
+/**
+ *
+ */
+static void
+glw_layout_batch_release(glw_layout_batch_t *glb)
+{
+  if(atomic_dec(&glb->glb_refcount))
+    return;
+
+  for(int i = 0; i < glb->glb_num_jobs; i++)
+    free(glb->glb_jobs[i].glj_ops);
+  free(glb->glb_jobs);
+  hts_cond_destroy(&glb->glb_cond);
+  hts_mutex_destroy(&glb->glb_mutex);
+  free(glb);
+}
+
+
+/**
+ * Collect a child of gr_layout_parent
+ */
+static void
+glw_layout_batch_add(glw_root_t *gr, glw_t *w, const glw_rctx_t *rc)
+{
+  glw_layout_batch_t *glb = gr->gr_layout_batch;
+
+  if(glb == NULL) {
+    glb = gr->gr_layout_batch = calloc(1, sizeof(glw_layout_batch_t));
+    atomic_set(&glb->glb_refcount, 1);
+    hts_mutex_init(&glb->glb_mutex);
+    hts_cond_init(&glb->glb_cond, &glb->glb_mutex);
+  }
+
+  if(glb->glb_num_jobs == glb->glb_jobs_capacity) {
+    glb->glb_jobs_capacity = MAX(8, glb->glb_jobs_capacity * 2);
+    glb->glb_jobs = realloc(glb->glb_jobs, glb->glb_jobs_capacity *
+                            sizeof(glw_layout_job_t));
+  }
+
+  glw_layout_job_t *glj = &glb->glb_jobs[glb->glb_num_jobs++];
+  glj->glj_widget = w;
+  glj->glj_rc = *rc;
+  glj->glj_ops = NULL;
+  glj->glj_num_ops = 0;
+  glj->glj_ops_capacity = 0;
+}
+
+
+/**
+ * Layout inside a job
+ */
+static void
+glw_layout_job_widget(glw_layout_job_t *glj, glw_t *w, const glw_rctx_t *rc)
+{
+  const int deferred =
+    !(w->glw_class->gc_flags & GLW_PARALLEL_LAYOUT) ||
+    !(w->glw_flags & GLW_ACTIVE) ||
+    w->glw_dynamic_eval & GLW_VIEW_EVAL_LAYOUT;
+
+  if(glj->glj_num_ops == glj->glj_ops_capacity) {
+    glj->glj_ops_capacity = MAX(16, glj->glj_ops_capacity * 2);
+    glj->glj_ops = realloc(glj->glj_ops, glj->glj_ops_capacity *
+                           sizeof(glw_layout_op_t));
+  }
+
+  glw_layout_op_t *glo = &glj->glj_ops[glj->glj_num_ops++];
+  glo->glo_widget = w;
+  glo->glo_deferred = deferred;
+
+  if(deferred) {
+    glo->glo_rc = *rc;
+    return;
+  }
+
+  w->glw_class->gc_layout(w, rc);
+}
+
+
+/**
+ * Run jobs until there are no more to claim
+ */
+static void
+glw_layout_batch_work(glw_layout_batch_t *glb)
+{
+  int i, done = 0;
+
+  while((i = atomic_add_and_fetch(&glb->glb_next, 1) - 1) <
+        glb->glb_num_jobs) {
+    glw_layout_job_t *glj = &glb->glb_jobs[i];
+    glw_layout_current_job = glj;
+    glw_layout_job_widget(glj, glj->glj_widget, &glj->glj_rc);
+    glw_layout_current_job = NULL;
+    done++;
+  }
+
+  if(done == 0)
+    return;
+
+  hts_mutex_lock(&glb->glb_mutex);
+  glb->glb_done += done;
+  if(glb->glb_done == glb->glb_num_jobs)
+    hts_cond_signal(&glb->glb_cond);
+  hts_mutex_unlock(&glb->glb_mutex);
+}
+
+
+/**
+ * Helpers that start after all jobs are claimed just drop their
+ * reference, so the GLW thread never waits for a helper to get going
+ */
+static void
+glw_layout_helper(void *aux)
+{
+  glw_layout_batch_t *glb = aux;
+  glw_layout_batch_work(glb);
+  glw_layout_batch_release(glb);
+}
+
+
+/**
+ *
+ */
+static void
+glw_layout_batch_run(glw_root_t *gr, glw_layout_batch_t *glb)
+{
+  if(glb->glb_num_jobs < GLW_LAYOUT_PARALLEL_MIN) {
+    for(int i = 0; i < glb->glb_num_jobs; i++)
+      glw_layout1(glb->glb_jobs[i].glj_widget, &glb->glb_jobs[i].glj_rc);
+    glw_layout_batch_release(glb);
+    return;
+  }
+
+  const int helpers = MIN(glb->glb_num_jobs - 1, GLW_LAYOUT_HELPERS);
+  for(int i = 0; i < helpers; i++) {
+    atomic_inc(&glb->glb_refcount);
+    task_run_ex(glw_layout_helper, glb, TASK_PRIO_INTERACTIVE,
+                TASK_ANY_WORKER);
+  }
+
+  glw_layout_batch_work(glb);
+
+  hts_mutex_lock(&glb->glb_mutex);
+  while(glb->glb_done < glb->glb_num_jobs)
+    hts_cond_wait(&glb->glb_cond, &glb->glb_mutex);
+  hts_mutex_unlock(&glb->glb_mutex);
+
+  // Merge in job order
+
+  for(int i = 0; i < glb->glb_num_jobs; i++) {
+    const glw_layout_job_t *glj = &glb->glb_jobs[i];
+
+    for(int j = 0; j < glj->glj_num_ops; j++) {
+      const glw_layout_op_t *glo = &glj->glj_ops[j];
+      glw_t *w = glo->glo_widget;
+
+      if(w->glw_flags & GLW_DESTROYING)
+        continue; // By a deferred layout earlier in the merge
+
+      if(glo->glo_deferred) {
+        glw_layout1(w, &glo->glo_rc);
+      } else {
+        LIST_REMOVE(w, glw_active_link);
+        LIST_INSERT_HEAD(&gr->gr_active_list, w, glw_active_link);
+      }
+    }
+  }
+  glw_layout_batch_release(glb);
+}
+
+
 /**
  *
  */
 void
 glw_layout0(glw_t *w, const glw_rctx_t *rc)
+{
+  glw_root_t *gr = w->glw_root;
+
+  if(unlikely(glw_layout_current_job != NULL))
+    glw_layout_job_widget(glw_layout_current_job, w, rc);
+  else if(unlikely(gr->gr_layout_parent != NULL &&
+                   gr->gr_layout_parent == w->glw_parent))
+    glw_layout_batch_add(gr, w, rc);
+  else if(unlikely(gconf.enable_glw_profile))
+    glw_profile_call(w, rc, GLW_PROFILE_LAYOUT);
+  else
+    glw_layout1(w, rc);
+}
+
+
+/**
+ *
+ */
+static void
+glw_layout1(glw_t *w, const glw_rctx_t *rc)
 {
   glw_root_t *gr = w->glw_root;
   LIST_REMOVE(w, glw_active_link);
@@ -359,6 +728,20 @@ glw_layout0(glw_t *w, const glw_rctx_t *rc)
   if(unlikely(w->glw_dynamic_eval & mask))
     glw_view_eval_layout(w, rc, mask);
 
+  if(unlikely(gconf.enable_glw_parallel_layout) && gconf.concurrency > 1 &&
+     w->glw_class->gc_flags & GLW_PARALLEL_LAYOUT &&
+     gr->gr_layout_parent == NULL && !gconf.enable_glw_profile) {
+    gr->gr_layout_parent = w;
+    w->glw_class->gc_layout(w, rc);
+    gr->gr_layout_parent = NULL;
+
+    glw_layout_batch_t *glb = gr->gr_layout_batch;
+    gr->gr_layout_batch = NULL;
+    if(glb != NULL)
+      glw_layout_batch_run(gr, glb);
+    return;
+  }
+
   w->glw_class->gc_layout(w, rc);
 }
 
@@ -535,6 +918,12 @@ glw_prepare_frame(glw_root_t *gr, int flags)
   }
   gr->gr_frames++;
 
+  if(unlikely(gconf.enable_glw_profile)) {
+    gr->gr_profile_frames++;
+    if((gr->gr_frames & 0xff) == 0)
+      glw_profile_report(gr);
+  }
+
   gr->gr_num_render_jobs = 0;
   gr->gr_vertex_offset = 0;
 
@@ -894,6 +1283,7 @@ glw_flush(glw_root_t *gr)
 {
   glw_gf_do();
   glw_tex_flush_all(gr);
+  glw_glyph_atlas_flush(gr);
   glw_text_flush(gr);
 }
 
@@ -2320,7 +2710,6 @@ glw_copy_constraints(glw_t *w, glw_t *src)
 }
 
 
-static LIST_HEAD(, glw_class) glw_classes;
 
 /**
  *
@@ -2343,6 +2732,7 @@ void
 glw_register_class(glw_class_t *gc)
 {
   assert(gc->gc_layout != NULL);
+  gc->gc_index = glw_num_classes++;
   LIST_INSERT_HEAD(&glw_classes, gc, gc_link);
 }
 
@@ -387,6 +387,14 @@ typedef struct glw_class {
 #define GLW_NAVIGATION_SEARCH_BOUNDARY 0x1
 #define GLW_CAN_HIDE_CHILDS            0x2
 #define GLW_UNCONSTRAINED              0x4
+/**
+ * gc_layout() only touches the widget itself, parent data of its
+ * children and calls glw_layout0() for its children. No GL, props,
+ * signals, glw_lp() or glw_need_refresh(), and children can be laid
+ * out in any order. Such widgets may be laid out on the task pool and
+ * their children are spread over it (gconf.enable_glw_parallel_layout)
+ */
+#define GLW_PARALLEL_LAYOUT            0x8
 
   /**
    * Constructor
@@ -694,6 +702,8 @@ typedef struct glw_class {
    */
   LIST_ENTRY(glw_class) gc_link;
 
+  int gc_index; // Assigned at registration, used for profiling
+
 } glw_class_t;
 
 void glw_register_class(glw_class_t *gc);
@@ -758,6 +768,11 @@ typedef struct glw_root {
   prop_t *gr_prop_width;
   prop_t *gr_prop_height;
 
+  prop_t *gr_prop_render_jobs;        // Render jobs queued last frame
+  prop_t *gr_prop_render_draw_calls;  // Draw calls after batching
+  prop_t *gr_prop_render_vertices;
+  prop_t *gr_prop_render_sort_time;   // Sort + batch time in usec
+
   float gr_mouse_x;
   float gr_mouse_y;
   int gr_mouse_valid;
@@ -807,6 +822,21 @@ typedef struct glw_root {
 
   rstr_t *gr_default_font;
   int gr_font_domain;
+  struct glw_glyph_atlas *gr_glyph_atlas;
+
+  /**
+   * Per widget class profiling (gconf.enable_glw_profile)
+   */
+  struct glw_class_profile *gr_class_profile;
+  int64_t gr_profile_child_time;
+  int gr_profile_frames;
+
+  /**
+   * Parallel layout, children of this GLW_PARALLEL_LAYOUT widget are
+   * collected in gr_layout_batch rather than laid out directly
+   */
+  struct glw *gr_layout_parent;
+  struct glw_layout_batch *gr_layout_batch;
 
   /**
    * Image/Texture loader
@@ -1445,10 +1475,14 @@ void glw_renderer_render(glw_root_t *gr);
 
 void glw_render_zoffset(glw_t *w, const glw_rctx_t *rc);
 
+void glw_render_profiled(glw_t *w, const glw_rctx_t *rc);
+
 static inline void glw_render0(glw_t *w, const glw_rctx_t *rc)
 {
   if(unlikely(w->glw_zoffset != 0)) {
     glw_render_zoffset(w, rc);
+  } else if(unlikely(gconf.enable_glw_profile)) {
+    glw_render_profiled(w, rc);
   } else {
     w->glw_class->gc_render(w, rc);
   }
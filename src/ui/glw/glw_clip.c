@@ -264,6 +264,7 @@ fader_set_float(glw_t *w, glw_attribute_t attrib, float value,
 static glw_class_t glw_fader = {
   .gc_name = "fader",
   .gc_instance_size = sizeof(glw_fade_t),
+  .gc_flags = GLW_PARALLEL_LAYOUT,
   .gc_layout = glw_fade_layout,
   .gc_render = glw_fade_render,
   .gc_signal_handler = glw_fade_callback,
@@ -781,7 +781,7 @@ static glw_class_t glw_container_x = {
   .gc_name = "container_x",
   .gc_instance_size = sizeof(glw_container_t),
   .gc_parent_data_size = sizeof(glw_container_item_t),
-  .gc_flags = GLW_CAN_HIDE_CHILDS,
+  .gc_flags = GLW_CAN_HIDE_CHILDS | GLW_PARALLEL_LAYOUT,
   .gc_set_int = glw_container_set_int,
   .gc_layout = glw_container_x_layout,
   .gc_render = glw_container_x_render,
@@ -808,7 +808,7 @@ static glw_class_t glw_container_y = {
 
 static glw_class_t glw_container_z = {
   .gc_name = "container_z",
-  .gc_flags = GLW_CAN_HIDE_CHILDS,
+  .gc_flags = GLW_CAN_HIDE_CHILDS | GLW_PARALLEL_LAYOUT,
   .gc_instance_size = sizeof(glw_container_t),
   .gc_set_int = glw_container_set_int,
   .gc_layout = glw_container_z_layout,
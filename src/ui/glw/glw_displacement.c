@@ -200,6 +200,7 @@ set_float4(glw_t *w, glw_attribute_t attrib, const float *vector)
 static glw_class_t glw_displacement = {
   .gc_name = "displacement",
   .gc_instance_size = sizeof(glw_displacement_t),
+  .gc_flags = GLW_PARALLEL_LAYOUT,
   .gc_ctor = glw_displacement_ctor,
   .gc_layout = glw_displacement_layout,
   .gc_render = glw_displacement_render,
@@ -195,6 +195,7 @@ glw_expander_set_float(glw_t *w, glw_attribute_t attrib, float value,
 static glw_class_t glw_expander_x = {
   .gc_name = "expander_x",
   .gc_instance_size = sizeof(glw_expander_t),
+  .gc_flags = GLW_PARALLEL_LAYOUT,
   .gc_layout = glw_expander_layout,
   .gc_render = glw_expander_render,
   .gc_set_float = glw_expander_set_float,
@@ -205,6 +206,7 @@ static glw_class_t glw_expander_x = {
 static glw_class_t glw_expander_y = {
   .gc_name = "expander_y",
   .gc_instance_size = sizeof(glw_expander_t),
+  .gc_flags = GLW_PARALLEL_LAYOUT,
   .gc_layout = glw_expander_layout,
   .gc_render = glw_expander_render,
   .gc_set_float = glw_expander_set_float,
@@ -0,0 +1,319 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+
+#include "glw.h"
+#include "glw_texture.h"
+#include "glw_glyph_atlas.h"
+#include "image/image.h"
+
+/**
+ * Glyph atlas
+ *
+ * Glyph coverage from text runs (see TR_RENDER_GLYPHS) is packed into
+ * a few shared IA textures. Intensity is always white and coverage goes
+ * in the alpha channel so the text color can be applied per vertex.
+ *
+ * Glyphs are packed in shelves. When all pages are full the oldest page
+ * is cleared and the epoch is bumped. Anyone holding texture coordinates
+ * must look them up again when the epoch changes.
+ *
+ * Pages are uploaded on first use after being modified, so a frame
+ * where lots of labels add glyphs only uploads each page once.
+ *
+ * Everything here runs with the GLW lock held.
+ */
+
+#define GLYPH_ATLAS_HASH_SIZE 256
+#define GLYPH_ATLAS_PAD 1 // Empty border around each glyph for filtering
+
+LIST_HEAD(glw_atlas_glyph_list, glw_atlas_glyph);
+
+typedef struct glw_atlas_glyph {
+  LIST_ENTRY(glw_atlas_glyph) gag_hash_link;
+  LIST_ENTRY(glw_atlas_glyph) gag_page_link;
+  uint32_t gag_id;
+  int16_t gag_x;
+  int16_t gag_y;
+  int16_t gag_width;
+  int16_t gag_height;
+  uint8_t gag_page;
+} glw_atlas_glyph_t;
+
+
+typedef struct glw_atlas_page {
+  pixmap_t *gap_pm;
+  glw_backend_texture_t gap_texture;
+  struct glw_atlas_glyph_list gap_glyphs;
+  int16_t gap_shelf_x;
+  int16_t gap_shelf_y;
+  int16_t gap_shelf_height;
+  uint8_t gap_dirty;
+} glw_atlas_page_t;
+
+
+typedef struct glw_glyph_atlas {
+  struct glw_atlas_glyph_list ga_hash[GLYPH_ATLAS_HASH_SIZE];
+  glw_atlas_page_t ga_pages[GLW_GLYPH_ATLAS_PAGES];
+  int ga_num_pages;
+  int ga_current;
+  int ga_epoch;
+} glw_glyph_atlas_t;
+
+
+/**
+ *
+ */
+static glw_glyph_atlas_t *
+glyph_atlas_get(glw_root_t *gr)
+{
+  if(gr->gr_glyph_atlas == NULL)
+    gr->gr_glyph_atlas = calloc(1, sizeof(glw_glyph_atlas_t));
+  return gr->gr_glyph_atlas;
+}
+
+
+/**
+ * Drop all glyphs on a page and make it empty
+ */
+static void
+glyph_atlas_page_clear(glw_atlas_page_t *gap)
+{
+  glw_atlas_glyph_t *gag;
+
+  while((gag = LIST_FIRST(&gap->gap_glyphs)) != NULL) {
+    LIST_REMOVE(gag, gag_hash_link);
+    LIST_REMOVE(gag, gag_page_link);
+    free(gag);
+  }
+
+  if(gap->gap_pm != NULL)
+    memset(gap->gap_pm->pm_data, 0,
+           gap->gap_pm->pm_linesize * gap->gap_pm->pm_height);
+
+  gap->gap_shelf_x = 0;
+  gap->gap_shelf_y = 0;
+  gap->gap_shelf_height = 0;
+  gap->gap_dirty = 1;
+}
+
+
+/**
+ * Find room for a width x height rectangle on the page
+ */
+static int
+glyph_atlas_page_alloc(glw_atlas_page_t *gap, int width, int height,
+                       int *xp, int *yp)
+{
+  if(gap->gap_shelf_x + width > GLW_GLYPH_ATLAS_SIZE) {
+    // New shelf
+    gap->gap_shelf_y += gap->gap_shelf_height;
+    gap->gap_shelf_x = 0;
+    gap->gap_shelf_height = 0;
+  }
+
+  if(gap->gap_shelf_y + height > GLW_GLYPH_ATLAS_SIZE)
+    return -1;
+
+  *xp = gap->gap_shelf_x;
+  *yp = gap->gap_shelf_y;
+  gap->gap_shelf_x += width;
+  gap->gap_shelf_height = MAX(gap->gap_shelf_height, height);
+  return 0;
+}
+
+
+/**
+ *
+ */
+static glw_atlas_glyph_t *
+glyph_atlas_insert(glw_glyph_atlas_t *ga, const image_glyph_t *ig)
+{
+  const pixmap_t *src = ig->ig_pm;
+  const int width  = src->pm_width  + GLYPH_ATLAS_PAD * 2;
+  const int height = src->pm_height + GLYPH_ATLAS_PAD * 2;
+  glw_atlas_page_t *gap;
+  int x, y;
+
+  if(width > GLW_GLYPH_ATLAS_SIZE || height > GLW_GLYPH_ATLAS_SIZE)
+    return NULL;
+
+  while(1) {
+    if(ga->ga_num_pages > 0) {
+      gap = &ga->ga_pages[ga->ga_current];
+      if(!glyph_atlas_page_alloc(gap, width, height, &x, &y))
+        break;
+    }
+
+    if(ga->ga_num_pages < GLW_GLYPH_ATLAS_PAGES) {
+      ga->ga_current = ga->ga_num_pages++;
+      gap = &ga->ga_pages[ga->ga_current];
+      gap->gap_pm = pixmap_create(GLW_GLYPH_ATLAS_SIZE, GLW_GLYPH_ATLAS_SIZE,
+                                  PIXMAP_IA, 0);
+      if(gap->gap_pm == NULL) {
+        ga->ga_num_pages--;
+        return NULL;
+      }
+    } else {
+      // All pages full, recycle the oldest one
+      ga->ga_current = (ga->ga_current + 1) % GLW_GLYPH_ATLAS_PAGES;
+      glyph_atlas_page_clear(&ga->ga_pages[ga->ga_current]);
+      ga->ga_epoch++;
+    }
+  }
+
+  pixmap_t *dst = gap->gap_pm;
+  for(int row = 0; row < src->pm_height; row++) {
+    const uint8_t *s = src->pm_data + row * src->pm_linesize;
+    uint8_t *d = dst->pm_data +
+      (y + GLYPH_ATLAS_PAD + row) * dst->pm_linesize +
+      (x + GLYPH_ATLAS_PAD) * 2;
+    for(int i = 0; i < src->pm_width; i++) {
+      *d++ = 0xff;
+      *d++ = *s++;
+    }
+  }
+  gap->gap_dirty = 1;
+
+  glw_atlas_glyph_t *gag = malloc(sizeof(glw_atlas_glyph_t));
+  gag->gag_id = ig->ig_id;
+  gag->gag_x = x + GLYPH_ATLAS_PAD;
+  gag->gag_y = y + GLYPH_ATLAS_PAD;
+  gag->gag_width = src->pm_width;
+  gag->gag_height = src->pm_height;
+  gag->gag_page = ga->ga_current;
+  LIST_INSERT_HEAD(&ga->ga_hash[ig->ig_id % GLYPH_ATLAS_HASH_SIZE],
+                   gag, gag_hash_link);
+  LIST_INSERT_HEAD(&gap->gap_glyphs, gag, gag_page_link);
+  return gag;
+}
+
+
+/**
+ * Get atlas location of a glyph, adding it if needed.
+ *
+ * Adding a glyph may bump the epoch and invalidate previously returned
+ * locations
+ */
+int
+glw_glyph_atlas_lookup(glw_root_t *gr, const image_glyph_t *ig,
+                       glw_glyph_atlas_rect_t *r)
+{
+  glw_glyph_atlas_t *ga = glyph_atlas_get(gr);
+  glw_atlas_glyph_t *gag;
+
+  LIST_FOREACH(gag, &ga->ga_hash[ig->ig_id % GLYPH_ATLAS_HASH_SIZE],
+               gag_hash_link)
+    if(gag->gag_id == ig->ig_id)
+      break;
+
+  if(gag == NULL && (gag = glyph_atlas_insert(ga, ig)) == NULL)
+    return -1;
+
+  const float scale = 1.0f / GLW_GLYPH_ATLAS_SIZE;
+  r->page = gag->gag_page;
+  r->s1 = gag->gag_x * scale;
+  r->t1 = gag->gag_y * scale;
+  r->s2 = (gag->gag_x + gag->gag_width)  * scale;
+  r->t2 = (gag->gag_y + gag->gag_height) * scale;
+  return 0;
+}
+
+
+/**
+ *
+ */
+int
+glw_glyph_atlas_epoch(glw_root_t *gr)
+{
+  return glyph_atlas_get(gr)->ga_epoch;
+}
+
+
+/**
+ * Must be called from the rendering context
+ */
+const glw_backend_texture_t *
+glw_glyph_atlas_texture(glw_root_t *gr, int page)
+{
+  glw_atlas_page_t *gap = &glyph_atlas_get(gr)->ga_pages[page];
+
+  if(gap->gap_dirty) {
+    glw_tex_upload(gr, &gap->gap_texture, gap->gap_pm, 0);
+    gap->gap_dirty = 0;
+  }
+  return &gap->gap_texture;
+}
+
+
+/**
+ *
+ */
+static void
+glyph_atlas_release_pages(glw_glyph_atlas_t *ga)
+{
+  for(int i = 0; i < ga->ga_num_pages; i++) {
+    glw_atlas_page_t *gap = &ga->ga_pages[i];
+    glyph_atlas_page_clear(gap);
+    pixmap_release(gap->gap_pm);
+    gap->gap_pm = NULL;
+  }
+  ga->ga_num_pages = 0;
+  ga->ga_current = 0;
+}
+
+
+/**
+ * Drop everything, must be called from the rendering context
+ */
+void
+glw_glyph_atlas_flush(glw_root_t *gr)
+{
+  glw_glyph_atlas_t *ga = gr->gr_glyph_atlas;
+
+  if(ga == NULL)
+    return;
+
+  for(int i = 0; i < ga->ga_num_pages; i++)
+    glw_tex_destroy(gr, &ga->ga_pages[i].gap_texture);
+
+  glyph_atlas_release_pages(ga);
+  ga->ga_epoch++;
+}
+
+
+/**
+ *
+ */
+void
+glw_glyph_atlas_fini(glw_root_t *gr)
+{
+  glw_glyph_atlas_t *ga = gr->gr_glyph_atlas;
+
+  if(ga == NULL)
+    return;
+
+  for(int i = 0; i < ga->ga_num_pages; i++)
+    glw_tex_destroy(gr, &ga->ga_pages[i].gap_texture);
+
+  glyph_atlas_release_pages(ga);
+  free(ga);
+  gr->gr_glyph_atlas = NULL;
+}
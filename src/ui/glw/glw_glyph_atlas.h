@@ -0,0 +1,46 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#pragma once
+
+struct image_glyph;
+
+#define GLW_GLYPH_ATLAS_SIZE  512
+#define GLW_GLYPH_ATLAS_PAGES 4
+
+/**
+ * Location of a glyph in the atlas, texture coordinates of the
+ * top left and bottom right corner
+ */
+typedef struct glw_glyph_atlas_rect {
+  int page;
+  float s1, t1, s2, t2;
+} glw_glyph_atlas_rect_t;
+
+int glw_glyph_atlas_lookup(glw_root_t *gr, const struct image_glyph *ig,
+                           glw_glyph_atlas_rect_t *r);
+
+int glw_glyph_atlas_epoch(glw_root_t *gr);
+
+const glw_backend_texture_t *glw_glyph_atlas_texture(glw_root_t *gr,
+                                                     int page);
+
+void glw_glyph_atlas_flush(glw_root_t *gr);
+
+void glw_glyph_atlas_fini(glw_root_t *gr);
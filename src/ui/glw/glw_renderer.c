@@ -769,6 +769,7 @@ glw_renderer_tesselate(glw_renderer_t *gr, glw_root_t *root,
   root->gr_vtmp_cur = 0;
 
   memcpy(grc->grc_mtx, rc->rc_mtx, sizeof(Mtx));
+  grc->grc_tesselated = 1;
 
   grc->grc_active_clippers  = root->gr_active_clippers;
   grc->grc_active_faders    = root->gr_active_faders;
@@ -923,6 +924,148 @@ glw_renderer_get_cache(glw_root_t *root, glw_renderer_t *gr)
 }
 
 
+/**
+ * Recompute object space bounding box from vertices
+ */
+static void
+glw_renderer_update_bbox(glw_renderer_t *gr)
+{
+  float *b = gr->gr_bbox;
+  const float *v = gr->gr_vertices;
+
+  b[0] = b[1] = b[2] = INFINITY;
+  b[3] = b[4] = b[5] = -INFINITY;
+
+  for(int i = 0; i < gr->gr_num_vertices; i++, v += VERTEX_SIZE) {
+    b[0] = MIN(b[0], v[0]);
+    b[1] = MIN(b[1], v[1]);
+    b[2] = MIN(b[2], v[2]);
+    b[3] = MAX(b[3], v[0]);
+    b[4] = MAX(b[4], v[1]);
+    b[5] = MAX(b[5], v[2]);
+  }
+}
+
+
+#define BBOX_UNKNOWN   0
+#define BBOX_INSIDE    1
+#define BBOX_OUTSIDE   2
+#define BBOX_INTERSECT 3
+
+/**
+ * Classify plane distances of the bounding box. The box has moved
+ * by translation T since the distances were computed
+ */
+static int
+glw_renderer_bbox_state(const glw_renderer_cache_t *grc, const float *T)
+{
+  const float *T0 = grc->grc_bbox_translation;
+  Vec4 V0, V1;
+  int r = BBOX_INSIDE;
+
+  glw_vec4_copy(V0, glw_vec4_make(T0[0], T0[1], T0[2], 1));
+  glw_vec4_copy(V1, glw_vec4_make(T[0], T[1], T[2], 1));
+
+  for(int i = 0; i < NUM_CLIPPLANES; i++) {
+    if(!((1 << i) & grc->grc_active_clippers))
+      continue;
+
+    const float d =
+      glw_vec34_dot(V1, grc->grc_clip[i]) - glw_vec34_dot(V0, grc->grc_clip[i]);
+
+    if(grc->grc_clip_dmax[i] + d < 0)
+      return BBOX_OUTSIDE;
+    if(grc->grc_clip_dmin[i] + d < 0)
+      r = BBOX_INTERSECT;
+  }
+  return r;
+}
+
+
+/**
+ * Classify the renderer's bounding box against the active clip planes
+ *
+ * The distance from each plane is kept in the cache. If the widget has
+ * only been translated since (such as when a list scrolls) the distances
+ * are just shifted instead of transforming the box again.
+ */
+static int
+glw_renderer_clip_state(glw_renderer_t *gr, glw_root_t *root,
+                        const glw_rctx_t *rc, glw_renderer_cache_t *grc)
+{
+  const float *m = glw_mtx_get(rc->rc_mtx);
+  const float *cm = glw_mtx_get(grc->grc_mtx);
+  int i;
+
+  const int moved_only = !gr->gr_dirty &&
+    grc->grc_bbox_state != BBOX_UNKNOWN &&
+    !glw_renderer_clippers_cmp(grc, root) &&
+    !memcmp(m, cm, sizeof(float) * 12) && m[15] == cm[15];
+
+  if(moved_only && m[12] == cm[12] && m[13] == cm[13] && m[14] == cm[14])
+    return grc->grc_bbox_state;
+
+  if(!moved_only) {
+
+    const float *b = gr->gr_bbox;
+    PMtx pmtx;
+
+    grc->grc_active_clippers = root->gr_active_clippers;
+    for(i = 0; i < NUM_CLIPPLANES; i++) {
+      if(!((1 << i) & root->gr_active_clippers))
+        continue;
+      memcpy(&grc->grc_clip[i], &root->gr_clip[i], sizeof(Vec4));
+      grc->grc_clip_dmin[i] = INFINITY;
+      grc->grc_clip_dmax[i] = -INFINITY;
+    }
+
+    glw_pmtx_mul_prepare(pmtx, rc->rc_mtx);
+
+    for(int c = 0; c < 8; c++) {
+      Vec4 V;
+      glw_pmtx_mul_vec4_i(V, pmtx, glw_vec4_make(b[c & 1 ? 3 : 0],
+                                                 b[c & 2 ? 4 : 1],
+                                                 b[c & 4 ? 5 : 2],
+                                                 1));
+
+      for(i = 0; i < NUM_CLIPPLANES; i++) {
+        if(!((1 << i) & root->gr_active_clippers))
+          continue;
+        const float D = glw_vec34_dot(V, root->gr_clip[i]);
+        grc->grc_clip_dmin[i] = MIN(grc->grc_clip_dmin[i], D);
+        grc->grc_clip_dmax[i] = MAX(grc->grc_clip_dmax[i], D);
+      }
+    }
+    memcpy(grc->grc_bbox_translation, m + 12, sizeof(float) * 3);
+  }
+
+  // Tesselated vertices no longer match grc_mtx
+  grc->grc_tesselated = 0;
+  memcpy(grc->grc_mtx, rc->rc_mtx, sizeof(Mtx));
+  grc->grc_bbox_state = glw_renderer_bbox_state(grc, m + 12);
+  return grc->grc_bbox_state;
+}
+
+
+/**
+ * Make sure there is room for num more vertices in the frame's
+ * vertex buffer
+ */
+static void
+vertex_buffer_reserve(glw_root_t *gr, int num)
+{
+  if(gr->gr_vertex_offset + num <= gr->gr_vertex_buffer_capacity)
+    return;
+
+  gr->gr_vertex_buffer_capacity = 100 + num +
+    gr->gr_vertex_buffer_capacity * 2;
+
+  gr->gr_vertex_buffer = realloc(gr->gr_vertex_buffer,
+                                 sizeof(float) * VERTEX_SIZE *
+                                 gr->gr_vertex_buffer_capacity);
+}
+
+
 /**
  *
  */
@@ -1019,14 +1162,7 @@ add_job(glw_root_t *gr,
 
   int vnum = indices ? num_triangles * 3 : num_vertices;
 
-  if(gr->gr_vertex_offset + vnum > gr->gr_vertex_buffer_capacity) {
-    gr->gr_vertex_buffer_capacity = 100 + vnum +
-      gr->gr_vertex_buffer_capacity * 2;
-
-    gr->gr_vertex_buffer = realloc(gr->gr_vertex_buffer,
-				     sizeof(float) * VERTEX_SIZE * 
-				     gr->gr_vertex_buffer_capacity);
-  }
+  vertex_buffer_reserve(gr, vnum);
 
   float *vdst = gr->gr_vertex_buffer + gr->gr_vertex_offset * VERTEX_SIZE;
 
@@ -1067,11 +1203,31 @@ glw_renderer_draw(glw_renderer_t *gr, glw_root_t *root,
   int flags =
     gr->gr_color_attributes ? GLW_RENDER_COLOR_ATTRIBUTES : 0;
 
+  if(gr->gr_dirty)
+    glw_renderer_update_bbox(gr);
+
   if(root->gr_need_sw_clip || root->gr_active_faders ||
      root->gr_stencil_width) {
     glw_renderer_cache_t *grc = glw_renderer_get_cache(root, gr);
 
-    if(gr->gr_dirty ||
+    if(!root->gr_active_faders && !root->gr_stencil_width) {
+
+      // Only clipping is needed. Widgets that are entirely inside or
+      // outside the clip planes don't have to be clipped per triangle
+
+      switch(glw_renderer_clip_state(gr, root, rc, grc)) {
+      case BBOX_OUTSIDE:
+        gr->gr_dirty = 0;
+        return;
+
+      case BBOX_INSIDE:
+        goto unclipped;
+      }
+    } else {
+      grc->grc_bbox_state = BBOX_UNKNOWN;
+    }
+
+    if(gr->gr_dirty || !grc->grc_tesselated ||
        memcmp(grc->grc_mtx, rc->rc_mtx, sizeof(Mtx)) ||
        glw_renderer_clippers_cmp(grc, root) ||
        glw_renderer_stencilers_cmp(grc, root) ||
@@ -1093,6 +1249,7 @@ glw_renderer_draw(glw_renderer_t *gr, glw_root_t *root,
             grc->grc_vertices, grc->grc_num_vertices,
             NULL, 0, flags, gpa, rc, GLW_DRAW_TRIANGLES, rc->rc_zindex);
   } else {
+  unclipped:
     add_job(root, rc->rc_mtx, tex, tex2, rgb_mul, rgb_off, alpha, blur,
             gr->gr_vertices, gr->gr_num_vertices,
             gr->gr_indices,  gr->gr_num_triangles,
@@ -1337,12 +1494,155 @@ render_order_cmp(const void *A, const void *B)
 }
 
 
+/**
+ * Return true if the job can be merged with others. Jobs with custom
+ * programs may look at the job itself when loading uniforms and the
+ * modelview matrix must be affine for us to transform on the CPU
+ */
+static int
+job_is_batchable(const glw_render_job_t *rj)
+{
+  if(rj->gpa != NULL || rj->primitive_type != GLW_DRAW_TRIANGLES)
+    return 0;
+
+  if(rj->eyespace)
+    return 1;
+
+  const float *m = glw_mtx_get(rj->m);
+  return m[3] == 0 && m[7] == 0 && m[11] == 0 && m[15] == 1;
+}
+
+
+/**
+ * Return true if two jobs would end up with identical GPU state
+ * apart from the modelview matrix
+ */
+static int
+jobs_share_state(const glw_render_order_t *a, const glw_render_order_t *b)
+{
+  const glw_render_job_t *aj = a->job;
+  const glw_render_job_t *bj = b->job;
+
+  return a->zindex == b->zindex &&
+    aj->t0 == bj->t0 &&
+    aj->t1 == bj->t1 &&
+    aj->flags == bj->flags &&
+    aj->blendmode == bj->blendmode &&
+    aj->frontface == bj->frontface &&
+    aj->width == bj->width &&
+    aj->height == bj->height &&
+    aj->alpha == bj->alpha &&
+    aj->blur == bj->blur &&
+    aj->rgb_mul.r == bj->rgb_mul.r &&
+    aj->rgb_mul.g == bj->rgb_mul.g &&
+    aj->rgb_mul.b == bj->rgb_mul.b &&
+    aj->rgb_off.r == bj->rgb_off.r &&
+    aj->rgb_off.g == bj->rgb_off.g &&
+    aj->rgb_off.b == bj->rgb_off.b;
+}
+
+
+/**
+ * Merge render order entries [start, end) into the first job.
+ *
+ * Vertices are transformed to eyespace and copied to the end of the
+ * vertex buffer, unless they already are in eyespace and laid out
+ * back to back. The other jobs are left with zero vertices and are
+ * skipped by the backends.
+ */
+static void
+merge_jobs(glw_root_t *gr, int start, int end, int num_vertices)
+{
+  glw_render_order_t *ro = gr->gr_render_order;
+  glw_render_job_t *first = ro[start].job;
+  int contiguous = 1;
+  int expect = first->vertex_offset;
+
+  for(int i = start; i < end; i++) {
+    const glw_render_job_t *rj = ro[i].job;
+    if(!rj->eyespace || rj->vertex_offset != expect) {
+      contiguous = 0;
+      break;
+    }
+    expect += rj->num_vertices;
+  }
+
+  if(!contiguous) {
+    vertex_buffer_reserve(gr, num_vertices);
+
+    const int base = gr->gr_vertex_offset;
+    float *dst = gr->gr_vertex_buffer + base * VERTEX_SIZE;
+
+    for(int i = start; i < end; i++) {
+      const glw_render_job_t *rj = ro[i].job;
+      const float *src = gr->gr_vertex_buffer + rj->vertex_offset * VERTEX_SIZE;
+      const int n = rj->num_vertices;
+
+      memcpy(dst, src, n * VERTEX_SIZE * sizeof(float));
+
+      if(!rj->eyespace) {
+        const float *m = glw_mtx_get(rj->m);
+        for(int v = 0; v < n; v++) {
+          float *p = dst + v * VERTEX_SIZE;
+          const float x = p[0], y = p[1], z = p[2];
+          p[0] = m[0] * x + m[4] * y + m[ 8] * z + m[12];
+          p[1] = m[1] * x + m[5] * y + m[ 9] * z + m[13];
+          p[2] = m[2] * x + m[6] * y + m[10] * z + m[14];
+        }
+      }
+      dst += n * VERTEX_SIZE;
+    }
+    gr->gr_vertex_offset += num_vertices;
+    first->vertex_offset = base;
+  }
+
+  first->eyespace = 1;
+  first->num_vertices = num_vertices;
+
+  for(int i = start + 1; i < end; i++)
+    ro[i].job->num_vertices = 0;
+}
+
+
+/**
+ * Collapse runs of jobs that share GPU state into single draw calls
+ */
+static void
+batch_jobs(glw_root_t *gr)
+{
+  const glw_render_order_t *ro = gr->gr_render_order;
+  const int num_jobs = gr->gr_num_render_jobs;
+  int i = 0;
+
+  while(i < num_jobs) {
+    int j = i + 1;
+    int num_vertices = ro[i].job->num_vertices;
+
+    if(job_is_batchable(ro[i].job)) {
+      while(j < num_jobs &&
+            job_is_batchable(ro[j].job) &&
+            jobs_share_state(&ro[i], &ro[j]) &&
+            num_vertices + ro[j].job->num_vertices <= INT16_MAX) {
+        num_vertices += ro[j].job->num_vertices;
+        j++;
+      }
+    }
+
+    if(j - i > 1)
+      merge_jobs(gr, i, j, num_vertices);
+    i = j;
+  }
+}
+
+
 /**
  *
  */
 void
 glw_renderer_render(glw_root_t *gr)
 {
+  int64_t ts = arch_get_ts();
+
   // Sort items to render in order:
 
   //  Front to back
@@ -1351,5 +1651,24 @@ glw_renderer_render(glw_root_t *gr)
   qsort(gr->gr_render_order, gr->gr_num_render_jobs,
         sizeof(glw_render_order_t), render_order_cmp);
 
+  batch_jobs(gr);
+
+  ts = arch_get_ts() - ts;
+
+  int draw_calls = 0;
+  int vertices = 0;
+  for(int i = 0; i < gr->gr_num_render_jobs; i++) {
+    const glw_render_job_t *rj = gr->gr_render_jobs + i;
+    if(rj->num_vertices) {
+      draw_calls++;
+      vertices += rj->num_vertices;
+    }
+  }
+
+  prop_set_int(gr->gr_prop_render_jobs, gr->gr_num_render_jobs);
+  prop_set_int(gr->gr_prop_render_draw_calls, draw_calls);
+  prop_set_int(gr->gr_prop_render_vertices, vertices);
+  prop_set_int(gr->gr_prop_render_sort_time, ts);
+
   gr->gr_be_render_unlocked(gr);
 }
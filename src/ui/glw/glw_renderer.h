@@ -57,8 +57,14 @@ typedef struct glw_renderer_cache {
   float grc_fader_alpha[NUM_FADERS];
   float grc_fader_blur[NUM_FADERS];
 
+  float grc_clip_dmin[NUM_CLIPPLANES]; // Bounding box distance to planes
+  float grc_clip_dmax[NUM_CLIPPLANES];
+  float grc_bbox_translation[3];      // Translation when they were computed
+
   char grc_blurred;
   char grc_colored;
+  char grc_tesselated;  // grc_vertices are valid for grc_mtx
+  char grc_bbox_state;
   uint16_t grc_num_vertices;
 
   float *grc_vertices;
@@ -80,6 +86,8 @@ typedef struct glw_renderer {
   unsigned char gr_framecmp;
   unsigned char gr_cacheptr;
 
+  float gr_bbox[6]; // Object space bounding box (min xyz, max xyz)
+
 
 #define GLW_RENDERER_CACHES 4
 
@@ -0,0 +1,134 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+
+/**
+ * Standalone benchmark of the CPU side of glw_renderer_draw() when a
+ * list scrolls under software clipping. Each item is a row of quads,
+ * like a label drawn from glyphs.
+ *
+ * Usage: glw-render-bench [quads per item]
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "glw.h"
+#include "glw_renderer.h"
+
+#define ITEMS  200
+#define FRAMES 2000
+
+
+void
+prop_set_int_ex(prop_t *p, prop_sub_t *skipme, int v)
+{
+}
+
+
+int64_t
+arch_get_ts(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+static void
+bench_render(glw_root_t *gr)
+{
+}
+
+
+int
+main(int argc, char **argv)
+{
+  static glw_root_t root;
+  static glw_renderer_t r[ITEMS];
+  const glw_rgb_t white = {1, 1, 1};
+  glw_root_t *gr = &root;
+  glw_rctx_t rc0 = {};
+  int quads = argc > 1 ? atoi(argv[1]) : 10;
+
+  if(quads < 1 || quads > 1000)
+    quads = 10;
+
+  rc0.rc_width  = 1280;
+  rc0.rc_height = 720;
+  rc0.rc_alpha  = 1;
+  glw_LoadIdentity(&rc0);
+  glw_Translatef(&rc0, 0, 0, -1 / tan(45 * M_PI / 360));
+
+  gr->gr_be_render_unlocked = bench_render;
+
+  for(int i = 0; i < ITEMS; i++) {
+    glw_renderer_init(&r[i], quads * 4, quads * 2, NULL);
+
+    for(int q = 0; q < quads; q++) {
+      const float x1 = -1 + 2.0f * q / quads;
+      const float x2 = -1 + 2.0f * (q + 0.8f) / quads;
+      const int v = q * 4;
+
+      glw_renderer_vtx_pos(&r[i], v + 0, x1, -1, 0);
+      glw_renderer_vtx_pos(&r[i], v + 1, x2, -1, 0);
+      glw_renderer_vtx_pos(&r[i], v + 2, x2,  1, 0);
+      glw_renderer_vtx_pos(&r[i], v + 3, x1,  1, 0);
+      glw_renderer_vtx_st(&r[i], v + 0, 0, 1);
+      glw_renderer_vtx_st(&r[i], v + 1, 1, 1);
+      glw_renderer_vtx_st(&r[i], v + 2, 1, 0);
+      glw_renderer_vtx_st(&r[i], v + 3, 0, 0);
+      glw_renderer_triangle(&r[i], q * 2 + 0, v, v + 1, v + 2);
+      glw_renderer_triangle(&r[i], q * 2 + 1, v, v + 2, v + 3);
+    }
+  }
+
+  // Viewport clipped at top and bottom, like glw_list does
+  glw_clip_enable(gr, &rc0, GLW_CLIP_TOP, 0.1);
+  glw_clip_enable(gr, &rc0, GLW_CLIP_BOTTOM, 0.1);
+
+  int64_t vertices = 0;
+  int64_t ts = arch_get_ts();
+
+  for(int f = 0; f < FRAMES; f++) {
+    gr->gr_num_render_jobs = 0;
+    gr->gr_vertex_offset = 0;
+    gr->gr_frames++;
+
+    const float scroll = fmodf(f * 0.01f, 1.2f);
+
+    for(int i = 0; i < ITEMS; i++) {
+      glw_rctx_t rc = rc0;
+      glw_Translatef(&rc, 0, 1.0f - i * 0.06f + scroll, 0);
+      glw_Scalef(&rc, 0.9f, 0.025f, 1);
+      glw_renderer_draw(&r[i], gr, &rc, NULL, NULL, &white, NULL,
+                        1, 0, NULL);
+    }
+    vertices += gr->gr_vertex_offset;
+  }
+
+  ts = arch_get_ts() - ts;
+
+  printf("%d items, %d quads each: %.4f ms/frame, %d vertices/frame\n",
+         ITEMS, quads, ts / 1000.0 / FRAMES, (int)(vertices / FRAMES));
+
+  for(int i = 0; i < ITEMS; i++)
+    glw_renderer_free(&r[i]);
+  return 0;
+}
@@ -69,6 +69,7 @@ glw_rotator_render(glw_t *w, const glw_rctx_t *rc)
 static glw_class_t glw_rotator = {
   .gc_name = "rotator",
   .gc_instance_size = sizeof(glw_rotator_t),
+  .gc_flags = GLW_PARALLEL_LAYOUT,
   .gc_layout = glw_rotator_layout,
   .gc_render = glw_rotator_render,
 };
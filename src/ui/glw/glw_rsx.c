@@ -275,6 +275,8 @@ rsx_render_unlocked(glw_root_t *gr)
     rsx_fp_t *rfp;
     float rgba[4];
 
+    if(unlikely(rj->num_vertices == 0))
+      continue;
 
     if(unlikely(rj->gpa != NULL)) {
 
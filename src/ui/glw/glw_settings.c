@@ -104,6 +104,14 @@ glw_settings_init(void)
                    SETTING_HTSMSG("wrap", store, "glw"),
                    NULL);
 
+  glw_settings.gs_setting_glyph_atlas =
+    setting_create(SETTING_BOOL, s, SETTINGS_INITIAL_UPDATE,
+                   SETTING_TITLE(_p("Draw text from a shared glyph texture")),
+                   SETTING_VALUE(0),
+                   SETTING_WRITE_BOOL(&glw_settings.gs_glyph_atlas),
+                   SETTING_HTSMSG("glyphatlas", store, "glw"),
+                   NULL);
+
   prop_t *p = prop_create(prop_get_global(), "glw");
   p = prop_create(p, "osk");
   kv_prop_bind_create(p, "showtime:glw:osk");
@@ -121,6 +129,7 @@ glw_settings_fini(void)
   setting_destroy(glw_settings.gs_setting_underscan_h);
   setting_destroy(glw_settings.gs_setting_size);
   setting_destroy(glw_settings.gs_setting_wrap);
+  setting_destroy(glw_settings.gs_setting_glyph_atlas);
   prop_destroy(glw_settings.gs_settings);
   htsmsg_release(glw_settings.gs_settings_store);
 }
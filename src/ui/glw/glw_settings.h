@@ -26,12 +26,14 @@ typedef struct glw_settings {
   int gs_underscan_v;
   int gs_screensaver_delay;
   int gs_wrap;
+  int gs_glyph_atlas;
 
   struct setting *gs_setting_size;
   struct setting *gs_setting_underscan_v;
   struct setting *gs_setting_underscan_h;
   struct setting *gs_setting_screensaver;
   struct setting *gs_setting_wrap;
+  struct setting *gs_setting_glyph_atlas;
 
   struct prop *gs_settings;
   struct htsmsg *gs_settings_store;
@@ -33,11 +33,22 @@
 #include "glw_texture.h"
 #include "glw_renderer.h"
 #include "glw_text_bitmap.h"
+#include "glw_glyph_atlas.h"
+#include "glw_settings.h"
 #include "misc/str.h"
 #include "text/text.h"
 #include "event.h"
 #include "image/image.h"
 
+/**
+ * Glyphs drawn from one atlas page
+ */
+typedef struct glw_glyph_batch {
+  glw_renderer_t ggb_renderer;
+  int ggb_page;
+} glw_glyph_batch_t;
+
+
 /**
  *
  */
@@ -57,6 +68,10 @@ typedef struct glw_text_bitmap {
   glw_renderer_t gtb_text_renderer;
   glw_renderer_t gtb_cursor_renderer;
 
+  glw_glyph_batch_t *gtb_glyph_batches;
+  int gtb_num_glyph_batches;
+  int gtb_atlas_epoch;
+
   TAILQ_ENTRY(glw_text_bitmap) gtb_workq_link;
   LIST_ENTRY(glw_text_bitmap) gtb_global_link;
 
@@ -81,6 +96,8 @@ typedef struct glw_text_bitmap {
   uint8_t gtb_need_layout;
   uint8_t gtb_deferred_realize;
   uint8_t gtb_caption_dirty;
+  uint8_t gtb_glyphs;     // gtb_image is a glyph run, not a pixmap
+  uint8_t gtb_no_atlas;   // Glyph run did not fit in the atlas
 
   int16_t gtb_edit_ptr;
 
@@ -117,6 +134,171 @@ static void gtb_caption_refresh(glw_text_bitmap_t *gtb);
 static glw_class_t glw_text, glw_label;
 
 
+/**
+ *
+ */
+static void
+gtb_glyph_batches_free(glw_text_bitmap_t *gtb)
+{
+  for(int i = 0; i < gtb->gtb_num_glyph_batches; i++)
+    glw_renderer_free(&gtb->gtb_glyph_batches[i].ggb_renderer);
+  free(gtb->gtb_glyph_batches);
+  gtb->gtb_glyph_batches = NULL;
+  gtb->gtb_num_glyph_batches = 0;
+}
+
+
+/**
+ * Build one renderer per atlas page with a quad for each glyph.
+ *
+ * Glyph positions are in the same coordinates as the bitmap would have
+ * had, so the visible part is [0, text_width] x [0, text_height] and it
+ * is placed with its top left corner at (left, top)
+ */
+static void
+gtb_layout_glyphs(glw_text_bitmap_t *gtb, const glw_rctx_t *rc,
+                  int left, int top, int text_width, int text_height,
+                  int fade)
+{
+  glw_root_t *gr = gtb->w.glw_root;
+  image_component_t *ic = image_find_component(gtb->gtb_image, IMAGE_GLYPHS);
+  const image_component_glyphs_t *icg = &ic->glyphs;
+  const int num_glyphs = MIN(icg->icg_count, 16384);
+  int batch_for_page[GLW_GLYPH_ATLAS_PAGES];
+  int count[GLW_GLYPH_ATLAS_PAGES] = {0};
+  int epoch, i;
+
+  gtb_glyph_batches_free(gtb);
+
+  glw_glyph_atlas_rect_t *rects = malloc(sizeof(rects[0]) * num_glyphs);
+
+  // If the atlas has to recycle a page while we add our glyphs, earlier
+  // lookups may have gone stale so try once more before giving up
+  for(int attempt = 0; ; attempt++) {
+    epoch = glw_glyph_atlas_epoch(gr);
+    for(i = 0; i < num_glyphs; i++)
+      if(glw_glyph_atlas_lookup(gr, &icg->icg_glyphs[i], &rects[i]))
+        break;
+
+    if(i == num_glyphs && epoch == glw_glyph_atlas_epoch(gr))
+      break;
+
+    if(attempt == 1) {
+      free(rects);
+      gtb->gtb_no_atlas = 1;
+      if(gtb->gtb_state == GTB_VALID)
+        gtb->gtb_state = GTB_NEED_RENDER;
+      return;
+    }
+  }
+
+  // Clip against visible area
+
+  float *clip = malloc(sizeof(float) * 4 * num_glyphs);
+
+  for(i = 0; i < num_glyphs; i++) {
+    const image_glyph_t *ig = &icg->icg_glyphs[i];
+    glw_glyph_atlas_rect_t *r = &rects[i];
+    float *c = clip + i * 4;
+    const float w = ig->ig_pm->pm_width;
+    const float h = ig->ig_pm->pm_height;
+
+    c[0] = MAX(ig->ig_x, 0);
+    c[1] = MAX(ig->ig_y, 0);
+    c[2] = MIN(ig->ig_x + w, text_width);
+    c[3] = MIN(ig->ig_y + h, text_height);
+
+    if(c[0] >= c[2] || c[1] >= c[3]) {
+      r->page = -1;
+      continue;
+    }
+
+    const float ds = r->s2 - r->s1;
+    const float dt = r->t2 - r->t1;
+    r->s2 = r->s1 + ds * (c[2] - ig->ig_x) / w;
+    r->t2 = r->t1 + dt * (c[3] - ig->ig_y) / h;
+    r->s1 = r->s1 + ds * (c[0] - ig->ig_x) / w;
+    r->t1 = r->t1 + dt * (c[1] - ig->ig_y) / h;
+    count[r->page]++;
+  }
+
+  for(i = 0; i < GLW_GLYPH_ATLAS_PAGES; i++)
+    if(count[i])
+      gtb->gtb_num_glyph_batches++;
+
+  gtb->gtb_glyph_batches = calloc(gtb->gtb_num_glyph_batches,
+                                  sizeof(glw_glyph_batch_t));
+
+  int n = 0;
+  for(i = 0; i < GLW_GLYPH_ATLAS_PAGES; i++) {
+    if(!count[i])
+      continue;
+    glw_glyph_batch_t *ggb = &gtb->gtb_glyph_batches[n];
+    ggb->ggb_page = i;
+    glw_renderer_init(&ggb->ggb_renderer, count[i] * 4, count[i] * 2, NULL);
+    for(int j = 0; j < count[i]; j++) {
+      glw_renderer_triangle(&ggb->ggb_renderer, j * 2 + 0,
+                            j * 4 + 0, j * 4 + 1, j * 4 + 2);
+      glw_renderer_triangle(&ggb->ggb_renderer, j * 2 + 1,
+                            j * 4 + 0, j * 4 + 2, j * 4 + 3);
+    }
+    batch_for_page[i] = n++;
+    count[i] = 0; // Reused as vertex cursor below
+  }
+
+  const float xs = 2.0f / rc->rc_width;
+  const float ys = 2.0f / rc->rc_height;
+  const float fa = 1 + fade / 20;
+
+  for(i = 0; i < num_glyphs; i++) {
+    const glw_glyph_atlas_rect_t *r = &rects[i];
+    const float *c = clip + i * 4;
+    if(r->page == -1)
+      continue;
+
+    glw_renderer_t *ren =
+      &gtb->gtb_glyph_batches[batch_for_page[r->page]].ggb_renderer;
+    const int v = count[r->page];
+    count[r->page] += 4;
+
+    const uint32_t rgba = icg->icg_glyphs[i].ig_color;
+    const float cr = (rgba & 0xff) / 255.0f;
+    const float cg = ((rgba >> 8) & 0xff) / 255.0f;
+    const float cb = ((rgba >> 16) & 0xff) / 255.0f;
+    const float ca = (rgba >> 24) / 255.0f;
+
+    // Same fade out as for oversized bitmaps, linear over text_width
+    const float a1 = fade ? ca * fa * (1.0f - c[0] / fade) : ca;
+    const float a2 = fade ? ca * fa * (1.0f - c[2] / fade) : ca;
+
+    const float vx1 = -1.0f + xs * (left + c[0]);
+    const float vx2 = -1.0f + xs * (left + c[2]);
+    const float vy1 = -1.0f + ys * (top - c[3]);
+    const float vy2 = -1.0f + ys * (top - c[1]);
+
+    glw_renderer_vtx_pos(ren, v + 0, vx1, vy1, 0.0);
+    glw_renderer_vtx_st (ren, v + 0, r->s1, r->t2);
+    glw_renderer_vtx_col(ren, v + 0, cr, cg, cb, a1);
+
+    glw_renderer_vtx_pos(ren, v + 1, vx2, vy1, 0.0);
+    glw_renderer_vtx_st (ren, v + 1, r->s2, r->t2);
+    glw_renderer_vtx_col(ren, v + 1, cr, cg, cb, a2);
+
+    glw_renderer_vtx_pos(ren, v + 2, vx2, vy2, 0.0);
+    glw_renderer_vtx_st (ren, v + 2, r->s2, r->t1);
+    glw_renderer_vtx_col(ren, v + 2, cr, cg, cb, a2);
+
+    glw_renderer_vtx_pos(ren, v + 3, vx1, vy2, 0.0);
+    glw_renderer_vtx_st (ren, v + 3, r->s1, r->t1);
+    glw_renderer_vtx_col(ren, v + 3, cr, cg, cb, a1);
+  }
+
+  free(clip);
+  free(rects);
+  gtb->gtb_atlas_epoch = epoch;
+}
+
+
 /**
  *
  */
@@ -148,8 +330,13 @@ glw_text_bitmap_layout(glw_t *w, const glw_rctx_t *rc)
     gtb->gtb_need_layout = 1;
   }
 
-  const int tex_width  = glw_tex_width(&gtb->gtb_texture);
-  const int tex_height = glw_tex_height(&gtb->gtb_texture);
+  const int tex_width  = gtb->gtb_glyphs ? gtb->gtb_image->im_width :
+    glw_tex_width(&gtb->gtb_texture);
+  const int tex_height = gtb->gtb_glyphs ? gtb->gtb_image->im_height :
+    glw_tex_height(&gtb->gtb_texture);
+
+  if(gtb->gtb_glyphs && gtb->gtb_atlas_epoch != glw_glyph_atlas_epoch(gr))
+    gtb->gtb_need_layout = 1;
 
   ic = image_find_component(gtb->gtb_image, IMAGE_TEXT_INFO);
   image_component_text_info_t *ti = ic ? &ic->text_info : NULL;
@@ -207,6 +394,7 @@ glw_text_bitmap_layout(glw_t *w, const glw_rctx_t *rc)
 
     int text_width  = tex_width;
     int text_height = tex_height;
+    int fade = 0;
 
     float x1, y1, x2, y2;
 
@@ -226,6 +414,7 @@ glw_text_bitmap_layout(glw_t *w, const glw_rctx_t *rc)
                text_width);
 
       if(!(gtb->gtb_flags & GTB_ELLIPSIZE)) {
+	fade = text_width;
 	glw_renderer_vtx_col(&gtb->gtb_text_renderer, 0, 1,1,1,1+text_width/20);
 	glw_renderer_vtx_col(&gtb->gtb_text_renderer, 1, 1,1,1,0);
 	glw_renderer_vtx_col(&gtb->gtb_text_renderer, 2, 1,1,1,0);
@@ -287,6 +476,9 @@ glw_text_bitmap_layout(glw_t *w, const glw_rctx_t *rc)
       }
     }
 
+    if(gtb->gtb_glyphs)
+      gtb_layout_glyphs(gtb, rc, left, top, text_width, text_height, fade);
+
     x1 = -1.0f + 2.0f * left   / (float)rc->rc_width;
     y1 = -1.0f + 2.0f * bottom / (float)rc->rc_height;
     x2 = -1.0f + 2.0f * right  / (float)rc->rc_width;
@@ -394,7 +586,21 @@ glw_text_bitmap_render(glw_t *w, const glw_rctx_t *rc)
   if(alpha < 0.01f)
     return;
 
-  if(glw_is_tex_inited(&gtb->gtb_texture) && gtb->gtb_image != NULL) {
+  if(gtb->gtb_glyphs) {
+    glw_root_t *gr = w->glw_root;
+
+    if(gtb->gtb_atlas_epoch == glw_glyph_atlas_epoch(gr)) {
+      for(int i = 0; i < gtb->gtb_num_glyph_batches; i++) {
+        glw_glyph_batch_t *ggb = &gtb->gtb_glyph_batches[i];
+        glw_renderer_draw(&ggb->ggb_renderer, gr, rc,
+                          glw_glyph_atlas_texture(gr, ggb->ggb_page), NULL,
+                          &gtb->gtb_color, NULL, alpha, blur, NULL);
+      }
+    } else {
+      // Atlas page got recycled after our layout, redo it next frame
+      glw_need_refresh(gr, 0);
+    }
+  } else if(glw_is_tex_inited(&gtb->gtb_texture) && gtb->gtb_image != NULL) {
     glw_renderer_draw(&gtb->gtb_text_renderer, w->glw_root, rc,
 		      &gtb->gtb_texture, NULL,
 		      &gtb->gtb_color, NULL, alpha, blur, NULL);
@@ -435,6 +641,7 @@ glw_text_bitmap_dtor(glw_t *w)
 
   glw_renderer_free(&gtb->gtb_text_renderer);
   glw_renderer_free(&gtb->gtb_cursor_renderer);
+  gtb_glyph_batches_free(gtb);
 
   switch(gtb->gtb_state) {
   case GTB_IDLE:
@@ -1139,6 +1346,9 @@ do_render(glw_text_bitmap_t *gtb, glw_root_t *gr, int no_output)
   if(gtb->gtb_flags & GTB_OUTLINE)
     flags |= TR_RENDER_OUTLINE;
 
+  if(glw_settings.gs_glyph_atlas && !gtb->gtb_no_atlas)
+    flags |= TR_RENDER_GLYPHS;
+
   if(gtb->gtb_edit_ptr >= 0)
     flags |= TR_RENDER_CHARACTER_POS;
 
@@ -1214,6 +1424,13 @@ do_render(glw_text_bitmap_t *gtb, glw_root_t *gr, int no_output)
     gtb->gtb_state = GTB_VALID;
     image_release(gtb->gtb_image);
     gtb->gtb_image = im;
+
+    gtb->gtb_glyphs = image_find_component(im, IMAGE_GLYPHS) != NULL;
+    if(gtb->gtb_glyphs) {
+      gtb->gtb_margin = im->im_margin;
+      gtb->gtb_need_layout = 1;
+    }
+
     if(im != NULL && gtb->gtb_maxlines > 1) {
       gtb_set_constraints(gr, gtb, im);
     }
@@ -1357,6 +1574,7 @@ glw_text_bitmap_fini(glw_root_t *gr)
   hts_mutex_unlock(&gr->gr_mutex);
   hts_thread_join(&gr->gr_font_thread);
   hts_cond_destroy(&gr->gr_gtb_work_cond);
+  glw_glyph_atlas_fini(gr);
 }
 
 
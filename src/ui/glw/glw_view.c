@@ -244,13 +244,20 @@ gcv_load(glw_root_t *gr, glw_cached_view_t *gcv, int may_unlock)
     return;
   }
 
-  token_t *sof = glw_view_token_alloc(gr);
+  token_t *sof = glw_view_cache_load(gr, file, buf, may_unlock);
+  if(sof != NULL) {
+    buf_release(buf);
+    gcv->gcv_sof = sof;
+    return;
+  }
+
+  sof = glw_view_token_alloc(gr);
   sof->type = TOKEN_START;
   sof->file = rstr_dup(file);
 
   token_t *l = glw_view_lexer(gr, buf_cstr(buf), &ei, file, sof);
-  buf_release(buf);
   if(l == NULL) {
+    buf_release(buf);
     glw_view_free_chain(gr, sof);
     goto bad;
   }
@@ -260,12 +267,20 @@ gcv_load(glw_root_t *gr, glw_cached_view_t *gcv, int may_unlock)
   eof->file = rstr_dup(file);
   l->next = eof;
 
-  if(glw_view_preproc(gr, sof, &ei, may_unlock) ||
+  glw_view_deps_t deps = {};
+
+  if(glw_view_preproc(gr, sof, &ei, may_unlock, &deps) ||
      glw_view_parse(sof, &ei, gr)) {
+    glw_view_deps_free(&deps);
+    buf_release(buf);
     glw_view_free_chain(gr, sof);
     goto bad;
   }
 
+  glw_view_cache_store(gr, file, buf, &deps, sof);
+  glw_view_deps_free(&deps);
+  buf_release(buf);
+
   gcv->gcv_sof = sof;
   return;
 
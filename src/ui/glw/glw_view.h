@@ -116,6 +116,7 @@ typedef struct token {
 #define TOKEN_F_SELECTED 0x1 // The 'selected' in a vector
 #define TOKEN_F_CANONICAL_PATH 0x2 // Do not follow paths when resolving prop
 #define TOKEN_F_PROP_LINK      0x4 // Value is set using prop_link
+#define TOKEN_F_NLS            0x8 // Translated string, key in t_nls_key
 
   uint8_t t_dynamic_eval;
 
@@ -131,6 +132,7 @@ typedef struct token {
 #define t_extra       arg.extra
 #define t_extra_float arg.f
 #define t_extra_int   arg.i
+#define t_nls_key     arg.extra
 
   union {
     const struct token_attrib *t_attrib;
@@ -282,8 +284,24 @@ void glw_view_token_free(glw_root_t *gr, token_t *t);
 
 token_t *glw_view_token_copy(glw_root_t *gr, token_t *src);
 
+/**
+ * Files (other than the view itself) that went into a parsed view.
+ * Recorded while loading so the precompiled view cache can tell
+ * when an include or import has changed. See glw_view_cache.c
+ */
+typedef struct glw_view_dep {
+  rstr_t *url;
+  uint8_t digest[20];
+} glw_view_dep_t;
+
+typedef struct glw_view_deps {
+  glw_view_dep_t *vec;
+  int num;
+} glw_view_deps_t;
+
 token_t *glw_view_load1(glw_root_t *gr, rstr_t *url, errorinfo_t *ei,
-                        token_t *prev, int may_unlock);
+                        token_t *prev, int may_unlock,
+                        glw_view_deps_t *deps);
 
 token_t *glw_view_lexer(glw_root_t *gr, const char *src, errorinfo_t *ei,
                         rstr_t *file, token_t *prev);
@@ -314,12 +332,26 @@ int glw_view_eval_block(token_t *t, glw_view_eval_context_t *ec,
 int glw_view_eval_rpn(token_t *t, glw_view_eval_context_t *pec, int *copyp);
 
 int glw_view_preproc(glw_root_t *gr, token_t *p, errorinfo_t *ei,
-                     int may_unlock);
+                     int may_unlock, glw_view_deps_t *deps);
 
 token_t *glw_view_clone_chain(glw_root_t *gr, token_t *src, token_t **lp);
 
 void glw_view_cache_flush(glw_root_t *gr);
 
+const token_func_t *glw_view_function_find(const char *name);
+
+const token_attrib_t *glw_view_attrib_find(const char *name);
+
+void glw_view_deps_add(glw_view_deps_t *deps, rstr_t *url, const buf_t *b);
+
+void glw_view_deps_free(glw_view_deps_t *deps);
+
+token_t *glw_view_cache_load(glw_root_t *gr, rstr_t *url, const buf_t *src,
+                             int may_unlock);
+
+void glw_view_cache_store(glw_root_t *gr, rstr_t *url, const buf_t *src,
+                          const glw_view_deps_t *deps, token_t *sof);
+
 struct glw_prop_sub_list;
 void glw_prop_subscription_destroy_list(glw_root_t *gr, 
 					struct glw_prop_sub_list *l);
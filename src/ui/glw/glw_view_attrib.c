@@ -1597,6 +1597,29 @@ static const token_attrib_t or_img_flags = {"or_img_flags", or_img_flags_fn};
 static const token_attrib_t or_txt_flags = {"or_txt_flags", or_txt_flags_fn};
 
 
+/**
+ * Find attribute by name, including the synthetic ones produced by
+ * glw_view_attrib_optimize()
+ */
+const token_attrib_t *
+glw_view_attrib_find(const char *name)
+{
+  int i;
+
+  for(i = 0; i < sizeof(attribtab) / sizeof(attribtab[0]); i++)
+    if(!strcmp(attribtab[i].name, name))
+      return &attribtab[i];
+
+  if(!strcmp(or_flags2.name, name))
+    return &or_flags2;
+  if(!strcmp(or_img_flags.name, name))
+    return &or_img_flags;
+  if(!strcmp(or_txt_flags.name, name))
+    return &or_txt_flags;
+  return NULL;
+}
+
+
 /**
  *
  */
@@ -0,0 +1,787 @@
+/*
+ *  Copyright (C) 2007-2015 Lonelycoder AB
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  This program is also available under a commercial proprietary license.
+ *  For more information, contact andreas@lonelycoder.com
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "main.h"
+#include "glw.h"
+#include "glw_view.h"
+#include "blobcache.h"
+#include "htsmsg/htsbuf.h"
+#include "fileaccess/fileaccess.h"
+#include "misc/sha.h"
+#include "misc/str.h"
+
+/**
+ * Precompiled view cache
+ *
+ * Parsed views (the token chain after lexing, preprocessing and
+ * parsing) are serialized into the blobcache so the next run can skip
+ * all of that. The blobcache etag is a digest of the application
+ * version and the view source. Included and imported files are stored
+ * in the blob together with a digest of their contents and are checked
+ * before the cached chain is used.
+ *
+ * Functions, attributes and widget classes are stored by name and
+ * resolved again when loading. Strings are stored once in a string
+ * table and shared between the tokens referring to them.
+ *
+ * Layout (native byte order):
+ *
+ *   header   magic, version, #deps, #strings
+ *   strings  length + bytes for each string
+ *   deps     url string + digest for each dependency
+ *   tokens   pre-order, each token tells if it has a child chain
+ *            and if it has a next sibling
+ */
+
+#define GVC_STASH   "glwview"
+#define GVC_MAXAGE  (86400 * 90)
+#define GVC_MAGIC   0x47565743 // GVWC
+#define GVC_VERSION 1 // Bump when token_t or the parser output changes
+
+#define GVC_HAS_CHILD 0x1
+#define GVC_HAS_NEXT  0x2
+
+#define GVC_STRING_HASH_SIZE 256
+
+
+/**
+ *
+ */
+void
+glw_view_deps_add(glw_view_deps_t *deps, rstr_t *url, const buf_t *b)
+{
+  deps->vec = realloc(deps->vec, sizeof(glw_view_dep_t) * (deps->num + 1));
+  glw_view_dep_t *d = &deps->vec[deps->num++];
+  d->url = rstr_dup(url);
+
+  sha1_decl(shactx);
+  sha1_init(shactx);
+  sha1_update(shactx, buf_data(b), buf_len(b));
+  sha1_final(shactx, d->digest);
+}
+
+
+/**
+ *
+ */
+void
+glw_view_deps_free(glw_view_deps_t *deps)
+{
+  for(int i = 0; i < deps->num; i++)
+    rstr_release(deps->vec[i].url);
+  free(deps->vec);
+  deps->vec = NULL;
+  deps->num = 0;
+}
+
+
+/**
+ *
+ */
+static void
+gvc_etag(char *etag, size_t etaglen, const buf_t *src)
+{
+  uint8_t digest[20];
+
+  sha1_decl(shactx);
+  sha1_init(shactx);
+  sha1_update(shactx, (const void *)htsversion_full, strlen(htsversion_full));
+  sha1_update(shactx, buf_data(src), buf_len(src));
+  sha1_final(shactx, digest);
+  bin2hex(etag, etaglen, digest, sizeof(digest));
+}
+
+
+/**
+ * Serialization
+ */
+typedef struct gvc_string {
+  struct gvc_string *next;
+  const char *str;
+  int index;
+} gvc_string_t;
+
+typedef struct gvc_writer {
+  htsbuf_queue_t strings;
+  htsbuf_queue_t tokens;
+  gvc_string_t *hash[GVC_STRING_HASH_SIZE];
+  int num_strings;
+} gvc_writer_t;
+
+
+/**
+ *
+ */
+static void
+w_u8(htsbuf_queue_t *hq, uint8_t v)
+{
+  htsbuf_append(hq, &v, 1);
+}
+
+
+/**
+ *
+ */
+static void
+w_u32(htsbuf_queue_t *hq, uint32_t v)
+{
+  htsbuf_append(hq, &v, sizeof(v));
+}
+
+
+/**
+ * Write reference to string, 0 is NULL, otherwise index + 1
+ */
+static void
+w_str(gvc_writer_t *w, const char *str)
+{
+  if(str == NULL) {
+    w_u32(&w->tokens, 0);
+    return;
+  }
+
+  const unsigned int h = mystrhash(str) & (GVC_STRING_HASH_SIZE - 1);
+  gvc_string_t *s;
+
+  for(s = w->hash[h]; s != NULL; s = s->next)
+    if(!strcmp(s->str, str))
+      break;
+
+  if(s == NULL) {
+    s = malloc(sizeof(gvc_string_t));
+    s->str = str;
+    s->index = w->num_strings++;
+    s->next = w->hash[h];
+    w->hash[h] = s;
+
+    const size_t len = strlen(str);
+    w_u32(&w->strings, len);
+    htsbuf_append(&w->strings, str, len);
+  }
+  w_u32(&w->tokens, s->index + 1);
+}
+
+
+/**
+ *
+ */
+static int
+gvc_write_chain(gvc_writer_t *w, const token_t *t)
+{
+  htsbuf_queue_t *hq = &w->tokens;
+  int i;
+
+  for(; t != NULL; t = t->next) {
+
+    w_u8(hq, t->type);
+    w_u8(hq, t->t_flags);
+    w_u8(hq,
+         (t->child != NULL ? GVC_HAS_CHILD : 0) |
+         (t->next  != NULL ? GVC_HAS_NEXT  : 0));
+    w_str(w, rstr_get(t->file));
+    w_u32(hq, t->line);
+    w_str(w, t->t_attrib != NULL ? t->t_attrib->name : NULL);
+
+    switch(t->type) {
+    case TOKEN_FLOAT:
+    case TOKEN_EM:
+      htsbuf_append(hq, &t->t_float, sizeof(float));
+      break;
+
+    case TOKEN_MOD_FLAGS:
+      w_u32(hq, t->t_set);
+      w_u32(hq, t->t_clr);
+      break;
+
+    case TOKEN_INT:
+      w_u32(hq, t->t_int);
+      break;
+
+    case TOKEN_FUNCTION:
+      w_str(w, t->t_func->name);
+      if(t->t_func_arg != NULL) {
+        // Only widget() keeps an argument, the widget class
+        if(strcmp(t->t_func->name, "widget"))
+          return -1;
+        w_str(w, ((const glw_class_t *)t->t_func_arg)->gc_name);
+      } else {
+        w_str(w, NULL);
+      }
+      // FALLTHRU
+    case TOKEN_LEFT_BRACKET:
+      w_u32(hq, t->t_num_args);
+      break;
+
+    case TOKEN_RSTRING:
+      w_u32(hq, t->t_rstrtype);
+      // FALLTHRU
+    case TOKEN_IDENTIFIER:
+    case TOKEN_UNRESOLVED_ATTRIBUTE:
+      w_str(w, rstr_get(t->t_rstring));
+      break;
+
+    case TOKEN_PROPERTY_NAME:
+      w_u32(hq, t->t_elements);
+      for(i = 0; i < t->t_elements; i++)
+        w_str(w, rstr_get(t->t_pnvec[i]));
+      break;
+
+    case TOKEN_RPN:
+      w_u32(hq, t->t_rpn_origin);
+      break;
+
+    case TOKEN_URI:
+      w_str(w, rstr_get(t->t_uri_title));
+      w_str(w, rstr_get(t->t_uri));
+      break;
+
+    case TOKEN_RESOLVED_ATTRIBUTE:
+      if(t->t_attrib == NULL)
+        return -1;
+      break;
+
+    case TOKEN_PROPERTY_REF:
+      // Translated strings are stored by key, other props can't be stored
+      if(!(t->t_flags & TOKEN_F_NLS))
+        return -1;
+      w_str(w, rstr_get(t->t_nls_key));
+      break;
+
+    case TOKEN_START:
+    case TOKEN_END:
+    case TOKEN_HASH:
+    case TOKEN_ASSIGNMENT:
+    case TOKEN_COND_ASSIGNMENT:
+    case TOKEN_DEBUG_ASSIGNMENT:
+    case TOKEN_END_OF_EXPR:
+    case TOKEN_SEPARATOR:
+    case TOKEN_BLOCK_OPEN:
+    case TOKEN_BLOCK_CLOSE:
+    case TOKEN_LEFT_PARENTHESIS:
+    case TOKEN_RIGHT_PARENTHESIS:
+    case TOKEN_RIGHT_BRACKET:
+    case TOKEN_DOT:
+    case TOKEN_ADD:
+    case TOKEN_SUB:
+    case TOKEN_MULTIPLY:
+    case TOKEN_DIVIDE:
+    case TOKEN_MODULO:
+    case TOKEN_DOLLAR:
+    case TOKEN_AMPERSAND:
+    case TOKEN_BOOLEAN_AND:
+    case TOKEN_BOOLEAN_OR:
+    case TOKEN_BOOLEAN_XOR:
+    case TOKEN_BOOLEAN_NOT:
+    case TOKEN_EQ:
+    case TOKEN_NEQ:
+    case TOKEN_LT:
+    case TOKEN_GT:
+    case TOKEN_NULL_COALESCE:
+    case TOKEN_EXPR:
+    case TOKEN_PURE_RPN:
+    case TOKEN_BLOCK:
+    case TOKEN_NOP:
+    case TOKEN_VOID:
+    case TOKEN_COLON:
+    case TOKEN_PROPERTY_SUBSCRIPTION:
+    case TOKEN_DIRECTORY:
+      break;
+
+    default:
+      // Props, constant strings, etc can't be stored
+      return -1;
+    }
+
+    if(t->child != NULL && gvc_write_chain(w, t->child))
+      return -1;
+  }
+  return 0;
+}
+
+
+/**
+ * Store a successfully parsed view
+ */
+void
+glw_view_cache_store(glw_root_t *gr, rstr_t *url, const buf_t *src,
+                     const glw_view_deps_t *deps, token_t *sof)
+{
+  gvc_writer_t w = {};
+  htsbuf_queue_t hq;
+  char etag[41];
+  int i;
+
+  htsbuf_queue_init(&w.strings, 0);
+  htsbuf_queue_init(&w.tokens, 0);
+
+  for(i = 0; i < deps->num; i++) {
+    w_str(&w, rstr_get(deps->vec[i].url));
+    htsbuf_append(&w.tokens, deps->vec[i].digest, 20);
+  }
+
+  if(!gvc_write_chain(&w, sof)) {
+    htsbuf_queue_init(&hq, 0);
+    w_u32(&hq, GVC_MAGIC);
+    w_u32(&hq, GVC_VERSION);
+    w_u32(&hq, deps->num);
+    w_u32(&hq, w.num_strings);
+    htsbuf_appendq(&hq, &w.strings);
+    htsbuf_appendq(&hq, &w.tokens);
+
+    const size_t size = hq.hq_size;
+    void *data = malloc(size);
+    htsbuf_read(&hq, data, size);
+    buf_t *b = buf_create_from_malloced(size, data);
+
+    gvc_etag(etag, sizeof(etag), src);
+    blobcache_put(rstr_get(url), GVC_STASH, b, GVC_MAXAGE, etag, 0,
+                  BLOBCACHE_IMPORTANT_ITEM);
+    buf_release(b);
+  }
+
+  htsbuf_queue_flush(&w.strings);
+  htsbuf_queue_flush(&w.tokens);
+
+  for(i = 0; i < GVC_STRING_HASH_SIZE; i++) {
+    gvc_string_t *s, *n;
+    for(s = w.hash[i]; s != NULL; s = n) {
+      n = s->next;
+      free(s);
+    }
+  }
+}
+
+
+/**
+ * Deserialization
+ */
+typedef struct gvc_reader {
+  const uint8_t *ptr;
+  const uint8_t *end;
+  rstr_t **strings;
+  int num_strings;
+  int error;
+
+  // Names resolved so far, indexed as 'strings'
+  const token_attrib_t **attribs;
+  const token_func_t **funcs;
+} gvc_reader_t;
+
+
+/**
+ *
+ */
+static const void *
+r_bytes(gvc_reader_t *r, size_t len)
+{
+  if((size_t)(r->end - r->ptr) < len) {
+    r->error = 1;
+    return NULL;
+  }
+  const void *p = r->ptr;
+  r->ptr += len;
+  return p;
+}
+
+
+/**
+ *
+ */
+static uint8_t
+r_u8(gvc_reader_t *r)
+{
+  const uint8_t *p = r_bytes(r, 1);
+  return p ? *p : 0;
+}
+
+
+/**
+ *
+ */
+static uint32_t
+r_u32(gvc_reader_t *r)
+{
+  uint32_t v = 0;
+  const void *p = r_bytes(r, sizeof(v));
+  if(p != NULL)
+    memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+/**
+ * Read reference to string, returns index in the string table or -1
+ * for NULL (or error)
+ */
+static int
+r_ref(gvc_reader_t *r)
+{
+  const uint32_t idx = r_u32(r);
+  if(idx == 0)
+    return -1;
+  if(idx > r->num_strings) {
+    r->error = 1;
+    return -1;
+  }
+  return idx - 1;
+}
+
+
+/**
+ * Returns a borrowed reference
+ */
+static rstr_t *
+r_str(gvc_reader_t *r)
+{
+  const int idx = r_ref(r);
+  return idx == -1 ? NULL : r->strings[idx];
+}
+
+
+/**
+ * Attribute referenced by name, NULL if none
+ */
+static const token_attrib_t *
+r_attrib(gvc_reader_t *r)
+{
+  const int idx = r_ref(r);
+  if(idx == -1)
+    return NULL;
+  if(r->attribs[idx] == NULL &&
+     (r->attribs[idx] = glw_view_attrib_find(rstr_get(r->strings[idx]))) == NULL)
+    r->error = 1;
+  return r->attribs[idx];
+}
+
+
+/**
+ * Function referenced by name, never NULL unless there is an error
+ */
+static const token_func_t *
+r_func(gvc_reader_t *r)
+{
+  const int idx = r_ref(r);
+  if(idx == -1) {
+    r->error = 1;
+    return NULL;
+  }
+  if(r->funcs[idx] == NULL &&
+     (r->funcs[idx] = glw_view_function_find(rstr_get(r->strings[idx]))) == NULL)
+    r->error = 1;
+  return r->funcs[idx];
+}
+
+
+/**
+ *
+ */
+static token_t *
+gvc_read_chain(glw_root_t *gr, gvc_reader_t *r)
+{
+  token_t *first = NULL, *t, **pp = &first;
+  uint8_t link;
+  int i;
+
+  do {
+    t = glw_view_token_alloc(gr);
+    t->type = TOKEN_NOP;
+    *pp = t;
+    pp = &t->next;
+
+    const token_type_t type = r_u8(r);
+    t->t_flags = r_u8(r);
+    link = r_u8(r);
+    t->file = rstr_dup(r_str(r));
+    t->line = r_u32(r);
+
+    t->t_attrib = r_attrib(r);
+
+    switch(type) {
+    case TOKEN_FLOAT:
+    case TOKEN_EM:
+      {
+        const void *p = r_bytes(r, sizeof(float));
+        if(p != NULL)
+          memcpy(&t->t_float, p, sizeof(float));
+      }
+      t->type = type;
+      break;
+
+    case TOKEN_MOD_FLAGS:
+      t->t_set = r_u32(r);
+      t->t_clr = r_u32(r);
+      t->type = type;
+      break;
+
+    case TOKEN_INT:
+      t->t_int = r_u32(r);
+      t->type = type;
+      break;
+
+    case TOKEN_FUNCTION:
+      {
+        t->t_func = r_func(r);
+        rstr_t *cname = r_str(r);
+        t->t_num_args = r_u32(r);
+        if(r->error)
+          break;
+        if(cname != NULL &&
+           (t->t_func_arg = glw_class_find_by_name(rstr_get(cname))) == NULL) {
+          r->error = 1;
+          break;
+        }
+        t->type = type;
+        if(t->t_func->ctor != NULL)
+          t->t_func->ctor(t);
+      }
+      break;
+
+    case TOKEN_LEFT_BRACKET:
+      t->t_num_args = r_u32(r);
+      t->type = type;
+      break;
+
+    case TOKEN_RSTRING:
+      t->t_rstrtype = r_u32(r);
+      // FALLTHRU
+    case TOKEN_IDENTIFIER:
+    case TOKEN_UNRESOLVED_ATTRIBUTE:
+      t->t_rstring = rstr_dup(r_str(r));
+      t->type = type;
+      break;
+
+    case TOKEN_PROPERTY_NAME:
+      t->t_elements = r_u32(r);
+      if(t->t_elements > TOKEN_PROPERTY_NAME_VEC_SIZE) {
+        t->t_elements = 0;
+        r->error = 1;
+        break;
+      }
+      for(i = 0; i < t->t_elements; i++)
+        t->t_pnvec[i] = rstr_dup(r_str(r));
+      t->type = type;
+      break;
+
+    case TOKEN_RPN:
+      t->t_rpn_origin = r_u32(r);
+      t->type = type;
+      break;
+
+    case TOKEN_URI:
+      t->t_uri_title = rstr_dup(r_str(r));
+      t->t_uri       = rstr_dup(r_str(r));
+      t->type = type;
+      break;
+
+    case TOKEN_RESOLVED_ATTRIBUTE:
+      if(t->t_attrib == NULL)
+        r->error = 1;
+      t->type = type;
+      break;
+
+    case TOKEN_PROPERTY_REF:
+      {
+        rstr_t *key = r_str(r);
+        if(key == NULL || !(t->t_flags & TOKEN_F_NLS)) {
+          t->t_flags &= ~TOKEN_F_NLS;
+          r->error = 1;
+          break;
+        }
+        t->t_nls_key = rstr_dup(key);
+        t->t_prop = prop_ref_inc(nls_get_prop(rstr_get(key)));
+        t->type = type;
+      }
+      break;
+
+    case TOKEN_START:
+    case TOKEN_END:
+    case TOKEN_HASH:
+    case TOKEN_ASSIGNMENT:
+    case TOKEN_COND_ASSIGNMENT:
+    case TOKEN_DEBUG_ASSIGNMENT:
+    case TOKEN_END_OF_EXPR:
+    case TOKEN_SEPARATOR:
+    case TOKEN_BLOCK_OPEN:
+    case TOKEN_BLOCK_CLOSE:
+    case TOKEN_LEFT_PARENTHESIS:
+    case TOKEN_RIGHT_PARENTHESIS:
+    case TOKEN_RIGHT_BRACKET:
+    case TOKEN_DOT:
+    case TOKEN_ADD:
+    case TOKEN_SUB:
+    case TOKEN_MULTIPLY:
+    case TOKEN_DIVIDE:
+    case TOKEN_MODULO:
+    case TOKEN_DOLLAR:
+    case TOKEN_AMPERSAND:
+    case TOKEN_BOOLEAN_AND:
+    case TOKEN_BOOLEAN_OR:
+    case TOKEN_BOOLEAN_XOR:
+    case TOKEN_BOOLEAN_NOT:
+    case TOKEN_EQ:
+    case TOKEN_NEQ:
+    case TOKEN_LT:
+    case TOKEN_GT:
+    case TOKEN_NULL_COALESCE:
+    case TOKEN_EXPR:
+    case TOKEN_PURE_RPN:
+    case TOKEN_BLOCK:
+    case TOKEN_NOP:
+    case TOKEN_VOID:
+    case TOKEN_COLON:
+    case TOKEN_PROPERTY_SUBSCRIPTION:
+    case TOKEN_DIRECTORY:
+      t->type = type;
+      break;
+
+    default:
+      r->error = 1;
+      break;
+    }
+
+    if(r->error)
+      break;
+
+    if(link & GVC_HAS_CHILD)
+      t->child = gvc_read_chain(gr, r);
+
+  } while((link & GVC_HAS_NEXT) && !r->error);
+
+  return first;
+}
+
+
+/**
+ * Check that all included files are unchanged
+ */
+static int
+gvc_check_deps(glw_root_t *gr, gvc_reader_t *r, int num_deps, int may_unlock)
+{
+  uint8_t digest[20];
+  int ok = 1;
+
+  if(may_unlock)
+    glw_unlock(gr);
+
+  for(int i = 0; i < num_deps && ok; i++) {
+    rstr_t *url = r_str(r);
+    const void *expected = r_bytes(r, 20);
+    buf_t *b = NULL;
+
+    if(url != NULL && expected != NULL)
+      b = fa_load(rstr_get(url),
+                  FA_LOAD_VPATHS(gr->gr_vpaths),
+                  NULL);
+    if(b == NULL) {
+      ok = 0;
+      break;
+    }
+
+    sha1_decl(shactx);
+    sha1_init(shactx);
+    sha1_update(shactx, buf_data(b), buf_len(b));
+    sha1_final(shactx, digest);
+    buf_release(b);
+
+    ok = !memcmp(digest, expected, 20);
+  }
+
+  if(may_unlock)
+    glw_lock(gr);
+
+  return ok && !r->error ? 0 : -1;
+}
+
+
+/**
+ * Try to load a parsed view from the cache, 'src' is the view source.
+ * Returns the start of the token chain or NULL if there is no usable
+ * cached copy
+ */
+token_t *
+glw_view_cache_load(glw_root_t *gr, rstr_t *url, const buf_t *src,
+                    int may_unlock)
+{
+  char etag[41];
+  char *cached_etag = NULL;
+  int expired;
+  token_t *sof = NULL;
+
+  // Expiry does not matter, the etag tells if the source is the same
+
+  buf_t *b = blobcache_get(rstr_get(url), GVC_STASH, 0, &expired,
+                           &cached_etag, NULL);
+  if(b == NULL)
+    return NULL;
+
+  gvc_etag(etag, sizeof(etag), src);
+
+  if(cached_etag == NULL || strcmp(cached_etag, etag)) {
+    free(cached_etag);
+    buf_release(b);
+    return NULL;
+  }
+  free(cached_etag);
+
+  gvc_reader_t r = {};
+  r.ptr = buf_data(b);
+  r.end = r.ptr + buf_len(b);
+
+  const uint32_t magic    = r_u32(&r);
+  const uint32_t version  = r_u32(&r);
+  const uint32_t num_deps = r_u32(&r);
+  const uint32_t num_strings = r_u32(&r);
+
+  if(r.error || magic != GVC_MAGIC || version != GVC_VERSION ||
+     num_strings > buf_len(b) / sizeof(uint32_t)) {
+    buf_release(b);
+    return NULL;
+  }
+
+  r.strings = calloc(num_strings, sizeof(rstr_t *));
+  r.attribs = calloc(num_strings, sizeof(token_attrib_t *));
+  r.funcs   = calloc(num_strings, sizeof(token_func_t *));
+  for(r.num_strings = 0; r.num_strings < num_strings; r.num_strings++) {
+    const uint32_t len = r_u32(&r);
+    const char *str = r_bytes(&r, len);
+    if(str == NULL)
+      break;
+    r.strings[r.num_strings] = rstr_allocl(str, len);
+  }
+
+  if(!gvc_check_deps(gr, &r, num_deps, may_unlock)) {
+    sof = gvc_read_chain(gr, &r);
+    if(r.error || r.ptr != r.end) {
+      glw_view_free_chain(gr, sof);
+      sof = NULL;
+    }
+  }
+
+  for(int i = 0; i < r.num_strings; i++)
+    rstr_release(r.strings[i]);
+  free(r.strings);
+  free(r.attribs);
+  free(r.funcs);
+  buf_release(b);
+  return sof;
+}
@@ -2319,7 +2319,7 @@ subscribe_prop(glw_view_eval_context_t *ec, struct token *self, int type)
   case GPS_VALUE:
     gps = calloc(1, sizeof(glw_prop_sub_t));
     cb = prop_callback_value;
-    f |= PROP_SUB_DIRECT_UPDATE;
+    f |= PROP_SUB_DIRECT_UPDATE | PROP_SUB_COALESCE;
     break;
 
   case GPS_CLONER: do {
@@ -6671,6 +6671,21 @@ static const token_func_t funcvec[] = {
 };
 
 
+/**
+ *
+ */
+const token_func_t *
+glw_view_function_find(const char *name)
+{
+  int i;
+
+  for(i = 0; i < sizeof(funcvec) / sizeof(funcvec[0]); i++)
+    if(!strcmp(funcvec[i].name, name))
+      return &funcvec[i];
+  return NULL;
+}
+
+
 /**
  *
  */
@@ -6678,23 +6693,22 @@ static const token_func_t funcvec[] = {
 token_t *
 glw_view_function_resolve(glw_root_t *gr, errorinfo_t *ei, token_t *t)
 {
-  int i;
   const char *fname = rstr_get(t->t_rstring);
+  const token_func_t *f = glw_view_function_find(fname);
 
-  for(i = 0; i < sizeof(funcvec) / sizeof(funcvec[0]); i++)
-    if(!strcmp(funcvec[i].name, fname)) {
-      rstr_release(t->t_rstring);
-      t->t_func = &funcvec[i];
-      t->type = TOKEN_FUNCTION;
-      if(t->t_func->ctor != NULL)
-	t->t_func->ctor(t);
-
-      if(t->t_func->preproc != NULL)
-        return t->t_func->preproc(gr, ei, t);
-      else
-        return t->next->next;
-    }
+  if(f == NULL) {
+    glw_view_seterr(ei, t, "Unknown function: %s", fname);
+    return NULL;
+  }
 
-  glw_view_seterr(ei, t, "Unknown function: %s", fname);
-  return NULL;
+  rstr_release(t->t_rstring);
+  t->t_func = f;
+  t->type = TOKEN_FUNCTION;
+  if(t->t_func->ctor != NULL)
+    t->t_func->ctor(t);
+
+  if(t->t_func->preproc != NULL)
+    return t->t_func->preproc(gr, ei, t);
+  else
+    return t->next->next;
 }
@@ -380,7 +380,7 @@ glw_view_lexer(glw_root_t *gr, const char *src, errorinfo_t *ei,
  */
 token_t *
 glw_view_load1(glw_root_t *gr, rstr_t *url, errorinfo_t *ei, token_t *prev,
-               int may_unlock)
+               int may_unlock, glw_view_deps_t *deps)
 {
   token_t *last;
   char errbuf[256];
@@ -407,6 +407,9 @@ glw_view_load1(glw_root_t *gr, rstr_t *url, errorinfo_t *ei, token_t *prev,
     return NULL;
   }
 
+  if(deps != NULL)
+    glw_view_deps_add(deps, p, b);
+
   last = glw_view_lexer(gr, buf_cstr(b), ei, p, prev);
   buf_release(b);
   rstr_release(p);
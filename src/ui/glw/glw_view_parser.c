@@ -22,7 +22,7 @@
 #include "i18n.h"
 
 #include <stdio.h>
-static void glw_view_nls_string(token_t *t, const char *str);
+static void glw_view_nls_string(token_t *t, rstr_t *str);
 
 static int parse_block(token_t *first, errorinfo_t *ei, token_type_t term,
 		       glw_root_t *gr);
@@ -471,7 +471,7 @@ parse_prep_expression(token_t *expr, errorinfo_t *ei, glw_root_t *gr)
 	   t1->next->type == TOKEN_RSTRING &&
 	   t1->next->next->type == TOKEN_RIGHT_PARENTHESIS) {
 
-	  glw_view_nls_string(t, rstr_get(t1->next->t_rstring));
+	  glw_view_nls_string(t, t1->next->t_rstring);
 
 	  t->next = t1->next->next->next;
 	  glw_view_token_free(gr, t1->next->next);
@@ -621,10 +621,12 @@ glw_view_parse(token_t *sof, errorinfo_t *ei, glw_root_t *gr)
  * Transform a string token into a translated property
  */
 static void
-glw_view_nls_string(token_t *t, const char *str)
+glw_view_nls_string(token_t *t, rstr_t *str)
 {
-  prop_t *p = nls_get_prop(str);
+  prop_t *p = nls_get_prop(rstr_get(str));
   rstr_release(t->t_rstring);
+  t->t_nls_key = rstr_dup(str);
+  t->t_flags |= TOKEN_F_NLS;
   t->type = TOKEN_PROPERTY_REF;
   t->t_prop = prop_ref_inc(p);
 }
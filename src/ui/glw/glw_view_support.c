@@ -54,6 +54,8 @@ glw_view_token_free(glw_root_t *gr, token_t *t)
 
   case TOKEN_PROPERTY_REF:
     prop_ref_dec(t->t_prop);
+    if(t->t_flags & TOKEN_F_NLS)
+      rstr_release(t->t_nls_key);
     break;
 
   case TOKEN_PROPERTY_OWNER:
@@ -170,6 +172,8 @@ glw_view_token_copy(glw_root_t *gr, token_t *src)
 
   case TOKEN_PROPERTY_REF:
     dst->t_prop = prop_ref_inc(src->t_prop);
+    if(src->t_flags & TOKEN_F_NLS)
+      dst->t_nls_key = rstr_dup(src->t_nls_key);
     break;
 
   case TOKEN_PROPERTY_OWNER:
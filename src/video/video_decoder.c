@@ -184,6 +184,8 @@ vd_thread(void *aux)
       continue;
     }
 
+    mq_ring_drain(mp, mq);
+
     media_buf_t *ctrl = TAILQ_FIRST(&mq->mq_q_ctrl);
     media_buf_t *data = TAILQ_FIRST(&mq->mq_q_data);
     media_buf_t *aux  = TAILQ_FIRST(&mq->mq_q_aux);
@@ -225,7 +227,7 @@ vd_thread(void *aux)
         mq->mq_last_deq_dts = mb->mb_dts;
 
     } else {
-      hts_cond_wait(&mq->mq_avail, &mp->mp_mutex);
+      mq_wait_data(mp, mq);
       continue;
     }
 